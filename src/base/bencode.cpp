@@ -0,0 +1,176 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "base/bencode.h"
+
+namespace base {
+
+constexpr size_t kMaxKeyLength = 16;
+constexpr size_t kMaxStringLengthDigits = 10;
+
+static bool IsDigit(const char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool BencodeValidator::Feed(std::string_view data) {
+  for (size_t i = 0; i < data.size() && state_ != State::Invalid; ++i) {
+    const char c = data[i];
+
+    switch (state_) {
+      case State::Value:
+        if (c == 'e' && !containers_.empty()) {
+          // A dictionary cannot end between a key and its value
+          if (containers_.back().type == 'd' && !ExpectsKey()) {
+            state_ = State::Invalid;
+            break;
+          }
+          containers_.pop_back();
+          EndValue();
+        } else if (IsDigit(c)) {
+          string_length_ = c - '0';
+          string_length_digits_ = 1;
+          collecting_key_ = containers_.size() == 1 && ExpectsKey();
+          info_next_ = false;
+          key_.clear();
+          state_ = State::StringLength;
+        } else if (ExpectsKey()) {
+          state_ = State::Invalid;  // Dictionary keys must be strings
+        } else {
+          BeginValue(c);
+        }
+        break;
+
+      case State::Integer:
+        if (c == '-' && !integer_negative_ && !integer_digits_) {
+          integer_negative_ = true;
+        } else if (IsDigit(c)) {
+          ++integer_digits_;
+        } else if (c == 'e' && integer_digits_) {
+          EndValue();
+        } else {
+          state_ = State::Invalid;
+        }
+        break;
+
+      case State::StringLength:
+        if (IsDigit(c) && string_length_digits_ < kMaxStringLengthDigits) {
+          string_length_ = string_length_ * 10 + (c - '0');
+          ++string_length_digits_;
+        } else if (c == ':') {
+          if (string_length_) {
+            state_ = State::String;
+          } else {
+            EndValue();
+          }
+        } else {
+          state_ = State::Invalid;
+        }
+        break;
+
+      case State::String: {
+        const auto n = std::min(string_length_, data.size() - i);
+        if (collecting_key_) {
+          if (key_.size() + n <= kMaxKeyLength) {
+            key_.append(data.substr(i, n));
+          } else {
+            collecting_key_ = false;
+          }
+        }
+        string_length_ -= n;
+        i += n - 1;
+        if (!string_length_)
+          EndValue();
+        break;
+      }
+
+      case State::End:
+        // Some servers append a line break to the file
+        if (c != '\r' && c != '\n')
+          state_ = State::Invalid;
+        break;
+    }
+  }
+
+  return state_ != State::Invalid;
+}
+
+bool BencodeValidator::IsComplete() const {
+  return state_ == State::End;
+}
+
+bool BencodeValidator::IsValid() const {
+  return state_ != State::Invalid;
+}
+
+bool BencodeValidator::IsTorrent() const {
+  return IsComplete() && has_info_;
+}
+
+void BencodeValidator::BeginValue(const char c) {
+  const bool info = info_next_;
+  info_next_ = false;
+
+  switch (c) {
+    case 'i':
+      integer_digits_ = 0;
+      integer_negative_ = false;
+      state_ = State::Integer;
+      break;
+    case 'd':
+    case 'l':
+      // A torrent file is a dictionary
+      if (containers_.empty() && c != 'd') {
+        state_ = State::Invalid;
+        break;
+      }
+      if (info && c == 'd')
+        has_info_ = true;
+      containers_.push_back({c, c == 'd'});
+      state_ = State::Value;
+      break;
+    default:
+      state_ = State::Invalid;
+      break;
+  }
+}
+
+void BencodeValidator::EndValue() {
+  if (containers_.empty()) {
+    state_ = State::End;
+    return;
+  }
+
+  auto& container = containers_.back();
+  if (container.type == 'd') {
+    if (container.expects_key) {
+      info_next_ = collecting_key_ && key_ == "info";
+      collecting_key_ = false;
+    }
+    container.expects_key = !container.expects_key;
+  }
+
+  state_ = State::Value;
+}
+
+bool BencodeValidator::ExpectsKey() const {
+  return !containers_.empty() && containers_.back().expects_key;
+}
+
+}  // namespace base
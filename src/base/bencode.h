@@ -0,0 +1,75 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace base {
+
+// Validates bencoded data (as used in .torrent files) as it arrives, without
+// keeping it in memory. Data can be passed in chunks of any size, and an
+// invalid byte is reported as soon as it is seen.
+//
+// Only the keys of the top-level dictionary are remembered, so that the
+// presence of a torrent's "info" dictionary can be verified.
+class BencodeValidator {
+public:
+  // Returns false once the data is known to be invalid.
+  bool Feed(std::string_view data);
+
+  bool IsComplete() const;
+  bool IsValid() const;
+  bool IsTorrent() const;
+
+private:
+  enum class State {
+    Value,
+    Integer,
+    StringLength,
+    String,
+    End,
+    Invalid,
+  };
+
+  struct Container {
+    char type = 0;            // 'd' for dictionaries, 'l' for lists
+    bool expects_key = false;
+  };
+
+  void BeginValue(char c);
+  void EndValue();
+  bool ExpectsKey() const;
+
+  State state_ = State::Value;
+  std::vector<Container> containers_;
+
+  size_t integer_digits_ = 0;
+  bool integer_negative_ = false;
+  size_t string_length_ = 0;
+  size_t string_length_digits_ = 0;
+
+  std::string key_;
+  bool collecting_key_ = false;
+  bool info_next_ = false;
+  bool has_info_ = false;
+};
+
+}  // namespace base
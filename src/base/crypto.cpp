@@ -17,9 +17,12 @@
 */
 
 #include <algorithm>
+#include <limits>
 #include <string>
 #include <windows.h>
 
+#include <zlib/zlib.h>
+
 #include "base/crypto.h"
 
 #include "base/base64.h"
@@ -192,3 +195,170 @@ std::string HmacSha1(const std::string& key_bytes, const std::string& data) {
 
   return hash;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t Crc32(uint32_t crc, const void* data, size_t size) {
+  // zlib takes at most UINT_MAX bytes at a time
+  auto bytes = static_cast<const Bytef*>(data);
+  while (size > 0) {
+    const auto length = static_cast<uInt>(
+        std::min<size_t>(size, std::numeric_limits<uInt>::max()));
+    crc = crc32(crc, bytes, length);
+    bytes += length;
+    size -= length;
+  }
+  return crc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// MD4 is not available in zlib, and CryptoAPI would mean a provider context
+// for each hash, so it is implemented here as described in RFC 1320.
+
+static inline uint32_t RotateLeft(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+Md4::Md4() {
+  Reset();
+}
+
+void Md4::Reset() {
+  state_ = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+  size_ = 0;
+}
+
+void Md4::Transform(const uint8_t* block) {
+  uint32_t x[16];
+  for (size_t i = 0; i < 16; ++i) {
+    x[i] = static_cast<uint32_t>(block[i * 4]) |
+           (static_cast<uint32_t>(block[i * 4 + 1]) << 8) |
+           (static_cast<uint32_t>(block[i * 4 + 2]) << 16) |
+           (static_cast<uint32_t>(block[i * 4 + 3]) << 24);
+  }
+
+  auto [a, b, c, d] = state_;
+
+  const auto f = [](uint32_t x, uint32_t y, uint32_t z) {
+    return (x & y) | (~x & z);
+  };
+  const auto g = [](uint32_t x, uint32_t y, uint32_t z) {
+    return (x & y) | (x & z) | (y & z);
+  };
+  const auto h = [](uint32_t x, uint32_t y, uint32_t z) {
+    return x ^ y ^ z;
+  };
+
+  constexpr int s1[] = {3, 7, 11, 19};
+  for (int i = 0; i < 16; ++i) {
+    const auto t = RotateLeft(a + f(b, c, d) + x[i], s1[i % 4]);
+    a = d; d = c; c = b; b = t;
+  }
+
+  constexpr int s2[] = {3, 5, 9, 13};
+  for (int i = 0; i < 16; ++i) {
+    const int k = (i % 4) * 4 + i / 4;
+    const auto t = RotateLeft(a + g(b, c, d) + x[k] + 0x5a827999, s2[i % 4]);
+    a = d; d = c; c = b; b = t;
+  }
+
+  constexpr int s3[] = {3, 9, 11, 15};
+  constexpr int k3[] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+  for (int i = 0; i < 16; ++i) {
+    const auto t =
+        RotateLeft(a + h(b, c, d) + x[k3[i]] + 0x6ed9eba1, s3[i % 4]);
+    a = d; d = c; c = b; b = t;
+  }
+
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+}
+
+void Md4::Update(const void* data, size_t size) {
+  auto bytes = static_cast<const uint8_t*>(data);
+
+  size_t used = size_ % 64;
+  size_ += size;
+
+  if (used) {
+    const auto length = std::min(size, 64 - used);
+    std::copy_n(bytes, length, buffer_.data() + used);
+    bytes += length;
+    size -= length;
+    if (used + length < 64)
+      return;
+    Transform(buffer_.data());
+  }
+
+  for (; size >= 64; bytes += 64, size -= 64) {
+    Transform(bytes);
+  }
+
+  std::copy_n(bytes, size, buffer_.data());
+}
+
+Md4::digest_t Md4::Final() {
+  const uint64_t bits = size_ * 8;
+
+  uint8_t padding[72] = {0x80};
+  const size_t used = size_ % 64;
+  const size_t length = (used < 56 ? 56 : 120) - used;
+  for (size_t i = 0; i < 8; ++i) {
+    padding[length + i] = static_cast<uint8_t>(bits >> (i * 8));
+  }
+  Update(padding, length + 8);
+
+  digest_t digest;
+  for (size_t i = 0; i < digest.size(); ++i) {
+    digest[i] = static_cast<uint8_t>(state_[i / 4] >> ((i % 4) * 8));
+  }
+
+  Reset();
+  return digest;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Ed2kHash::Update(const void* data, size_t size) {
+  auto bytes = static_cast<const uint8_t*>(data);
+
+  while (size > 0) {
+    const auto length = std::min(size, kChunkSize - chunk_size_);
+    chunk_.Update(bytes, length);
+    chunk_size_ += length;
+    bytes += length;
+    size -= length;
+
+    if (chunk_size_ == kChunkSize) {
+      digests_.push_back(chunk_.Final());
+      chunk_size_ = 0;
+    }
+  }
+}
+
+std::string Ed2kHash::Final() {
+  if (chunk_size_ > 0 || digests_.empty())
+    digests_.push_back(chunk_.Final());
+
+  Md4::digest_t digest = digests_.front();
+  if (digests_.size() > 1) {
+    for (const auto& chunk_digest : digests_) {
+      chunk_.Update(chunk_digest.data(), chunk_digest.size());
+    }
+    digest = chunk_.Final();
+  }
+
+  chunk_size_ = 0;
+  digests_.clear();
+
+  static constexpr char kHexDigits[] = "0123456789abcdef";
+  std::string output;
+  for (const auto byte : digest) {
+    output.push_back(kHexDigits[byte >> 4]);
+    output.push_back(kHexDigits[byte & 0x0f]);
+  }
+  return output;
+}
@@ -18,7 +18,10 @@
 
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 class StringCoder {
 public:
@@ -39,3 +42,40 @@ private:
 };
 
 std::string HmacSha1(const std::string& key_bytes, const std::string& data);
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t Crc32(uint32_t crc, const void* data, size_t size);
+
+class Md4 {
+public:
+  using digest_t = std::array<uint8_t, 16>;
+
+  Md4();
+
+  void Update(const void* data, size_t size);
+  digest_t Final();  // also resets the state
+
+private:
+  void Reset();
+  void Transform(const uint8_t* block);
+
+  std::array<uint32_t, 4> state_;
+  std::array<uint8_t, 64> buffer_;
+  uint64_t size_;
+};
+
+// ED2K hashes are the MD4 digest of a file if it fits into a single chunk,
+// or else the MD4 digest of the digests of its chunks.
+class Ed2kHash {
+public:
+  static constexpr size_t kChunkSize = 9728000;
+
+  void Update(const void* data, size_t size);
+  std::string Final();  // lowercase hexadecimal, also resets the state
+
+private:
+  Md4 chunk_;
+  size_t chunk_size_ = 0;
+  std::vector<Md4::digest_t> digests_;
+};
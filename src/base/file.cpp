@@ -111,12 +111,9 @@ uint64_t GetFileSize(const std::wstring& path) {
 
 uint64_t GetFolderSize(const std::wstring& path, bool recursive) {
   uint64_t folder_size = 0;
-  const auto max_dword = static_cast<uint64_t>(MAXDWORD) + 1;
 
   const auto on_file = [&](const base::FileSearchResult& result) {
-    folder_size +=
-        static_cast<uint64_t>(result.data.nFileSizeHigh) * max_dword +
-        static_cast<uint64_t>(result.data.nFileSizeLow);
+    folder_size += result.size;
     return false;
   };
 
@@ -16,14 +16,48 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+
 #include "base/file_monitor.h"
 
-#include "base/file.h"
 #include "base/log.h"
-#include "base/string.h"
+
+namespace {
+
+// A burst of changes ends when nothing has changed for a while, or when it
+// has gone on for too long.
+constexpr auto kQuietPeriod = std::chrono::seconds{2};
+constexpr auto kMaxDelay = std::chrono::seconds{10};
+
+bool IsInsideDirectory(const std::wstring& filename,
+                       const std::wstring& directory) {
+  return filename.size() > directory.size() &&
+         (filename[directory.size()] == L'\\' ||
+          filename[directory.size()] == L'/') &&
+         filename.compare(0, directory.size(), directory) == 0;
+}
+
+void LogFileAction(const DirectoryChangeNotification& notification) {
+  using Action = DirectoryChangeNotification::Action;
+
+  switch (notification.action) {
+    case Action::Added:
+      LOGD(L"Added: {}{}", notification.path, notification.filename.first);
+      break;
+    case Action::Removed:
+      LOGD(L"Removed: {}{}", notification.path, notification.filename.first);
+      break;
+    case Action::Renamed:
+      LOGD(L"Renamed (old): {0}{1}\nRenamed (new): {0}{2}", notification.path,
+           notification.filename.second, notification.filename.first);
+      break;
+  }
+}
+
+}  // namespace
 
 DirectoryChangeNotification::DirectoryChangeNotification(
-    DWORD action, const std::wstring& filename, const std::wstring& path)
+    Action action, const std::wstring& filename, const std::wstring& path)
     : action(action),
       filename(std::make_pair(filename, L"")),
       path(path),
@@ -32,21 +66,8 @@ DirectoryChangeNotification::DirectoryChangeNotification(
 
 ////////////////////////////////////////////////////////////////////////////////
 
-DirectoryChangeEntry::DirectoryChangeEntry(HANDLE directory_handle,
-                                           const std::wstring& path)
-    : bytes_returned_(0),
-      directory_handle_(directory_handle),
-      path(path),
-      state(State::Stopped) {
-  buffer_.resize(65536);
-  ZeroMemory(&overlapped_, sizeof(overlapped_));
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
 DirectoryMonitor::DirectoryMonitor()
-    : completion_port_(nullptr), window_handle_(nullptr) {
-  thread_.parent = this;
+    : backend_(CreateDirectoryMonitorBackend()) {
 }
 
 DirectoryMonitor::~DirectoryMonitor() {
@@ -54,211 +75,212 @@ DirectoryMonitor::~DirectoryMonitor() {
   Clear();
 }
 
-void DirectoryMonitor::SetWindowHandle(HWND hwnd) { window_handle_ = hwnd; }
+void DirectoryMonitor::SetNotifyFunction(notify_function_t function) {
+  notify_function_ = std::move(function);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
 bool DirectoryMonitor::Add(const std::wstring& path) {
-  if (!FolderExists(path))
-    return false;
-
-  HANDLE directory_handle = ::CreateFile(
-      path.c_str(),
-      FILE_LIST_DIRECTORY,
-      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-      nullptr,
-      OPEN_EXISTING,
-      FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
-      nullptr);
+  return backend_->Add(path);
+}
 
-  if (directory_handle == INVALID_HANDLE_VALUE)
-    return false;
+void DirectoryMonitor::Clear() {
+  backend_->Clear();
+}
 
-  entries_.push_back(DirectoryChangeEntry(directory_handle, path));
-  AddTrailingSlash(entries_.back().path);
+bool DirectoryMonitor::Start() {
+  if (!thread_.joinable()) {
+    stopping_ = false;
+    thread_ = std::thread{[this]() { DebounceProc(); }};
+  }
 
-  return true;
+  return backend_->Start(
+      [this](DirectoryChangeNotification&& notification) {
+        Queue(std::move(notification));
+      });
 }
 
-void DirectoryMonitor::Clear() {
-  for (auto& entry : entries_) {
-    if (entry.directory_handle_ != INVALID_HANDLE_VALUE) {
-      ::CloseHandle(entry.directory_handle_);
-      entry.directory_handle_ = INVALID_HANDLE_VALUE;
+void DirectoryMonitor::Stop() {
+  backend_->Stop();
+
+  if (thread_.joinable()) {
+    {
+      std::lock_guard lock{mutex_};
+      stopping_ = true;
     }
+    condition_.notify_all();
+    thread_.join();
   }
 
-  entries_.clear();
+  std::lock_guard lock{mutex_};
+  pending_.clear();
+  pending_paths_.clear();
+  ready_.clear();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-bool DirectoryMonitor::Start() {
-  if (!thread_.GetThreadHandle())
-    thread_.CreateThread(nullptr, 0, 0);
-
-  if (!thread_.GetThreadHandle())
-    return false;
-
-  for (auto& entry : entries_) {
-    auto completion_key = reinterpret_cast<ULONG_PTR>(&entry);
-    completion_port_ = ::CreateIoCompletionPort(
-        entry.directory_handle_, completion_port_, completion_key, 0);
-    if (completion_port_)
-      ::PostQueuedCompletionStatus(completion_port_, sizeof(entry),
-                                   completion_key, &entry.overlapped_);
-  }
+void DirectoryMonitor::Queue(DirectoryChangeNotification&& notification) {
+  using Action = DirectoryChangeNotification::Action;
+
+  {
+    std::lock_guard lock{mutex_};
+
+    const auto now = clock_t::now();
+    if (pending_.empty())
+      first_change_ = now;
+    last_change_ = now;
+
+    // Merges the notification with an earlier one for the same entry
+    const auto merge = [&](const std::wstring& filename) {
+      const auto it = pending_paths_.find(notification.path + filename);
+      if (it == pending_paths_.end())
+        return true;
+
+      const auto index = it->second;
+      const auto previous = *pending_.at(index);
+      Drop(index);
+
+      switch (notification.action) {
+        case Action::Added:
+          // Replaced, or restored after being removed
+          return true;
+
+        case Action::Removed:
+          switch (previous.action) {
+            case Action::Added:  // never mind
+              return false;
+            case Action::Renamed:  // it's the old name that is gone
+              notification.filename.first = previous.filename.second;
+              return true;
+            default:
+              return true;
+          }
+
+        case Action::Renamed:
+          switch (previous.action) {
+            case Action::Added:  // added under a temporary name
+              notification.action = Action::Added;
+              notification.filename.second.clear();
+              return true;
+            case Action::Renamed:  // renamed more than once
+              notification.filename.second = previous.filename.second;
+              return notification.filename.first != previous.filename.second;
+            default:
+              return true;
+          }
+      }
 
-  return true;
-}
+      return true;
+    };
 
-void DirectoryMonitor::Stop() {
-  if (thread_.GetThreadHandle()) {
-    ::PostQueuedCompletionStatus(completion_port_, 0, 0, nullptr);
-    ::WaitForSingleObject(thread_.GetThreadHandle(), INFINITE);
-    thread_.CloseThreadHandle();
-  }
+    const auto filename = notification.action == Action::Renamed ?
+        notification.filename.second : notification.filename.first;
 
-  if (completion_port_) {
-    ::CloseHandle(completion_port_);
-    completion_port_ = nullptr;
+    if (notification.type == DirectoryChangeNotification::Type::Directory &&
+        notification.action != Action::Added) {
+      MoveChildren(notification);
+    }
+
+    if (merge(filename))
+      Push(std::move(notification));
   }
-}
 
-////////////////////////////////////////////////////////////////////////////////
+  condition_.notify_one();
+}
 
-bool DirectoryMonitor::ReadDirectoryChanges(DirectoryChangeEntry& entry) {
-  const auto result = ::ReadDirectoryChangesW(
-      entry.directory_handle_,
-      entry.buffer_.data(),
-      static_cast<DWORD>(entry.buffer_.size()),
-      TRUE,  // watch subtree
-      FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME,
-      &entry.bytes_returned_,
-      &entry.overlapped_,
-      nullptr);
-
-  return result != 0;
+void DirectoryMonitor::Push(DirectoryChangeNotification&& notification) {
+  pending_paths_[notification.path + notification.filename.first] =
+      pending_.size();
+  pending_.push_back(std::move(notification));
 }
 
-DWORD DirectoryMonitor::Thread::ThreadProc() {
-  parent->MonitorProc();
-  return 0;
+void DirectoryMonitor::Drop(size_t index) {
+  auto& notification = pending_.at(index);
+  pending_paths_.erase(notification->path + notification->filename.first);
+  notification.reset();
 }
 
-void DirectoryMonitor::MonitorProc() {
-  DirectoryChangeEntry* entry = nullptr;
-  DWORD number_of_bytes = 0;
-  LPOVERLAPPED overlapped;
-
-  do {
-    ::GetQueuedCompletionStatus(completion_port_, &number_of_bytes,
-                                reinterpret_cast<PULONG_PTR>(&entry),
-                                &overlapped, INFINITE);
-
-    if (entry && number_of_bytes > 0) {
-      win::Lock lock(critical_section_);
-      switch (entry->state) {
-        case DirectoryChangeEntry::State::Stopped: {
-          HandleStoppedState(*entry);
-          break;
-        }
-        case DirectoryChangeEntry::State::Active: {
-          HandleActiveState(*entry);
-          break;
-        }
-      }
+// Changes that were queued for the contents of a directory follow it, so that
+// they are not reported for paths that no longer exist.
+void DirectoryMonitor::MoveChildren(
+    const DirectoryChangeNotification& directory) {
+  using Action = DirectoryChangeNotification::Action;
+
+  const auto& old_name = directory.action == Action::Renamed ?
+      directory.filename.second : directory.filename.first;
+
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    const auto& notification = pending_[i];
+    if (!notification || notification->path != directory.path ||
+        !IsInsideDirectory(notification->filename.first, old_name)) {
+      continue;
     }
-  } while (entry);
 
-  LOGD(L"Stopped monitoring.");
-}
+    auto child = *notification;
+    Drop(i);
 
-void DirectoryMonitor::HandleStoppedState(DirectoryChangeEntry& entry) {
-  if (ReadDirectoryChanges(entry)) {
-    entry.state = DirectoryChangeEntry::State::Active;
-    LOGD(L"Started monitoring: {}", entry.path);
+    if (directory.action == Action::Renamed) {
+      child.filename.first.replace(0, old_name.size(),
+                                   directory.filename.first);
+      pending_paths_[child.path + child.filename.first] = i;
+      pending_[i] = std::move(child);
+    }
   }
 }
 
-void DirectoryMonitor::HandleActiveState(DirectoryChangeEntry& entry) {
-  DWORD next_entry_offset = 0;
-  PFILE_NOTIFY_INFORMATION file_notify_info = nullptr;
-
-  do {
-    file_notify_info = reinterpret_cast<PFILE_NOTIFY_INFORMATION>(
-        entry.buffer_.data() + next_entry_offset);
-    // Retrieve filename
-    size_t length = file_notify_info->FileNameLength / sizeof(wchar_t);
-    std::wstring filename(file_notify_info->FileName, length);
-    // Create a new notification
-    entry.notifications.push_back(DirectoryChangeNotification(
-        file_notify_info->Action, filename, entry.path));
-    // Continue to the next entry
-    next_entry_offset += file_notify_info->NextEntryOffset;
-  } while (file_notify_info->NextEntryOffset != 0);
-
-  // Post a message to the main thread
-  if (window_handle_) {
-    ::PostMessage(window_handle_, WM_MONITORCALLBACK, 0,
-                  reinterpret_cast<LPARAM>(&entry));
+void DirectoryMonitor::DebounceProc() {
+  std::unique_lock lock{mutex_};
+
+  while (true) {
+    condition_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+    if (stopping_)
+      break;
+
+    const auto deadline =
+        std::min(last_change_ + kQuietPeriod, first_change_ + kMaxDelay);
+    if (clock_t::now() < deadline) {
+      condition_.wait_until(lock, deadline);
+      continue;
+    }
+
+    // Notifications that are still waiting to be handled are not repeated
+    const bool notify = ready_.empty();
+
+    for (auto& notification : pending_) {
+      if (notification)
+        ready_.push_back(std::move(*notification));
+    }
+    pending_.clear();
+    pending_paths_.clear();
+
+    if (notify && !ready_.empty() && notify_function_) {
+      lock.unlock();
+      notify_function_();
+      lock.lock();
+    }
   }
 
-  // Continue monitoring
-  ReadDirectoryChanges(entry);
+  LOGD(L"Stopped monitoring.");
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static void LogFileAction(const DirectoryChangeEntry& entry,
-                          const DirectoryChangeNotification& notification) {
-  switch (notification.action) {
-    case FILE_ACTION_ADDED:
-      LOGD(L"Added: {}{}", entry.path, notification.filename.first);
-      break;
-    case FILE_ACTION_REMOVED:
-      LOGD(L"Removed: {}{}", entry.path, notification.filename.first);
-      break;
-    case FILE_ACTION_RENAMED_NEW_NAME:
-      LOGD(L"Renamed (old): {0}{1}\nRenamed (new): {0}{2}", entry.path,
-           notification.filename.second, notification.filename.first);
-      break;
-  }
-}
+void DirectoryMonitor::Callback() {
+  std::vector<DirectoryChangeNotification> notifications;
 
-void DirectoryMonitor::Callback(DirectoryChangeEntry& entry) {
-  win::Lock lock(critical_section_);
-
-  DirectoryChangeNotification* old_name_notification = nullptr;
-
-  for (auto& notification : entry.notifications) {
-    switch (notification.action) {
-      case FILE_ACTION_RENAMED_OLD_NAME:
-        old_name_notification = &notification;
-        continue;
-      case FILE_ACTION_RENAMED_NEW_NAME:
-        if (old_name_notification) {
-          notification.filename.second = old_name_notification->filename.first;
-          old_name_notification = nullptr;
-        }
-        break;
-    }
+  {
+    std::lock_guard lock{mutex_};
+    notifications.swap(ready_);
+  }
 
-    if (notification.action != FILE_ACTION_REMOVED) {
-      std::wstring path = entry.path + notification.filename.first;
-      notification.type = FolderExists(path)
-                              ? DirectoryChangeNotification::Type::Directory
-                              : DirectoryChangeNotification::Type::File;
-    } else {
-      std::wstring extension = GetFileExtension(notification.filename.first);
-      notification.type = !ValidateFileExtension(extension, 4)
-                              ? DirectoryChangeNotification::Type::Directory
-                              : DirectoryChangeNotification::Type::File;
-    }
+  if (notifications.empty())
+    return;
 
-    LogFileAction(entry, notification);
-    HandleChangeNotification(notification);
+  for (const auto& notification : notifications) {
+    LogFileAction(notification);
   }
 
-  entry.notifications.clear();
+  HandleChangeNotifications(notifications);
 }
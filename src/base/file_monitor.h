@@ -18,69 +18,92 @@
 
 #pragma once
 
-#include <windows.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
-#include <windows/win/thread.h>
+#ifdef _WIN32
+#include <windows.h>
 
 constexpr unsigned int WM_MONITORCALLBACK = WM_APP + 0x32;
+#endif
 
 class DirectoryChangeNotification {
 public:
+  enum class Action {
+    Added,
+    Removed,
+    Renamed,
+  };
+
   enum class Type {
     Directory,
     File,
     Unknown,
   };
 
-  DirectoryChangeNotification(DWORD action, const std::wstring& filename,
+  DirectoryChangeNotification(Action action, const std::wstring& filename,
                               const std::wstring& path);
 
-  DWORD action;
-  std::pair<std::wstring, std::wstring> filename;
-  std::wstring path;
+  Action action;
+  std::pair<std::wstring, std::wstring> filename;  // new and old names
+  std::wstring path;  // the monitored directory, with a trailing separator
   Type type;
 };
 
-class DirectoryChangeEntry {
+////////////////////////////////////////////////////////////////////////////////
+// Watches directories on its own thread, and reports changes as they happen.
+// Filenames are relative to the directory that was added.
+class DirectoryMonitorBackend {
 public:
-  friend class DirectoryMonitor;
+  using callback_function_t =
+      std::function<void(DirectoryChangeNotification&&)>;
 
-  enum class State {
-    Stopped,
-    Active,
-  };
-
-  DirectoryChangeEntry(HANDLE directory_handle, const std::wstring& path);
+  virtual ~DirectoryMonitorBackend() = default;
 
-  std::vector<DirectoryChangeNotification> notifications;
-  std::wstring path;
-  State state;
+  virtual bool Add(const std::wstring& path) = 0;
+  virtual void Clear() = 0;
 
-private:
-  std::vector<BYTE> buffer_;
-  DWORD bytes_returned_;
-  HANDLE directory_handle_;
-  OVERLAPPED overlapped_;
+  virtual bool Start(callback_function_t callback) = 0;
+  virtual void Stop() = 0;
 };
 
+// ReadDirectoryChangesW on Windows, inotify on Linux
+std::unique_ptr<DirectoryMonitorBackend> CreateDirectoryMonitorBackend();
+
 ////////////////////////////////////////////////////////////////////////////////
 // Monitors the contents of a directory and its subdirectories by using change
 // notifications.
+//
+// Bursts of changes are merged before they are delivered. For example, a file
+// that is downloaded under a temporary name and then renamed arrives as a
+// single addition under its final name, and a file that is added and removed
+// within the same burst does not arrive at all. A burst is delivered once the
+// directories have been quiet for a while, or after a few seconds at most.
 class DirectoryMonitor {
 public:
+  using notify_function_t = std::function<void()>;
+
   DirectoryMonitor();
   virtual ~DirectoryMonitor();
 
-  // The window must handle WM_MONITORCALLBACK message and call the callback
-  // function. lParam of the message is a pointer to a DirectoryChangeEntry.
-  void Callback(DirectoryChangeEntry& entry);
-  void SetWindowHandle(HWND hwnd);
+  // The notify function is called on the monitor's thread when changes are
+  // ready. It should arrange for Callback() to be called on the thread that
+  // handles them, e.g. by posting WM_MONITORCALLBACK to a window.
+  void Callback();
+  void SetNotifyFunction(notify_function_t function);
 
   // Override this function to handle notifications
-  virtual void HandleChangeNotification(
-      const DirectoryChangeNotification& notification) const = 0;
+  virtual void HandleChangeNotifications(
+      const std::vector<DirectoryChangeNotification>& notifications) const = 0;
 
 protected:
   bool Add(const std::wstring& path);
@@ -90,19 +113,28 @@ protected:
   void Stop();
 
 private:
-  bool ReadDirectoryChanges(DirectoryChangeEntry& entry);
-  void MonitorProc();
-  void HandleStoppedState(DirectoryChangeEntry& entry);
-  void HandleActiveState(DirectoryChangeEntry& entry);
-
-  class Thread : public win::Thread {
-  public:
-    DWORD ThreadProc();
-    DirectoryMonitor* parent;
-  } thread_;
-
-  std::vector<DirectoryChangeEntry> entries_;
-  win::CriticalSection critical_section_;
-  HANDLE completion_port_;
-  HWND window_handle_;
+  using clock_t = std::chrono::steady_clock;
+
+  void Queue(DirectoryChangeNotification&& notification);
+  void Push(DirectoryChangeNotification&& notification);
+  void Drop(size_t index);
+  void MoveChildren(const DirectoryChangeNotification& directory);
+  void DebounceProc();
+
+  std::unique_ptr<DirectoryMonitorBackend> backend_;
+  notify_function_t notify_function_;
+
+  // Changes of the current burst, in the order they arrived. Merged changes
+  // are left empty, and looked up by the current path of their entry.
+  std::vector<std::optional<DirectoryChangeNotification>> pending_;
+  std::unordered_map<std::wstring, size_t> pending_paths_;
+  clock_t::time_point first_change_;
+  clock_t::time_point last_change_;
+
+  std::vector<DirectoryChangeNotification> ready_;
+
+  std::thread thread_;
+  std::condition_variable condition_;
+  std::mutex mutex_;
+  bool stopping_ = false;
 };
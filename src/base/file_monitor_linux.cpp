@@ -0,0 +1,338 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <optional>
+
+#include "base/file_monitor.h"
+
+#include "base/file_search.h"
+#include "base/log.h"
+
+namespace {
+
+// Paths are UTF-8 encoded, as far as we're concerned
+std::string ToNativePath(const std::wstring& path) {
+  return std::filesystem::path{path}.u8string();
+}
+
+std::wstring FromNativePath(const char* path) {
+  return std::filesystem::u8path(path).wstring();
+}
+
+bool StartsWith(const std::wstring& str, const std::wstring& prefix) {
+  return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Uses inotify, with a thread of its own waiting on the inotify instance.
+// Watches are not recursive, so each directory gets a watch of its own, and
+// new subdirectories are watched as they appear.
+class InotifyDirectoryMonitor final : public DirectoryMonitorBackend {
+public:
+  ~InotifyDirectoryMonitor();
+
+  bool Add(const std::wstring& path) override;
+  void Clear() override;
+
+  bool Start(callback_function_t callback) override;
+  void Stop() override;
+
+private:
+  struct Watch {
+    size_t root = 0;
+    std::wstring directory;  // relative to the root, with a trailing slash
+  };
+
+  void AddWatch(size_t root, const std::wstring& directory);
+  void RemoveWatches(size_t root, const std::wstring& directory);
+  void RenameWatches(size_t root, const std::wstring& from,
+                     const std::wstring& to);
+
+  void MonitorProc();
+  void HandleEvents(const char* data, size_t size);
+  void Report(DirectoryChangeNotification&& notification);
+
+  std::vector<std::wstring> roots_;
+  std::map<int, Watch> watches_;
+  callback_function_t callback_;
+  std::thread thread_;
+  int inotify_fd_ = -1;
+  int stop_fd_ = -1;
+};
+
+InotifyDirectoryMonitor::~InotifyDirectoryMonitor() {
+  Stop();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool InotifyDirectoryMonitor::Add(const std::wstring& path) {
+  std::error_code error;
+  if (path.empty() ||
+      !std::filesystem::is_directory(ToNativePath(path), error)) {
+    return false;
+  }
+
+  roots_.push_back(path.back() == L'/' ? path : path + L'/');
+
+  return true;
+}
+
+void InotifyDirectoryMonitor::Clear() {
+  roots_.clear();
+}
+
+bool InotifyDirectoryMonitor::Start(callback_function_t callback) {
+  if (thread_.joinable())
+    return true;
+
+  callback_ = std::move(callback);
+
+  inotify_fd_ = ::inotify_init1(IN_CLOEXEC);
+  stop_fd_ = ::eventfd(0, EFD_CLOEXEC);
+  if (inotify_fd_ < 0 || stop_fd_ < 0) {
+    LOGE(L"Could not start monitoring: {}",
+         FromNativePath(std::strerror(errno)));
+    Stop();
+    return false;
+  }
+
+  for (size_t i = 0; i < roots_.size(); ++i) {
+    AddWatch(i, std::wstring{});
+    LOGD(L"Started monitoring: {}", roots_[i]);
+  }
+
+  thread_ = std::thread{[this]() { MonitorProc(); }};
+
+  return true;
+}
+
+void InotifyDirectoryMonitor::Stop() {
+  if (thread_.joinable()) {
+    const uint64_t value = 1;
+    if (::write(stop_fd_, &value, sizeof(value)) == sizeof(value))
+      thread_.join();
+    else
+      thread_.detach();
+  }
+
+  for (auto fd : {&inotify_fd_, &stop_fd_}) {
+    if (*fd >= 0) {
+      ::close(*fd);
+      *fd = -1;
+    }
+  }
+
+  watches_.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void InotifyDirectoryMonitor::AddWatch(size_t root,
+                                       const std::wstring& directory) {
+  constexpr uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                            IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+  // Linked subdirectories are not followed, like in FileSearch
+  const auto path = roots_.at(root) + directory;
+  const auto wd = ::inotify_add_watch(
+      inotify_fd_, ToNativePath(path).c_str(),
+      directory.empty() ? mask : mask | IN_DONT_FOLLOW);
+  if (wd < 0) {
+    // Most likely the limit of watches per user (ENOSPC)
+    LOGE(L"{}\nPath: {}", FromNativePath(std::strerror(errno)), path);
+    return;
+  }
+
+  watches_[wd] = {root, directory};
+
+  base::FileSearch search;
+  search.options.log_errors = false;
+  search.options.skip_files = true;
+  search.options.skip_subdirectories = true;
+  search.Search(path,
+      [this, root, &directory](const base::FileSearchResult& result) {
+        AddWatch(root, directory + result.name + L'/');
+        return false;
+      },
+      nullptr);
+}
+
+void InotifyDirectoryMonitor::RemoveWatches(size_t root,
+                                            const std::wstring& directory) {
+  for (auto it = watches_.begin(); it != watches_.end();) {
+    const auto& watch = it->second;
+    if (watch.root == root && StartsWith(watch.directory, directory)) {
+      ::inotify_rm_watch(inotify_fd_, it->first);
+      it = watches_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void InotifyDirectoryMonitor::RenameWatches(size_t root,
+                                            const std::wstring& from,
+                                            const std::wstring& to) {
+  for (auto& [wd, watch] : watches_) {
+    if (watch.root == root && StartsWith(watch.directory, from))
+      watch.directory = to + watch.directory.substr(from.size());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void InotifyDirectoryMonitor::MonitorProc() {
+  // Large enough for hundreds of events, and aligned for inotify_event
+  std::vector<uint64_t> buffer(8 * 1024);
+
+  pollfd fds[] = {
+    {inotify_fd_, POLLIN, 0},
+    {stop_fd_, POLLIN, 0},
+  };
+
+  while (true) {
+    if (::poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents)
+      break;
+
+    const auto size = ::read(inotify_fd_, buffer.data(),
+                             buffer.size() * sizeof(uint64_t));
+    if (size > 0) {
+      HandleEvents(reinterpret_cast<const char*>(buffer.data()),
+                   static_cast<size_t>(size));
+    }
+  }
+}
+
+void InotifyDirectoryMonitor::HandleEvents(const char* data, size_t size) {
+  using Action = DirectoryChangeNotification::Action;
+  using Type = DirectoryChangeNotification::Type;
+
+  // A move within the monitored tree is reported as a pair of events with the
+  // same cookie. Without a pair, the entry was moved out of the tree.
+  struct MovedFrom {
+    uint32_t cookie;
+    size_t root;
+    DirectoryChangeNotification notification;
+  };
+  std::optional<MovedFrom> moved_from;
+
+  const auto report_moved_from = [this, &moved_from]() {
+    if (moved_from) {
+      auto& notification = moved_from->notification;
+      if (notification.type == Type::Directory) {
+        RemoveWatches(moved_from->root,
+                      notification.filename.first + L'/');
+      }
+      Report(std::move(notification));
+      moved_from.reset();
+    }
+  };
+
+  for (size_t offset = 0; offset < size;) {
+    const auto event = reinterpret_cast<const inotify_event*>(data + offset);
+    offset += sizeof(inotify_event) + event->len;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+      LOGW(L"Some changes were lost, because too many happened at once.");
+      continue;
+    }
+
+    const auto it = watches_.find(event->wd);
+    if (it == watches_.end())
+      continue;
+    if (event->mask & IN_IGNORED) {  // the directory is gone
+      watches_.erase(it);
+      continue;
+    }
+    if (!event->len)
+      continue;
+
+    const auto watch = it->second;
+    const auto filename = watch.directory + FromNativePath(event->name);
+    const bool is_directory = (event->mask & IN_ISDIR) != 0;
+
+    DirectoryChangeNotification notification{Action::Added, filename,
+                                             roots_.at(watch.root)};
+    notification.type = is_directory ? Type::Directory : Type::File;
+
+    if ((event->mask & IN_MOVED_TO) && moved_from &&
+        moved_from->cookie == event->cookie) {
+      notification.action = Action::Renamed;
+      notification.filename.second =
+          moved_from->notification.filename.first;
+      moved_from.reset();
+      if (is_directory) {
+        RenameWatches(watch.root, notification.filename.second + L'/',
+                      notification.filename.first + L'/');
+      }
+      Report(std::move(notification));
+      continue;
+    }
+
+    report_moved_from();
+
+    if (event->mask & IN_MOVED_FROM) {
+      notification.action = Action::Removed;
+      moved_from = MovedFrom{event->cookie, watch.root,
+                             std::move(notification)};
+      continue;
+    }
+
+    if (event->mask & IN_DELETE) {
+      notification.action = Action::Removed;
+    } else if (is_directory) {  // created, or moved into the tree
+      AddWatch(watch.root, filename + L'/');
+    }
+
+    Report(std::move(notification));
+  }
+
+  report_moved_from();
+}
+
+void InotifyDirectoryMonitor::Report(
+    DirectoryChangeNotification&& notification) {
+  if (callback_)
+    callback_(std::move(notification));
+}
+
+}  // namespace
+
+std::unique_ptr<DirectoryMonitorBackend> CreateDirectoryMonitorBackend() {
+  return std::make_unique<InotifyDirectoryMonitor>();
+}
+
+#endif  // __linux__
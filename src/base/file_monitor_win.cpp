@@ -0,0 +1,293 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef _WIN32
+
+#include <windows/win/thread.h>
+
+#include "base/file_monitor.h"
+
+#include "base/file.h"
+#include "base/log.h"
+#include "base/string.h"
+
+namespace {
+
+class DirectoryChangeEntry {
+public:
+  friend class WindowsDirectoryMonitor;
+
+  enum class State {
+    Stopped,
+    Active,
+  };
+
+  DirectoryChangeEntry(HANDLE directory_handle, const std::wstring& path);
+
+  std::wstring path;
+  State state;
+
+private:
+  std::vector<BYTE> buffer_;
+  DWORD bytes_returned_;
+  HANDLE directory_handle_;
+  OVERLAPPED overlapped_;
+};
+
+DirectoryChangeEntry::DirectoryChangeEntry(HANDLE directory_handle,
+                                           const std::wstring& path)
+    : bytes_returned_(0),
+      directory_handle_(directory_handle),
+      path(path),
+      state(State::Stopped) {
+  buffer_.resize(65536);
+  ZeroMemory(&overlapped_, sizeof(overlapped_));
+}
+
+DirectoryChangeNotification::Type GetNotificationType(
+    const DirectoryChangeNotification& notification) {
+  if (notification.action != DirectoryChangeNotification::Action::Removed) {
+    const auto path = notification.path + notification.filename.first;
+    return FolderExists(path) ? DirectoryChangeNotification::Type::Directory
+                              : DirectoryChangeNotification::Type::File;
+  } else {
+    const auto extension = GetFileExtension(notification.filename.first);
+    return !ValidateFileExtension(extension, 4)
+               ? DirectoryChangeNotification::Type::Directory
+               : DirectoryChangeNotification::Type::File;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Uses ReadDirectoryChangesW with overlapped I/O, with a single thread waiting
+// on a completion port for all directories.
+class WindowsDirectoryMonitor final : public DirectoryMonitorBackend {
+public:
+  WindowsDirectoryMonitor();
+  ~WindowsDirectoryMonitor();
+
+  bool Add(const std::wstring& path) override;
+  void Clear() override;
+
+  bool Start(callback_function_t callback) override;
+  void Stop() override;
+
+private:
+  bool ReadDirectoryChanges(DirectoryChangeEntry& entry);
+  void MonitorProc();
+  void HandleStoppedState(DirectoryChangeEntry& entry);
+  void HandleActiveState(DirectoryChangeEntry& entry);
+
+  class Thread : public win::Thread {
+  public:
+    DWORD ThreadProc();
+    WindowsDirectoryMonitor* parent;
+  } thread_;
+
+  std::vector<DirectoryChangeEntry> entries_;
+  callback_function_t callback_;
+  HANDLE completion_port_;
+};
+
+WindowsDirectoryMonitor::WindowsDirectoryMonitor()
+    : completion_port_(nullptr) {
+  thread_.parent = this;
+}
+
+WindowsDirectoryMonitor::~WindowsDirectoryMonitor() {
+  Stop();
+  Clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool WindowsDirectoryMonitor::Add(const std::wstring& path) {
+  if (!FolderExists(path))
+    return false;
+
+  HANDLE directory_handle = ::CreateFile(
+      path.c_str(),
+      FILE_LIST_DIRECTORY,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      nullptr,
+      OPEN_EXISTING,
+      FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+      nullptr);
+
+  if (directory_handle == INVALID_HANDLE_VALUE)
+    return false;
+
+  entries_.push_back(DirectoryChangeEntry(directory_handle, path));
+  AddTrailingSlash(entries_.back().path);
+
+  return true;
+}
+
+void WindowsDirectoryMonitor::Clear() {
+  for (auto& entry : entries_) {
+    if (entry.directory_handle_ != INVALID_HANDLE_VALUE) {
+      ::CloseHandle(entry.directory_handle_);
+      entry.directory_handle_ = INVALID_HANDLE_VALUE;
+    }
+  }
+
+  entries_.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool WindowsDirectoryMonitor::Start(callback_function_t callback) {
+  callback_ = std::move(callback);
+
+  if (!thread_.GetThreadHandle())
+    thread_.CreateThread(nullptr, 0, 0);
+
+  if (!thread_.GetThreadHandle())
+    return false;
+
+  for (auto& entry : entries_) {
+    auto completion_key = reinterpret_cast<ULONG_PTR>(&entry);
+    completion_port_ = ::CreateIoCompletionPort(
+        entry.directory_handle_, completion_port_, completion_key, 0);
+    if (completion_port_)
+      ::PostQueuedCompletionStatus(completion_port_, sizeof(entry),
+                                   completion_key, &entry.overlapped_);
+  }
+
+  return true;
+}
+
+void WindowsDirectoryMonitor::Stop() {
+  if (thread_.GetThreadHandle()) {
+    ::PostQueuedCompletionStatus(completion_port_, 0, 0, nullptr);
+    ::WaitForSingleObject(thread_.GetThreadHandle(), INFINITE);
+    thread_.CloseThreadHandle();
+  }
+
+  if (completion_port_) {
+    ::CloseHandle(completion_port_);
+    completion_port_ = nullptr;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool WindowsDirectoryMonitor::ReadDirectoryChanges(
+    DirectoryChangeEntry& entry) {
+  const auto result = ::ReadDirectoryChangesW(
+      entry.directory_handle_,
+      entry.buffer_.data(),
+      static_cast<DWORD>(entry.buffer_.size()),
+      TRUE,  // watch subtree
+      FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME,
+      &entry.bytes_returned_,
+      &entry.overlapped_,
+      nullptr);
+
+  return result != 0;
+}
+
+DWORD WindowsDirectoryMonitor::Thread::ThreadProc() {
+  parent->MonitorProc();
+  return 0;
+}
+
+void WindowsDirectoryMonitor::MonitorProc() {
+  DirectoryChangeEntry* entry = nullptr;
+  DWORD number_of_bytes = 0;
+  LPOVERLAPPED overlapped;
+
+  do {
+    ::GetQueuedCompletionStatus(completion_port_, &number_of_bytes,
+                                reinterpret_cast<PULONG_PTR>(&entry),
+                                &overlapped, INFINITE);
+
+    if (entry && number_of_bytes > 0) {
+      switch (entry->state) {
+        case DirectoryChangeEntry::State::Stopped: {
+          HandleStoppedState(*entry);
+          break;
+        }
+        case DirectoryChangeEntry::State::Active: {
+          HandleActiveState(*entry);
+          break;
+        }
+      }
+    }
+  } while (entry);
+}
+
+void WindowsDirectoryMonitor::HandleStoppedState(DirectoryChangeEntry& entry) {
+  if (ReadDirectoryChanges(entry)) {
+    entry.state = DirectoryChangeEntry::State::Active;
+    LOGD(L"Started monitoring: {}", entry.path);
+  }
+}
+
+void WindowsDirectoryMonitor::HandleActiveState(DirectoryChangeEntry& entry) {
+  using Action = DirectoryChangeNotification::Action;
+
+  DWORD next_entry_offset = 0;
+  PFILE_NOTIFY_INFORMATION file_notify_info = nullptr;
+  std::wstring old_filename;
+
+  do {
+    file_notify_info = reinterpret_cast<PFILE_NOTIFY_INFORMATION>(
+        entry.buffer_.data() + next_entry_offset);
+    // Retrieve filename
+    size_t length = file_notify_info->FileNameLength / sizeof(wchar_t);
+    std::wstring filename(file_notify_info->FileName, length);
+    // Continue to the next entry
+    next_entry_offset += file_notify_info->NextEntryOffset;
+
+    // Old and new names of a renamed entry are reported one after the other
+    std::optional<DirectoryChangeNotification> notification;
+    switch (file_notify_info->Action) {
+      case FILE_ACTION_ADDED:
+        notification.emplace(Action::Added, filename, entry.path);
+        break;
+      case FILE_ACTION_REMOVED:
+        notification.emplace(Action::Removed, filename, entry.path);
+        break;
+      case FILE_ACTION_RENAMED_OLD_NAME:
+        old_filename = filename;
+        break;
+      case FILE_ACTION_RENAMED_NEW_NAME:
+        notification.emplace(Action::Renamed, filename, entry.path);
+        notification->filename.second = old_filename;
+        break;
+    }
+
+    if (notification && callback_) {
+      notification->type = GetNotificationType(*notification);
+      callback_(std::move(*notification));
+    }
+  } while (file_notify_info->NextEntryOffset != 0);
+
+  // Continue monitoring
+  ReadDirectoryChanges(entry);
+}
+
+}  // namespace
+
+std::unique_ptr<DirectoryMonitorBackend> CreateDirectoryMonitorBackend() {
+  return std::make_unique<WindowsDirectoryMonitor>();
+}
+
+#endif  // _WIN32
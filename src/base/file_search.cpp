@@ -16,90 +16,301 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <limits>
 #include <set>
 
+#ifdef _WIN32
+#include <windows.h>
 #include <windows/win/error.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#endif
 
 #include "base/file_search.h"
 
+#ifdef _WIN32
 #include "base/file.h"
-#include "base/log.h"
 #include "base/string.h"
+#endif
+#include "base/log.h"
 
 namespace base {
 
-struct FileSearchHandleDeleter {
-  using pointer = HANDLE;
-  void operator()(pointer p) const { ::FindClose(p); }
+namespace {
+
+#ifdef _WIN32
+
+constexpr wchar_t kPathSeparator = L'\\';
+
+uint64_t GetFileSize(const WIN32_FIND_DATA& data) {
+  return (static_cast<uint64_t>(data.nFileSizeHigh) << 32) |
+         data.nFileSizeLow;
+}
+
+uint64_t GetFileTime(const FILETIME& file_time) {
+  return (static_cast<uint64_t>(file_time.dwHighDateTime) << 32) |
+         file_time.dwLowDateTime;
+}
+
+// Reads the entries of a directory with FindFirstFileEx. Short names are not
+// needed, and asking for larger buffers saves round trips on network drives.
+class DirectoryReader final {
+public:
+  DirectoryReader(const std::wstring& path, const DirectoryReader*,
+                  const std::wstring&, bool log_errors) {
+    const auto pattern = AddTrailingSlash(GetExtendedLengthPath(path)) + L"*";
+    handle_ = ::FindFirstFileEx(pattern.c_str(), FindExInfoBasic, &data_,
+                                FindExSearchNameMatch, nullptr,
+                                FIND_FIRST_EX_LARGE_FETCH);
+    if (handle_ == INVALID_HANDLE_VALUE) {
+      if (log_errors) {
+        auto error_message = win::FormatError(::GetLastError());
+        TrimRight(error_message, L"\r\n");
+        LOGE(L"{}\nPath: {}", error_message, pattern);
+      }
+      ::SetLastError(ERROR_SUCCESS);
+    }
+    has_data_ = is_open();
+  }
+
+  ~DirectoryReader() {
+    if (is_open())
+      ::FindClose(handle_);
+  }
+
+  bool is_open() const {
+    return handle_ != INVALID_HANDLE_VALUE;
+  }
+
+  bool Read(FileSearchResult& result) {
+    while (has_data_) {
+      const bool valid = !IsDirectory(data_) || IsValidDirectory(data_);
+      if (valid) {
+        result.name = data_.cFileName;
+        result.attributes = 0;
+        if (IsDirectory(data_))
+          result.attributes |= FileSearchResult::kDirectory;
+        if (IsHiddenFile(data_))
+          result.attributes |= FileSearchResult::kHidden;
+        if (IsSystemFile(data_))
+          result.attributes |= FileSearchResult::kSystem;
+        result.size = IsDirectory(data_) ? 0 : GetFileSize(data_);
+        result.modified = GetFileTime(data_.ftLastWriteTime);
+      }
+      has_data_ = ::FindNextFile(handle_, &data_) != FALSE;
+      if (valid)
+        return true;
+    }
+    return false;
+  }
+
+private:
+  HANDLE handle_ = INVALID_HANDLE_VALUE;
+  WIN32_FIND_DATA data_;
+  bool has_data_ = false;
 };
 
-using FileSearchHandle = std::unique_ptr<HANDLE, FileSearchHandleDeleter>;
+#else
+
+constexpr wchar_t kPathSeparator = L'/';
+
+// Seconds between 1601-01-01 and 1970-01-01, so that modification times have
+// the same meaning on every platform
+constexpr uint64_t kUnixEpochOffset = 11644473600ull;
 
-constexpr uint64_t GetFileSize(const WIN32_FIND_DATA& data) {
-  constexpr auto m = std::numeric_limits<decltype(data.nFileSizeLow)>::max();
-  return (data.nFileSizeHigh * (m + 1ull)) + data.nFileSizeLow;
+uint64_t GetFileTime(const timespec& time) {
+  return (static_cast<uint64_t>(time.tv_sec) + kUnixEpochOffset) * 10000000 +
+         static_cast<uint64_t>(time.tv_nsec) / 100;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// @TODO: Use std::filesystem?
+// Paths are UTF-8 encoded, as far as we're concerned
+std::string ToNativePath(const std::wstring& path) {
+  return std::filesystem::path{path}.u8string();
+}
 
-bool FileSearch::Search(const std::wstring& root,
-                        callback_function_t on_directory,
-                        callback_function_t on_file) const {
-  if (root.empty())
+std::wstring FromNativePath(const char* path) {
+  return std::filesystem::u8path(path).wstring();
+}
+
+// Reads the entries of a directory in large batches with getdents64, opening
+// subdirectories relative to their parent. The entry type usually tells us
+// what we need, so only files (and entries of unknown type) are stat'ed.
+class DirectoryReader final {
+public:
+  DirectoryReader(const std::wstring& path, const DirectoryReader* parent,
+                  const std::wstring& name, bool log_errors) {
+    constexpr int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    fd_ = parent ? ::openat(parent->fd_, ToNativePath(name).c_str(), flags)
+                 : ::open(ToNativePath(path).c_str(), flags);
+    if (fd_ < 0 && log_errors) {
+      LOGE(L"{}\nPath: {}", FromNativePath(std::strerror(errno)), path);
+    }
+  }
+
+  ~DirectoryReader() {
+    if (is_open())
+      ::close(fd_);
+  }
+
+  bool is_open() const {
+    return fd_ >= 0;
+  }
+
+  bool Read(FileSearchResult& result) {
+    while (is_open()) {
+      if (offset_ >= size_) {
+        const auto size = Fill();
+        if (size <= 0)
+          return false;
+        size_ = static_cast<size_t>(size);
+        offset_ = 0;
+      }
+
+      const auto entry =
+          reinterpret_cast<const dirent64*>(buffer_.data() + offset_);
+      offset_ += entry->d_reclen;
+
+      const char* name = entry->d_name;
+      if (!std::strcmp(name, ".") || !std::strcmp(name, ".."))
+        continue;
+
+      result.name = FromNativePath(name);
+      result.attributes = 0;
+      result.size = 0;
+      result.modified = 0;
+
+      // Dot files are hidden by convention
+      if (name[0] == '.')
+        result.attributes |= FileSearchResult::kHidden;
+
+      auto type = entry->d_type;
+
+      if (type == DT_REG || type == DT_LNK || type == DT_UNKNOWN) {
+        struct stat st;
+        if (::fstatat(fd_, name, &st, 0) != 0)
+          continue;  // dangling link, or removed in the meantime
+        // Linked files are followed, but linked directories could lead us
+        // around in circles.
+        if (S_ISDIR(st.st_mode) && type == DT_LNK) {
+          type = DT_UNKNOWN;
+        } else {
+          type = S_ISDIR(st.st_mode) ? DT_DIR :
+                 S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        result.size = static_cast<uint64_t>(st.st_size);
+        result.modified = GetFileTime(st.st_mtim);
+      }
+
+      switch (type) {
+        case DT_DIR:
+          result.attributes |= FileSearchResult::kDirectory;
+          result.size = 0;
+          break;
+        case DT_REG:
+          break;
+        default:
+          // Devices, pipes and sockets are as good as system files
+          result.attributes |= FileSearchResult::kSystem;
+          break;
+      }
+
+      return true;
+    }
     return false;
-  if (options.skip_directories && options.skip_files)
+  }
+
+private:
+  ssize_t Fill() {
+    if (buffer_.empty())
+      buffer_.resize(64 * 1024);
+    return ::getdents64(fd_, buffer_.data(), buffer_.size());
+  }
+
+  int fd_ = -1;
+  std::vector<char> buffer_;
+  size_t offset_ = 0;
+  size_t size_ = 0;
+};
+
+#endif
+
+std::wstring JoinPath(const std::wstring& root, const std::wstring& name) {
+  if (!root.empty() && root.back() == kPathSeparator)
+    return root + name;
+  return root + kPathSeparator + name;
+}
+
+bool SearchDirectory(const FileSearchOptions& options,
+                     const std::wstring& root,
+                     const DirectoryReader* parent,
+                     const std::wstring& name,
+                     const FileSearch::callback_function_t& on_directory,
+                     const FileSearch::callback_function_t& on_file) {
+  DirectoryReader reader{root, parent, name, options.log_errors};
+  if (!reader.is_open())
     return false;
 
-  const auto path = AddTrailingSlash(GetExtendedLengthPath(root)) + L"*";
   std::set<std::wstring> subdirectories;
 
-  WIN32_FIND_DATA data;
-  FileSearchHandle handle(::FindFirstFile(path.c_str(), &data));
+  FileSearchResult result;
+  result.root = root;
 
-  do {
-    if (handle.get() == INVALID_HANDLE_VALUE) {
-      if (options.log_errors) {
-        auto error_message = win::FormatError(::GetLastError());
-        TrimRight(error_message, L"\r\n");
-        LOGE(L"{}\nPath: {}", error_message, path);
-      }
-      ::SetLastError(ERROR_SUCCESS);
+  while (reader.Read(result)) {
+    if (result.attributes & (FileSearchResult::kHidden |
+                             FileSearchResult::kSystem)) {
       continue;
     }
 
-    if (IsSystemFile(data) || IsHiddenFile(data))
-      continue;
-
     // Directory
-    if (IsDirectory(data)) {
-      if (!IsValidDirectory(data))
-        continue;
+    if (result.attributes & FileSearchResult::kDirectory) {
       if (!options.skip_directories)
-        if (on_directory && on_directory({root, data.cFileName, data}))
+        if (on_directory && on_directory(result))
           return true;
       if (!options.skip_subdirectories)
-        subdirectories.insert(AddTrailingSlash(root) + data.cFileName);
+        subdirectories.insert(result.name);
 
     // File
     } else {
       if (options.skip_files)
         continue;
-      if (GetFileSize(data) < options.min_file_size)
+      if (result.size < options.min_file_size)
         continue;
-      if (on_file && on_file({root, data.cFileName, data}))
+      if (on_file && on_file(result))
         return true;
     }
-
-  } while (::FindNextFile(handle.get(), &data));
+  }
 
   for (const auto& subdirectory : subdirectories) {
-    if (Search(subdirectory, on_directory, on_file))
+    if (SearchDirectory(options, JoinPath(root, subdirectory), &reader,
+                        subdirectory, on_directory, on_file)) {
       return true;
+    }
   }
 
   return false;
 }
 
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool FileSearch::Search(const std::wstring& root,
+                        callback_function_t on_directory,
+                        callback_function_t on_file) const {
+  if (root.empty())
+    return false;
+  if (options.skip_directories && options.skip_files)
+    return false;
+
+  return SearchDirectory(options, root, nullptr, std::wstring{},
+                         on_directory, on_file);
+}
+
 }  // namespace base
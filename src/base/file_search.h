@@ -22,8 +22,6 @@
 #include <functional>
 #include <string>
 
-#include <windows.h>
-
 namespace base {
 
 struct FileSearchOptions {
@@ -35,9 +33,17 @@ struct FileSearchOptions {
 };
 
 struct FileSearchResult {
+  enum Attributes : uint32_t {
+    kDirectory = 0x1,
+    kHidden = 0x2,
+    kSystem = 0x4,
+  };
+
   std::wstring root;
   std::wstring name;
-  WIN32_FIND_DATA data;
+  uint32_t attributes = 0;
+  uint64_t size = 0;      // files only
+  uint64_t modified = 0;  // in 100-nanosecond intervals since 1601-01-01 UTC
 };
 
 class FileSearch {
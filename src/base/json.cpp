@@ -29,6 +29,10 @@ bool JsonParseString(const std::string& str, Json& output) {
   }
 }
 
+Json JsonParseString(const std::string& str) {
+  return Json::parse(str.begin(), str.end(), nullptr, false);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 bool JsonReadBool(const Json& json, const std::string& key) {
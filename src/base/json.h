@@ -25,6 +25,7 @@
 using Json = nlohmann::json;
 
 bool JsonParseString(const std::string& str, Json& output);
+Json JsonParseString(const std::string& str);  // discarded value on failure
 
 bool JsonReadBool(const Json& json, const std::string& key);
 double JsonReadDouble(const Json& json, const std::string& key);
@@ -0,0 +1,777 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include "base/regex.h"
+
+namespace base {
+
+namespace {
+
+constexpr size_t kInfinite = static_cast<size_t>(-1);
+constexpr size_t kMaxRepetitions = 1000;
+constexpr size_t kMaxStates = 4096;
+constexpr uint32_t kUnknownState = static_cast<uint32_t>(-1);
+
+struct Node {
+  enum class Type {
+    Empty,
+    Bytes,
+    Concatenation,
+    Alternation,
+    Repetition,
+    Group,
+    Begin,
+    End,
+  };
+
+  Type type = Type::Empty;
+  std::vector<Node> children;
+  uint32_t byte_set = 0;
+  size_t capture = 0;  // 0 for non-capturing groups
+  size_t min = 0;
+  size_t max = 0;
+  bool greedy = true;
+};
+
+bool IsAlphanumeric(const char c) {
+  return ('0' <= c && c <= '9') || ('A' <= c && c <= 'Z') ||
+         ('a' <= c && c <= 'z');
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+class RegexSet::Compiler {
+public:
+  Compiler(RegexSet& regex_set, std::string_view pattern)
+      : regex_set_{regex_set}, pattern_{pattern} {}
+
+  bool Compile(Pattern& pattern, const uint32_t index) {
+    Node root;
+    if (!ParseAlternation(root) || !AtEnd())
+      return false;
+
+    auto& program = regex_set_.program_;
+    pattern.start = static_cast<uint32_t>(program.size());
+    pattern.capture_count = capture_count_;
+    Emit({Instruction::Op::Save, 0});
+    Generate(root);
+    Emit({Instruction::Op::Save, 1});
+    Emit({Instruction::Op::Match, index});
+    pattern.end = static_cast<uint32_t>(program.size());
+    pattern.valid = true;
+
+    return true;
+  }
+
+private:
+  bool AtEnd() const {
+    return pos_ >= pattern_.size();
+  }
+
+  char Peek() const {
+    return !AtEnd() ? pattern_[pos_] : '\0';
+  }
+
+  bool Consume(const char c) {
+    if (AtEnd() || pattern_[pos_] != c)
+      return false;
+    ++pos_;
+    return true;
+  }
+
+  uint32_t AddByteSet(const byte_set_t& byte_set) {
+    auto& byte_sets = regex_set_.byte_sets_;
+    const auto it = std::find(byte_sets.begin(), byte_sets.end(), byte_set);
+    if (it != byte_sets.end())
+      return static_cast<uint32_t>(it - byte_sets.begin());
+    byte_sets.push_back(byte_set);
+    return static_cast<uint32_t>(byte_sets.size() - 1);
+  }
+
+  static void SetRange(byte_set_t& byte_set, const uint8_t first,
+                       const uint8_t last) {
+    for (size_t c = first; c <= last; ++c)
+      byte_set.set(c);
+  }
+
+  static bool GetSingleByte(const byte_set_t& byte_set, uint8_t& byte) {
+    if (byte_set.count() != 1)
+      return false;
+    for (size_t c = 0; c < byte_set.size(); ++c) {
+      if (byte_set[c]) {
+        byte = static_cast<uint8_t>(c);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool ParseAlternation(Node& node) {
+    Node alternative;
+    if (!ParseConcatenation(alternative))
+      return false;
+
+    if (Peek() != '|') {
+      node = std::move(alternative);
+      return true;
+    }
+
+    node.type = Node::Type::Alternation;
+    node.children.push_back(std::move(alternative));
+    while (Consume('|')) {
+      if (!ParseConcatenation(alternative))
+        return false;
+      node.children.push_back(std::move(alternative));
+    }
+
+    return true;
+  }
+
+  bool ParseConcatenation(Node& node) {
+    node = Node{};
+    node.type = Node::Type::Concatenation;
+
+    while (!AtEnd() && Peek() != '|' && Peek() != ')') {
+      Node child;
+      if (!ParseRepetition(child))
+        return false;
+      node.children.push_back(std::move(child));
+    }
+
+    return true;
+  }
+
+  bool ParseNumber(size_t& number) {
+    const size_t begin = pos_;
+    number = 0;
+    while ('0' <= Peek() && Peek() <= '9')
+      number = number * 10 + (pattern_[pos_++] - '0');
+    return pos_ > begin && number <= kMaxRepetitions;
+  }
+
+  bool ParseRepetition(Node& node) {
+    Node atom;
+    if (!ParseAtom(atom))
+      return false;
+
+    size_t min = 0;
+    size_t max = 0;
+
+    switch (Peek()) {
+      case '*':
+        min = 0, max = kInfinite;
+        break;
+      case '+':
+        min = 1, max = kInfinite;
+        break;
+      case '?':
+        min = 0, max = 1;
+        break;
+      case '{':
+        ++pos_;
+        if (!ParseNumber(min))
+          return false;
+        max = min;
+        if (Consume(',')) {
+          max = kInfinite;
+          if (Peek() != '}' && (!ParseNumber(max) || max < min))
+            return false;
+        }
+        if (Peek() != '}')
+          return false;
+        break;
+      default:
+        node = std::move(atom);
+        return true;
+    }
+    ++pos_;
+
+    node.type = Node::Type::Repetition;
+    node.min = min;
+    node.max = max;
+    node.greedy = !Consume('?');
+    node.children.push_back(std::move(atom));
+
+    return true;
+  }
+
+  bool ParseAtom(Node& node) {
+    byte_set_t byte_set;
+
+    switch (const char c = pattern_[pos_++]) {
+      case '(': {
+        node.type = Node::Type::Group;
+        if (Consume('?')) {
+          if (!Consume(':'))
+            return false;  // lookaheads are not supported
+        } else {
+          node.capture = ++capture_count_;
+        }
+        Node child;
+        if (!ParseAlternation(child) || !Consume(')'))
+          return false;
+        node.children.push_back(std::move(child));
+        return true;
+      }
+      case '[':
+        if (!ParseBracket(byte_set))
+          return false;
+        break;
+      case '.':
+        byte_set.set();
+        byte_set.reset('\n');
+        byte_set.reset('\r');
+        break;
+      case '\\':
+        if (!ParseEscape(byte_set))
+          return false;
+        break;
+      case '^':
+        node.type = Node::Type::Begin;
+        return true;
+      case '$':
+        node.type = Node::Type::End;
+        return true;
+      case '*':
+      case '+':
+      case '?':
+      case '{':
+        return false;  // nothing to repeat
+      default:
+        byte_set.set(static_cast<uint8_t>(c));
+        break;
+    }
+
+    node.type = Node::Type::Bytes;
+    node.byte_set = AddByteSet(byte_set);
+    return true;
+  }
+
+  bool ParseEscape(byte_set_t& byte_set) {
+    if (AtEnd())
+      return false;
+
+    const char c = pattern_[pos_++];
+
+    switch (c) {
+      case 'd':
+      case 'D':
+        SetRange(byte_set, '0', '9');
+        break;
+      case 's':
+      case 'S':
+        for (const char space : {' ', '\t', '\n', '\r', '\f', '\v'})
+          byte_set.set(static_cast<uint8_t>(space));
+        break;
+      case 'w':
+      case 'W':
+        SetRange(byte_set, '0', '9');
+        SetRange(byte_set, 'A', 'Z');
+        SetRange(byte_set, 'a', 'z');
+        byte_set.set('_');
+        break;
+      case 'f': byte_set.set('\f'); return true;
+      case 'n': byte_set.set('\n'); return true;
+      case 'r': byte_set.set('\r'); return true;
+      case 't': byte_set.set('\t'); return true;
+      case 'v': byte_set.set('\v'); return true;
+      default:
+        // Other alphanumeric escapes (e.g. backreferences, word boundaries)
+        // are not supported.
+        if (IsAlphanumeric(c))
+          return false;
+        byte_set.set(static_cast<uint8_t>(c));
+        return true;
+    }
+
+    if (c == 'D' || c == 'S' || c == 'W')
+      byte_set.flip();
+
+    return true;
+  }
+
+  bool ParseBracketCharacter(byte_set_t& byte_set) {
+    if (AtEnd())
+      return false;
+    if (Consume('\\'))
+      return ParseEscape(byte_set);
+    byte_set.set(static_cast<uint8_t>(pattern_[pos_++]));
+    return true;
+  }
+
+  bool ParseBracket(byte_set_t& byte_set) {
+    const bool negate = Consume('^');
+
+    while (!AtEnd() && Peek() != ']') {
+      byte_set_t first;
+      if (!ParseBracketCharacter(first))
+        return false;
+
+      uint8_t first_byte = 0;
+      if (GetSingleByte(first, first_byte) && Peek() == '-' &&
+          pos_ + 1 < pattern_.size() && pattern_[pos_ + 1] != ']') {
+        ++pos_;
+        byte_set_t last;
+        uint8_t last_byte = 0;
+        if (!ParseBracketCharacter(last) || !GetSingleByte(last, last_byte) ||
+            last_byte < first_byte) {
+          return false;
+        }
+        SetRange(byte_set, first_byte, last_byte);
+      } else {
+        byte_set |= first;
+      }
+    }
+
+    if (!Consume(']'))
+      return false;
+
+    if (negate)
+      byte_set.flip();
+
+    return true;
+  }
+
+  size_t Emit(const Instruction& instruction) {
+    regex_set_.program_.push_back(instruction);
+    return regex_set_.program_.size() - 1;
+  }
+
+  uint32_t NextPc() const {
+    return static_cast<uint32_t>(regex_set_.program_.size());
+  }
+
+  void SetSplit(const size_t pc, const uint32_t body, const uint32_t exit,
+                const bool greedy) {
+    auto& instruction = regex_set_.program_[pc];
+    instruction.x = greedy ? body : exit;
+    instruction.y = greedy ? exit : body;
+  }
+
+  void Generate(const Node& node) {
+    using Op = Instruction::Op;
+    auto& program = regex_set_.program_;
+
+    switch (node.type) {
+      case Node::Type::Empty:
+        break;
+
+      case Node::Type::Bytes:
+        Emit({Op::Byte, node.byte_set});
+        break;
+
+      case Node::Type::Concatenation:
+        for (const auto& child : node.children)
+          Generate(child);
+        break;
+
+      case Node::Type::Alternation: {
+        std::vector<size_t> jumps;
+        for (size_t i = 0; i + 1 < node.children.size(); ++i) {
+          const auto split = Emit({Op::Split});
+          program[split].x = NextPc();
+          Generate(node.children[i]);
+          jumps.push_back(Emit({Op::Jump}));
+          program[split].y = NextPc();
+        }
+        Generate(node.children.back());
+        for (const auto jump : jumps)
+          program[jump].x = NextPc();
+        break;
+      }
+
+      case Node::Type::Repetition: {
+        const auto& child = node.children.front();
+        for (size_t i = 0; i < node.min; ++i)
+          Generate(child);
+        if (node.max == kInfinite) {
+          const auto split = Emit({Op::Split});
+          Generate(child);
+          Emit({Op::Jump, static_cast<uint32_t>(split)});
+          SetSplit(split, static_cast<uint32_t>(split + 1), NextPc(),
+                   node.greedy);
+        } else {
+          std::vector<size_t> splits;
+          for (size_t i = node.min; i < node.max; ++i) {
+            splits.push_back(Emit({Op::Split}));
+            Generate(child);
+          }
+          for (const auto split : splits)
+            SetSplit(split, static_cast<uint32_t>(split + 1), NextPc(),
+                     node.greedy);
+        }
+        break;
+      }
+
+      case Node::Type::Group: {
+        const auto slot = static_cast<uint32_t>(node.capture * 2);
+        if (node.capture)
+          Emit({Op::Save, slot});
+        Generate(node.children.front());
+        if (node.capture)
+          Emit({Op::Save, slot + 1});
+        break;
+      }
+
+      case Node::Type::Begin:
+        Emit({Op::AssertBegin});
+        break;
+
+      case Node::Type::End:
+        Emit({Op::AssertEnd});
+        break;
+    }
+  }
+
+  RegexSet& regex_set_;
+  std::string_view pattern_;
+  size_t pos_ = 0;
+  size_t capture_count_ = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+RegexSet::RegexSet(std::initializer_list<std::string_view> patterns) {
+  for (const auto& pattern : patterns) {
+    Add(pattern);
+  }
+  Compile();
+}
+
+RegexSet::RegexSet(const std::vector<std::string_view>& patterns) {
+  for (const auto& pattern : patterns) {
+    Add(pattern);
+  }
+  Compile();
+}
+
+size_t RegexSet::size() const {
+  return patterns_.size();
+}
+
+bool RegexSet::valid(size_t index) const {
+  return index < patterns_.size() && patterns_[index].valid;
+}
+
+void RegexSet::Add(std::string_view pattern) {
+  const auto index = static_cast<uint32_t>(patterns_.size());
+  auto& compiled_pattern = patterns_.emplace_back();
+
+  if (index >= kMaxPatterns)
+    return;
+
+  const auto program_size = program_.size();
+  Compiler compiler{*this, pattern};
+  if (!compiler.Compile(compiled_pattern, index)) {
+    program_.resize(program_size);
+    compiled_pattern = Pattern{};
+  }
+}
+
+void RegexSet::Compile() {
+  // Bytes that are not distinguished by any byte set are grouped into the
+  // same class, which keeps the transition table small.
+  std::vector<size_t> classes(256, 0);
+  size_t class_count = 1;
+  for (const auto& byte_set : byte_sets_) {
+    std::map<std::pair<size_t, bool>, size_t> refined;
+    for (size_t c = 0; c < classes.size(); ++c) {
+      const auto key = std::make_pair(classes[c], byte_set[c]);
+      classes[c] = refined.try_emplace(key, refined.size()).first->second;
+    }
+    class_count = refined.size();
+  }
+  byte_classes_.assign(classes.begin(), classes.end());
+  byte_class_count_ = class_count;
+
+  // The start state is not shared with others, because it is the only one
+  // where the beginning of the input can be asserted.
+  std::vector<bool> visited(program_.size(), false);
+  for (const auto& pattern : patterns_) {
+    if (pattern.valid)
+      Closure(pattern.start, true, false, start_pcs_, visited,
+              start_state_.accept);
+  }
+  std::sort(start_pcs_.begin(), start_pcs_.end());
+
+  ResetStates();
+}
+
+uint32_t RegexSet::AddState(pcs_t pcs, uint64_t accept, bool at_begin) const {
+  State state;
+  state.accept = accept;
+
+  std::vector<bool> visited(program_.size(), false);
+  pcs_t unused;
+  for (const auto pc : pcs) {
+    if (program_[pc].op == Instruction::Op::AssertEnd)
+      Closure(pc + 1, at_begin, true, unused, visited, state.accept_end);
+  }
+
+  const auto id = static_cast<uint32_t>(states_.size());
+  states_.push_back(state);
+  state_pcs_.push_back(std::move(pcs));
+  transitions_.resize(states_.size() * byte_class_count_, kUnknownState);
+
+  return id;
+}
+
+uint32_t RegexSet::GetTransition(uint32_t state, uint8_t byte) const {
+  const auto index = state * byte_class_count_ + byte_classes_[byte];
+  if (transitions_[index] != kUnknownState)
+    return transitions_[index];
+
+  pcs_t next;
+  const auto accept = Step(state_pcs_[state], byte, next);
+
+  if (states_.size() >= kMaxStates) {
+    // We are running out of memory; start over from where we are
+    ResetStates();
+    const auto id = AddState(std::move(next), accept, false);
+    state_ids_.emplace(state_pcs_[id], id);
+    return id;
+  }
+
+  auto it = state_ids_.find(next);
+  if (it == state_ids_.end()) {
+    const auto id = AddState(std::move(next), accept, false);
+    it = state_ids_.emplace(state_pcs_[id], id).first;
+  }
+
+  transitions_[index] = it->second;
+  return it->second;
+}
+
+void RegexSet::ResetStates() const {
+  states_.clear();
+  state_pcs_.clear();
+  state_ids_.clear();
+  transitions_.clear();
+
+  AddState(start_pcs_, start_state_.accept, true);
+}
+
+void RegexSet::Closure(uint32_t pc, bool at_begin, bool at_end, pcs_t& pcs,
+                       std::vector<bool>& visited, uint64_t& accept) const {
+  using Op = Instruction::Op;
+
+  std::vector<uint32_t> stack{pc};
+
+  while (!stack.empty()) {
+    pc = stack.back();
+    stack.pop_back();
+    if (visited[pc])
+      continue;
+    visited[pc] = true;
+
+    const auto& instruction = program_[pc];
+    switch (instruction.op) {
+      case Op::Byte:
+        pcs.push_back(pc);
+        break;
+      case Op::Split:
+        stack.push_back(instruction.y);
+        stack.push_back(instruction.x);
+        break;
+      case Op::Jump:
+        stack.push_back(instruction.x);
+        break;
+      case Op::Save:
+        stack.push_back(pc + 1);
+        break;
+      case Op::AssertBegin:
+        if (at_begin)
+          stack.push_back(pc + 1);
+        break;
+      case Op::AssertEnd:
+        if (at_end) {
+          stack.push_back(pc + 1);
+        } else {
+          pcs.push_back(pc);  // to be resolved at the end of the input
+        }
+        break;
+      case Op::Match:
+        pcs.push_back(pc);
+        accept |= 1ull << instruction.x;
+        break;
+    }
+  }
+}
+
+uint64_t RegexSet::Step(const pcs_t& pcs, uint8_t byte, pcs_t& next) const {
+  uint64_t accept = 0;
+  std::vector<bool> visited(program_.size(), false);
+
+  for (const auto pc : pcs) {
+    const auto& instruction = program_[pc];
+    if (instruction.op == Instruction::Op::Byte &&
+        byte_sets_[instruction.x][byte]) {
+      Closure(pc + 1, false, false, next, visited, accept);
+    }
+  }
+
+  // Patterns can begin at any position
+  for (const auto& pattern : patterns_) {
+    if (pattern.valid)
+      Closure(pattern.start, false, false, next, visited, accept);
+  }
+
+  std::sort(next.begin(), next.end());
+  return accept;
+}
+
+size_t RegexSet::Search(std::string_view input) const {
+  if (patterns_.empty())
+    return npos;
+
+  uint64_t accept = 0;
+
+  {
+    std::lock_guard lock{mutex_};
+
+    uint32_t state = 0;
+    accept = states_[state].accept;
+    for (const auto c : input) {
+      state = GetTransition(state, static_cast<uint8_t>(c));
+      accept |= states_[state].accept;
+    }
+    accept |= states_[state].accept_end;
+  }
+
+  for (size_t i = 0; i < patterns_.size(); ++i) {
+    if (accept & (1ull << i))
+      return i;
+  }
+
+  return npos;
+}
+
+bool RegexSet::Match(size_t index, std::string_view input) const {
+  captures_t captures;
+  return Match(index, input, captures);
+}
+
+bool RegexSet::Match(size_t index, std::string_view input,
+                     captures_t& captures) const {
+  using Op = Instruction::Op;
+
+  captures.clear();
+
+  if (!valid(index))
+    return false;
+
+  const auto& pattern = patterns_[index];
+
+  // This is a backtracking implementation that never visits the same position
+  // with the same instruction twice, which bounds its running time by the
+  // size of the input times the size of the pattern. Alternatives are tried in
+  // order of their priority, so the first match is the same as what
+  // std::regex would have found.
+  const size_t program_size = pattern.end - pattern.start;
+  const size_t positions = input.size() + 1;
+  std::vector<bool> visited(program_size * positions, false);
+
+  std::vector<size_t> slots((pattern.capture_count + 1) * 2, npos);
+
+  struct Job {
+    uint32_t pc;
+    size_t sp;
+    size_t slot = npos;  // if set, restores the slot to the value of sp
+  };
+  std::vector<Job> stack;
+  stack.push_back({pattern.start, 0});
+
+  bool matched = false;
+
+  while (!stack.empty() && !matched) {
+    auto [pc, sp, slot] = stack.back();
+    stack.pop_back();
+
+    if (slot != npos) {
+      slots[slot] = sp;
+      continue;
+    }
+
+    for (bool failed = false; !failed && !matched; ) {
+      const size_t state = (pc - pattern.start) * positions + sp;
+      if (visited[state])
+        break;
+      visited[state] = true;
+
+      const auto& instruction = program_[pc];
+      switch (instruction.op) {
+        case Op::Byte:
+          if (sp < input.size() &&
+              byte_sets_[instruction.x][static_cast<uint8_t>(input[sp])]) {
+            ++pc;
+            ++sp;
+          } else {
+            failed = true;
+          }
+          break;
+        case Op::Split:
+          stack.push_back({instruction.y, sp});
+          pc = instruction.x;
+          break;
+        case Op::Jump:
+          pc = instruction.x;
+          break;
+        case Op::Save:
+          stack.push_back({0, slots[instruction.x], instruction.x});
+          slots[instruction.x] = sp;
+          ++pc;
+          break;
+        case Op::AssertBegin:
+          failed = sp != 0;
+          ++pc;
+          break;
+        case Op::AssertEnd:
+          failed = sp != input.size();
+          ++pc;
+          break;
+        case Op::Match:
+          matched = sp == input.size();
+          failed = !matched;
+          break;
+      }
+    }
+  }
+
+  if (!matched)
+    return false;
+
+  for (size_t i = 0; i < slots.size(); i += 2) {
+    const auto begin = slots[i];
+    const auto end = slots[i + 1];
+    if (begin != npos && end != npos && begin <= end) {
+      captures.push_back(input.substr(begin, end - begin));
+    } else {
+      captures.emplace_back();
+    }
+  }
+
+  return true;
+}
+
+}  // namespace base
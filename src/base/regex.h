@@ -0,0 +1,131 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace base {
+
+// A regular expression engine for patterns that are matched very often, such
+// as the ones used for stream detection. All patterns of a set are compiled
+// into a single DFA, which finds the pattern that matches in one pass over
+// the input without backtracking. Submatches are then extracted for that
+// pattern alone, by a backtracking matcher that remembers where it has been
+// and therefore never takes exponential time.
+//
+// DFA states are built lazily and cached, because building all of them up
+// front is not feasible for a large set of patterns. The cache is guarded by a
+// mutex, so that a set can be shared between threads.
+//
+// The supported syntax is a subset of ECMAScript: literals, escapes, `.`,
+// `\d`, `\s`, `\w`, bracket expressions, capturing and non-capturing groups,
+// alternation, greedy and lazy quantifiers, and the `^` and `$` anchors.
+// Matching is done on bytes, so non-ASCII text must be encoded in UTF-8.
+class RegexSet {
+public:
+  static constexpr size_t npos = static_cast<size_t>(-1);
+  static constexpr size_t kMaxPatterns = 64;
+
+  using captures_t = std::vector<std::string_view>;
+
+  RegexSet() = default;
+  RegexSet(std::initializer_list<std::string_view> patterns);
+  explicit RegexSet(const std::vector<std::string_view>& patterns);
+
+  size_t size() const;
+  bool valid(size_t index) const;
+
+  // Returns the index of the first pattern that matches any part of the input
+  // (as in std::regex_search), or npos if there is none.
+  size_t Search(std::string_view input) const;
+
+  // Returns true if the pattern matches the whole input (as in
+  // std::regex_match). The first capture is the whole match, followed by
+  // capturing groups in order. Groups that did not participate are empty.
+  bool Match(size_t index, std::string_view input) const;
+  bool Match(size_t index, std::string_view input, captures_t& captures) const;
+
+private:
+  struct Instruction {
+    enum class Op : uint8_t {
+      Byte,         // consumes a byte in byte_sets_[x]
+      Split,        // continues at x, then at y with lower priority
+      Jump,         // continues at x
+      Save,         // saves the position to capture slot x
+      AssertBegin,  // at the beginning of the input
+      AssertEnd,    // at the end of the input
+      Match,        // pattern x matches
+    };
+    Op op = Op::Match;
+    uint32_t x = 0;
+    uint32_t y = 0;
+  };
+
+  struct Pattern {
+    uint32_t start = 0;
+    uint32_t end = 0;
+    size_t capture_count = 0;
+    bool valid = false;
+  };
+
+  struct State {
+    uint64_t accept = 0;      // patterns that have matched upon entering
+    uint64_t accept_end = 0;  // patterns that match if the input ends here
+  };
+
+  using pcs_t = std::vector<uint32_t>;
+  using byte_set_t = std::bitset<256>;
+
+  class Compiler;
+
+  void Add(std::string_view pattern);
+  void Compile();
+
+  void Closure(uint32_t pc, bool at_begin, bool at_end, pcs_t& pcs,
+               std::vector<bool>& visited, uint64_t& accept) const;
+  uint64_t Step(const pcs_t& pcs, uint8_t byte, pcs_t& next) const;
+
+  uint32_t AddState(pcs_t pcs, uint64_t accept, bool at_begin) const;
+  uint32_t GetTransition(uint32_t state, uint8_t byte) const;
+  void ResetStates() const;
+
+  std::vector<byte_set_t> byte_sets_;
+  std::vector<Instruction> program_;
+  std::vector<Pattern> patterns_;
+
+  std::vector<uint8_t> byte_classes_;
+  size_t byte_class_count_ = 0;
+  State start_state_;
+  pcs_t start_pcs_;
+
+  // Lazily built DFA for searching, where the first state is the start state
+  mutable std::mutex mutex_;
+  mutable std::vector<State> states_;
+  mutable std::vector<pcs_t> state_pcs_;
+  mutable std::map<pcs_t, uint32_t> state_ids_;
+  mutable std::vector<uint32_t> transitions_;  // states x byte classes
+};
+
+}  // namespace base
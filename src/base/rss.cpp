@@ -16,81 +16,472 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <windows.h>
+
 #include "base/rss.h"
 
 #include "base/html.h"
-#include "base/string.h"
-#include "base/xml.h"
 
 namespace rss {
 
-Channel ParseChannel(const XmlNode& node) {
-  Channel channel;
+namespace {
 
-  channel.title = node.child_value(L"title");
-  channel.link = node.child_value(L"link");
-  channel.description = node.child_value(L"description");
+constexpr std::string_view kCdataBegin = "<![CDATA[";
+constexpr std::string_view kCdataEnd = "]]>";
+constexpr std::string_view kCommentBegin = "<!--";
+constexpr std::string_view kCommentEnd = "-->";
 
-  return channel;
+bool IsWhitespace(const char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
 }
 
-Item ParseItem(const XmlNode& node) {
-  Item item;
+bool StartsWith(const std::string_view str, const size_t pos,
+                const std::string_view search) {
+  return str.compare(pos, search.size(), search) == 0;
+}
+
+std::string_view TrimWhitespace(std::string_view str) {
+  while (!str.empty() && IsWhitespace(str.front()))
+    str.remove_prefix(1);
+  while (!str.empty() && IsWhitespace(str.back()))
+    str.remove_suffix(1);
+  return str;
+}
 
-  item.title = node.child_value(L"title");
-  item.link = node.child_value(L"link");
-  item.description = node.child_value(L"description");
-  item.author = node.child_value(L"author");
-  item.comments = node.child_value(L"comments");
-  item.pub_date = node.child_value(L"pubDate");
+std::wstring Utf8ToWide(const std::string_view str) {
+  std::wstring output;
 
-  if (const auto category_node = node.child(L"category")) {
-    item.category.domain = category_node.attribute(L"domain").as_string();
-    item.category.value = category_node.child_value();
+  if (!str.empty()) {
+    const auto size = static_cast<int>(str.size());
+    const int length =
+        ::MultiByteToWideChar(CP_UTF8, 0, str.data(), size, nullptr, 0);
+    if (length > 0) {
+      output.resize(length);
+      ::MultiByteToWideChar(CP_UTF8, 0, str.data(), size, output.data(),
+                            length);
+    }
   }
 
-  if (const auto enclosure_node = node.child(L"enclosure")) {
-    item.enclosure.url = enclosure_node.attribute(L"url").as_string();
-    item.enclosure.length = enclosure_node.attribute(L"length").as_string();
-    item.enclosure.type = enclosure_node.attribute(L"type").as_string();
+  return output;
+}
+
+void AppendUtf8(std::string& output, const unsigned long cp) {
+  if (cp < 0x80) {
+    output += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    output += static_cast<char>(0xC0 | (cp >> 6));
+    output += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    output += static_cast<char>(0xE0 | (cp >> 12));
+    output += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    output += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x110000) {
+    output += static_cast<char>(0xF0 | (cp >> 18));
+    output += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    output += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    output += static_cast<char>(0x80 | (cp & 0x3F));
   }
+}
+
+// Decodes the entity reference at the given position, and returns the number
+// of characters consumed. Unknown references are left as is, so that they can
+// be handled later on as HTML entities.
+size_t DecodeEntity(const std::string_view text, const size_t pos,
+                    std::string& output) {
+  constexpr size_t kMaxEntityLength = 10;
 
-  if (const auto guid_node = node.child(L"guid")) {
-    item.guid.is_permalink = guid_node.attribute(L"isPermaLink").as_bool(true);
-    item.guid.value = guid_node.child_value();
+  const auto end = text.find(';', pos);
+  if (end == text.npos || end - pos > kMaxEntityLength) {
+    output += '&';
+    return 1;
   }
 
-  for (const auto& element : node.children()) {
-    if (InStr(element.name(), L":") > -1) {
-      item.namespace_elements[element.name()] = element.child_value();
+  const auto name = text.substr(pos + 1, end - pos - 1);
+  const size_t length = end - pos + 1;
+
+  if (name == "amp") {
+    output += '&';
+  } else if (name == "lt") {
+    output += '<';
+  } else if (name == "gt") {
+    output += '>';
+  } else if (name == "quot") {
+    output += '"';
+  } else if (name == "apos") {
+    output += '\'';
+  } else if (name.size() > 1 && name.front() == '#') {
+    const bool hex = name[1] == 'x' || name[1] == 'X';
+    const auto digits = name.substr(hex ? 2 : 1);
+    if (digits.empty()) {
+      output.append(text.substr(pos, length));
+      return length;
     }
+    unsigned long cp = 0;
+    for (const char c : digits) {
+      if ('0' <= c && c <= '9') {
+        cp = cp * (hex ? 16 : 10) + (c - '0');
+      } else if (hex && 'a' <= (c | 0x20) && (c | 0x20) <= 'f') {
+        cp = cp * 16 + ((c | 0x20) - 'a' + 10);
+      } else {
+        output.append(text.substr(pos, length));
+        return length;
+      }
+    }
+    AppendUtf8(output, cp);
+  } else {
+    output.append(text.substr(pos, length));
   }
 
-  return item;
+  return length;
 }
 
-Feed ParseDocument(const XmlDocument& document) {
-  Feed feed;
+std::string_view FindAttribute(const std::string_view attributes,
+                               const std::string_view name) {
+  const size_t size = attributes.size();
+  size_t pos = 0;
+
+  const auto skip_whitespace = [&]() {
+    while (pos < size && IsWhitespace(attributes[pos]))
+      ++pos;
+  };
+
+  while (pos < size) {
+    skip_whitespace();
+    const size_t name_begin = pos;
+    while (pos < size && attributes[pos] != '=' &&
+           !IsWhitespace(attributes[pos]))
+      ++pos;
+    const auto attribute_name = attributes.substr(name_begin, pos - name_begin);
+
+    skip_whitespace();
+    if (pos >= size || attributes[pos] != '=')
+      continue;  // attribute without a value
+    ++pos;
+    skip_whitespace();
+    if (pos >= size)
+      break;
+
+    std::string_view value;
+    if (const char quote = attributes[pos]; quote == '"' || quote == '\'') {
+      const auto end = attributes.find(quote, pos + 1);
+      if (end == attributes.npos)
+        break;
+      value = attributes.substr(pos + 1, end - pos - 1);
+      pos = end + 1;
+    } else {
+      const size_t value_begin = pos;
+      while (pos < size && !IsWhitespace(attributes[pos]))
+        ++pos;
+      value = attributes.substr(value_begin, pos - value_begin);
+    }
+
+    if (attribute_name == name)
+      return value;
+  }
 
-  const auto channel_node = document.child(L"rss").child(L"channel");
+  return {};
+}
+
+}  // namespace
 
-  feed.channel = ParseChannel(channel_node);
+////////////////////////////////////////////////////////////////////////////////
 
-  for (auto node : channel_node.children(L"item")) {
-    auto item = ParseItem(node);
+Reader::Reader(std::string_view document) : document_{document} {
+  // Skip UTF-8 byte order mark
+  if (StartsWith(document_, 0, "\xEF\xBB\xBF"))
+    pos_ = 3;
+}
 
-    // All elements of an item are optional, however at least one of title or
-    // description must be present.
-    if (item.title.empty() && item.description.empty())
+const ChannelView& Reader::channel() const {
+  return channel_;
+}
+
+bool Reader::is_feed() const {
+  return is_feed_;
+}
+
+bool Reader::Next(ItemView& item) {
+  Tag tag;
+
+  while (NextTag(tag)) {
+    if (tag.is_closing)
       continue;
 
-    DecodeHtmlEntities(item.title);
-    DecodeHtmlEntities(item.description);
+    // RSS 2.0 and 1.0 (<rdf:RDF> wraps a <channel>), and Atom 1.0
+    if (tag.name == "rss" || tag.name == "channel" || tag.name == "feed") {
+      is_feed_ = true;
+      continue;
+    }
+
+    // RSS 2.0 and Atom 1.0, respectively
+    if (tag.name == "item" || tag.name == "entry") {
+      ReadItem(tag, item);
+      return true;
+    }
+
+    if (tag.is_self_closing) {
+      if (tag.name == "link" && channel_.link.empty())
+        channel_.link = FindAttribute(tag.attributes, "href");
+      continue;
+    }
 
-    feed.items.push_back(item);
+    // Channel elements of RSS (title, link, description) and feed elements of
+    // Atom (title, subtitle). Nested elements such as <image> also contain a
+    // title, but they come after the channel's own.
+    if (tag.name == "title") {
+      const auto content = ReadContent(tag);
+      if (channel_.title.empty())
+        channel_.title = content;
+    } else if (tag.name == "link") {
+      const auto content = ReadContent(tag);
+      if (channel_.link.empty())
+        channel_.link = content;
+    } else if (tag.name == "description" || tag.name == "subtitle") {
+      const auto content = ReadContent(tag);
+      if (channel_.description.empty())
+        channel_.description = content;
+    }
   }
 
-  return feed;
+  return false;
+}
+
+bool Reader::NextTag(Tag& tag) {
+  while (pos_ < document_.size()) {
+    const auto begin = document_.find('<', pos_);
+    if (begin == document_.npos)
+      break;
+
+    // Skip markup that is not an element
+    const auto skip_to = [&](const std::string_view end) {
+      const auto pos = document_.find(end, begin + 1);
+      pos_ = pos != document_.npos ? pos + end.size() : document_.size();
+    };
+    if (StartsWith(document_, begin, kCdataBegin)) {
+      skip_to(kCdataEnd);
+      continue;
+    } else if (StartsWith(document_, begin, kCommentBegin)) {
+      skip_to(kCommentEnd);
+      continue;
+    } else if (StartsWith(document_, begin, "<?")) {
+      skip_to("?>");
+      continue;
+    } else if (StartsWith(document_, begin, "<!")) {
+      skip_to(">");
+      continue;
+    }
+
+    // Find the end of the tag, ignoring any '>' inside attribute values
+    size_t end = begin + 1;
+    char quote = '\0';
+    for (; end < document_.size(); ++end) {
+      const char c = document_[end];
+      if (quote) {
+        if (c == quote)
+          quote = '\0';
+      } else if (c == '"' || c == '\'') {
+        quote = c;
+      } else if (c == '>') {
+        break;
+      }
+    }
+    if (end >= document_.size())
+      break;
+
+    auto markup = document_.substr(begin + 1, end - begin - 1);
+
+    tag.begin = begin;
+    tag.is_closing = !markup.empty() && markup.front() == '/';
+    if (tag.is_closing)
+      markup.remove_prefix(1);
+    tag.is_self_closing = !markup.empty() && markup.back() == '/';
+    if (tag.is_self_closing)
+      markup.remove_suffix(1);
+
+    size_t name_end = 0;
+    while (name_end < markup.size() && !IsWhitespace(markup[name_end]))
+      ++name_end;
+    tag.name = markup.substr(0, name_end);
+    tag.attributes = markup.substr(name_end);
+
+    pos_ = end + 1;
+    return true;
+  }
+
+  pos_ = document_.size();
+  return false;
+}
+
+std::string_view Reader::ReadContent(const Tag& tag) {
+  if (tag.is_self_closing)
+    return {};
+
+  const size_t begin = pos_;
+  size_t depth = 1;
+
+  Tag child;
+  while (NextTag(child)) {
+    if (child.is_closing) {
+      if (--depth == 0)
+        return document_.substr(begin, child.begin - begin);
+    } else if (!child.is_self_closing) {
+      ++depth;
+    }
+  }
+
+  return document_.substr(begin);
+}
+
+void Reader::ReadItem(const Tag& item_tag, ItemView& item) {
+  item.title = {};
+  item.link = {};
+  item.description = {};
+  item.author = {};
+  item.category_domain = {};
+  item.category = {};
+  item.comments = {};
+  item.enclosure_url = {};
+  item.enclosure_length = {};
+  item.enclosure_type = {};
+  item.guid_is_permalink = true;
+  item.guid = {};
+  item.pub_date = {};
+  item.namespace_elements.clear();  // keeps capacity
+
+  if (item_tag.is_self_closing)
+    return;
+
+  Tag tag;
+  while (NextTag(tag)) {
+    if (tag.is_closing)
+      return;  // end of item
+
+    const auto& name = tag.name;
+    const auto& attributes = tag.attributes;
+    const auto content = ReadContent(tag);
+
+    if (name == "title") {
+      item.title = content;
+    } else if (name == "link") {
+      // Atom links are defined by the href attribute, and there can be more
+      // than one of them. We prefer the alternate link, which is the default.
+      if (const auto href = FindAttribute(attributes, "href"); !href.empty()) {
+        const auto rel = FindAttribute(attributes, "rel");
+        if (item.link.empty() || rel.empty() || rel == "alternate")
+          item.link = href;
+        if (rel == "enclosure") {
+          item.enclosure_url = href;
+          item.enclosure_length = FindAttribute(attributes, "length");
+          item.enclosure_type = FindAttribute(attributes, "type");
+        }
+      } else {
+        item.link = content;
+      }
+    } else if (name == "description" || name == "summary") {
+      item.description = content;
+    } else if (name == "content") {
+      if (item.description.empty())
+        item.description = content;
+    } else if (name == "author") {
+      item.author = content;
+    } else if (name == "category") {
+      if (item.category.empty() && item.category_domain.empty()) {
+        item.category_domain = FindAttribute(attributes, "domain");
+        item.category = !content.empty() ? content
+                                         : FindAttribute(attributes, "term");
+      }
+    } else if (name == "comments") {
+      item.comments = content;
+    } else if (name == "enclosure") {
+      item.enclosure_url = FindAttribute(attributes, "url");
+      item.enclosure_length = FindAttribute(attributes, "length");
+      item.enclosure_type = FindAttribute(attributes, "type");
+    } else if (name == "guid" || name == "id") {
+      const auto is_permalink = FindAttribute(attributes, "isPermaLink");
+      item.guid_is_permalink = is_permalink.empty() ||
+          std::string_view{"1tTyY"}.find(is_permalink.front()) !=
+              std::string_view::npos;
+      item.guid = content;
+    } else if (name == "pubDate" || name == "published") {
+      item.pub_date = content;
+    } else if (name == "updated") {
+      if (item.pub_date.empty())
+        item.pub_date = content;
+    } else if (name.find(':') != name.npos) {
+      item.namespace_elements.emplace_back(name, content);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::wstring DecodeText(std::string_view text) {
+  text = TrimWhitespace(text);
+
+  // Fast path for plain text, which is the most common case
+  if (text.find('&') == text.npos && text.find(kCdataBegin) == text.npos)
+    return Utf8ToWide(text);
+
+  std::string output;
+  output.reserve(text.size());
+
+  for (size_t pos = 0; pos < text.size(); ) {
+    if (text[pos] == '<' && StartsWith(text, pos, kCdataBegin)) {
+      const auto begin = pos + kCdataBegin.size();
+      auto end = text.find(kCdataEnd, begin);
+      if (end == text.npos)
+        end = text.size();
+      output.append(text.substr(begin, end - begin));
+      pos = end + kCdataEnd.size();
+    } else if (text[pos] == '&') {
+      pos += DecodeEntity(text, pos, output);
+    } else {
+      output += text[pos++];
+    }
+  }
+
+  return Utf8ToWide(output);
+}
+
+Channel DecodeChannel(const ChannelView& view) {
+  Channel channel;
+
+  channel.title = DecodeText(view.title);
+  channel.link = DecodeText(view.link);
+  channel.description = DecodeText(view.description);
+
+  return channel;
+}
+
+Item DecodeItem(const ItemView& view) {
+  Item item;
+
+  item.title = DecodeText(view.title);
+  item.link = DecodeText(view.link);
+  item.description = DecodeText(view.description);
+  item.author = DecodeText(view.author);
+  item.category.domain = DecodeText(view.category_domain);
+  item.category.value = DecodeText(view.category);
+  item.comments = DecodeText(view.comments);
+  item.enclosure.url = DecodeText(view.enclosure_url);
+  item.enclosure.length = DecodeText(view.enclosure_length);
+  item.enclosure.type = DecodeText(view.enclosure_type);
+  item.guid.is_permalink = view.guid_is_permalink;
+  item.guid.value = DecodeText(view.guid);
+  item.pub_date = DecodeText(view.pub_date);
+
+  for (const auto& [name, value] : view.namespace_elements) {
+    item.namespace_elements[Utf8ToWide(name)] = DecodeText(value);
+  }
+
+  // Title and description are often escaped twice, so that they can contain
+  // HTML entities. Other elements are not displayed or filtered on.
+  if (item.title.find(L'&') != item.title.npos)
+    DecodeHtmlEntities(item.title);
+  if (item.description.find(L'&') != item.description.npos)
+    DecodeHtmlEntities(item.description);
+
+  return item;
 }
 
 }  // namespace rss
@@ -19,14 +19,11 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
-namespace pugi {
-class xml_document;
-class xml_node;
-}
-
 namespace rss {
 
 // Reference: http://www.rssboard.org/rss-specification
@@ -74,13 +71,77 @@ struct Item {
   std::unordered_map<std::wstring, std::wstring> namespace_elements;
 };
 
-struct Feed {
-  Channel channel;
-  std::vector<Item> items;
+// Views refer to raw UTF-8 text inside the document, which may still contain
+// CDATA sections and entity references. They are only valid as long as the
+// document they were read from, and must be decoded before use.
+
+struct ChannelView {
+  std::string_view title;
+  std::string_view link;
+  std::string_view description;
+};
+
+struct ItemView {
+  using element_t = std::pair<std::string_view, std::string_view>;
+
+  std::string_view title;
+  std::string_view link;
+  std::string_view description;
+  std::string_view author;
+  std::string_view category_domain;
+  std::string_view category;
+  std::string_view comments;
+  std::string_view enclosure_url;
+  std::string_view enclosure_length;
+  std::string_view enclosure_type;
+  bool guid_is_permalink = true;
+  std::string_view guid;
+  std::string_view pub_date;
+  std::vector<element_t> namespace_elements;
 };
 
-Channel ParseChannel(const pugi::xml_node& node);
-Item ParseItem(const pugi::xml_node& node);
-Feed ParseDocument(const pugi::xml_document& document);
+// Reads RSS 2.0 and Atom 1.0 documents in place, without building a DOM. The
+// reader is forgiving about malformed markup, as many feeds in the wild are.
+class Reader {
+public:
+  explicit Reader(std::string_view document);
+
+  // Channel elements are filled as they are encountered, so the channel is
+  // complete once the first item has been read.
+  const ChannelView& channel() const;
+
+  // Returns true once an <rss>, <feed> or <channel> element has been read.
+  // Documents without one (e.g. HTML error pages) are not feeds.
+  bool is_feed() const;
+
+  // Reads the next item into the given view, reusing its storage. Returns
+  // false at the end of the document.
+  bool Next(ItemView& item);
+
+private:
+  struct Tag {
+    std::string_view name;
+    std::string_view attributes;
+    size_t begin = 0;
+    bool is_closing = false;
+    bool is_self_closing = false;
+  };
+
+  bool NextTag(Tag& tag);
+  std::string_view ReadContent(const Tag& tag);
+  void ReadItem(const Tag& item_tag, ItemView& item);
+
+  ChannelView channel_;
+  std::string_view document_;
+  bool is_feed_ = false;
+  size_t pos_ = 0;
+};
+
+// Resolves CDATA sections and XML entity references, trims surrounding
+// whitespace and converts the text to UTF-16.
+std::wstring DecodeText(std::string_view text);
+
+Channel DecodeChannel(const ChannelView& view);
+Item DecodeItem(const ItemView& view);
 
 }  // namespace rss
@@ -149,9 +149,4 @@ struct MyInformation {
   std::wstring notes;
 };
 
-struct LocalInformation {
-  std::vector<bool> available_episodes;
-  std::wstring next_episode_path;
-};
-
 }  // namespace anime
@@ -0,0 +1,431 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <bitset>
+#include <set>
+#include <unordered_set>
+
+#include "media/anime_availability.h"
+
+#include "base/string.h"
+#include "media/anime_db.h"
+#include "media/anime_item.h"
+#include "media/anime_util.h"
+#include "ui/ui.h"
+
+namespace anime {
+
+constexpr uint32_t kBlockSize = 64;
+
+static int PopCount(uint64_t bits) {
+  return static_cast<int>(std::bitset<64>{bits}.count());
+}
+
+// Bits from `first` to `last` within a block, inclusive
+static uint64_t GetMask(uint32_t first, uint32_t last) {
+  const uint64_t high = last == kBlockSize - 1 ?
+      ~uint64_t{0} : (uint64_t{1} << (last + 1)) - 1;
+  return high & ~((uint64_t{1} << first) - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool EpisodeSet::Contains(int number) const {
+  if (number < 1)
+    return false;
+
+  const auto bit = static_cast<uint32_t>(number - 1);
+  const auto it = std::lower_bound(blocks_.begin(), blocks_.end(),
+                                   block_t{bit / kBlockSize, 0});
+  return it != blocks_.end() && it->first == bit / kBlockSize &&
+         (it->second & (uint64_t{1} << (bit % kBlockSize)));
+}
+
+int EpisodeSet::Count() const {
+  int count = 0;
+  for (const auto& [index, bits] : blocks_) {
+    count += PopCount(bits);
+  }
+  return count;
+}
+
+int EpisodeSet::Count(int first, int last) const {
+  first = std::max(first, 1);
+  if (last < first)
+    return 0;
+
+  const auto first_bit = static_cast<uint32_t>(first - 1);
+  const auto last_bit = static_cast<uint32_t>(last - 1);
+
+  int count = 0;
+  for (const auto& [index, bits] : blocks_) {
+    if (index < first_bit / kBlockSize)
+      continue;
+    if (index > last_bit / kBlockSize)
+      break;
+    const auto low = index == first_bit / kBlockSize ?
+        first_bit % kBlockSize : 0;
+    const auto high = index == last_bit / kBlockSize ?
+        last_bit % kBlockSize : kBlockSize - 1;
+    count += PopCount(bits & GetMask(low, high));
+  }
+  return count;
+}
+
+int EpisodeSet::Last() const {
+  if (blocks_.empty())
+    return 0;
+
+  const auto& [index, bits] = blocks_.back();
+  uint32_t bit = kBlockSize - 1;
+  while (!(bits & (uint64_t{1} << bit)))
+    --bit;
+  return static_cast<int>(index * kBlockSize + bit + 1);
+}
+
+bool EpisodeSet::empty() const {
+  return blocks_.empty();
+}
+
+bool EpisodeSet::Insert(int number) {
+  if (number < 1)
+    return false;
+
+  const auto bit = static_cast<uint32_t>(number - 1);
+  const auto mask = uint64_t{1} << (bit % kBlockSize);
+  auto it = std::lower_bound(blocks_.begin(), blocks_.end(),
+                             block_t{bit / kBlockSize, 0});
+  if (it == blocks_.end() || it->first != bit / kBlockSize)
+    it = blocks_.insert(it, {bit / kBlockSize, 0});
+
+  if (it->second & mask)
+    return false;
+  it->second |= mask;
+  return true;
+}
+
+bool EpisodeSet::Erase(int number) {
+  if (number < 1)
+    return false;
+
+  const auto bit = static_cast<uint32_t>(number - 1);
+  const auto mask = uint64_t{1} << (bit % kBlockSize);
+  const auto it = std::lower_bound(blocks_.begin(), blocks_.end(),
+                                   block_t{bit / kBlockSize, 0});
+  if (it == blocks_.end() || it->first != bit / kBlockSize ||
+      !(it->second & mask)) {
+    return false;
+  }
+
+  it->second &= ~mask;
+  if (!it->second)
+    blocks_.erase(it);
+  return true;
+}
+
+void EpisodeSet::Clear() {
+  blocks_.clear();
+}
+
+void EpisodeSet::ForEach(const std::function<void(int)>& function) const {
+  for (const auto& [index, bits] : blocks_) {
+    for (uint32_t bit = 0; bit < kBlockSize; ++bit) {
+      if (bits & (uint64_t{1} << bit))
+        function(static_cast<int>(index * kBlockSize + bit + 1));
+    }
+  }
+}
+
+const std::vector<EpisodeSet::block_t>& EpisodeSet::blocks() const {
+  return blocks_;
+}
+
+void EpisodeSet::set_blocks(std::vector<block_t> blocks) {
+  blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+                              [](const block_t& block) {
+                                return !block.second;
+                              }),
+               blocks.end());
+  std::sort(blocks.begin(), blocks.end());
+  blocks.erase(std::unique(blocks.begin(), blocks.end(),
+                           [](const block_t& a, const block_t& b) {
+                             return a.first == b.first;
+                           }),
+               blocks.end());
+  blocks_ = std::move(blocks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const AvailabilityDatabase::Entry* AvailabilityDatabase::Find(int id) const {
+  const auto it = entries_.find(id);
+  return it != entries_.end() ? &it->second : nullptr;
+}
+
+bool AvailabilityDatabase::IsAvailable(int id, int number) const {
+  const auto entry = Find(id);
+  return entry && entry->episodes.Contains(number);
+}
+
+int AvailabilityDatabase::GetCount(int id) const {
+  const auto entry = Find(id);
+  return entry ? entry->episodes.Count() : 0;
+}
+
+int AvailabilityDatabase::GetCount(int id, int first, int last) const {
+  const auto entry = Find(id);
+  return entry ? entry->episodes.Count(first, last) : 0;
+}
+
+int AvailabilityDatabase::GetLastNumber(int id) const {
+  const auto entry = Find(id);
+  return entry ? entry->episodes.Last() : 0;
+}
+
+std::wstring AvailabilityDatabase::GetPath(int id, int number) const {
+  const auto entry = Find(id);
+  if (!entry)
+    return {};
+
+  const auto it = entry->paths.find(number);
+  return it != entry->paths.end() ? paths_.at(it->second) : std::wstring{};
+}
+
+bool AvailabilityDatabase::Set(int id, int number, bool available,
+                               const std::wstring& path) {
+  bool changed = false;
+
+  if (available) {
+    auto& entry = entries_[id];
+    changed = entry.episodes.Insert(number);
+    if (!path.empty()) {
+      const auto index = InternPath(path);
+      const auto [it, inserted] = entry.paths.try_emplace(number, index);
+      if (inserted || it->second != index) {
+        it->second = index;
+        changed = true;
+      }
+    }
+  } else {
+    const auto it = entries_.find(id);
+    if (it == entries_.end())
+      return false;
+    auto& entry = it->second;
+    changed = entry.episodes.Erase(number);
+    entry.paths.erase(number);
+    if (entry.episodes.empty())
+      entries_.erase(it);
+  }
+
+  modified_ = modified_ || changed;
+  return changed;
+}
+
+void AvailabilityDatabase::Clear() {
+  modified_ = modified_ || !entries_.empty();
+  entries_.clear();
+  path_indexes_.clear();
+  paths_.clear();
+}
+
+void AvailabilityDatabase::ForEachInside(
+    const std::vector<std::wstring>& folders,
+    const std::function<void(int, int)>& function) const {
+  if (folders.empty())
+    return;
+
+  std::unordered_set<std::wstring> prefixes;
+  for (const auto& folder : folders) {
+    prefixes.insert(ToLower_Copy(AddTrailingSlash(folder)));
+  }
+
+  // Each path is checked only once, no matter how many episodes it has or how
+  // many folders there are, by looking up each of its parent folders.
+  std::vector<bool> inside(paths_.size());
+  for (size_t i = 0; i < paths_.size(); ++i) {
+    const auto path = ToLower_Copy(paths_[i]);
+    for (auto pos = path.find(L'\\'); pos != path.npos;
+         pos = path.find(L'\\', pos + 1)) {
+      if (prefixes.count(path.substr(0, pos + 1))) {
+        inside[i] = true;
+        break;
+      }
+    }
+  }
+
+  for (const auto& [id, entry] : entries_) {
+    for (const auto& [number, index] : entry.paths) {
+      if (inside.at(index))
+        function(id, number);
+    }
+  }
+}
+
+const std::unordered_map<int, AvailabilityDatabase::Entry>&
+AvailabilityDatabase::entries() const {
+  return entries_;
+}
+
+const std::wstring& AvailabilityDatabase::GetPathByIndex(
+    uint32_t index) const {
+  return paths_.at(index);
+}
+
+uint32_t AvailabilityDatabase::InternPath(const std::wstring& path) {
+  const auto it = path_indexes_.find(path);
+  if (it != path_indexes_.end())
+    return it->second;
+
+  const auto index = static_cast<uint32_t>(paths_.size());
+  paths_.push_back(path);
+  path_indexes_.emplace(paths_.back(), index);
+  return index;
+}
+
+bool AvailabilityDatabase::modified() const {
+  return modified_;
+}
+
+void AvailabilityDatabase::set_modified(bool modified) {
+  modified_ = modified;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool AvailabilityTransaction::Set(const Item& item, int number, bool available,
+                                  const std::wstring& path) {
+  if (number == 0)
+    number = 1;
+
+  if (number > item.GetEpisodeCount() &&
+      IsValidEpisodeCount(item.GetEpisodeCount())) {
+    return false;
+  }
+
+  auto& changes = changes_[item.GetId()];
+  if (available) {
+    changes.available.Insert(number);
+    changes.unavailable.Erase(number);
+    changes.paths[number] = path;
+  } else {
+    changes.available.Erase(number);
+    changes.unavailable.Insert(number);
+    changes.paths.erase(number);
+  }
+
+  return true;
+}
+
+void AvailabilityTransaction::Clear(const Item& item) {
+  auto& changes = changes_[item.GetId()];
+  changes.available.Clear();
+  changes.paths.clear();
+
+  const auto& entries = availability_db.entries();
+  const auto it = entries.find(item.GetId());
+  if (it != entries.end()) {
+    it->second.episodes.ForEach([&changes](int number) {
+      changes.unavailable.Insert(number);
+    });
+  }
+}
+
+void AvailabilityTransaction::Reset(const std::wstring& folder) {
+  reset_folders_.push_back(folder);
+}
+
+bool AvailabilityTransaction::IsEpisodeAvailable(const Item& item,
+                                                 int number) const {
+  if (number < 1)
+    number = 1;
+
+  const auto it = changes_.find(item.GetId());
+  if (it != changes_.end()) {
+    if (it->second.available.Contains(number))
+      return true;
+    if (it->second.unavailable.Contains(number))
+      return false;
+  }
+
+  return item.IsEpisodeAvailable(number);
+}
+
+bool AvailabilityTransaction::IsAllEpisodesAvailable(const Item& item) const {
+  if (changes_.find(item.GetId()) == changes_.end())
+    return anime::IsAllEpisodesAvailable(item);
+
+  const int count = item.GetEpisodeCount();
+  if (!IsValidEpisodeCount(count))
+    return false;
+
+  for (int number = 1; number <= count; ++number) {
+    if (!IsEpisodeAvailable(item, number))
+      return false;
+  }
+
+  return true;
+}
+
+void AvailabilityTransaction::Commit() {
+  // Taken out first, so that the transaction can be reused right away
+  const auto changes = std::move(changes_);
+  const auto reset_folders = std::move(reset_folders_);
+  changes_.clear();
+  reset_folders_.clear();
+
+  std::set<int> changed_ids;
+
+  std::vector<std::pair<int, int>> reset_episodes;
+  availability_db.ForEachInside(reset_folders,
+      [&changes, &reset_episodes](int id, int number) {
+        const auto it = changes.find(id);
+        if (it == changes.end() || !it->second.available.Contains(number))
+          reset_episodes.emplace_back(id, number);
+      });
+  for (const auto& [id, number] : reset_episodes) {
+    if (availability_db.Set(id, number, false, L""))
+      changed_ids.insert(id);
+  }
+
+  for (const auto& [id, item_changes] : changes) {
+    const auto anime_id = id;
+    item_changes.unavailable.ForEach([&](int number) {
+      if (availability_db.Set(anime_id, number, false, L""))
+        changed_ids.insert(anime_id);
+    });
+    const auto& paths = item_changes.paths;
+    item_changes.available.ForEach([&](int number) {
+      const auto it = paths.find(number);
+      const auto path = it != paths.end() ? it->second : std::wstring{};
+      if (availability_db.Set(anime_id, number, true, path))
+        changed_ids.insert(anime_id);
+    });
+  }
+
+  for (const auto id : changed_ids) {
+    if (db.Find(id))
+      ui::OnEpisodeAvailabilityChange(id);
+  }
+}
+
+bool AvailabilityTransaction::empty() const {
+  return changes_.empty() && reset_folders_.empty();
+}
+
+}  // namespace anime
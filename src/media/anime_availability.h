@@ -0,0 +1,145 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace anime {
+
+class Item;
+
+// A sparse set of episode numbers, stored in blocks of 64. Only the blocks
+// that have at least one episode are kept, so that a few episodes of a long
+// running series take as little space as a whole season of a short one.
+class EpisodeSet {
+public:
+  using block_t = std::pair<uint32_t, uint64_t>;  // index, bits
+
+  bool Contains(int number) const;
+  int Count() const;
+  int Count(int first, int last) const;
+  int Last() const;
+  bool empty() const;
+
+  bool Insert(int number);
+  bool Erase(int number);
+  void Clear();
+
+  void ForEach(const std::function<void(int)>& function) const;
+
+  const std::vector<block_t>& blocks() const;
+  void set_blocks(std::vector<block_t> blocks);
+
+private:
+  std::vector<block_t> blocks_;  // sorted by index
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Available episodes of the whole library, along with the path of each one.
+// It is saved with the scan index, so that availability is known at startup,
+// before the library is scanned again.
+class AvailabilityDatabase {
+public:
+  struct Entry {
+    EpisodeSet episodes;
+    std::map<int, uint32_t> paths;  // episode number, path index
+  };
+
+  bool IsAvailable(int id, int number) const;
+  int GetCount(int id) const;
+  int GetCount(int id, int first, int last) const;
+  int GetLastNumber(int id) const;
+  std::wstring GetPath(int id, int number) const;
+
+  bool Set(int id, int number, bool available, const std::wstring& path);
+  void Clear();
+
+  // Calls the function for each available episode whose file is inside any of
+  // the folders.
+  void ForEachInside(const std::vector<std::wstring>& folders,
+                     const std::function<void(int, int)>& function) const;
+
+  const std::unordered_map<int, Entry>& entries() const;
+  const std::wstring& GetPathByIndex(uint32_t index) const;
+
+  bool modified() const;
+  void set_modified(bool modified);
+
+private:
+  const Entry* Find(int id) const;
+  uint32_t InternPath(const std::wstring& path);
+
+  std::unordered_map<int, Entry> entries_;
+
+  // Multi-episode files share a single path. Paths that are no longer used are
+  // left out when the index is saved.
+  std::deque<std::wstring> paths_;
+  std::unordered_map<std::wstring_view, uint32_t> path_indexes_;
+
+  bool modified_ = false;
+};
+
+inline AvailabilityDatabase availability_db;
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Collects episode availability changes, e.g. from a scan or from a burst of
+// directory changes, and applies them all at once. Each anime whose
+// availability has changed is then refreshed once, rather than once per
+// episode.
+class AvailabilityTransaction {
+public:
+  // Follows the same rules as Item::SetEpisodeAvailability
+  bool Set(const Item& item, int number, bool available,
+           const std::wstring& path);
+  void Clear(const Item& item);
+
+  // Episodes inside the folder that were not found to be available by the
+  // time of commit become unavailable. This is how a complete scan of a
+  // folder removes the files that are gone.
+  void Reset(const std::wstring& folder);
+
+  // Takes pending changes into account
+  bool IsEpisodeAvailable(const Item& item, int number) const;
+  bool IsAllEpisodesAvailable(const Item& item) const;
+
+  void Commit();
+  bool empty() const;
+
+private:
+  struct Changes {
+    EpisodeSet available;
+    EpisodeSet unavailable;
+    std::map<int, std::wstring> paths;
+  };
+
+  std::map<int, Changes> changes_;
+  std::vector<std::wstring> reset_folders_;
+};
+
+}  // namespace anime
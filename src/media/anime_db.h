@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <ctime>
 #include <string>
 #include <map>
 
@@ -63,6 +64,10 @@ public:
 public:
   std::map<int, Item> items;
 
+  // Library synchronization state, stored along with the list
+  time_t last_synchronized = 0;
+  time_t last_scanned = 0;
+
 private:
   void ReadDatabaseNode(pugi::xml_node& database_node);
   void WriteDatabaseNode(pugi::xml_node& database_node) const;
@@ -0,0 +1,269 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <mutex>
+
+#include "media/anime_folder_index.h"
+
+#include "base/file.h"
+#include "base/string.h"
+#include "media/anime.h"
+
+namespace anime {
+
+std::vector<std::wstring_view> FolderIndex::Split(const std::wstring& path) {
+  std::vector<std::wstring_view> components;
+
+  const std::wstring_view view{path};
+  size_t pos = 0;
+  while (pos < view.size()) {
+    const auto end = std::min(view.find_first_of(L"\\/", pos), view.size());
+    if (end > pos)
+      components.push_back(view.substr(pos, end - pos));
+    pos = end + 1;
+  }
+
+  return components;
+}
+
+std::wstring FolderIndex::Fold(std::wstring_view component) {
+  return ToLower_Copy(std::wstring{component});
+}
+
+const FolderIndex::Node* FolderIndex::FindNode(
+    const std::wstring& path) const {
+  const auto components = Split(path);
+  if (components.empty())
+    return nullptr;
+
+  const Node* node = &root_;
+  for (const auto component : components) {
+    const auto it = node->children.find(Fold(component));
+    if (it == node->children.end())
+      return nullptr;
+    node = it->second.get();
+  }
+
+  return node;
+}
+
+FolderIndex::Node& FolderIndex::InsertNode(const std::wstring& path) {
+  Node* node = &root_;
+  for (const auto component : Split(path)) {
+    auto& child = node->children[Fold(component)];
+    if (!child)
+      child = std::make_unique<Node>();
+    node = child.get();
+  }
+  return *node;
+}
+
+void FolderIndex::EraseId(const std::wstring& path, int id) {
+  std::vector<std::pair<Node*, std::wstring>> parents;
+
+  Node* node = &root_;
+  for (const auto component : Split(path)) {
+    auto key = Fold(component);
+    const auto it = node->children.find(key);
+    if (it == node->children.end())
+      return;
+    parents.emplace_back(node, std::move(key));
+    node = it->second.get();
+  }
+
+  auto& ids = node->ids;
+  ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+
+  // Remove the branch that no longer leads to any folder
+  for (auto it = parents.rbegin(); it != parents.rend(); ++it) {
+    auto& [parent, key] = *it;
+    const auto& child = parent->children[key];
+    if (!child->ids.empty() || child->library_folder > -1 ||
+        !child->children.empty()) {
+      break;
+    }
+    parent->children.erase(key);
+  }
+}
+
+void FolderIndex::ResetLibraryFolders(Node& node) {
+  node.library_folder = -1;
+
+  for (auto it = node.children.begin(); it != node.children.end(); ) {
+    auto& child = *it->second;
+    ResetLibraryFolders(child);
+    if (child.ids.empty() && child.children.empty()) {
+      it = node.children.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const std::wstring& FolderIndex::Get(int id) const {
+  static const std::wstring empty_folder;
+
+  std::shared_lock lock{mutex_};
+  const auto it = folders_.find(id);
+  return it != folders_.end() ? *it->second : empty_folder;
+}
+
+bool FolderIndex::Set(int id, const std::wstring& folder) {
+  std::unique_lock lock{mutex_};
+
+  const auto it = folders_.find(id);
+  const bool found = it != folders_.end();
+  if (found) {
+    if (*it->second == folder)
+      return false;
+    EraseId(*it->second, id);
+    folders_.erase(it);
+  }
+
+  if (!folder.empty()) {
+    folders_[id] = &*strings_.insert(folder).first;
+    InsertNode(folder).ids.push_back(id);
+  }
+
+  return found || !folder.empty();
+}
+
+void FolderIndex::Clear() {
+  std::unique_lock lock{mutex_};
+  root_ = Node{};
+  folders_.clear();
+  library_folders_.clear();
+}
+
+int FolderIndex::Find(const std::wstring& folder) const {
+  std::shared_lock lock{mutex_};
+  const auto node = FindNode(folder);
+  return node && !node->ids.empty() ? node->ids.front() : ID_UNKNOWN;
+}
+
+std::vector<int> FolderIndex::FindInside(const std::wstring& folder) const {
+  std::vector<int> ids;
+
+  std::shared_lock lock{mutex_};
+
+  const auto node = FindNode(folder);
+  if (!node)
+    return ids;
+
+  std::vector<const Node*> nodes{node};
+  while (!nodes.empty()) {
+    const auto current = nodes.back();
+    nodes.pop_back();
+    ids.insert(ids.end(), current->ids.begin(), current->ids.end());
+    for (const auto& [key, child] : current->children) {
+      nodes.push_back(child.get());
+    }
+  }
+
+  return ids;
+}
+
+std::map<int, std::wstring> FolderIndex::GetAll() const {
+  std::map<int, std::wstring> folders;
+
+  std::shared_lock lock{mutex_};
+  for (const auto& [id, folder] : folders_) {
+    folders.emplace(id, *folder);
+  }
+
+  return folders;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void FolderIndex::SetLibraryFolders(const std::vector<std::wstring>& folders) {
+  // Paths reported by media players may be resolved, so both forms are added.
+  // Resolving has to access the file system, so it is done here once, rather
+  // than every time a path is checked.
+  std::vector<std::wstring> final_paths;
+  for (const auto& folder : folders) {
+    final_paths.push_back(GetNormalizedPath(GetFinalPath(folder)));
+  }
+
+  std::unique_lock lock{mutex_};
+
+  ResetLibraryFolders(root_);
+  library_folders_ = folders;
+
+  for (size_t i = 0; i < folders.size(); ++i) {
+    for (const auto& path : {folders.at(i), final_paths.at(i)}) {
+      if (Split(path).empty())
+        continue;
+      auto& node = InsertNode(path);
+      if (node.library_folder == -1)
+        node.library_folder = static_cast<int>(i);
+    }
+  }
+}
+
+bool FolderIndex::IsInsideLibraryFolders(const std::wstring& path) const {
+  std::shared_lock lock{mutex_};
+
+  const Node* node = &root_;
+  for (const auto component : Split(path)) {
+    const auto it = node->children.find(Fold(component));
+    if (it == node->children.end())
+      return false;
+    node = it->second.get();
+    if (node->library_folder > -1)
+      return true;
+  }
+
+  return false;
+}
+
+FolderLocation FolderIndex::Resolve(const std::wstring& path) const {
+  FolderLocation location;
+
+  const auto components = Split(path);
+  size_t library_depth = 0;
+
+  std::shared_lock lock{mutex_};
+
+  const Node* node = &root_;
+  for (size_t depth = 0; depth < components.size(); ++depth) {
+    const auto it = node->children.find(Fold(components.at(depth)));
+    if (it == node->children.end())
+      break;
+    node = it->second.get();
+    if (node->library_folder > -1) {
+      location.library_folder = library_folders_.at(node->library_folder);
+      library_depth = depth + 1;
+    }
+    if (!node->ids.empty()) {
+      location.anime_id = node->ids.front();
+      location.anime_folder = *folders_.at(location.anime_id);
+    }
+  }
+
+  for (size_t depth = library_depth; depth < components.size(); ++depth) {
+    location.components.emplace_back(components.at(depth));
+  }
+
+  return location;
+}
+
+}  // namespace anime
@@ -0,0 +1,90 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace anime {
+
+struct FolderLocation {
+  std::wstring library_folder;  // empty if the path is outside the library
+  int anime_id = 0;             // owning anime folder, or ID_UNKNOWN
+  std::wstring anime_folder;
+  // Path components below the library folder, or all of them if the path is
+  // outside the library
+  std::vector<std::wstring> components;
+};
+
+// Anime folders, as set by the user or found by the scanner, and library
+// folders. Folders are saved with the settings, but kept here so that looking
+// them up doesn't involve the settings store. Folder strings are interned and
+// never freed during a session, so references to them remain valid.
+//
+// Folders are arranged in a trie of case-folded path components, so that a
+// path can be resolved to its library folder and owning anime folder in a
+// single walk.
+class FolderIndex {
+public:
+  const std::wstring& Get(int id) const;
+  bool Set(int id, const std::wstring& folder);
+  void Clear();
+
+  // Looks up anime by their folder, or by a folder that contains them
+  int Find(const std::wstring& folder) const;
+  std::vector<int> FindInside(const std::wstring& folder) const;
+
+  std::map<int, std::wstring> GetAll() const;
+
+  void SetLibraryFolders(const std::vector<std::wstring>& folders);
+  bool IsInsideLibraryFolders(const std::wstring& path) const;
+
+  FolderLocation Resolve(const std::wstring& path) const;
+
+private:
+  struct Node {
+    std::unordered_map<std::wstring, std::unique_ptr<Node>> children;
+    std::vector<int> ids;
+    int library_folder = -1;
+  };
+
+  static std::vector<std::wstring_view> Split(const std::wstring& path);
+  static std::wstring Fold(std::wstring_view component);
+
+  const Node* FindNode(const std::wstring& path) const;
+  Node& InsertNode(const std::wstring& path);
+  void EraseId(const std::wstring& path, int id);
+  static void ResetLibraryFolders(Node& node);
+
+  Node root_;
+  std::unordered_map<int, const std::wstring*> folders_;
+  std::unordered_set<std::wstring> strings_;
+  std::vector<std::wstring> library_folders_;
+  mutable std::shared_mutex mutex_;
+};
+
+inline FolderIndex folder_index;
+
+}  // namespace anime
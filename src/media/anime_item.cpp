@@ -22,11 +22,12 @@
 
 #include "base/string.h"
 #include "base/time.h"
+#include "media/anime_availability.h"
+#include "media/anime_folder_index.h"
 #include "media/anime_util.h"
 #include "media/library/queue.h"
 #include "sync/service.h"
 #include "taiga/settings.h"
-#include "ui/ui.h"
 
 namespace anime {
 
@@ -161,11 +162,6 @@ void Item::SetType(SeriesType type) {
 
 void Item::SetEpisodeCount(int number) {
   series_.episode_count = number;
-
-  // TODO: Call it separately
-  if (number >= 0)
-    if (static_cast<size_t>(number) > local_info_.available_episodes.size())
-      local_info_.available_episodes.resize(number);
 }
 
 void Item::SetEpisodeLength(int number) {
@@ -500,15 +496,19 @@ void Item::SetMyNotes(const std::wstring& notes) {
 ////////////////////////////////////////////////////////////////////////////////
 
 int Item::GetAvailableEpisodeCount() const {
-  return static_cast<int>(local_info_.available_episodes.size());
+  return availability_db.GetCount(GetId());
+}
+
+int Item::GetLastAvailableEpisode() const {
+  return availability_db.GetLastNumber(GetId());
 }
 
-std::wstring Item::GetFolder() const {
-  return taiga::settings.GetAnimeFolder(GetId());
+const std::wstring& Item::GetFolder() const {
+  return folder_index.Get(GetId());
 }
 
-const std::wstring& Item::GetNextEpisodePath() const {
-  return local_info_.next_episode_path;
+std::wstring Item::GetNextEpisodePath() const {
+  return availability_db.GetPath(GetId(), GetMyLastWatchedEpisode() + 1);
 }
 
 bool Item::GetUseAlternative() const {
@@ -523,32 +523,17 @@ std::vector<std::wstring> Item::GetUserSynonyms() const {
 
 bool Item::SetEpisodeAvailability(int number, bool available,
                                   const std::wstring& path) {
-  if (number == 0)
-    number = 1;
-
-  if (number <= GetEpisodeCount() || !IsValidEpisodeCount(GetEpisodeCount())) {
-    if (static_cast<size_t>(number) > local_info_.available_episodes.size()) {
-      local_info_.available_episodes.resize(number);
-    }
-    local_info_.available_episodes.at(number - 1) = available;
-    if (number == GetMyLastWatchedEpisode() + 1) {
-      SetNextEpisodePath(path);
-    }
-
-    ui::OnEpisodeAvailabilityChange(GetId());
-
-    return true;
-  }
+  AvailabilityTransaction transaction;
+  if (!transaction.Set(*this, number, available, path))
+    return false;
 
-  return false;
+  transaction.Commit();
+  return true;
 }
 
 void Item::SetFolder(const std::wstring& folder) {
-  taiga::settings.SetAnimeFolder(GetId(), folder);
-}
-
-void Item::SetNextEpisodePath(const std::wstring& path) {
-  local_info_.next_episode_path = path;
+  if (folder_index.Set(GetId(), folder))
+    taiga::settings.SetModified();
 }
 
 void Item::SetUseAlternative(bool use_alternative) {
@@ -577,10 +562,8 @@ void Item::SetUserSynonyms(std::vector<std::wstring> synonyms) {
 bool Item::IsEpisodeAvailable(int number) const {
   if (number < 1)
     number = 1;
-  if (static_cast<size_t>(number) > local_info_.available_episodes.size())
-    return false;
 
-  return local_info_.available_episodes.at(number - 1);
+  return availability_db.IsAvailable(GetId(), number);
 }
 
 bool Item::IsNextEpisodeAvailable() const {
@@ -134,14 +134,14 @@ public:
   // Local data
 
   int GetAvailableEpisodeCount() const;
-  std::wstring GetFolder() const;
-  const std::wstring& GetNextEpisodePath() const;
+  int GetLastAvailableEpisode() const;
+  const std::wstring& GetFolder() const;
+  std::wstring GetNextEpisodePath() const;
   bool GetUseAlternative() const;
   std::vector<std::wstring> GetUserSynonyms() const;
 
   bool SetEpisodeAvailability(int number, bool available, const std::wstring& path);
   void SetFolder(const std::wstring& folder);
-  void SetNextEpisodePath(const std::wstring& path);
   void SetUseAlternative(bool use_alternative);
   void SetUserSynonyms(const std::wstring& synonyms);
   void SetUserSynonyms(std::vector<std::wstring> synonyms);
@@ -166,9 +166,6 @@ private:
   // User information, stored in user\<username>\anime.xml - some items are not
   // in user's list, thus this member is not valid for every item.
   std::shared_ptr<MyInformation> my_info_;
-
-  // Local information, stored temporarily
-  LocalInformation local_info_;
 };
 
 }  // namespace anime
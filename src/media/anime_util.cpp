@@ -28,7 +28,9 @@
 #include "base/log.h"
 #include "base/string.h"
 #include "media/anime.h"
+#include "media/anime_availability.h"
 #include "media/anime_db.h"
+#include "media/anime_folder_index.h"
 #include "media/library/queue.h"
 #include "sync/sync.h"
 #include "taiga/announce.h"
@@ -413,13 +415,7 @@ void GetUpcomingTitles(std::vector<int>& anime_ids) {
 ////////////////////////////////////////////////////////////////////////////////
 
 bool IsInsideLibraryFolders(const std::wstring& path) {
-  for (auto library_folder : taiga::settings.GetLibraryFolders()) {
-    library_folder = GetNormalizedPath(GetFinalPath(library_folder));
-    if (StartsWith(path, library_folder))
-      return true;
-  }
-
-  return false;
+  return folder_index.IsInsideLibraryFolders(path);
 }
 
 bool ValidateFolder(Item& item) {
@@ -435,9 +431,9 @@ bool ValidateFolder(Item& item) {
 
   item.SetFolder(L"");
 
-  for (int i = 1; i <= item.GetAvailableEpisodeCount(); ++i) {
-    item.SetEpisodeAvailability(i, false, L"");
-  }
+  AvailabilityTransaction availability;
+  availability.Clear(item);
+  availability.Commit();
 
   return false;
 }
@@ -445,20 +441,10 @@ bool ValidateFolder(Item& item) {
 ////////////////////////////////////////////////////////////////////////////////
 
 bool IsAllEpisodesAvailable(const Item& item) {
-  if (!IsValidEpisodeCount(item.GetEpisodeCount()))
-    return false;
-
-  int available_episode_count = item.GetAvailableEpisodeCount();
-  bool all_episodes_available = available_episode_count > 0;
-
-  for (int i = 1; i <= available_episode_count; i++) {
-    if (!item.IsEpisodeAvailable(i)) {
-      all_episodes_available = false;
-      break;
-    }
-  }
+  const int count = item.GetEpisodeCount();
 
-  return all_episodes_available;
+  return IsValidEpisodeCount(count) &&
+         availability_db.GetCount(item.GetId(), 1, count) == count;
 }
 
 bool IsValidEpisodeCount(int number) {
@@ -490,8 +476,7 @@ int GetLastEpisodeNumber(const Item& item) {
 
   // Estimate using user information
   number = std::max(number, item.GetMyLastWatchedEpisode());
-  if (item.GetAvailableEpisodeCount() != item.GetEpisodeCount())
-    number = std::max(number, item.GetAvailableEpisodeCount());
+  number = std::max(number, item.GetLastAvailableEpisode());
 
   // Estimate using local information
   number = std::max(number, item.GetLastAiredEpisodeNumber());
@@ -33,6 +33,8 @@ namespace anime {
 
 bool Database::LoadList() {
   ClearUserData();
+  last_synchronized = 0;
+  last_scanned = 0;
 
   if (taiga::GetCurrentUsername().empty())
     return false;
@@ -53,6 +55,10 @@ bool Database::LoadList() {
   auto node_database = document.child(L"database");
   ReadDatabaseNode(node_database);
 
+  auto node_sync = document.child(L"sync");
+  last_synchronized = ToTime(XmlReadStr(node_sync, L"last_synchronized"));
+  last_scanned = ToTime(XmlReadStr(node_sync, L"last_scanned"));
+
   auto node_library = document.child(L"library");
   for (auto node : node_library.children(L"anime")) {
     const auto id = XmlReadInt(node, L"id");
@@ -90,6 +96,10 @@ bool Database::SaveList(bool include_database) const {
     WriteDatabaseNode(XmlChild(document, L"database"));
   }
 
+  auto node_sync = document.append_child(L"sync");
+  XmlWriteStr(node_sync, L"last_synchronized", ToWstr(last_synchronized));
+  XmlWriteStr(node_sync, L"last_scanned", ToWstr(last_scanned));
+
   auto node_library = document.append_child(L"library");
 
   for (const auto& [id, item] : items) {
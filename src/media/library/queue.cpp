@@ -16,6 +16,9 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <set>
+
 #include "media/library/queue.h"
 
 #include "base/log.h"
@@ -62,6 +65,27 @@ static void ValidateQueueItem(QueueItem& item, const anime::Item& anime_item) {
       item.date_finish.reset();
 }
 
+static void MergeQueueItem(QueueItem& item, const QueueItem& next_item) {
+  if (next_item.episode)
+    item.episode = *next_item.episode;
+  if (next_item.score)
+    item.score = *next_item.score;
+  if (next_item.status)
+    item.status = *next_item.status;
+  if (next_item.enable_rewatching)
+    item.enable_rewatching = *next_item.enable_rewatching;
+  if (next_item.rewatched_times)
+    item.rewatched_times = *next_item.rewatched_times;
+  if (next_item.tags)
+    item.tags = *next_item.tags;
+  if (next_item.notes)
+    item.notes = *next_item.notes;
+  if (next_item.date_start)
+    item.date_start = *next_item.date_start;
+  if (next_item.date_finish)
+    item.date_finish = *next_item.date_finish;
+}
+
 void Queue::Add(QueueItem& item, bool save) {
   const auto anime_item = anime::db.Find(item.anime_id);
 
@@ -97,24 +121,7 @@ void Queue::Add(QueueItem& item, bool save) {
         if (it->mode != QueueItemMode::Add &&
             it->mode != QueueItemMode::Delete) {
           if (!item.episode || (!it->episode && it == items.rbegin())) {
-            if (item.episode)
-              it->episode = *item.episode;
-            if (item.score)
-              it->score = *item.score;
-            if (item.status)
-              it->status = *item.status;
-            if (item.enable_rewatching)
-              it->enable_rewatching = *item.enable_rewatching;
-            if (item.rewatched_times)
-              it->rewatched_times = *item.rewatched_times;
-            if (item.tags)
-              it->tags = *item.tags;
-            if (item.notes)
-              it->notes = *item.notes;
-            if (item.date_start)
-              it->date_start = *item.date_start;
-            if (item.date_finish)
-              it->date_finish = *item.date_finish;
+            MergeQueueItem(*it, item);
             add_new_item = false;
           }
           if (!add_new_item) {
@@ -148,7 +155,6 @@ void Queue::Add(QueueItem& item, bool save) {
 
     // Check new episode
     if (item.episode) {
-      anime_item->SetNextEpisodePath(L"");
       ScanAvailableEpisodesQuick(anime_item->GetId());
     }
 
@@ -163,22 +169,26 @@ void Queue::Check(bool automatic) {
   if (updating || items.empty())
     return;
 
-  const auto& queue_item = items.front();
+  for (size_t i = 0; i < items.size(); ) {
+    const auto& queue_item = items.at(i);
 
-  if (!queue_item.enabled) {
-    LOGD(L"Item is disabled, removing...");
-    Remove(0, true, true, false);
-    Check(automatic);
-    return;
+    if (!queue_item.enabled) {
+      LOGD(L"Item is disabled, removing...");
+      Remove(static_cast<int>(i), true, true, false);
+      continue;
+    }
+
+    if (!anime::db.Find(queue_item.anime_id)) {
+      LOGW(L"Item not found in list, removing... ID: {}", queue_item.anime_id);
+      Remove(static_cast<int>(i), true, true, false);
+      continue;
+    }
+
+    ++i;
   }
 
-  const auto anime_item = anime::db.Find(queue_item.anime_id);
-  if (!anime_item) {
-    LOGW(L"Item not found in list, removing... ID: {}", queue_item.anime_id);
-    Remove(0, true, true, false);
-    Check(automatic);
+  if (items.empty())
     return;
-  }
 
   if (automatic && !taiga::settings.GetAppOptionEnableSync()) {
     LOGD(L"Automatic synchronization is disabled");
@@ -191,17 +201,81 @@ void Queue::Check(bool automatic) {
   }
 
   updating = true;
+  failed_ = false;
 
-  switch (queue_item.mode) {
-    case QueueItemMode::Add:
-      sync::AddLibraryEntry(queue_item);
-      break;
-    case QueueItemMode::Delete:
-      sync::DeleteLibraryEntry(queue_item.anime_id);
-      break;
-    case QueueItemMode::Update:
-      sync::UpdateLibraryEntry(queue_item);
-      break;
+  sync::UpdateLibraryEntries(Coalesce());
+}
+
+std::vector<QueueItem> Queue::Coalesce() {
+  // All pending changes to an anime are merged into a single net change. Items
+  // are removed individually once the change is complete, so that each watched
+  // episode is still moved to history.
+  std::vector<QueueItem> net_items;
+  std::map<int, size_t> positions;
+  std::set<int> blocked;
+
+  in_progress_.clear();
+
+  for (const auto& queue_item : items) {
+    const auto anime_id = queue_item.anime_id;
+
+    if (blocked.count(anime_id))
+      continue;
+
+    const auto it = positions.find(anime_id);
+    if (it == positions.end()) {
+      positions[anime_id] = net_items.size();
+      net_items.push_back(queue_item);
+      in_progress_[anime_id] = 1;
+      continue;
+    }
+
+    // Additions and deletions must be sent in order; they are left for the
+    // next check, along with any following items for the same anime.
+    auto& net_item = net_items.at(it->second);
+    if (net_item.mode == QueueItemMode::Delete ||
+        queue_item.mode != QueueItemMode::Update) {
+      blocked.insert(anime_id);
+      continue;
+    }
+
+    MergeQueueItem(net_item, queue_item);
+    in_progress_[anime_id] += 1;
+  }
+
+  LOGD(L"Items: {}, requests: {}", items.size(), net_items.size());
+
+  return net_items;
+}
+
+void Queue::Complete(int anime_id, bool success) {
+  const auto it = in_progress_.find(anime_id);
+  if (it == in_progress_.end())
+    return;
+
+  if (success) {
+    for (auto count = it->second; count > 0; --count) {
+      const auto queue_item = std::find_if(
+          items.begin(), items.end(), [&anime_id](const QueueItem& item) {
+            return item.anime_id == anime_id;
+          });
+      if (queue_item == items.end())
+        break;
+      anime::db.UpdateItem(*queue_item);
+      Remove(static_cast<int>(queue_item - items.begin()), false, true, true);
+    }
+    anime::db.SaveList();
+    history.Save();
+  } else {
+    failed_ = true;
+  }
+
+  in_progress_.erase(it);
+
+  if (in_progress_.empty()) {
+    updating = false;
+    if (!failed_)
+      Check(false);
   }
 }
 
@@ -307,15 +381,6 @@ void Queue::Remove(int index, bool save, bool refresh, bool to_history) {
       }
     }
 
-    if (queue_item.episode) {
-      auto anime_item = anime::db.Find(queue_item.anime_id);
-      if (anime_item &&
-          anime_item->GetMyLastWatchedEpisode() == *queue_item.episode) {
-        // Next episode path is no longer valid
-        anime_item->SetNextEpisodePath(L"");
-      }
-    }
-
     items.erase(it);
 
     if (refresh)
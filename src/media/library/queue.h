@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <map>
 #include <optional>
 #include <queue>
 #include <string>
@@ -69,6 +70,7 @@ class Queue {
 public:
   void Add(QueueItem& item, bool save = true);
   void Check(bool automatic = true);
+  void Complete(int anime_id, bool success);
   void Clear(bool save = true);
   void Merge(bool save = true);
   bool IsQueued(int anime_id) const;
@@ -80,6 +82,13 @@ public:
 
   std::vector<QueueItem> items;
   bool updating = false;
+
+private:
+  std::vector<QueueItem> Coalesce();
+
+  // Number of queue items that were merged into each request in progress
+  std::map<int, size_t> in_progress_;
+  bool failed_ = false;
 };
 
 class ConfirmationQueue {
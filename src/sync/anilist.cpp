@@ -16,6 +16,12 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <memory>
+#include <regex>
+#include <set>
+#include <vector>
+
 #include <windows/win/string.h>
 
 #include "sync/anilist.h"
@@ -31,8 +37,11 @@
 #include "media/anime_util.h"
 #include "media/library/queue.h"
 #include "sync/anilist_util.h"
+#include "sync/library_delta.h"
+#include "sync/pages.h"
 #include "sync/sync.h"
 #include "taiga/http.h"
+#include "taiga/http_metrics.h"
 #include "taiga/settings.h"
 #include "track/recognition.h"
 #include "ui/translate.h"
@@ -53,9 +62,11 @@ constexpr auto kAuthenticateUser = L"IDR_ANILIST_VIEWER";
 constexpr auto kDeleteLibraryEntry = L"IDR_ANILIST_DELETEMEDIALISTENTRY";
 constexpr auto kGetLibraryEntries = L"IDR_ANILIST_MEDIALISTCOLLECTION";
 constexpr auto kGetMetadataById = L"IDR_ANILIST_MEDIA";
+constexpr auto kGetMetadataByIds = L"IDR_ANILIST_MEDIAPAGE";
 constexpr auto kGetSeason = L"IDR_ANILIST_MEDIASEASON";
 constexpr auto kMediaFields = L"IDR_ANILIST_MEDIAFIELDS";
 constexpr auto kMediaListFields = L"IDR_ANILIST_MEDIALISTFIELDS";
+constexpr auto kMediaSummaryFields = L"IDR_ANILIST_MEDIASUMMARYFIELDS";
 constexpr auto kSearchTitle = L"IDR_ANILIST_MEDIASEARCH";
 constexpr auto kUpdateLibraryEntry = L"IDR_ANILIST_SAVEMEDIALISTENTRY";
 
@@ -137,9 +148,11 @@ std::string GetGraphQlQuery(const std::wstring_view gql) {
 
   std::wstring query = get_query(gql);
 
-  ReplaceString(query, L"{mediaFields}", get_query(L"IDR_ANILIST_MEDIAFIELDS"));
+  ReplaceString(query, L"{mediaFields}", get_query(gql::kMediaFields));
   ReplaceString(query, L"{mediaListFields}",
-                get_query(L"IDR_ANILIST_MEDIALISTFIELDS"));
+                get_query(gql::kMediaListFields));
+  ReplaceString(query, L"{mediaSummaryFields}",
+                get_query(gql::kMediaSummaryFields));
 
   EraseChars(query, L"\r");
   ReplaceChar(query, '\n', ' ');
@@ -222,8 +235,12 @@ int ParseMediaObject(const Json& json) {
   anime_item.SetType(TranslateSeriesTypeFrom(JsonReadStr(json, "format")));
   anime_item.SetAiringStatus(
       TranslateSeriesStatusFrom(JsonReadStr(json, "status")));
-  anime_item.SetSynopsis(
-      anime::NormalizeSynopsis(StrToWstr(JsonReadStr(json, "description"))));
+  // Summary fields leave out the synopsis, which is only shown in the anime
+  // information dialog; we keep what we already have in that case.
+  if (json.contains("description")) {
+    anime_item.SetSynopsis(anime::NormalizeSynopsis(
+        StrToWstr(JsonReadStr(json, "description"))));
+  }
   anime_item.SetDateStart(TranslateFuzzyDateFrom(json["startDate"]));
   anime_item.SetDateEnd(TranslateFuzzyDateFrom(json["endDate"]));
   anime_item.SetEpisodeCount(JsonReadInt(json, "episodes"));
@@ -286,13 +303,12 @@ int ParseMediaListObject(const Json& json) {
   anime_item.AddtoUserList();
   anime_item.SetMyId(ToWstr(library_id));
 
+  // Entries are updated in place, so every field must be set explicitly
   const auto status = JsonReadStr(json, "status");
-  if (status == kRepeatingMediaListStatus) {
-    anime_item.SetMyStatus(anime::MyStatus::Watching);
-    anime_item.SetMyRewatching(true);
-  } else {
-    anime_item.SetMyStatus(TranslateMyStatusFrom(status));
-  }
+  const bool rewatching = status == kRepeatingMediaListStatus;
+  anime_item.SetMyStatus(rewatching ? anime::MyStatus::Watching
+                                    : TranslateMyStatusFrom(status));
+  anime_item.SetMyRewatching(rewatching);
 
   anime_item.SetMyScore(JsonReadInt(json, "score"));
   anime_item.SetMyLastWatchedEpisode(JsonReadInt(json, "progress"));
@@ -351,6 +367,12 @@ bool HasError(const taiga::http::Response& response) {
   return false;
 }
 
+// Response bodies are parsed in the worker thread, and the result is then
+// passed to the response handler in the main thread.
+Json ParseResponseBody(const taiga::http::Response& response) {
+  return JsonParseString(response.body());
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void AuthenticateUser() {
@@ -362,16 +384,15 @@ void AuthenticateUser() {
                       L"AniList: Authenticating user...");
   };
 
-  const auto on_response = [](const taiga::http::Response& response) {
+  const auto on_response = [](const taiga::http::Response& response,
+                              Json& root) {
     if (HasError(response)) {
       account.set_authenticated(false);
       sync::OnError(RequestType::AuthenticateUser);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       account.set_authenticated(false);
       ui::ChangeStatusText(L"AniList: Could not parse authentication data.");
       sync::OnError(RequestType::AuthenticateUser);
@@ -389,7 +410,7 @@ void AuthenticateUser() {
     }
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
 void GetLibraryEntries() {
@@ -405,37 +426,39 @@ void GetLibraryEntries() {
                       L"AniList: Retrieving anime list...");
   };
 
-  const auto on_response = [](const taiga::http::Response& response) {
+  const auto on_response = [](const taiga::http::Response& response,
+                              Json& root) {
     if (HasError(response)) {
       sync::OnError(RequestType::GetLibraryEntries);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"AniList: Could not parse anime list.");
       sync::OnError(RequestType::GetLibraryEntries);
       return;
     }
 
-    anime::db.ClearUserData();
+    // MediaListCollection can't be filtered by modification date, so we
+    // always get the entire list. Comparing it with what we already have
+    // still lets us update the changed entries only.
+    library_delta.Begin(LibraryDelta::Mode::Full);
 
     const auto& lists = root["data"]["MediaListCollection"]["lists"];
     for (const auto& list : lists) {
       const auto& entries = list["entries"];
       for (const auto& entry : entries) {
-        ParseMediaListObject(entry);
+        library_delta.Add(ParseMediaListObject(entry));
       }
     }
 
     sync::OnResponse(RequestType::GetLibraryEntries);
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
-void GetMetadataById(const int id) {
+void GetMediaById(const int id) {
   const Json variables{
     {"id", id},
   };
@@ -448,7 +471,8 @@ void GetMetadataById(const int id) {
                       L"AniList: Retrieving anime information...");
   };
 
-  const auto on_response = [id](const taiga::http::Response& response) {
+  const auto on_response = [id](const taiga::http::Response& response,
+                                Json& root) {
     if (HasError(response)) {
       if (response.status_code() == 404) {
         sync::OnInvalidAnimeId(id);
@@ -459,9 +483,7 @@ void GetMetadataById(const int id) {
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"AniList: Could not parse anime data.");
       ui::OnLibraryEntryChangeFailure(id);
       sync::OnError(RequestType::GetMetadataById);
@@ -474,10 +496,111 @@ void GetMetadataById(const int id) {
     sync::OnResponse(RequestType::GetMetadataById);
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
-void GetSeason(const anime::Season season, const int page) {
+void GetMediaByIds(const std::vector<int>& ids) {
+  if (ids.size() == 1) {
+    GetMediaById(ids.front());
+    return;
+  }
+
+  const Json variables{
+    {"ids", ids},
+  };
+
+  auto request = BuildRequest();
+  request.set_body(BuildRequestBody(gql::kGetMetadataByIds, variables));
+
+  const auto on_transfer = [](const taiga::http::Transfer& transfer) {
+    return OnTransfer(RequestType::GetMetadataById, transfer,
+                      L"AniList: Retrieving anime information...");
+  };
+
+  const auto on_response = [ids](const taiga::http::Response& response,
+                                 Json& root) {
+    if (HasError(response) || root.is_discarded()) {
+      if (root.is_discarded())
+        ui::ChangeStatusText(L"AniList: Could not parse anime data.");
+      for (const auto id : ids) {
+        ui::OnLibraryEntryChangeFailure(id);
+      }
+      sync::OnError(RequestType::GetMetadataById);
+      return;
+    }
+
+    std::set<int> found_ids;
+    for (const auto& media : root["data"]["Page"]["media"]) {
+      const int anime_id = ParseMediaObject(media);
+      found_ids.insert(anime_id);
+      ui::OnLibraryEntryChange(anime_id);
+    }
+
+    // An id that is missing from the page might be invalid. We ask for it on
+    // its own, so that it is handled the same way as before.
+    for (const auto id : ids) {
+      if (!found_ids.count(id))
+        GetMediaById(id);
+    }
+
+    sync::OnResponse(RequestType::GetMetadataById);
+  };
+
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
+}
+
+// Lookups that are made in quick succession (e.g. when refreshing the anime
+// season or a list of stale items) are collected for a short while, and then
+// sent together in one request.
+class MetadataBatch {
+public:
+  void Add(const int id) {
+    if (std::find(ids_.begin(), ids_.end(), id) == ids_.end())
+      ids_.push_back(id);
+
+    if (ids_.size() >= kMaxBatchSize) {
+      Flush();
+    } else if (!timer_id_) {
+      timer_id_ = ::SetTimer(nullptr, 0, kBatchDelay, TimerProc);
+    }
+  }
+
+  void Flush() {
+    if (timer_id_) {
+      ::KillTimer(nullptr, timer_id_);
+      timer_id_ = 0;
+    }
+    if (!ids_.empty()) {
+      const auto ids = std::move(ids_);
+      ids_.clear();
+      GetMediaByIds(ids);
+    }
+  }
+
+private:
+  static void CALLBACK TimerProc(HWND, UINT, UINT_PTR, DWORD);
+
+  static constexpr UINT kBatchDelay = 100;  // milliseconds
+  static constexpr size_t kMaxBatchSize = 50;  // AniList's maximum page size
+
+  std::vector<int> ids_;
+  UINT_PTR timer_id_ = 0;
+};
+
+static MetadataBatch metadata_batch;
+
+void CALLBACK MetadataBatch::TimerProc(HWND, UINT, UINT_PTR, DWORD) {
+  const taiga::http::MetricsScope metrics_scope{"GetMetadataById"};
+  const taiga::http::PriorityScope priority_scope{taiga::http::Priority::Low};
+  metadata_batch.Flush();
+}
+
+void GetMetadataById(const int id) {
+  metadata_batch.Add(id);
+}
+
+taiga::http::Request BuildSeasonRequest(const anime::Season season,
+                                        const int page) {
   const Json variables{
     {"season", TranslateSeasonTo(ui::TranslateSeasonName(season.name))},
     {"seasonYear", static_cast<int>(season.year)},
@@ -487,50 +610,104 @@ void GetSeason(const anime::Season season, const int page) {
   auto request = BuildRequest();
   request.set_body(BuildRequestBody(gql::kGetSeason, variables));
 
+  return request;
+}
+
+void ParseSeasonPage(Json& root) {
+  for (const auto& media : root["data"]["Page"]["media"]) {
+    const auto anime_id = ParseMediaObject(media);
+    anime::season_db.items.push_back(anime_id);
+    ui::OnLibraryEntryChange(anime_id);
+  }
+}
+
+void GetRemainingSeasonPages(const anime::Season season, const int last_page) {
+  const auto pages = std::make_shared<PageQueue>(last_page - 1,
+                                                 ParseSeasonPage);
+
   const auto on_transfer = [season](const taiga::http::Transfer& transfer) {
     return OnTransfer(RequestType::GetSeason, transfer,
         L"AniList: Retrieving {} anime season..."_format(
             ui::TranslateSeason(season)));
   };
 
-  const auto on_response = [season](const taiga::http::Response& response) {
+  for (int page = 2; page <= last_page; ++page) {
+    const auto request = BuildSeasonRequest(season, page);
+
+    const auto on_response = [pages, index = page - 2](
+        const taiga::http::Response& response, Json& root) {
+      if (pages->failed()) {
+        return;
+      }
+
+      if (HasError(response)) {
+        if (pages->Fail())
+          sync::OnError(RequestType::GetSeason);
+        return;
+      }
+
+      if (root.is_discarded()) {
+        if (pages->Fail()) {
+          ui::ChangeStatusText(L"AniList: Could not parse season data.");
+          sync::OnError(RequestType::GetSeason);
+        }
+        return;
+      }
+
+      if (pages->Push(index, root)) {
+        sync::OnResponse(RequestType::GetSeason);
+      }
+    };
+
+    taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
+  }
+}
+
+void GetSeason(const anime::Season season, const int page) {
+  const auto request = BuildSeasonRequest(season, page);
+
+  const auto on_transfer = [season](const taiga::http::Transfer& transfer) {
+    return OnTransfer(RequestType::GetSeason, transfer,
+        L"AniList: Retrieving {} anime season..."_format(
+            ui::TranslateSeason(season)));
+  };
+
+  const auto on_response = [season](const taiga::http::Response& response,
+                                    Json& root) {
     if (HasError(response)) {
       sync::OnError(RequestType::GetSeason);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"AniList: Could not parse season data.");
       sync::OnError(RequestType::GetSeason);
       return;
     }
 
-    const auto& page = root["data"]["Page"];
-
-    const auto& page_info = page["pageInfo"];
+    const auto& page_info = root["data"]["Page"]["pageInfo"];
     const int current_page = JsonReadInt(page_info, "currentPage");
+    const int last_page = JsonReadInt(page_info, "lastPage");
     const bool has_next_page = JsonReadBool(page_info, "hasNextPage");
 
     if (current_page <= 1) {  // first page
       anime::season_db.items.clear();
     }
 
-    for (const auto& media : page["media"]) {
-      const auto anime_id = ParseMediaObject(media);
-      anime::season_db.items.push_back(anime_id);
-      ui::OnLibraryEntryChange(anime_id);
-    }
+    ParseSeasonPage(root);
 
     if (has_next_page) {
-      GetSeason(season, current_page + 1);
+      if (current_page <= 1 && last_page > 1) {
+        GetRemainingSeasonPages(season, last_page);
+      } else {
+        GetSeason(season, current_page + 1);  // last page is unavailable
+      }
     } else {
       sync::OnResponse(RequestType::GetSeason);
     }
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
 void SearchTitle(const std::wstring& title) {
@@ -546,15 +723,14 @@ void SearchTitle(const std::wstring& title) {
                       L"AniList: Searching for \"{}\"..."_format(title));
   };
 
-  const auto on_response = [](const taiga::http::Response& response) {
+  const auto on_response = [](const taiga::http::Response& response,
+                              Json& root) {
     if (HasError(response)) {
       sync::OnError(RequestType::SearchTitle);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"AniList: Could not parse search results.");
       sync::OnError(RequestType::SearchTitle);
       return;
@@ -570,7 +746,7 @@ void SearchTitle(const std::wstring& title) {
     sync::OnResponse(RequestType::SearchTitle);
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
 void AddLibraryEntry(const library::QueueItem& queue_item) {
@@ -600,22 +776,20 @@ void DeleteLibraryEntry(const int id) {
       } else {
         ui::OnLibraryUpdateFailure(id, StrToWstr(response.error().str()),
                                    false);
-        sync::OnError(RequestType::DeleteLibraryEntry);
+        sync::OnError(RequestType::DeleteLibraryEntry, id);
         return;
       }
     }
 
     // Returns: {"data":{"DeleteMediaListEntry":{"deleted":true}}}
 
-    sync::OnResponse(RequestType::DeleteLibraryEntry);
+    sync::OnResponse(RequestType::DeleteLibraryEntry, id);
   };
 
   taiga::http::Send(request, on_transfer, on_response);
 }
 
-void UpdateLibraryEntry(const library::QueueItem& queue_item) {
-  const auto id = queue_item.anime_id;
-
+Json BuildLibraryEntryVariables(const library::QueueItem& queue_item) {
   Json variables{
     {"mediaId", queue_item.anime_id},
   };
@@ -644,6 +818,53 @@ void UpdateLibraryEntry(const library::QueueItem& queue_item) {
   if (queue_item.date_finish)
     variables["completedAt"] = TranslateFuzzyDateTo(*queue_item.date_finish);
 
+  return variables;
+}
+
+std::string BuildBatchMutation(const size_t count) {
+  // SaveMediaListEntry is repeated with an alias and its own set of variables
+  // for each entry:
+  //
+  //   mutation ($id_0: Int, ..., $id_1: Int, ...) {
+  //     entry_0: SaveMediaListEntry (id: $id_0, ...) {...}
+  //     entry_1: SaveMediaListEntry (id: $id_1, ...) {...}
+  //   }
+  const auto query = GetGraphQlQuery(gql::kUpdateLibraryEntry);
+
+  const auto params_begin = query.find('(');
+  const auto params_end = query.find(')', params_begin);
+  const auto body_begin = query.find('{', params_end);
+  const auto body_end = query.rfind('}');
+  if (params_end == std::string::npos || body_begin == std::string::npos ||
+      body_end <= body_begin) {
+    return {};
+  }
+
+  const auto params =
+      query.substr(params_begin + 1, params_end - params_begin - 1);
+  const auto body = query.substr(body_begin + 1, body_end - body_begin - 1);
+
+  static const std::regex variable{R"(\$(\w+))"};
+
+  std::string batch_params;
+  std::string batch_body;
+
+  for (size_t i = 0; i < count; ++i) {
+    const auto suffix = "$$$1_" + std::to_string(i);
+    if (i > 0)
+      batch_params += ", ";
+    batch_params += std::regex_replace(params, variable, suffix);
+    batch_body += " entry_{}: {}"_format(
+        i, std::regex_replace(body, variable, suffix));
+  }
+
+  return "mutation ({}) {{{} }}"_format(batch_params, batch_body);
+}
+
+void UpdateLibraryEntry(const library::QueueItem& queue_item) {
+  const auto id = queue_item.anime_id;
+  const auto variables = BuildLibraryEntryVariables(queue_item);
+
   auto request = BuildRequest();
   request.set_body(BuildRequestBody(gql::kUpdateLibraryEntry, variables));
 
@@ -652,31 +873,90 @@ void UpdateLibraryEntry(const library::QueueItem& queue_item) {
                       L"AniList: Updating anime list...");
   };
 
-  const auto on_response = [id](const taiga::http::Response& response) {
+  const auto on_response = [id](const taiga::http::Response& response,
+                                Json& root) {
     if (HasError(response)) {
       auto error_description = StrToWstr(response.error().str());
       if (response.status_code() == 404) {
         error_description = L"AniList: Anime list entry does not exist.";
       }
       ui::OnLibraryUpdateFailure(id, error_description, false);
-      sync::OnError(RequestType::UpdateLibraryEntry);
+      sync::OnError(RequestType::UpdateLibraryEntry, id);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"AniList: Could not parse anime list entry.");
-      sync::OnError(RequestType::UpdateLibraryEntry);
+      sync::OnError(RequestType::UpdateLibraryEntry, id);
       return;
     }
 
     ParseMediaListObject(root["data"]["SaveMediaListEntry"]);
 
-    sync::OnResponse(RequestType::UpdateLibraryEntry);
+    sync::OnResponse(RequestType::UpdateLibraryEntry, id);
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
+}
+
+void UpdateLibraryEntries(const std::vector<library::QueueItem>& queue_items) {
+  // Larger documents are more likely to exceed the query complexity limit
+  constexpr size_t kMaxBatchSize = 20;
+
+  for (size_t begin = 0; begin < queue_items.size(); begin += kMaxBatchSize) {
+    const auto end = std::min(begin + kMaxBatchSize, queue_items.size());
+
+    std::vector<int> ids;
+    Json variables = Json::object();
+    for (size_t i = begin; i < end; ++i) {
+      const auto& queue_item = queue_items[i];
+      ids.push_back(queue_item.anime_id);
+      const auto entry_variables = BuildLibraryEntryVariables(queue_item);
+      for (const auto& it : entry_variables.items()) {
+        variables["{}_{}"_format(it.key(), i - begin)] = it.value();
+      }
+    }
+
+    const Json json{
+      {"query", BuildBatchMutation(ids.size())},
+      {"variables", variables},
+    };
+
+    auto request = BuildRequest();
+    request.set_body(hypr::Body{json.dump()});
+
+    const auto on_transfer = [](const taiga::http::Transfer& transfer) {
+      return OnTransfer(RequestType::UpdateLibraryEntry, transfer,
+                        L"AniList: Updating anime list...");
+    };
+
+    const auto on_response = [ids](const taiga::http::Response& response,
+                                   Json& root) {
+      // Each mutation succeeds or fails on its own. Failed ones are null in
+      // the response, while the errors are listed separately.
+      std::wstring error_description = L"Could not update anime list entry.";
+      if (HasError(response) && response.error()) {
+        error_description = StrToWstr(response.error().str());
+      }
+
+      const auto data = !root.is_discarded() && root.contains("data") ?
+                        root["data"] : Json{};
+
+      for (size_t i = 0; i < ids.size(); ++i) {
+        const auto id = ids[i];
+        const auto key = "entry_{}"_format(i);
+        if (data.is_object() && data.contains(key) && data[key].is_object()) {
+          ParseMediaListObject(data[key]);
+          sync::OnResponse(RequestType::UpdateLibraryEntry, id);
+        } else {
+          ui::OnLibraryUpdateFailure(id, error_description, false);
+          sync::OnError(RequestType::UpdateLibraryEntry, id);
+        }
+      }
+    };
+
+    taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
+  }
 }
 
 }  // namespace sync::anilist
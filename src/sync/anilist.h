@@ -19,6 +19,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 namespace anime {
 class Season;
@@ -37,6 +38,7 @@ void SearchTitle(const std::wstring& title);
 void AddLibraryEntry(const library::QueueItem& queue_item);
 void DeleteLibraryEntry(const int id);
 void UpdateLibraryEntry(const library::QueueItem& queue_item);
+void UpdateLibraryEntries(const std::vector<library::QueueItem>& queue_items);
 
 bool IsUserAuthenticated();
 void InvalidateUserAuthentication();
@@ -17,6 +17,7 @@
 */
 
 #include <map>
+#include <memory>
 
 #include "sync/kitsu.h"
 
@@ -34,6 +35,8 @@
 #include "media/library/queue.h"
 #include "sync/kitsu_types.h"
 #include "sync/kitsu_util.h"
+#include "sync/library_delta.h"
+#include "sync/pages.h"
 #include "sync/sync.h"
 #include "taiga/http.h"
 #include "taiga/settings.h"
@@ -113,13 +116,6 @@ public:
     authenticated_ = authenticated;
   }
 
-  time_t last_synchronized() const {
-    return last_synchronized_;
-  }
-  void set_last_synchronized(const time_t last_synchronized) {
-    last_synchronized_ = last_synchronized;
-  }
-
   std::string access_token() const {
     return access_token_;
   }
@@ -136,7 +132,6 @@ public:
 
 private:
   bool authenticated_ = false;
-  time_t last_synchronized_ = 0;
   std::string access_token_;
   std::string id_;
 };
@@ -499,7 +494,7 @@ void ParseObject(const Json& json) {
 }
 
 bool IsPartialLibraryRequest() {
-  return account.last_synchronized() &&
+  return library_delta.watermark() &&
          taiga::settings.GetSyncServiceKitsuPartialLibrary();
 }
 
@@ -542,6 +537,12 @@ bool HasError(const taiga::http::Response& response) {
   return false;
 }
 
+// Response bodies are parsed in the worker thread, and the result is then
+// passed to the response handler in the main thread.
+Json ParseResponseBody(const taiga::http::Response& response) {
+  return JsonParseString(response.body());
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void AuthenticateUser() {
@@ -568,16 +569,15 @@ void AuthenticateUser() {
                       L"Kitsu: Authenticating user...");
   };
 
-  const auto on_response = [](const taiga::http::Response& response) {
+  const auto on_response = [](const taiga::http::Response& response,
+                              Json& root) {
     if (HasError(response)) {
       account.set_authenticated(false);
       sync::OnError(RequestType::AuthenticateUser);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       account.set_authenticated(false);
       ui::ChangeStatusText(L"Kitsu: Could not parse authentication data.");
       sync::OnError(RequestType::AuthenticateUser);
@@ -592,7 +592,7 @@ void AuthenticateUser() {
     GetUser();  // We need to make an additional request to get the user ID
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
 void GetUser() {
@@ -613,15 +613,14 @@ void GetUser() {
                       L"Kitsu: Retrieving user information...");
   };
 
-  const auto on_response = [](const taiga::http::Response& response) {
+  const auto on_response = [](const taiga::http::Response& response,
+                              Json& root) {
     if (HasError(response)) {
       sync::OnError(RequestType::GetUser);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"Kitsu: Could not parse user data.");
       sync::OnError(RequestType::GetUser);
       return;
@@ -654,24 +653,10 @@ void GetUser() {
     }
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
-void GetLibraryEntries(const int page) {
-  if (account.id().empty()) {
-    ui::ChangeStatusText(
-        L"Kitsu: Cannot get anime list. User ID is unavailable.");
-    sync::OnError(RequestType::GetLibraryEntries);
-    return;
-  }
-  if (Account::username().empty()) {
-    ui::ChangeStatusText(
-        L"Kitsu: Cannot get anime list. "
-        L"Please set the profile URL for your account.");
-    sync::OnError(RequestType::GetLibraryEntries);
-    return;
-  }
-
+taiga::http::Request BuildLibraryRequest(const int page) {
   auto request = BuildRequest();
   request.set_target("{}/edge/library-entries"_format(kBaseUrl));
 
@@ -689,10 +674,10 @@ void GetLibraryEntries(const int page) {
   // 3. Get library entries via client, using `filter[since]={...}`
   // 4. Client doesn't know entry was deleted
   //
-  // Our "solution" to this is to allow Taiga to download the entire library
-  // after each restart (i.e. last_synchronized is not saved on exit).
+  // Our solution to this is to scan the ids of the entire library every once
+  // in a while (see GetLibraryIds).
   if (IsPartialLibraryRequest()) {
-    const auto date = GetDate(account.last_synchronized() -
+    const auto date = GetDate(library_delta.watermark() -
                               (60 * 60 * 24));  // 1 day before, to be safe
     params.add("filter[since]", WstrToStr(date.to_string()));
   }
@@ -708,20 +693,144 @@ void GetLibraryEntries(const int page) {
   UseSparseFieldsetsForLibraryEntries(params);
   request.set_query(params);
 
-  const auto on_transfer = [](const taiga::http::Transfer& transfer) {
-    return OnTransfer(RequestType::GetLibraryEntries, transfer,
-                      L"Kitsu: Retrieving anime list...");
+  return request;
+}
+
+bool OnLibraryTransfer(const taiga::http::Transfer& transfer) {
+  return OnTransfer(RequestType::GetLibraryEntries, transfer,
+                    L"Kitsu: Retrieving anime list...");
+}
+
+void ParseLibraryPage(Json& root) {
+  for (const auto& value : root["data"]) {
+    library_delta.Add(ParseLibraryObject(value));
+  }
+  for (const auto& value : root["included"]) {
+    ParseObject(value);
+  }
+}
+
+void GetLibraryIds(const int page) {
+  auto request = BuildRequest();
+  request.set_target("{}/edge/library-entries"_format(kBaseUrl));
+
+  // Anime objects are only included so that we get the relationship data;
+  // their attributes are left out.
+  request.set_query({
+      {"filter[user_id]", account.id()},
+      {"filter[kind]", "anime"},
+      {"include", "anime"},
+      {"fields[anime]", "id"},
+      {"fields[libraryEntries]", "anime"},
+      {"page[offset]", ToStr(page)},
+      {"page[limit]", ToStr(kLibraryMaximumPageSize)}});
+
+  const auto on_response = [](const taiga::http::Response& response,
+                              Json& root) {
+    // The scan is not essential; changed entries have already been applied
+    if (HasError(response) || root.is_discarded()) {
+      LOGW(L"Could not scan library entries.");
+      sync::OnResponse(RequestType::GetLibraryEntries);
+      return;
+    }
+
+    if (!GetOffset(root, "prev")) {  // first page
+      library_delta.BeginScan();
+    }
+
+    for (const auto& value : root["data"]) {
+      const auto& media = value["relationships"]["anime"];
+      library_delta.AddScannedId(ToInt(JsonReadStr(media["data"], "id")));
+    }
+
+    if (const auto next_page = GetOffset(root, "next");
+        next_page && *next_page > 0) {
+      GetLibraryIds(*next_page);
+    } else {
+      library_delta.FinishScan();
+      sync::OnResponse(RequestType::GetLibraryEntries);
+    }
   };
 
-  const auto on_response = [](const taiga::http::Response& response) {
+  taiga::http::Send(request, OnLibraryTransfer, ParseResponseBody,
+                    on_response);
+}
+
+void OnLibraryEntries() {
+  if (IsPartialLibraryRequest() && library_delta.IsScanDue()) {
+    GetLibraryIds(0);
+  } else {
+    sync::OnResponse(RequestType::GetLibraryEntries);
+  }
+}
+
+void GetRemainingLibraryEntries(const int count) {
+  // The first page has already been handled by the time we get here, so the
+  // remaining pages can be requested all at once. HTTP connections are limited
+  // per host, and the pages are merged in order as they arrive.
+  const auto page_count = GetPageCount(count, kLibraryMaximumPageSize);
+  const auto pages = std::make_shared<PageQueue>(page_count - 1,
+                                                 ParseLibraryPage);
+
+  for (size_t page = 1; page < page_count; ++page) {
+    const auto request = BuildLibraryRequest(
+        static_cast<int>(page) * kLibraryMaximumPageSize);
+
+    const auto on_response = [pages, index = page - 1](
+        const taiga::http::Response& response, Json& root) {
+      if (pages->failed()) {
+        return;
+      }
+
+      if (HasError(response)) {
+        if (pages->Fail())
+          sync::OnError(RequestType::GetLibraryEntries);
+        return;
+      }
+
+      if (root.is_discarded()) {
+        if (pages->Fail()) {
+          ui::ChangeStatusText(L"Kitsu: Could not parse anime list.");
+          sync::OnError(RequestType::GetLibraryEntries);
+        }
+        return;
+      }
+
+      if (pages->Push(index, root)) {
+        OnLibraryEntries();
+      }
+    };
+
+    taiga::http::Send(request, OnLibraryTransfer, ParseResponseBody,
+                      on_response);
+  }
+}
+
+void GetLibraryEntries(const int page) {
+  if (account.id().empty()) {
+    ui::ChangeStatusText(
+        L"Kitsu: Cannot get anime list. User ID is unavailable.");
+    sync::OnError(RequestType::GetLibraryEntries);
+    return;
+  }
+  if (Account::username().empty()) {
+    ui::ChangeStatusText(
+        L"Kitsu: Cannot get anime list. "
+        L"Please set the profile URL for your account.");
+    sync::OnError(RequestType::GetLibraryEntries);
+    return;
+  }
+
+  const auto request = BuildLibraryRequest(page);
+
+  const auto on_response = [](const taiga::http::Response& response,
+                              Json& root) {
     if (HasError(response)) {
       sync::OnError(RequestType::GetLibraryEntries);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"Kitsu: Could not parse anime list.");
       sync::OnError(RequestType::GetLibraryEntries);
       return;
@@ -729,27 +838,29 @@ void GetLibraryEntries(const int page) {
 
     const auto prev_page = GetOffset(root, "prev");
     const auto next_page = GetOffset(root, "next");
+    const auto count = JsonReadInt(root["meta"], "count");
 
-    if (!IsPartialLibraryRequest() && !prev_page) {
-      anime::db.ClearUserData();
+    if (!prev_page) {  // first page
+      library_delta.Begin(IsPartialLibraryRequest() ?
+                          LibraryDelta::Mode::Partial :
+                          LibraryDelta::Mode::Full);
     }
 
-    for (const auto& value : root["data"]) {
-      ParseLibraryObject(value);
-    }
-    for (const auto& value : root["included"]) {
-      ParseObject(value);
-    }
+    ParseLibraryPage(root);
 
     if (next_page && *next_page > 0) {
-      GetLibraryEntries(*next_page);
+      if (!prev_page && count > kLibraryMaximumPageSize) {
+        GetRemainingLibraryEntries(count);
+      } else {
+        GetLibraryEntries(*next_page);  // total count is unavailable
+      }
     } else {
-      account.set_last_synchronized(time(nullptr));  // current time
-      sync::OnResponse(RequestType::GetLibraryEntries);
+      OnLibraryEntries();
     }
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, OnLibraryTransfer, ParseResponseBody,
+                    on_response);
 }
 
 void GetMetadataById(const int id) {
@@ -769,7 +880,8 @@ void GetMetadataById(const int id) {
                       L"Kitsu: Retrieving anime information...");
   };
 
-  const auto on_response = [id](const taiga::http::Response& response) {
+  const auto on_response = [id](const taiga::http::Response& response,
+                                Json& root) {
     if (HasError(response)) {
       if (response.status_code() == 404) {
         sync::OnInvalidAnimeId(id);
@@ -780,9 +892,7 @@ void GetMetadataById(const int id) {
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root))  {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"Kitsu: Could not parse anime data.");
       ui::OnLibraryEntryChangeFailure(id);
       sync::OnError(RequestType::GetMetadataById);
@@ -797,10 +907,11 @@ void GetMetadataById(const int id) {
     sync::OnResponse(RequestType::GetMetadataById);
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
-void GetSeason(const anime::Season season, const int page) {
+taiga::http::Request BuildSeasonRequest(const anime::Season season,
+                                        const int page) {
   const auto season_year = static_cast<int>(season.year);
   const auto season_name =
       WstrToStr(ToLower_Copy(ui::TranslateSeasonName(season.name)));
@@ -821,21 +932,78 @@ void GetSeason(const anime::Season season, const int page) {
   UseSparseFieldsetsForAnime(params, false);
   request.set_query(params);
 
+  return request;
+}
+
+void ParseSeasonPage(Json& root) {
+  for (const auto& value : root["data"]) {
+    const auto anime_id = ParseAnimeObject(value);
+    anime::season_db.items.push_back(anime_id);
+    ui::OnLibraryEntryChange(anime_id);
+  }
+}
+
+void GetRemainingSeasonPages(const anime::Season season, const int count) {
+  const auto page_count = GetPageCount(count, kJsonApiMaximumPageSize);
+  const auto pages = std::make_shared<PageQueue>(page_count - 1,
+                                                 ParseSeasonPage);
+
   const auto on_transfer = [season](const taiga::http::Transfer& transfer) {
     return OnTransfer(RequestType::GetSeason, transfer,
         L"Kitsu: Retrieving {} anime season..."_format(
             ui::TranslateSeason(season)));
   };
 
-  const auto on_response = [season](const taiga::http::Response& response) {
+  for (size_t page = 1; page < page_count; ++page) {
+    const auto request = BuildSeasonRequest(
+        season, static_cast<int>(page) * kJsonApiMaximumPageSize);
+
+    const auto on_response = [pages, index = page - 1](
+        const taiga::http::Response& response, Json& root) {
+      if (pages->failed()) {
+        return;
+      }
+
+      if (HasError(response)) {
+        if (pages->Fail())
+          sync::OnError(RequestType::GetSeason);
+        return;
+      }
+
+      if (root.is_discarded()) {
+        if (pages->Fail()) {
+          ui::ChangeStatusText(L"Kitsu: Could not parse season data.");
+          sync::OnError(RequestType::GetSeason);
+        }
+        return;
+      }
+
+      if (pages->Push(index, root)) {
+        sync::OnResponse(RequestType::GetSeason);
+      }
+    };
+
+    taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
+  }
+}
+
+void GetSeason(const anime::Season season, const int page) {
+  const auto request = BuildSeasonRequest(season, page);
+
+  const auto on_transfer = [season](const taiga::http::Transfer& transfer) {
+    return OnTransfer(RequestType::GetSeason, transfer,
+        L"Kitsu: Retrieving {} anime season..."_format(
+            ui::TranslateSeason(season)));
+  };
+
+  const auto on_response = [season](const taiga::http::Response& response,
+                                    Json& root) {
     if (HasError(response)) {
       sync::OnError(RequestType::GetSeason);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"Kitsu: Could not parse season data.");
       sync::OnError(RequestType::GetSeason);
       return;
@@ -843,25 +1011,26 @@ void GetSeason(const anime::Season season, const int page) {
 
     const auto prev_page = GetOffset(root, "prev");
     const auto next_page = GetOffset(root, "next");
+    const auto count = JsonReadInt(root["meta"], "count");
 
     if (!prev_page) {  // first page
       anime::season_db.items.clear();
     }
 
-    for (const auto& value : root["data"]) {
-      const auto anime_id = ParseAnimeObject(value);
-      anime::season_db.items.push_back(anime_id);
-      ui::OnLibraryEntryChange(anime_id);
-    }
+    ParseSeasonPage(root);
 
     if (next_page && *next_page > 0) {
-      GetSeason(season, *next_page);
+      if (!prev_page && count > kJsonApiMaximumPageSize) {
+        GetRemainingSeasonPages(season, count);
+      } else {
+        GetSeason(season, *next_page);  // total count is unavailable
+      }
     } else {
       sync::OnResponse(RequestType::GetSeason);
     }
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
 void SearchTitle(const std::wstring& title) {
@@ -881,15 +1050,14 @@ void SearchTitle(const std::wstring& title) {
         L"Kitsu: Searching for \"{}\"..."_format(title));
   };
 
-  const auto on_response = [](const taiga::http::Response& response) {
+  const auto on_response = [](const taiga::http::Response& response,
+                              Json& root) {
     if (HasError(response)) {
       sync::OnError(RequestType::SearchTitle);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"Kitsu: Could not parse search results.");
       sync::OnError(RequestType::SearchTitle);
       return;
@@ -905,7 +1073,7 @@ void SearchTitle(const std::wstring& title) {
     sync::OnResponse(RequestType::SearchTitle);
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
 void AddLibraryEntry(const library::QueueItem& queue_item) {
@@ -933,26 +1101,25 @@ void AddLibraryEntry(const library::QueueItem& queue_item) {
                       L"Kitsu: Updating anime list...");
   };
 
-  const auto on_response = [id](const taiga::http::Response& response) {
+  const auto on_response = [id](const taiga::http::Response& response,
+                                Json& root) {
     if (HasError(response)) {
       if (response.status_code() == 422) {
         // If we try to add a library entry that is already there, Kitsu returns
         // a "422 Unprocessable Entity" response with "animeId - has already
         // been taken" error message. Here we ignore this error and assume that
         // our request succeeded.
-        sync::OnResponse(RequestType::AddLibraryEntry);
+        sync::OnResponse(RequestType::AddLibraryEntry, id);
       } else {
         ui::OnLibraryUpdateFailure(id, StrToWstr(response.error().str()), false);
-        sync::OnError(RequestType::AddLibraryEntry);
+        sync::OnError(RequestType::AddLibraryEntry, id);
       }
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"Kitsu: Could not parse anime list entry.");
-      sync::OnError(RequestType::AddLibraryEntry);
+      sync::OnError(RequestType::AddLibraryEntry, id);
       return;
     }
 
@@ -963,10 +1130,10 @@ void AddLibraryEntry(const library::QueueItem& queue_item) {
     ParseCategories(root["included"], anime_id);
     ParseProducers(root["included"], anime_id);
 
-    sync::OnResponse(RequestType::AddLibraryEntry);
+    sync::OnResponse(RequestType::AddLibraryEntry, id);
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
 void DeleteLibraryEntry(const int id) {
@@ -990,14 +1157,14 @@ void DeleteLibraryEntry(const int id) {
       } else {
         ui::OnLibraryUpdateFailure(id, StrToWstr(response.error().str()),
                                    false);
-        sync::OnError(RequestType::DeleteLibraryEntry);
+        sync::OnError(RequestType::DeleteLibraryEntry, id);
         return;
       }
     }
 
     // Returns "204 No Content" status and empty response body.
 
-    sync::OnResponse(RequestType::DeleteLibraryEntry);
+    sync::OnResponse(RequestType::DeleteLibraryEntry, id);
   };
 
   taiga::http::Send(request, on_transfer, on_response);
@@ -1030,22 +1197,21 @@ void UpdateLibraryEntry(const library::QueueItem& queue_item) {
                       L"Kitsu: Updating anime list...");
   };
 
-  const auto on_response = [id](const taiga::http::Response& response) {
+  const auto on_response = [id](const taiga::http::Response& response,
+                                Json& root) {
     if (HasError(response)) {
       auto error_description = StrToWstr(response.error().str());
       if (response.status_code() == 404) {
         error_description = L"Kitsu: Anime list entry does not exist.";
       }
       ui::OnLibraryUpdateFailure(id, error_description, false);
-      sync::OnError(RequestType::UpdateLibraryEntry);
+      sync::OnError(RequestType::UpdateLibraryEntry, id);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (root.is_discarded()) {
       ui::ChangeStatusText(L"Kitsu: Could not parse anime list entry.");
-      sync::OnError(RequestType::UpdateLibraryEntry);
+      sync::OnError(RequestType::UpdateLibraryEntry, id);
       return;
     }
 
@@ -1056,10 +1222,10 @@ void UpdateLibraryEntry(const library::QueueItem& queue_item) {
     ParseCategories(root["included"], anime_id);
     ParseProducers(root["included"], anime_id);
 
-    sync::OnResponse(RequestType::UpdateLibraryEntry);
+    sync::OnResponse(RequestType::UpdateLibraryEntry, id);
   };
 
-  taiga::http::Send(request, on_transfer, on_response);
+  taiga::http::Send(request, on_transfer, ParseResponseBody, on_response);
 }
 
 }  // namespace sync::kitsu
@@ -0,0 +1,166 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <functional>
+
+#include "sync/library_delta.h"
+
+#include "base/format.h"
+#include "base/log.h"
+#include "media/anime_db.h"
+#include "media/anime_item.h"
+#include "media/anime_util.h"
+
+namespace sync {
+
+// Partial downloads can't detect deleted entries, so we scan the ids of the
+// entire list at this interval.
+constexpr time_t kScanInterval = 60 * 60 * 24;  // 1 day
+
+void LibraryDelta::Begin(const Mode mode) {
+  active_ = true;
+  scanned_ = false;
+  mode_ = mode;
+
+  snapshot_.clear();
+  seen_.clear();
+  scanned_ids_.clear();
+
+  for (const auto& [id, item] : anime::db.items) {
+    if (item.IsInList()) {
+      snapshot_[id] = {GetUserDataHash(item), item.GetMyStatus(false)};
+    }
+  }
+}
+
+void LibraryDelta::Add(const int anime_id) {
+  if (active_ && anime::IsValidId(anime_id)) {
+    seen_.insert(anime_id);
+  }
+}
+
+LibraryDelta::Changes LibraryDelta::Finish() {
+  Changes changes;
+
+  if (!active_)
+    return changes;
+
+  changes.list_changed = false;
+
+  const auto is_removed = [this](const int id) {
+    if (seen_.count(id))
+      return false;
+    if (mode_ == Mode::Full)
+      return true;
+    return scanned_ && !scanned_ids_.count(id);
+  };
+
+  for (const auto& [id, entry] : snapshot_) {
+    if (is_removed(id)) {
+      if (auto anime_item = anime::db.Find(id, false)) {
+        anime_item->RemoveFromUserList();
+        changes.ids.push_back(id);
+        changes.list_changed = true;
+      }
+    }
+  }
+
+  for (const auto id : seen_) {
+    const auto anime_item = anime::db.Find(id, false);
+    if (!anime_item)
+      continue;
+    const auto it = snapshot_.find(id);
+    if (it == snapshot_.end()) {
+      changes.ids.push_back(id);
+      changes.list_changed = true;
+    } else if (it->second.hash != GetUserDataHash(*anime_item)) {
+      changes.ids.push_back(id);
+      if (it->second.status != anime_item->GetMyStatus(false))
+        changes.list_changed = true;
+    }
+  }
+
+  const auto now = time(nullptr);
+  anime::db.last_synchronized = now;
+  if (mode_ == Mode::Full || scanned_)
+    anime::db.last_scanned = now;
+
+  LOGD(L"Mode: {}, entries: {}, changed: {}",
+       mode_ == Mode::Full ? L"full" : L"partial", seen_.size(),
+       changes.ids.size());
+
+  active_ = false;
+  snapshot_.clear();
+  seen_.clear();
+  scanned_ids_.clear();
+
+  return changes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void LibraryDelta::BeginScan() {
+  scanned_ = false;
+  scanned_ids_.clear();
+}
+
+void LibraryDelta::AddScannedId(const int anime_id) {
+  if (anime::IsValidId(anime_id)) {
+    scanned_ids_.insert(anime_id);
+  }
+}
+
+void LibraryDelta::FinishScan() {
+  scanned_ = true;
+}
+
+bool LibraryDelta::IsScanDue() const {
+  return time(nullptr) - anime::db.last_scanned >= kScanInterval;
+}
+
+time_t LibraryDelta::watermark() const {
+  return anime::db.last_synchronized;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+size_t GetUserDataHash(const anime::Item& item) {
+  // Besides library data, this includes what our list view shows about the
+  // series, so that metadata changes are rendered as well.
+  const auto data = L"{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}"_format(
+      item.GetMyId(),
+      item.GetMyLastWatchedEpisode(false),
+      item.GetMyScore(false),
+      static_cast<int>(item.GetMyStatus(false)),
+      item.GetMyRewatchedTimes(false),
+      item.GetMyRewatching(false),
+      item.GetMyRewatchingEp(),
+      item.GetMyDateStart(false).to_string(),
+      item.GetMyDateEnd(false).to_string(),
+      item.GetMyLastUpdated(),
+      item.GetMyTags(false),
+      item.GetMyNotes(false),
+      item.GetTitle(),
+      item.GetEpisodeCount(),
+      static_cast<int>(item.GetAiringStatus(false)));
+
+  return std::hash<std::wstring>{}(data);
+}
+
+}  // namespace sync
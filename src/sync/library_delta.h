@@ -0,0 +1,85 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <ctime>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "media/anime.h"
+
+namespace anime {
+class Item;
+}
+
+namespace sync {
+
+// Keeps track of the changes that a library download makes to the user's list,
+// so that entries can be updated in place instead of clearing the list and
+// rebuilding it from scratch.
+//
+// The time of the last download (watermark) and the last id scan are stored
+// along with the list. Services that can filter entries by modification date
+// use the watermark to download changed entries only. Such partial downloads
+// cannot tell us about deleted entries, so they are followed by an id-only scan
+// every once in a while.
+class LibraryDelta {
+public:
+  enum class Mode {
+    Full,     // Response contains every entry; others are deleted
+    Partial,  // Response contains entries changed since the watermark
+  };
+
+  struct Changes {
+    std::vector<int> ids;
+    bool list_changed = true;  // entries were added, removed or moved
+  };
+
+  void Begin(const Mode mode);
+  void Add(const int anime_id);
+  Changes Finish();
+
+  void BeginScan();
+  void AddScannedId(const int anime_id);
+  void FinishScan();
+
+  bool IsScanDue() const;
+  time_t watermark() const;
+
+private:
+  struct Entry {
+    size_t hash = 0;
+    anime::MyStatus status = anime::MyStatus::NotInList;
+  };
+
+  bool active_ = false;
+  bool scanned_ = false;
+  Mode mode_ = Mode::Full;
+  std::map<int, Entry> snapshot_;
+  std::set<int> seen_;
+  std::set<int> scanned_ids_;
+};
+
+inline LibraryDelta library_delta;
+
+size_t GetUserDataHash(const anime::Item& item);
+
+}  // namespace sync
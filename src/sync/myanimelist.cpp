@@ -18,6 +18,7 @@
 
 #include <functional>
 #include <optional>
+#include <vector>
 
 #include "sync/myanimelist.h"
 
@@ -32,9 +33,12 @@
 #include "media/anime_season_db.h"
 #include "media/anime_util.h"
 #include "media/library/queue.h"
+#include "sync/library_delta.h"
+#include "sync/myanimelist_json.h"
 #include "sync/myanimelist_util.h"
 #include "sync/sync.h"
 #include "taiga/http.h"
+#include "taiga/http_metrics.h"
 #include "taiga/settings.h"
 #include "track/recognition.h"
 #include "ui/resource.h"
@@ -244,91 +248,66 @@ std::wstring GetListStatusFields() {
 }
 
 std::optional<int> GetOffset(const Json& json, const std::string& name) {
-  if (const auto link = JsonReadStr(json["paging"], name); !link.empty()) {
-    const Url url = StrToWstr(link);
-    const auto query = url.query();
-    if (const auto it = query.find(L"offset"); it != query.end()) {
-      return ToInt(it->second);
-    }
-  }
-  return std::nullopt;
+  return ReadPagingOffset(JsonReadStr(json["paging"], name));
 }
 
-int ParseAnimeObject(const Json& json) {
-  const auto anime_id = JsonReadInt(json, "id");
-
-  if (!anime_id) {
-    LOGW(L"Could not parse anime object:\n{}", StrToWstr(json.dump()));
+int ParseAnimeObject(const AnimeRecord& record) {
+  if (!record.id) {
+    LOGW(L"Could not parse anime object.");
     return anime::ID_UNKNOWN;
   }
 
-  auto& anime_item = anime::db.items[anime_id];
+  auto& anime_item = anime::db.items[record.id];
 
   anime_item.SetSource(ServiceId::MyAnimeList);
-  anime_item.SetId(ToWstr(anime_id), ServiceId::MyAnimeList);
+  anime_item.SetId(ToWstr(record.id), ServiceId::MyAnimeList);
   anime_item.SetLastModified(time(nullptr));  // current time
 
-  anime_item.SetTitle(StrToWstr(JsonReadStr(json, "title")));
-  anime_item.SetDateStart(
-      TranslateDateFrom(StrToWstr(JsonReadStr(json, "start_date"))));
-  anime_item.SetDateEnd(
-      TranslateDateFrom(StrToWstr(JsonReadStr(json, "end_date"))));
-  anime_item.SetSynopsis(
-      anime::NormalizeSynopsis(StrToWstr(JsonReadStr(json, "synopsis"))));
-  anime_item.SetScore(JsonReadDouble(json, "mean"));
-  anime_item.SetPopularity(JsonReadInt(json, "popularity"));
-  anime_item.SetType(
-      TranslateSeriesTypeFrom(StrToWstr(JsonReadStr(json, "media_type"))));
-  anime_item.SetAiringStatus(
-      TranslateSeriesStatusFrom(StrToWstr(JsonReadStr(json, "status"))));
-  anime_item.SetEpisodeCount(JsonReadInt(json, "num_episodes"));
-  anime_item.SetEpisodeLength(TranslateEpisodeLengthFrom(
-      JsonReadInt(json, "average_episode_duration")));
-  anime_item.SetAgeRating(
-      TranslateAgeRatingFrom(StrToWstr(JsonReadStr(json, "rating"))));
-
-  if (json.contains("main_picture")) {
-    anime_item.SetImageUrl(
-        StrToWstr(JsonReadStr(json["main_picture"], "medium")));
+  anime_item.SetTitle(record.title);
+  anime_item.SetDateStart(TranslateDateFrom(record.start_date));
+  anime_item.SetDateEnd(TranslateDateFrom(record.end_date));
+  anime_item.SetSynopsis(anime::NormalizeSynopsis(record.synopsis));
+  anime_item.SetScore(record.mean);
+  anime_item.SetPopularity(record.popularity);
+  anime_item.SetType(TranslateSeriesTypeFrom(record.media_type));
+  anime_item.SetAiringStatus(TranslateSeriesStatusFrom(record.status));
+  anime_item.SetEpisodeCount(record.num_episodes);
+  anime_item.SetEpisodeLength(
+      TranslateEpisodeLengthFrom(record.average_episode_duration));
+  anime_item.SetAgeRating(TranslateAgeRatingFrom(record.rating));
+
+  if (record.main_picture) {
+    anime_item.SetImageUrl(*record.main_picture);
   }
 
-  if (json.contains("alternative_titles")) {
-    const auto& alternative_titles = json["alternative_titles"];
-    if (alternative_titles.contains("synonyms")) {
-      std::vector<std::wstring> synonyms;
-      for (const auto& synonym : alternative_titles["synonyms"]) {
-        if (synonym.is_string())
-          synonyms.push_back(StrToWstr(synonym));
-      }
-      anime_item.SetSynonyms(synonyms);
+  if (record.has_alternative_titles) {
+    if (record.synonyms) {
+      anime_item.SetSynonyms(*record.synonyms);
     }
-    anime_item.SetEnglishTitle(
-        StrToWstr(JsonReadStr(alternative_titles, "en")));
-    anime_item.SetJapaneseTitle(
-        StrToWstr(JsonReadStr(alternative_titles, "ja")));
+    anime_item.SetEnglishTitle(record.english_title);
+    anime_item.SetJapaneseTitle(record.japanese_title);
   }
 
-  const auto get_names = [](const Json& json, const std::string& key) {
-    std::vector<std::wstring> names;
-    if (json.contains(key) && json[key].is_array()) {
-      for (const auto& genre : json[key]) {
-        const auto name = JsonReadStr(genre, "name");
-        if (!name.empty()) {
-          names.push_back(StrToWstr(name));
-        }
-      }
-    }
-    return names;
-  };
-  anime_item.SetGenres(get_names(json, "genres"));
-  anime_item.SetProducers(get_names(json, "studios"));
+  anime_item.SetGenres(record.genres);
+  anime_item.SetProducers(record.studios);
 
   Meow.UpdateTitles(anime_item);
 
-  return anime_id;
+  return record.id;
 }
 
-void ParseLibraryObject(const Json& json, const int anime_id) {
+int ParseAnimeObject(const Json& json) {
+  const auto record = ReadAnimeRecord(json);
+
+  if (!record.id) {
+    LOGW(L"Could not parse anime object:\n{}", StrToWstr(json.dump()));
+    return anime::ID_UNKNOWN;
+  }
+
+  return ParseAnimeObject(record);
+}
+
+void ParseLibraryObject(const ListStatusRecord& record, const int anime_id) {
   if (!anime_id) {
     LOGW(L"Could not parse anime list entry #{}", anime_id);
     return;
@@ -337,29 +316,20 @@ void ParseLibraryObject(const Json& json, const int anime_id) {
   auto& anime_item = anime::db.items[anime_id];
 
   anime_item.AddtoUserList();
-  anime_item.SetMyStatus(
-      TranslateMyStatusFrom(StrToWstr(JsonReadStr(json, "status"))));
-  anime_item.SetMyScore(TranslateMyRatingFrom(JsonReadInt(json, "score")));
-  anime_item.SetMyLastWatchedEpisode(JsonReadInt(json, "num_episodes_watched"));
-  anime_item.SetMyRewatching(JsonReadBool(json, "is_rewatching"));
-  anime_item.SetMyDateStart(
-      TranslateDateFrom(StrToWstr(JsonReadStr(json, "start_date"))));
-  anime_item.SetMyDateEnd(
-      TranslateDateFrom(StrToWstr(JsonReadStr(json, "finish_date"))));
-  anime_item.SetMyRewatchedTimes(JsonReadInt(json, "num_times_rewatched"));
-  anime_item.SetMyNotes(StrToWstr(JsonReadStr(json, "comments")));
-  anime_item.SetMyLastUpdated(
-      TranslateMyLastUpdatedFrom(JsonReadStr(json, "updated_at")));
-
-  std::vector<std::wstring> tags;
-  if (json.contains("tags") && json["tags"].is_array()) {
-    for (const auto& tag : json["tags"]) {
-      if (tag.is_string()) {
-        tags.push_back(StrToWstr(tag.get<std::string>()));
-      }
-    }
-  }
-  anime_item.SetMyTags(Join(tags, L", "));
+  anime_item.SetMyStatus(TranslateMyStatusFrom(record.status));
+  anime_item.SetMyScore(TranslateMyRatingFrom(record.score));
+  anime_item.SetMyLastWatchedEpisode(record.num_episodes_watched);
+  anime_item.SetMyRewatching(record.is_rewatching);
+  anime_item.SetMyDateStart(TranslateDateFrom(record.start_date));
+  anime_item.SetMyDateEnd(TranslateDateFrom(record.finish_date));
+  anime_item.SetMyRewatchedTimes(record.num_times_rewatched);
+  anime_item.SetMyNotes(record.comments);
+  anime_item.SetMyLastUpdated(TranslateMyLastUpdatedFrom(record.updated_at));
+  anime_item.SetMyTags(Join(record.tags, L", "));
+}
+
+void ParseLibraryObject(const Json& json, const int anime_id) {
+  ParseLibraryObject(ReadListStatusRecord(json), anime_id);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -408,10 +378,39 @@ void RequestAccessToken(const std::wstring& authorization_code,
   taiga::http::Send(request, on_transfer, on_response);
 }
 
-void RefreshAccessToken(std::function<void()> after_response) {
+// Each refresh replaces the refresh token, so only one refresh can be in
+// flight. Requests that find their access token expired in the meantime wait
+// for it, and are then either retried or failed together.
+struct PendingRefresh {
+  std::function<void()> on_success;
+  std::function<void()> on_failure;
+};
+
+static std::vector<PendingRefresh> pending_refreshes;
+
+static void CompleteRefresh(const bool success) {
+  const auto refreshes = std::move(pending_refreshes);
+  pending_refreshes.clear();
+
+  for (const auto& refresh : refreshes) {
+    const auto& callback = success ? refresh.on_success : refresh.on_failure;
+    if (callback) {
+      callback();
+    }
+  }
+}
+
+void RefreshAccessToken(std::function<void()> after_response,
+                        std::function<void()> after_failure) {
+  pending_refreshes.push_back({after_response, after_failure});
+  if (pending_refreshes.size() > 1) {
+    return;  // Already in flight
+  }
+
   const auto refresh_token = Account::refresh_token();
   if (refresh_token.empty()) {
     ui::ChangeStatusText(L"MyAnimeList: Refresh token is unavailable.");
+    CompleteRefresh(false);
     return;
   }
 
@@ -429,7 +428,7 @@ void RefreshAccessToken(std::function<void()> after_response) {
                       L"MyAnimeList: Refreshing access token...");
   };
 
-  const auto on_response = [after_response](const taiga::http::Response& response) {
+  const auto on_response = [](const taiga::http::Response& response) {
     if (const auto error = HasError(response)) {
       HandleError(*error);
       account.set_authenticated(false);
@@ -439,6 +438,7 @@ void RefreshAccessToken(std::function<void()> after_response) {
             L"Please re-authorize your account via Settings.");
       }
       sync::OnError(RequestType::RefreshAccessToken);
+      CompleteRefresh(false);
       return;
     }
 
@@ -449,6 +449,7 @@ void RefreshAccessToken(std::function<void()> after_response) {
       ui::ChangeStatusText(
           L"MyAnimeList: Could not parse authentication data.");
       sync::OnError(RequestType::RefreshAccessToken);
+      CompleteRefresh(false);
       return;
     }
 
@@ -458,18 +459,20 @@ void RefreshAccessToken(std::function<void()> after_response) {
 
     sync::OnResponse(RequestType::RefreshAccessToken);
 
-    if (after_response) {
-      after_response();
-    }
+    CompleteRefresh(true);
   };
 
   taiga::http::Send(request, on_transfer, on_response);
 }
 
 void RefreshAccessToken() {
-  RefreshAccessToken([]() { GetUser(); });
+  RefreshAccessToken([]() { GetUser(); }, nullptr);
 }
 
+// Requests are retried once the access token is refreshed. If that fails,
+// their own callbacks get the original response, so that they can report the
+// error (e.g. to let the library queue move on).
+
 void SendRequest(taiga::http::Request request,
                  taiga::http::TransferCallback on_transfer,
                  taiga::http::ResponseCallback on_response) {
@@ -480,10 +483,17 @@ void SendRequest(taiga::http::Request request,
       if (error->type == Error::Type::AccessTokenExpired) {
         account.set_authenticated(false);
         // Refresh the access token and retry the original request
-        RefreshAccessToken([=]() mutable {
-          SetAuthorizationHeader(request);
-          taiga::http::Send(request, on_transfer, on_response);
-        });
+        RefreshAccessToken(
+            [=]() mutable {
+              SetAuthorizationHeader(request);
+              taiga::http::metrics.AddRetry(request);
+              taiga::http::Send(request, on_transfer, on_response);
+            },
+            [=]() {
+              if (on_response) {
+                on_response(response);
+              }
+            });
         return;
       }
     }
@@ -496,6 +506,39 @@ void SendRequest(taiga::http::Request request,
   taiga::http::Send(request, on_transfer, handle_response);
 }
 
+// Same as above, but calls on_parse in a worker thread first.
+template <typename ParseCallback, typename Callback>
+void SendRequest(taiga::http::Request request,
+                 taiga::http::TransferCallback on_transfer,
+                 ParseCallback on_parse,
+                 Callback on_response) {
+  const auto handle_response = [=](const taiga::http::Response& response,
+                                   auto& result) {
+    if (const auto error = HasError(response)) {
+      HandleError(*error);
+
+      if (error->type == Error::Type::AccessTokenExpired) {
+        account.set_authenticated(false);
+        // Refresh the access token and retry the original request
+        RefreshAccessToken(
+            [=]() mutable {
+              SetAuthorizationHeader(request);
+              taiga::http::metrics.AddRetry(request);
+              taiga::http::Send(request, on_transfer, on_parse, on_response);
+            },
+            [=, result = std::move(result)]() mutable {
+              on_response(response, result);
+            });
+        return;
+      }
+    }
+
+    on_response(response, result);
+  };
+
+  taiga::http::Send(request, on_transfer, on_parse, handle_response);
+}
+
 void GetUser() {
   const auto username = account.authenticated() ? "@me" : Account::username();
 
@@ -528,6 +571,7 @@ void GetUser() {
     if (account.authenticated()) {
       sync::Synchronize();
     } else {
+      const taiga::http::MetricsScope metrics_scope{"GetLibraryEntries"};
       GetLibraryEntries();
     }
   };
@@ -535,6 +579,71 @@ void GetUser() {
   SendRequest(request, on_transfer, on_response);
 }
 
+bool IsPartialLibraryRequest() {
+  return library_delta.watermark() != 0;
+}
+
+bool HasUnchangedEntries(const LibraryPage& page) {
+  // Entries are sorted by modification date. Once we reach the ones that were
+  // there before the last download, the rest of the list is unchanged.
+  if (page.entries.empty())
+    return true;
+
+  const auto updated_at = ToTime(TranslateMyLastUpdatedFrom(
+      page.entries.back().list_status.updated_at));
+
+  // 1 day before the last download, to be safe
+  const auto watermark = library_delta.watermark() - (60 * 60 * 24);
+
+  return updated_at > 0 && updated_at < watermark;
+}
+
+void GetLibraryIds(const int page_offset) {
+  // Without the `fields` parameter, only the basic fields of anime objects are
+  // returned, and list status is left out.
+  auto request = BuildRequest();
+  request.set_target(
+      "{}/users/{}/animelist"_format(kBaseUrl, Account::username()));
+  request.set_query({
+      {"limit", ToStr(kLibraryPageLimit)},
+      {"offset", ToStr(page_offset)},
+      {"nsfw", "true"}});
+
+  const auto on_transfer = [](const taiga::http::Transfer& transfer) {
+    return OnTransfer(RequestType::GetLibraryEntries, transfer,
+                      L"MyAnimeList: Retrieving anime list...");
+  };
+
+  const auto on_response = [](const taiga::http::Response& response) {
+    Json root;
+
+    // The scan is not essential; changed entries have already been applied
+    if (HasError(response) || !JsonParseString(response.body(), root)) {
+      LOGW(L"Could not scan library entries.");
+      sync::OnResponse(RequestType::GetLibraryEntries);
+      return;
+    }
+
+    if (!GetOffset(root, "previous")) {  // first page
+      library_delta.BeginScan();
+    }
+
+    for (const auto& value : root["data"]) {
+      library_delta.AddScannedId(JsonReadInt(value["node"], "id"));
+    }
+
+    if (const auto next_page_offset = GetOffset(root, "next");
+        next_page_offset && *next_page_offset > 0) {
+      GetLibraryIds(*next_page_offset);
+    } else {
+      library_delta.FinishScan();
+      sync::OnResponse(RequestType::GetLibraryEntries);
+    }
+  };
+
+  SendRequest(request, on_transfer, on_response);
+}
+
 void GetLibraryEntries(const int page_offset) {
   auto request = BuildRequest();
   request.set_target(
@@ -543,6 +652,7 @@ void GetLibraryEntries(const int page_offset) {
       {"limit", ToStr(kLibraryPageLimit)},
       {"offset", ToStr(page_offset)},
       {"nsfw", "true"},
+      {"sort", "list_updated_at"},
       {"fields", "{},list_status{{{}}}"_format(
           WstrToStr(GetAnimeFields()), WstrToStr(GetListStatusFields()))}});
 
@@ -551,42 +661,63 @@ void GetLibraryEntries(const int page_offset) {
                       L"MyAnimeList: Retrieving anime list...");
   };
 
-  const auto on_response = [](const taiga::http::Response& response) {
+  // Library pages can be large, so they are decoded in the worker thread,
+  // straight into typed records.
+  const auto on_parse = [](const taiga::http::Response& response) {
+    std::optional<LibraryPage> page{std::in_place};
+    if (!ParseLibraryPage(response.body(), *page))
+      page.reset();
+    return page;
+  };
+
+  const auto on_response = [](const taiga::http::Response& response,
+                              const std::optional<LibraryPage>& page) {
     if (HasError(response)) {
       sync::OnError(RequestType::GetLibraryEntries);
       return;
     }
 
-    Json root;
-
-    if (!JsonParseString(response.body(), root)) {
+    if (!page) {
       ui::ChangeStatusText(L"MyAnimeList: Could not parse anime list.");
       sync::OnError(RequestType::GetLibraryEntries);
       return;
     }
 
-    const auto previous_page_offset = GetOffset(root, "previous");
-    const auto next_page_offset = GetOffset(root, "next");
+    // MAL doesn't report the total number of entries, so we can't request
+    // all pages at once. Asking for the next page before applying this one at
+    // least keeps the connection busy. Responses are handled in the main
+    // thread, so the next page can't be applied before this one.
+    const bool has_next_page =
+        page->next_offset && *page->next_offset > 0 &&
+        !(IsPartialLibraryRequest() && HasUnchangedEntries(*page));
+    if (has_next_page) {
+      GetLibraryEntries(*page->next_offset);
+    }
 
-    if (!previous_page_offset) {  // first page
-      anime::db.ClearUserData();
+    if (!page->previous_offset) {  // first page
+      library_delta.Begin(IsPartialLibraryRequest() ?
+                          LibraryDelta::Mode::Partial :
+                          LibraryDelta::Mode::Full);
     }
 
-    for (const auto& value : root["data"]) {
-      if (value.contains("node") && value.contains("list_status")) {
-        const auto anime_id = ParseAnimeObject(value["node"]);
-        ParseLibraryObject(value["list_status"], anime_id);
+    for (const auto& entry : page->entries) {
+      if (entry.has_node && entry.has_list_status) {
+        const auto anime_id = ParseAnimeObject(entry.node);
+        ParseLibraryObject(entry.list_status, anime_id);
+        library_delta.Add(anime_id);
       }
     }
 
-    if (next_page_offset && *next_page_offset > 0) {
-      GetLibraryEntries(*next_page_offset);
-    } else {
-      sync::OnResponse(RequestType::GetLibraryEntries);
+    if (!has_next_page) {
+      if (IsPartialLibraryRequest() && library_delta.IsScanDue()) {
+        GetLibraryIds(0);
+      } else {
+        sync::OnResponse(RequestType::GetLibraryEntries);
+      }
     }
   };
 
-  SendRequest(request, on_transfer, on_response);
+  SendRequest(request, on_transfer, on_parse, on_response);
 }
 
 void GetMetadataById(const int id) {
@@ -665,6 +796,12 @@ void GetSeason(const anime::Season season, const int page_offset) {
     const auto previous_page_offset = GetOffset(root, "previous");
     const auto next_page_offset = GetOffset(root, "next");
 
+    // See the note in GetLibraryEntries
+    const bool has_next_page = next_page_offset && *next_page_offset > 0;
+    if (has_next_page) {
+      GetSeason(season, *next_page_offset);
+    }
+
     if (!previous_page_offset) {  // first page
       anime::season_db.items.clear();
     }
@@ -675,9 +812,7 @@ void GetSeason(const anime::Season season, const int page_offset) {
       ui::OnLibraryEntryChange(anime_id);
     }
 
-    if (next_page_offset && *next_page_offset > 0) {
-      GetSeason(season, *next_page_offset);
-    } else {
+    if (!has_next_page) {
       sync::OnResponse(RequestType::GetSeason);
     }
   };
@@ -746,12 +881,12 @@ void DeleteLibraryEntry(const int id) {
         // We consider "404 Not Found" to be a success.
       } else {
         ui::OnLibraryUpdateFailure(id, error->description, false);
-        sync::OnError(RequestType::DeleteLibraryEntry);
+        sync::OnError(RequestType::DeleteLibraryEntry, id);
         return;
       }
     }
 
-    sync::OnResponse(RequestType::DeleteLibraryEntry);
+    sync::OnResponse(RequestType::DeleteLibraryEntry, id);
   };
 
   SendRequest(request, on_transfer, on_response);
@@ -799,7 +934,7 @@ void UpdateLibraryEntry(const library::QueueItem& queue_item) {
         error->description = L"Anime list entry does not exist";
       }
       ui::OnLibraryUpdateFailure(id, error->description, false);
-      sync::OnError(RequestType::UpdateLibraryEntry);
+      sync::OnError(RequestType::UpdateLibraryEntry, id);
       return;
     }
 
@@ -807,13 +942,13 @@ void UpdateLibraryEntry(const library::QueueItem& queue_item) {
 
     if (!JsonParseString(response.body(), root)) {
       ui::ChangeStatusText(L"MyAnimeList: Could not parse anime list entry.");
-      sync::OnError(RequestType::UpdateLibraryEntry);
+      sync::OnError(RequestType::UpdateLibraryEntry, id);
       return;
     }
 
     ParseLibraryObject(root, id);
 
-    sync::OnResponse(RequestType::UpdateLibraryEntry);
+    sync::OnResponse(RequestType::UpdateLibraryEntry, id);
   };
 
   SendRequest(request, on_transfer, on_response);
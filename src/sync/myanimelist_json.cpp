@@ -0,0 +1,405 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <windows.h>
+
+#include <rapidjson/memorystream.h>
+#include <rapidjson/reader.h>
+
+#include "sync/myanimelist_json.h"
+
+#include "base/string.h"
+#include "base/url.h"
+
+namespace sync::myanimelist {
+
+AnimeRecord ReadAnimeRecord(const Json& json) {
+  AnimeRecord record;
+
+  record.id = JsonReadInt(json, "id");
+  record.title = StrToWstr(JsonReadStr(json, "title"));
+  record.start_date = StrToWstr(JsonReadStr(json, "start_date"));
+  record.end_date = StrToWstr(JsonReadStr(json, "end_date"));
+  record.synopsis = StrToWstr(JsonReadStr(json, "synopsis"));
+  record.mean = JsonReadDouble(json, "mean");
+  record.popularity = JsonReadInt(json, "popularity");
+  record.media_type = StrToWstr(JsonReadStr(json, "media_type"));
+  record.status = StrToWstr(JsonReadStr(json, "status"));
+  record.num_episodes = JsonReadInt(json, "num_episodes");
+  record.average_episode_duration =
+      JsonReadInt(json, "average_episode_duration");
+  record.rating = StrToWstr(JsonReadStr(json, "rating"));
+
+  if (json.contains("main_picture")) {
+    record.main_picture = StrToWstr(JsonReadStr(json["main_picture"], "medium"));
+  }
+
+  if (json.contains("alternative_titles")) {
+    const auto& alternative_titles = json["alternative_titles"];
+    record.has_alternative_titles = true;
+    if (alternative_titles.contains("synonyms")) {
+      auto& synonyms = record.synonyms.emplace();
+      for (const auto& synonym : alternative_titles["synonyms"]) {
+        if (synonym.is_string())
+          synonyms.push_back(StrToWstr(synonym));
+      }
+    }
+    record.english_title = StrToWstr(JsonReadStr(alternative_titles, "en"));
+    record.japanese_title = StrToWstr(JsonReadStr(alternative_titles, "ja"));
+  }
+
+  const auto read_names = [&json](const std::string& key,
+                                  std::vector<std::wstring>& names) {
+    if (json.contains(key) && json[key].is_array()) {
+      for (const auto& value : json[key]) {
+        const auto name = JsonReadStr(value, "name");
+        if (!name.empty()) {
+          names.push_back(StrToWstr(name));
+        }
+      }
+    }
+  };
+  read_names("genres", record.genres);
+  read_names("studios", record.studios);
+
+  return record;
+}
+
+ListStatusRecord ReadListStatusRecord(const Json& json) {
+  ListStatusRecord record;
+
+  record.status = StrToWstr(JsonReadStr(json, "status"));
+  record.score = JsonReadInt(json, "score");
+  record.num_episodes_watched = JsonReadInt(json, "num_episodes_watched");
+  record.is_rewatching = JsonReadBool(json, "is_rewatching");
+  record.start_date = StrToWstr(JsonReadStr(json, "start_date"));
+  record.finish_date = StrToWstr(JsonReadStr(json, "finish_date"));
+  record.num_times_rewatched = JsonReadInt(json, "num_times_rewatched");
+  record.comments = StrToWstr(JsonReadStr(json, "comments"));
+  record.updated_at = JsonReadStr(json, "updated_at");
+
+  if (json.contains("tags") && json["tags"].is_array()) {
+    for (const auto& tag : json["tags"]) {
+      if (tag.is_string()) {
+        record.tags.push_back(StrToWstr(tag.get<std::string>()));
+      }
+    }
+  }
+
+  return record;
+}
+
+std::optional<int> ReadPagingOffset(const std::string& link) {
+  if (!link.empty()) {
+    const Url url = StrToWstr(link);
+    const auto query = url.query();
+    if (const auto it = query.find(L"offset"); it != query.end()) {
+      return ToInt(it->second);
+    }
+  }
+  return std::nullopt;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+std::wstring Utf8ToWstr(const char* str, const size_t length) {
+  std::wstring output;
+  if (length) {
+    const auto size = static_cast<int>(length);
+    output.resize(::MultiByteToWideChar(CP_UTF8, 0, str, size, nullptr, 0));
+    ::MultiByteToWideChar(CP_UTF8, 0, str, size, output.data(),
+                          static_cast<int>(output.size()));
+  }
+  return output;
+}
+
+// Keeps track of where we are in the document, and maps the values we are
+// interested in directly to the records of the current entry.
+class LibraryPageHandler
+    : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>,
+                                          LibraryPageHandler> {
+public:
+  explicit LibraryPageHandler(LibraryPage& page) : page_{page} {}
+
+  bool StartObject() {
+    const auto scope = GetChildScope(true);
+    switch (scope) {
+      case Scope::Entry:
+        page_.entries.emplace_back();
+        break;
+      case Scope::Node:
+        entry().has_node = true;
+        break;
+      case Scope::ListStatus:
+        entry().has_list_status = true;
+        break;
+      case Scope::MainPicture:
+        entry().node.main_picture.emplace();
+        break;
+      case Scope::AlternativeTitles:
+        entry().node.has_alternative_titles = true;
+        break;
+    }
+    scopes_.push_back(scope);
+    return true;
+  }
+
+  bool EndObject(rapidjson::SizeType) {
+    scopes_.pop_back();
+    return true;
+  }
+
+  bool StartArray() {
+    const auto scope = GetChildScope(false);
+    if (scope == Scope::Synonyms)
+      entry().node.synonyms.emplace();
+    scopes_.push_back(scope);
+    return true;
+  }
+
+  bool EndArray(rapidjson::SizeType) {
+    scopes_.pop_back();
+    return true;
+  }
+
+  bool Key(const char* str, rapidjson::SizeType length, bool) {
+    key_.assign(str, length);
+    return true;
+  }
+
+  bool String(const char* str, rapidjson::SizeType length, bool) {
+    switch (scope()) {
+      case Scope::Node: {
+        auto& node = entry().node;
+        if (key_ == "title") {
+          node.title = Utf8ToWstr(str, length);
+        } else if (key_ == "start_date") {
+          node.start_date = Utf8ToWstr(str, length);
+        } else if (key_ == "end_date") {
+          node.end_date = Utf8ToWstr(str, length);
+        } else if (key_ == "synopsis") {
+          node.synopsis = Utf8ToWstr(str, length);
+        } else if (key_ == "media_type") {
+          node.media_type = Utf8ToWstr(str, length);
+        } else if (key_ == "status") {
+          node.status = Utf8ToWstr(str, length);
+        } else if (key_ == "rating") {
+          node.rating = Utf8ToWstr(str, length);
+        }
+        break;
+      }
+      case Scope::MainPicture:
+        if (key_ == "medium")
+          entry().node.main_picture = Utf8ToWstr(str, length);
+        break;
+      case Scope::AlternativeTitles:
+        if (key_ == "en") {
+          entry().node.english_title = Utf8ToWstr(str, length);
+        } else if (key_ == "ja") {
+          entry().node.japanese_title = Utf8ToWstr(str, length);
+        }
+        break;
+      case Scope::Synonyms:
+        entry().node.synonyms->push_back(Utf8ToWstr(str, length));
+        break;
+      case Scope::Genre:
+        if (key_ == "name" && length)
+          entry().node.genres.push_back(Utf8ToWstr(str, length));
+        break;
+      case Scope::Studio:
+        if (key_ == "name" && length)
+          entry().node.studios.push_back(Utf8ToWstr(str, length));
+        break;
+      case Scope::ListStatus: {
+        auto& list_status = entry().list_status;
+        if (key_ == "status") {
+          list_status.status = Utf8ToWstr(str, length);
+        } else if (key_ == "start_date") {
+          list_status.start_date = Utf8ToWstr(str, length);
+        } else if (key_ == "finish_date") {
+          list_status.finish_date = Utf8ToWstr(str, length);
+        } else if (key_ == "comments") {
+          list_status.comments = Utf8ToWstr(str, length);
+        } else if (key_ == "updated_at") {
+          list_status.updated_at.assign(str, length);
+        }
+        break;
+      }
+      case Scope::Tags:
+        entry().list_status.tags.push_back(Utf8ToWstr(str, length));
+        break;
+      case Scope::Paging:
+        if (key_ == "previous") {
+          page_.previous_offset = ReadPagingOffset({str, length});
+        } else if (key_ == "next") {
+          page_.next_offset = ReadPagingOffset({str, length});
+        }
+        break;
+    }
+    return true;
+  }
+
+  bool Bool(bool value) {
+    if (scope() == Scope::ListStatus && key_ == "is_rewatching")
+      entry().list_status.is_rewatching = value;
+    return true;
+  }
+
+  bool Int(int value) { return Number(value); }
+  bool Uint(unsigned value) { return Number(value); }
+  bool Int64(int64_t value) { return Number(static_cast<double>(value)); }
+  bool Uint64(uint64_t value) { return Number(static_cast<double>(value)); }
+  bool Double(double value) { return Number(value); }
+
+private:
+  enum class Scope {
+    Unknown,
+    Page,
+    Data,
+    Entry,
+    Node,
+    MainPicture,
+    AlternativeTitles,
+    Synonyms,
+    Genres,
+    Genre,
+    Studios,
+    Studio,
+    ListStatus,
+    Tags,
+    Paging,
+  };
+
+  Scope scope() const {
+    return scopes_.empty() ? Scope::Unknown : scopes_.back();
+  }
+
+  LibraryPage::Entry& entry() {
+    return page_.entries.back();
+  }
+
+  Scope GetChildScope(const bool object) const {
+    if (scopes_.empty())
+      return object ? Scope::Page : Scope::Unknown;
+
+    // Elements of an array don't have a key; `key_` still holds the key of
+    // the array itself.
+    switch (scopes_.back()) {
+      case Scope::Page:
+        if (object && key_ == "paging")
+          return Scope::Paging;
+        if (!object && key_ == "data")
+          return Scope::Data;
+        break;
+      case Scope::Data:
+        if (object)
+          return Scope::Entry;
+        break;
+      case Scope::Entry:
+        if (object && key_ == "node")
+          return Scope::Node;
+        if (object && key_ == "list_status")
+          return Scope::ListStatus;
+        break;
+      case Scope::Node:
+        if (object && key_ == "main_picture")
+          return Scope::MainPicture;
+        if (object && key_ == "alternative_titles")
+          return Scope::AlternativeTitles;
+        if (!object && key_ == "genres")
+          return Scope::Genres;
+        if (!object && key_ == "studios")
+          return Scope::Studios;
+        break;
+      case Scope::AlternativeTitles:
+        if (!object && key_ == "synonyms")
+          return Scope::Synonyms;
+        break;
+      case Scope::Genres:
+        if (object)
+          return Scope::Genre;
+        break;
+      case Scope::Studios:
+        if (object)
+          return Scope::Studio;
+        break;
+      case Scope::ListStatus:
+        if (!object && key_ == "tags")
+          return Scope::Tags;
+        break;
+    }
+
+    return Scope::Unknown;
+  }
+
+  bool Number(const double value) {
+    const auto int_value = static_cast<int>(value);
+
+    switch (scope()) {
+      case Scope::Node: {
+        auto& node = entry().node;
+        if (key_ == "id") {
+          node.id = int_value;
+        } else if (key_ == "mean") {
+          node.mean = value;
+        } else if (key_ == "popularity") {
+          node.popularity = int_value;
+        } else if (key_ == "num_episodes") {
+          node.num_episodes = int_value;
+        } else if (key_ == "average_episode_duration") {
+          node.average_episode_duration = int_value;
+        }
+        break;
+      }
+      case Scope::ListStatus: {
+        auto& list_status = entry().list_status;
+        if (key_ == "score") {
+          list_status.score = int_value;
+        } else if (key_ == "num_episodes_watched") {
+          list_status.num_episodes_watched = int_value;
+        } else if (key_ == "num_times_rewatched") {
+          list_status.num_times_rewatched = int_value;
+        }
+        break;
+      }
+    }
+
+    return true;
+  }
+
+  LibraryPage& page_;
+  std::vector<Scope> scopes_;
+  std::string key_;
+};
+
+}  // namespace
+
+bool ParseLibraryPage(const std::string_view json, LibraryPage& page) {
+  page = {};
+
+  LibraryPageHandler handler{page};
+  rapidjson::MemoryStream stream{json.data(), json.size()};
+  rapidjson::Reader reader;
+
+  return !reader.Parse(stream, handler).IsError();
+}
+
+}  // namespace sync::myanimelist
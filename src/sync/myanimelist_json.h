@@ -0,0 +1,91 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "base/json.h"
+
+namespace sync::myanimelist {
+
+// Typed records that API objects are mapped into, before they are applied to
+// the anime database. Strings are converted to UTF-16 while decoding, which can
+// be done in a worker thread.
+
+struct AnimeRecord {
+  int id = 0;
+  std::wstring title;
+  std::wstring start_date;
+  std::wstring end_date;
+  std::wstring synopsis;
+  double mean = 0.0;
+  int popularity = 0;
+  std::wstring media_type;
+  std::wstring status;
+  int num_episodes = 0;
+  int average_episode_duration = 0;
+  std::wstring rating;
+  std::optional<std::wstring> main_picture;
+  bool has_alternative_titles = false;
+  std::optional<std::vector<std::wstring>> synonyms;
+  std::wstring english_title;
+  std::wstring japanese_title;
+  std::vector<std::wstring> genres;
+  std::vector<std::wstring> studios;
+};
+
+struct ListStatusRecord {
+  std::wstring status;
+  int score = 0;
+  int num_episodes_watched = 0;
+  bool is_rewatching = false;
+  std::wstring start_date;
+  std::wstring finish_date;
+  int num_times_rewatched = 0;
+  std::wstring comments;
+  std::string updated_at;
+  std::vector<std::wstring> tags;
+};
+
+struct LibraryPage {
+  struct Entry {
+    bool has_node = false;
+    bool has_list_status = false;
+    AnimeRecord node;
+    ListStatusRecord list_status;
+  };
+
+  std::vector<Entry> entries;
+  std::optional<int> previous_offset;
+  std::optional<int> next_offset;
+};
+
+AnimeRecord ReadAnimeRecord(const Json& json);
+ListStatusRecord ReadListStatusRecord(const Json& json);
+std::optional<int> ReadPagingOffset(const std::string& link);
+
+// Decodes a library page with rapidjson's SAX reader, without building a DOM.
+// Unknown fields are skipped.
+bool ParseLibraryPage(const std::string_view json, LibraryPage& page);
+
+}  // namespace sync::myanimelist
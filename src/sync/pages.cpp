@@ -0,0 +1,62 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "sync/pages.h"
+
+namespace sync {
+
+PageQueue::PageQueue(size_t count, page_handler_t handler)
+    : count_{count}, handler_{std::move(handler)} {
+}
+
+bool PageQueue::Push(size_t index, Json& page) {
+  if (failed_ || index < next_ || index >= count_)
+    return false;
+
+  pending_[index] = std::move(page);
+
+  // Pages may arrive in any order; only the contiguous prefix can be handled
+  for (auto it = pending_.begin();
+       it != pending_.end() && it->first == next_;
+       it = pending_.erase(it), ++next_) {
+    handler_(it->second);
+  }
+
+  return next_ == count_;
+}
+
+bool PageQueue::Fail() {
+  if (failed_)
+    return false;
+  failed_ = true;
+  pending_.clear();
+  return true;
+}
+
+bool PageQueue::failed() const {
+  return failed_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+size_t GetPageCount(size_t total, size_t page_size) {
+  return page_size ? (total + page_size - 1) / page_size : 0;
+}
+
+}  // namespace sync
@@ -0,0 +1,56 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <functional>
+#include <map>
+
+#include "base/json.h"
+
+namespace sync {
+
+// Collects the responses of pages that are requested concurrently, and hands
+// them over in page order. This lets us merge the results exactly as if they
+// had been retrieved one after another.
+class PageQueue {
+public:
+  using page_handler_t = std::function<void(Json&)>;
+
+  PageQueue(size_t count, page_handler_t handler);
+
+  // Returns true when all pages have been handled.
+  bool Push(size_t index, Json& page);
+
+  // Returns true only for the first failure, so that errors are reported once.
+  bool Fail();
+
+  bool failed() const;
+
+private:
+  size_t count_ = 0;
+  size_t next_ = 0;
+  bool failed_ = false;
+  page_handler_t handler_;
+  std::map<size_t, Json> pending_;
+};
+
+size_t GetPageCount(size_t total, size_t page_size);
+
+}  // namespace sync
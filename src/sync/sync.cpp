@@ -28,9 +28,11 @@
 #include "media/library/queue.h"
 #include "sync/anilist.h"
 #include "sync/kitsu.h"
+#include "sync/library_delta.h"
 #include "sync/myanimelist.h"
 #include "sync/service.h"
 #include "taiga/http.h"
+#include "taiga/http_metrics.h"
 #include "taiga/settings.h"
 #include "ui/dialog.h"
 #include "ui/resource.h"
@@ -40,6 +42,8 @@
 namespace sync {
 
 void AuthenticateUser() {
+  const taiga::http::MetricsScope metrics_scope{"AuthenticateUser"};
+
   ui::EnableDialogInput(ui::Dialog::Main, false);
   ui::ChangeStatusText(L"{}: Authenticating user..."_format(
       GetCurrentServiceName()));
@@ -58,6 +62,8 @@ void AuthenticateUser() {
 }
 
 void GetUser() {
+  const taiga::http::MetricsScope metrics_scope{"GetUser"};
+
   ui::EnableDialogInput(ui::Dialog::Main, false);
   ui::ChangeStatusText(L"{}: Retrieving user information..."_format(
       GetCurrentServiceName()));
@@ -75,6 +81,8 @@ void GetUser() {
 }
 
 void GetLibraryEntries() {
+  const taiga::http::MetricsScope metrics_scope{"GetLibraryEntries"};
+
   ui::EnableDialogInput(ui::Dialog::Main, false);
   ui::ChangeStatusText(L"{}: Retrieving anime list..."_format(
       GetCurrentServiceName()));
@@ -93,6 +101,9 @@ void GetLibraryEntries() {
 }
 
 void GetMetadataById(const int id) {
+  const taiga::http::MetricsScope metrics_scope{"GetMetadataById"};
+  const taiga::http::PriorityScope priority_scope{taiga::http::Priority::Low};
+
   ui::ChangeStatusText(L"{}: Retrieving anime information..."_format(
       GetCurrentServiceName()));
 
@@ -110,6 +121,8 @@ void GetMetadataById(const int id) {
 }
 
 void GetSeason(const anime::Season season) {
+  const taiga::http::MetricsScope metrics_scope{"GetSeason"};
+
   ui::EnableDialogInput(ui::Dialog::Seasons, false);
   ui::ChangeStatusText(L"{}: Retrieving {} anime season..."_format(
       GetCurrentServiceName(), ui::TranslateSeason(season)));
@@ -128,6 +141,9 @@ void GetSeason(const anime::Season season) {
 }
 
 void SearchTitle(const std::wstring& title) {
+  const taiga::http::MetricsScope metrics_scope{"SearchTitle"};
+  const taiga::http::PriorityScope priority_scope{taiga::http::Priority::High};
+
   ui::ChangeStatusText(L"{}: Searching for \"{}\"..."_format(
       GetCurrentServiceName(), title));
 
@@ -176,6 +192,9 @@ void Synchronize() {
 }
 
 void AddLibraryEntry(const library::QueueItem& queue_item) {
+  const taiga::http::MetricsScope metrics_scope{"AddLibraryEntry"};
+  const taiga::http::PriorityScope priority_scope{taiga::http::Priority::High};
+
   const auto anime_item = anime::db.Find(queue_item.anime_id);
   if (!anime_item)
     return;
@@ -197,6 +216,9 @@ void AddLibraryEntry(const library::QueueItem& queue_item) {
 }
 
 void DeleteLibraryEntry(const int id) {
+  const taiga::http::MetricsScope metrics_scope{"DeleteLibraryEntry"};
+  const taiga::http::PriorityScope priority_scope{taiga::http::Priority::High};
+
   const auto anime_item = anime::db.Find(id);
   if (!anime_item)
     return;
@@ -218,6 +240,9 @@ void DeleteLibraryEntry(const int id) {
 }
 
 void UpdateLibraryEntry(const library::QueueItem& queue_item) {
+  const taiga::http::MetricsScope metrics_scope{"UpdateLibraryEntry"};
+  const taiga::http::PriorityScope priority_scope{taiga::http::Priority::High};
+
   const auto anime_item = anime::db.Find(queue_item.anime_id);
   if (!anime_item)
     return;
@@ -238,7 +263,47 @@ void UpdateLibraryEntry(const library::QueueItem& queue_item) {
   }
 }
 
+void UpdateLibraryEntries(const std::vector<library::QueueItem>& queue_items) {
+  // Entries belong to different anime, so they are independent of each other
+  // and can be sent at the same time. AniList accepts several mutations in a
+  // single request; other services get one request per entry.
+  const bool batch = GetCurrentServiceId() == ServiceId::AniList;
+  std::vector<library::QueueItem> batch_items;
+
+  for (const auto& queue_item : queue_items) {
+    switch (queue_item.mode) {
+      case library::QueueItemMode::Add:
+      case library::QueueItemMode::Update:
+        if (batch) {
+          batch_items.push_back(queue_item);
+        } else if (queue_item.mode == library::QueueItemMode::Add) {
+          AddLibraryEntry(queue_item);
+        } else {
+          UpdateLibraryEntry(queue_item);
+        }
+        break;
+      case library::QueueItemMode::Delete:
+        DeleteLibraryEntry(queue_item.anime_id);
+        break;
+    }
+  }
+
+  if (batch_items.size() == 1) {
+    UpdateLibraryEntry(batch_items.front());
+  } else if (!batch_items.empty()) {
+    ui::ChangeStatusText(L"{}: Updating anime list... ({} entries)"_format(
+        GetCurrentServiceName(), batch_items.size()));
+    const taiga::http::MetricsScope metrics_scope{"UpdateLibraryEntry"};
+    const taiga::http::PriorityScope priority_scope{
+        taiga::http::Priority::High};
+    anilist::UpdateLibraryEntries(batch_items);
+  }
+}
+
 void DownloadImage(const int anime_id, const std::wstring& image_url) {
+  const taiga::http::MetricsScope metrics_scope{"DownloadImage"};
+  const taiga::http::PriorityScope priority_scope{taiga::http::Priority::Low};
+
   if (image_url.empty())
     return;
 
@@ -335,7 +400,7 @@ bool HasProgress(const RequestType type) {
   }
 }
 
-void OnError(const RequestType type) {
+void OnError(const RequestType type, const int anime_id) {
   if (HasProgress(type)) {
     ui::taskbar_list.SetProgressState(TBPF_NOPROGRESS);
   }
@@ -354,7 +419,7 @@ void OnError(const RequestType type) {
     case RequestType::AddLibraryEntry:
     case RequestType::DeleteLibraryEntry:
     case RequestType::UpdateLibraryEntry:
-      library::queue.updating = false;
+      library::queue.Complete(anime_id, false);
       break;
   }
 }
@@ -377,7 +442,7 @@ bool OnTransfer(const RequestType type, const taiga::http::Transfer& transfer,
   return true;
 }
 
-void OnResponse(const RequestType type) {
+void OnResponse(const RequestType type, const int anime_id) {
   if (HasProgress(type)) {
     ui::taskbar_list.SetProgressState(TBPF_NOPROGRESS);
     ui::ClearStatusText();
@@ -399,11 +464,17 @@ void OnResponse(const RequestType type) {
       ui::OnLogin();
       break;
 
-    case RequestType::GetLibraryEntries:
+    case RequestType::GetLibraryEntries: {
+      const auto changes = library_delta.Finish();
       anime::db.SaveDatabase();
       anime::db.SaveList();
-      ui::OnLibraryChange();
+      if (changes.list_changed) {
+        ui::OnLibraryChange();
+      } else {
+        ui::OnLibraryEntriesChange(changes.ids);
+      }
       break;
+    }
 
     case RequestType::GetMetadataById:
       break;
@@ -421,13 +492,7 @@ void OnResponse(const RequestType type) {
     case RequestType::AddLibraryEntry:
     case RequestType::DeleteLibraryEntry:
     case RequestType::UpdateLibraryEntry:
-      if (const auto queue_item = library::queue.GetCurrentItem()) {
-        anime::db.UpdateItem(*queue_item);
-        anime::db.SaveList();
-        library::queue.Remove();
-      }
-      library::queue.updating = false;
-      library::queue.Check(false);
+      library::queue.Complete(anime_id, true);
       break;
   }
 }
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 namespace anime {
 class Season;
@@ -59,6 +60,7 @@ void Synchronize();
 void AddLibraryEntry(const library::QueueItem& queue_item);
 void DeleteLibraryEntry(const int id);
 void UpdateLibraryEntry(const library::QueueItem& queue_item);
+void UpdateLibraryEntries(const std::vector<library::QueueItem>& queue_items);
 
 void DownloadImage(const int anime_id, const std::wstring& image_url);
 
@@ -67,10 +69,10 @@ void InvalidateUserAuthentication();
 bool IsUserAccountAvailable();
 bool IsUserAuthenticationAvailable();
 
-void OnError(const RequestType type);
+void OnError(const RequestType type, const int anime_id = 0);
 bool OnTransfer(const RequestType type, const taiga::http::Transfer& transfer,
                 const std::wstring& status);
-void OnResponse(const RequestType type);
+void OnResponse(const RequestType type, const int anime_id = 0);
 
 void OnInvalidAnimeId(const int id);
 
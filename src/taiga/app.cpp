@@ -29,6 +29,7 @@
 #include "media/anime_db.h"
 #include "media/library/history.h"
 #include "taiga/announce.h"
+#include "taiga/benchmark.h"
 #include "taiga/config.h"
 #include "taiga/dummy.h"
 #include "taiga/http.h"
@@ -36,7 +37,11 @@
 #include "taiga/settings.h"
 #include "taiga/version.h"
 #include "track/feed_aggregator.h"
+#include "track/feed_filter_manager.h"
+#include "track/hash_index.h"
+#include "track/hasher.h"
 #include "track/media.h"
+#include "track/scan_index.h"
 #include "ui/dialog.h"
 #include "ui/menu.h"
 #include "ui/theme.h"
@@ -57,9 +62,17 @@ CommandLineOptions ParseCommandLine() {
     if (arg == L"allowmultipleinstances") {
       options.allow_multiple_instances = true;
       found = true;
+    } else if (arg == L"benchmark") {
+      options.allow_multiple_instances = true;
+      options.benchmark = true;
+      found = true;
     } else if (arg == L"debug") {
       options.debug_mode = true;
       found = true;
+    } else if (arg == L"replay") {
+      options.allow_multiple_instances = true;
+      options.replay = true;
+      found = true;
     } else if (arg == L"verbose") {
       options.verbose = true;
       found = true;
@@ -91,6 +104,8 @@ void LoadData() {
 
   library::history.Load();
   track::aggregator.archive.Load();
+  track::scan_index.Load();
+  track::hash_index.Load();
 }
 
 }  // namespace detail
@@ -134,6 +149,19 @@ BOOL App::InitInstance() {
 
   InitializeDummies();
 
+  // Collect feed filter statistics while debugging
+  track::feed_filter_manager.SetProfiling(options.debug_mode);
+
+  // Run benchmarks and exit without showing any UI
+  if (options.benchmark || options.replay) {
+    if (options.benchmark)
+      benchmark::Run();
+    if (options.replay)
+      benchmark::Replay();
+    http::Shutdown();
+    return FALSE;
+  }
+
   // Initialize Discord
   if (settings.GetShareDiscordEnabled())
     link::discord::Initialize();
@@ -162,6 +190,8 @@ void App::Uninitialize() {
   ui::taskbar_list.Release();
 
   // Save
+  track::hasher.Enable(false);
+  track::hash_index.Save();
   settings.Save();
   anime::db.SaveDatabase();
   track::aggregator.archive.Save();
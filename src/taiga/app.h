@@ -26,7 +26,9 @@ namespace detail {
 
 struct CommandLineOptions {
   bool allow_multiple_instances = false;
+  bool benchmark = false;
   bool debug_mode = false;
+  bool replay = false;
   bool verbose = false;
 };
 
@@ -0,0 +1,991 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <crtdbg.h>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <regex>
+#include <set>
+#include <unordered_map>
+
+#include "taiga/benchmark.h"
+
+#include "base/file.h"
+#include "base/file_search.h"
+#include "base/format.h"
+#include "base/json.h"
+#include "base/log.h"
+#include "base/regex.h"
+#include "base/rss.h"
+#include "base/string.h"
+#include "base/xml.h"
+#include "media/anime_availability.h"
+#include "media/anime_db.h"
+#include "media/anime_item.h"
+#include "media/anime_util.h"
+#include "sync/myanimelist_json.h"
+#include "taiga/path.h"
+#include "track/episode.h"
+#include "track/episode_util.h"
+#include "track/feed.h"
+#include "track/feed_aggregator.h"
+#include "track/feed_filter_manager.h"
+#include "track/media_stream.h"
+#include "track/recognition.h"
+#include "track/scan_pipeline.h"
+
+namespace taiga::benchmark {
+
+double Stopwatch::Elapsed() const {
+  return std::chrono::duration_cast<duration_t>(clock_t::now() - t0_).count();
+}
+
+void Stopwatch::Reset() {
+  t0_ = clock_t::now();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+std::atomic<size_t> allocation_count{0};
+std::atomic<ptrdiff_t> allocated_bytes{0};
+std::atomic<ptrdiff_t> peak_allocated_bytes{0};
+std::atomic<int> allocation_counter_refs{0};
+
+#ifdef _DEBUG
+void AddAllocatedBytes(const ptrdiff_t bytes) {
+  const ptrdiff_t current = allocated_bytes += bytes;
+  auto peak = peak_allocated_bytes.load();
+  while (current > peak &&
+         !peak_allocated_bytes.compare_exchange_weak(peak, current)) {
+  }
+}
+
+ptrdiff_t GetBlockSize(void* data, const int block_type) {
+  return data ? static_cast<ptrdiff_t>(_msize_dbg(data, block_type)) : 0;
+}
+
+int __cdecl AllocationHook(int alloc_type, void* data, size_t size,
+                           int block_type, long, const unsigned char*, int) {
+  // The CRT's own blocks are not ours to count, and must not be inspected
+  // from within the hook.
+  if (_BLOCK_TYPE(block_type) == _CRT_BLOCK)
+    return TRUE;
+
+  switch (alloc_type) {
+    case _HOOK_ALLOC:
+      ++allocation_count;
+      AddAllocatedBytes(static_cast<ptrdiff_t>(size));
+      break;
+    case _HOOK_REALLOC:
+      ++allocation_count;
+      AddAllocatedBytes(static_cast<ptrdiff_t>(size) -
+                        GetBlockSize(data, block_type));
+      break;
+    case _HOOK_FREE:
+      AddAllocatedBytes(-GetBlockSize(data, block_type));
+      break;
+  }
+
+  return TRUE;
+}
+#endif
+
+}  // namespace
+
+AllocationCounter::AllocationCounter() {
+#ifdef _DEBUG
+  if (allocation_counter_refs++ == 0)
+    _CrtSetAllocHook(AllocationHook);
+#endif
+  initial_count_ = allocation_count;
+  // Blocks that were allocated before the hook was installed are subtracted
+  // when they are freed, so the peak is a lower bound.
+  initial_bytes_ = allocated_bytes;
+  peak_allocated_bytes = initial_bytes_;
+}
+
+AllocationCounter::~AllocationCounter() {
+#ifdef _DEBUG
+  if (--allocation_counter_refs == 0)
+    _CrtSetAllocHook(nullptr);
+#endif
+}
+
+bool AllocationCounter::IsAvailable() {
+#ifdef _DEBUG
+  return true;
+#else
+  return false;
+#endif
+}
+
+size_t AllocationCounter::count() const {
+  return allocation_count - initial_count_;
+}
+
+size_t AllocationCounter::peak_bytes() const {
+  const auto bytes = peak_allocated_bytes - initial_bytes_;
+  return bytes > 0 ? static_cast<size_t>(bytes) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+double Percentile(std::vector<double> samples, double percentile) {
+  if (samples.empty())
+    return 0.0;
+
+  const auto n = static_cast<size_t>(percentile / 100.0 * (samples.size() - 1));
+  std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+  return samples[n];
+}
+
+std::wstring FormatResult(const Result& result) {
+  double total = 0.0;
+  for (const auto sample : result.samples) {
+    total += sample;
+  }
+
+  const auto iterations = result.samples.size();
+  const auto items = result.items * iterations;
+  const double items_per_second = total > 0.0 ? items / (total / 1000.0) : 0.0;
+
+  std::wstring allocations = L"n/a";
+  std::wstring peak_bytes = L"n/a";
+  if (AllocationCounter::IsAvailable() && items > 0) {
+    allocations = L"{:.1f}"_format(
+        static_cast<double>(result.allocations) / items);
+    peak_bytes = L"{:.1f} KB"_format(result.peak_bytes / 1024.0);
+  }
+
+  auto line = L"{} | {} iterations x {} items | {:.0f} items/s | "
+              L"p50 {:.3f}ms, p90 {:.3f}ms, p99 {:.3f}ms | "
+              L"{} allocations/item | {} peak"_format(
+                  result.name, iterations, result.items, items_per_second,
+                  Percentile(result.samples, 50.0),
+                  Percentile(result.samples, 90.0),
+                  Percentile(result.samples, 99.0),
+                  allocations, peak_bytes);
+  if (!result.details.empty())
+    line += L" | " + result.details;
+  return line;
+}
+
+template <typename Function>
+Result Measure(const std::wstring& name, const size_t iterations,
+               Function function) {
+  Result result;
+  result.name = name;
+  result.samples.reserve(iterations);
+
+  AllocationCounter allocation_counter;
+
+  for (size_t i = 0; i < iterations; ++i) {
+    Stopwatch stopwatch;
+    result.items = function();
+    result.samples.push_back(stopwatch.Elapsed());
+  }
+
+  result.allocations = allocation_counter.count();
+  result.peak_bytes = allocation_counter.peak_bytes();
+
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Feeds are read from the "feed" subdirectory of the test directory. Captured
+// feeds can be copied there from the feed data directory.
+
+static void FeedParser(std::vector<Result>& results) {
+  constexpr size_t kIterations = 100;
+
+  const auto path = GetPath(Path::Test) + L"feed\\";
+  std::vector<std::wstring> files;
+  PopulateFiles(files, path, L"xml");
+
+  for (const auto& file : files) {
+    std::string data;
+    if (!ReadFromFile(path + file, data))
+      continue;
+
+    results.push_back(Measure(L"Feed (pugixml): " + file, kIterations,
+        [&data]() {
+          XmlDocument document;
+          document.load_buffer(data.data(), data.size(), pugi::parse_default,
+                               pugi::encoding_utf8);
+          size_t items = 0;
+          const auto channel = document.child(L"rss").child(L"channel");
+          for (const auto node : channel.children(L"item")) {
+            std::wstring title = node.child_value(L"title");
+            std::wstring description = node.child_value(L"description");
+            ++items;
+          }
+          return items;
+        }));
+
+    results.push_back(Measure(L"Feed (rss::Reader): " + file, kIterations,
+        [&data]() {
+          rss::Reader reader{data};
+          rss::ItemView view;
+          size_t items = 0;
+          while (reader.Next(view)) {
+            ++items;
+          }
+          return items;
+        }));
+
+    results.push_back(Measure(L"Feed (track::Feed): " + file, kIterations,
+        [&data]() {
+          track::Feed feed;
+          feed.Load(data);
+          return feed.items.size();
+        }));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Stream detection runs every few seconds against the active tab of each web
+// browser, and most of the time the URL does not belong to a stream.
+
+static void StreamDetection(std::vector<Result>& results) {
+  constexpr size_t kIterations = 1000;
+
+  static const std::vector<std::string> urls{
+    "github.com/erengy/taiga/issues?q=is%3Aissue+is%3Aopen+sort%3Aupdated-desc",
+    "www.google.com/search?q=taiga+anime&oq=taiga+anime&sourceid=chrome",
+    "anilist.co/anime/21/One-Piece/",
+    "myanimelist.net/forum/?topicid=1234567&show=50",
+    "en.wikipedia.org/wiki/List_of_anime_television_series",
+    "app.plex.tv/desktop#!/server/1234/details?key=%2Flibrary%2Fmetadata%2F5",
+    "www.crunchyroll.com/one-piece/episode-1000-overwhelming-strength-123456",
+    "www.youtube.com/watch?v=dQw4w9WgXcQ",
+    "www.hidive.com/stream/made-in-abyss/s01e001",
+  };
+
+  const auto& stream_data = track::recognition::GetStreamData();
+
+  std::vector<std::regex> regexes;
+  std::vector<std::string_view> patterns;
+  for (const auto& item : stream_data) {
+    regexes.emplace_back(item.url_pattern.begin(), item.url_pattern.end());
+    patterns.push_back(item.url_pattern);
+  }
+  const base::RegexSet regex_set{patterns};
+
+  results.push_back(Measure(L"Stream URLs (std::regex)", kIterations,
+      [&]() {
+        for (const auto& url : urls) {
+          for (const auto& regex : regexes) {
+            if (std::regex_search(url, regex))
+              break;
+          }
+        }
+        return urls.size();
+      }));
+
+  results.push_back(Measure(L"Stream URLs (base::RegexSet)", kIterations,
+      [&]() {
+        for (const auto& url : urls) {
+          regex_set.Search(url);
+        }
+        return urls.size();
+      }));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The feed pipeline is what runs after each feed check. It depends on the
+// user's anime list and feed filters, which are loaded before benchmarking.
+// Stages are measured separately, as each one works on the output of the
+// previous one.
+
+static void FeedPipeline(std::vector<Result>& results) {
+  constexpr size_t kIterations = 50;
+
+  const auto path = GetPath(Path::Test) + L"feed\\";
+  std::vector<std::wstring> files;
+  PopulateFiles(files, path, L"xml");
+
+  for (const auto& file : files) {
+    std::string data;
+    if (!ReadFromFile(path + file, data))
+      continue;
+
+    std::vector<Result> stages{
+        {L"Pipeline (parse): " + file},
+        {L"Pipeline (identify): " + file},
+        {L"Pipeline (filter): " + file},
+        {L"Pipeline (sort): " + file},
+        {L"Pipeline (total): " + file},
+    };
+
+    for (size_t i = 0; i < kIterations; ++i) {
+      track::Feed feed;
+      size_t stage = 0;
+      double total = 0.0;
+
+      auto measure = [&](auto function) {
+        auto& result = stages.at(stage++);
+        AllocationCounter allocation_counter;
+        Stopwatch stopwatch;
+        function();
+        const auto elapsed = stopwatch.Elapsed();
+        result.allocations += allocation_counter.count();
+        result.peak_bytes =
+            std::max(result.peak_bytes, allocation_counter.peak_bytes());
+        result.items = feed.items.size();
+        result.samples.push_back(elapsed);
+        total += elapsed;
+      };
+
+      measure([&]() { feed.Load(data); });
+      measure([&]() { track::aggregator.IdentifyItems(feed); });
+      measure([&]() { track::aggregator.FilterItems(feed); });
+      measure([&]() { track::aggregator.SortItems(feed); });
+
+      auto& result = stages.back();
+      result.items = feed.items.size();
+      result.samples.push_back(total);
+    }
+
+    for (size_t i = 0; i + 1 < stages.size(); ++i) {
+      stages.back().allocations += stages.at(i).allocations;
+      stages.back().peak_bytes =
+          std::max(stages.back().peak_bytes, stages.at(i).peak_bytes);
+    }
+
+    results.insert(results.end(), stages.begin(), stages.end());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// MyAnimeList library pages are read from the "sync" subdirectory of the test
+// directory. If there are none, a page is generated instead, so that there is
+// always something to compare.
+
+static std::string GenerateLibraryPage() {
+  Json data = Json::array();
+
+  for (int i = 1; i <= 1000; ++i) {
+    data.push_back({
+        {"node", {
+            {"id", i},
+            {"title", "Anime #{}"_format(i)},
+            {"main_picture", {
+                {"medium", "https://cdn.myanimelist.net/images/anime/{}.jpg"_format(i)},
+                {"large", "https://cdn.myanimelist.net/images/anime/{}l.jpg"_format(i)}}},
+            {"alternative_titles", {
+                {"synonyms", {"Synonym #{}"_format(i)}},
+                {"en", "English title #{}"_format(i)},
+                {"ja", "Japanese title #{}"_format(i)}}},
+            {"start_date", "2021-01-01"},
+            {"end_date", "2021-03-31"},
+            {"synopsis", std::string(500, 'x')},
+            {"mean", 7.5},
+            {"popularity", i},
+            {"media_type", "tv"},
+            {"status", "finished_airing"},
+            {"genres", {{{"id", 1}, {"name", "Action"}},
+                        {{"id", 22}, {"name", "Romance"}}}},
+            {"num_episodes", 12},
+            {"average_episode_duration", 1440},
+            {"rating", "pg_13"},
+            {"studios", {{{"id", 1}, {"name", "Studio"}}}}}},
+        {"list_status", {
+            {"status", "completed"},
+            {"score", 8},
+            {"num_episodes_watched", 12},
+            {"is_rewatching", false},
+            {"start_date", "2021-01-01"},
+            {"finish_date", "2021-03-31"},
+            {"num_times_rewatched", 0},
+            {"comments", ""},
+            {"tags", Json::array()},
+            {"updated_at", "2021-04-01T00:00:00+00:00"}}}});
+  }
+
+  return Json{{"data", data}, {"paging", Json::object()}}.dump();
+}
+
+static void SyncParser(std::vector<Result>& results) {
+  constexpr size_t kIterations = 20;
+
+  const auto path = GetPath(Path::Test) + L"sync\\";
+  std::vector<std::wstring> files;
+  PopulateFiles(files, path, L"json");
+
+  std::vector<std::pair<std::wstring, std::string>> samples;
+  for (const auto& file : files) {
+    std::string data;
+    if (ReadFromFile(path + file, data))
+      samples.emplace_back(file, std::move(data));
+  }
+  if (samples.empty()) {
+    samples.emplace_back(L"(generated)", GenerateLibraryPage());
+  }
+
+  for (const auto& sample : samples) {
+    const auto& data = sample.second;
+
+    results.push_back(Measure(L"MAL library (nlohmann::json): " + sample.first,
+        kIterations, [&data]() {
+          size_t items = 0;
+          const auto root = JsonParseString(data);
+          if (root.contains("data")) {
+            for (const auto& value : root["data"]) {
+              if (value.contains("node") && value.contains("list_status")) {
+                sync::myanimelist::ReadAnimeRecord(value["node"]);
+                sync::myanimelist::ReadListStatusRecord(value["list_status"]);
+                ++items;
+              }
+            }
+          }
+          return items;
+        }));
+
+    results.push_back(Measure(L"MAL library (rapidjson SAX): " + sample.first,
+        kIterations, [&data]() {
+          sync::myanimelist::LibraryPage page;
+          sync::myanimelist::ParseLibraryPage(data, page);
+          return page.entries.size();
+        }));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Directories are walked over a synthetic library of a million files, which is
+// generated in the "file_search" subdirectory of the test directory on the
+// first run, and kept for later runs. The results are checked against
+// std::filesystem before they are timed.
+
+constexpr size_t kTreeDirectories = 1000;
+constexpr size_t kTreeFilesPerDirectory = 1000;
+
+// SaveToFile does not create empty files, and some of ours have to be
+static bool WriteTestFile(const std::wstring& path, const size_t size) {
+  std::ofstream file{std::filesystem::path{path}, std::ios::binary};
+  file << std::string(size, 'x');
+  return static_cast<bool>(file);
+}
+
+static std::wstring GenerateFileTree() {
+  const auto root = GetPath(Path::Test) + L"file_search\\";
+  const auto marker = root + L"complete";
+
+  if (FileExists(marker))
+    return root;
+
+  LOGI(L"Generating {} files in {}",
+       kTreeDirectories * kTreeFilesPerDirectory, root);
+
+  for (size_t i = 0; i < kTreeDirectories; ++i) {
+    const auto directory = L"{}Series {:04}\\"_format(root, i);
+    std::filesystem::create_directories(directory + L"Extras");
+
+    for (size_t j = 0; j < kTreeFilesPerDirectory; ++j) {
+      // Every tenth file is an extra, and file sizes vary so that the size
+      // threshold has something to filter out
+      const auto path =
+          j % 10 ? L"{}[Group] Series {} - {:04} [1080p].mkv"_format(
+                       directory, i, j)
+                 : L"{}Extras\\NCOP {:04}.mkv"_format(directory, j);
+      WriteTestFile(path, j % 16);
+    }
+
+    // Hidden files must be skipped
+    const auto hidden = directory + L".hidden";
+    WriteTestFile(hidden, 0);
+    ::SetFileAttributes(hidden.c_str(), FILE_ATTRIBUTE_HIDDEN);
+  }
+
+  WriteTestFile(marker, 0);
+
+  return root;
+}
+
+static std::set<std::wstring> ListFileTree(const std::wstring& root,
+                                           const uint64_t min_file_size) {
+  std::set<std::wstring> entries;
+
+  base::FileSearch search;
+  search.options.min_file_size = min_file_size;
+  search.Search(root,
+      [&entries](const base::FileSearchResult& result) {
+        entries.insert(AddTrailingSlash(result.root) + result.name + L"\\");
+        return false;
+      },
+      [&entries](const base::FileSearchResult& result) {
+        entries.insert(L"{}{} ({})"_format(
+            AddTrailingSlash(result.root), result.name, result.size));
+        return false;
+      });
+
+  return entries;
+}
+
+static std::set<std::wstring> ListFileTreeReference(
+    const std::wstring& root, const uint64_t min_file_size) {
+  namespace fs = std::filesystem;
+  std::set<std::wstring> entries;
+
+  for (auto it = fs::recursive_directory_iterator{root};
+       it != fs::recursive_directory_iterator{}; ++it) {
+    const auto name = it->path().filename().wstring();
+    if (StartsWith(name, L".")) {
+      if (it->is_directory())
+        it.disable_recursion_pending();
+      continue;
+    }
+    const auto parent = AddTrailingSlash(it->path().parent_path().wstring());
+    if (it->is_directory()) {
+      entries.insert(parent + name + L"\\");
+    } else if (it->file_size() >= min_file_size) {
+      entries.insert(L"{}{} ({})"_format(parent, name, it->file_size()));
+    }
+  }
+
+  return entries;
+}
+
+static void FileTree(std::vector<Result>& results) {
+  constexpr size_t kIterations = 3;
+  constexpr uint64_t kMinFileSize = 8;
+
+  const auto root = GenerateFileTree();
+
+  const auto entries = ListFileTree(root, kMinFileSize);
+  const auto reference = ListFileTreeReference(root, kMinFileSize);
+  if (entries != reference) {
+    LOGE(L"base::FileSearch found {} entries, std::filesystem found {}.",
+         entries.size(), reference.size());
+  }
+
+  results.push_back(Measure(L"File search (base::FileSearch)", kIterations,
+      [&root]() {
+        size_t items = 0;
+        uint64_t bytes = 0;
+        base::FileSearch search;
+        search.Search(root,
+            [&items](const base::FileSearchResult&) {
+              ++items;
+              return false;
+            },
+            [&items, &bytes](const base::FileSearchResult& result) {
+              bytes += result.size;
+              ++items;
+              return false;
+            });
+        return items;
+      }));
+
+  results.push_back(Measure(L"File search (std::filesystem)", kIterations,
+      [&root]() {
+        size_t items = 0;
+        uint64_t bytes = 0;
+        for (const auto& entry :
+             std::filesystem::recursive_directory_iterator{root}) {
+          if (!entry.is_directory())
+            bytes += entry.file_size();
+          ++items;
+        }
+        return items;
+      }));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The scanner is run over a synthetic library, which is generated in the
+// "scanner" subdirectory of the test directory on the first run, and kept for
+// later runs. File names are made up from the titles in the anime database, in
+// the styles of common release groups, and the anime and episode of each file
+// are saved next to the directory as the ground truth. Anime IDs belong to the
+// current service, so both should be deleted after switching services.
+//
+// Stages are measured separately on a single thread, and then together by the
+// scan pipeline, which is what actually runs.
+//
+// Unlike the directory walk, which is also checked by the POSIX test in
+// test/base, this only runs in the benchmark mode of the application on
+// Windows. It needs the loaded anime database, recognition and the scan
+// pipeline, and these don't build elsewhere.
+
+constexpr size_t kScannerFiles = 20000;
+
+struct ScannerFile {
+  std::wstring path;
+  int anime_id = anime::ID_UNKNOWN;
+  int episode_number = 0;
+};
+
+static std::vector<ScannerFile> GenerateScannerLibrary() {
+  const auto root = GetPath(Path::Test) + L"scanner\\";
+  const auto truth_path = GetPath(Path::Test) + L"scanner.json";
+
+  std::vector<ScannerFile> files;
+
+  std::string data;
+  Json truth;
+  if (ReadFromFile(truth_path, data) && JsonParseString(data, truth) &&
+      truth.is_array()) {
+    for (const auto& item : truth) {
+      files.push_back({root + StrToWstr(item.at(0).get<std::string>()),
+                       item.at(1).get<int>(), item.at(2).get<int>()});
+    }
+    // A library that was not generated completely is generated again
+    if (!files.empty() &&
+        std::all_of(files.begin(), files.end(), [](const ScannerFile& file) {
+          return FileExists(file.path);
+        })) {
+      return files;
+    }
+    files.clear();
+  }
+
+  std::vector<const anime::Item*> items;
+  for (const auto& [id, item] : anime::db.items) {
+    if (item.GetType() == anime::SeriesType::Tv &&
+        item.GetEpisodeCount() > 0 && anime::IsAiredYet(item)) {
+      items.push_back(&item);
+    }
+  }
+
+  std::mt19937 generator{2021};
+  std::shuffle(items.begin(), items.end(), generator);
+
+  static const std::vector<std::wstring> groups{
+    L"Commie", L"Erai-raws", L"GJM", L"HorribleSubs", L"Judas", L"SubsPlease",
+  };
+
+  LOGI(L"Generating up to {} files in {}", kScannerFiles, root);
+
+  std::set<std::wstring> titles;
+  truth = Json::array();
+
+  for (const auto item : items) {
+    if (files.size() >= kScannerFiles)
+      break;
+
+    // Titles that are shared by several anime have no single ground truth
+    auto title = item->GetTitle();
+    ValidateFileName(title);
+    if (title.empty() || !titles.insert(ToLower_Copy(title)).second)
+      continue;
+
+    const auto style = generator() % 4;
+    const auto& group = groups.at(generator() % groups.size());
+    const auto directory = style % 2 ? L"{}\\Season 1\\"_format(title)
+                                     : L"{}\\"_format(title);
+    std::filesystem::create_directories(root + directory);
+
+    const int episode_count = std::min(item->GetEpisodeCount(), 26);
+    for (int number = 1; number <= episode_count; ++number) {
+      std::wstring name;
+      switch (style) {
+        case 0:
+          name = L"[{}] {} - {:02} (1080p) [{:08X}].mkv"_format(
+              group, title, number, static_cast<uint32_t>(generator()));
+          break;
+        case 1:
+          name = L"{} S01E{:02} 1080p WEB H.264-{}.mkv"_format(
+              title, number, group);
+          break;
+        case 2:
+          name = L"[{}] {} - {:02}v2 [720p][HEVC].mkv"_format(
+              group, title, number);
+          break;
+        case 3:
+          name = L"{} Ep{:02} [{}].mp4"_format(title, number, group);
+          break;
+      }
+      ValidateFileName(name);
+
+      const auto relative_path = directory + name;
+      if (!WriteTestFile(root + relative_path, 0)) {
+        LOGE(L"Could not create file: {}", root + relative_path);
+        continue;
+      }
+      files.push_back({root + relative_path, item->GetId(), number});
+      truth.push_back({WstrToStr(relative_path), item->GetId(), number});
+    }
+  }
+
+  if (!files.empty())
+    SaveToFile(truth.dump(), truth_path);
+
+  return files;
+}
+
+class ScannerAccuracy {
+public:
+  explicit ScannerAccuracy(const std::vector<ScannerFile>& files) {
+    for (const auto& file : files) {
+      truth_[ToLower_Copy(file.path)] = &file;
+    }
+  }
+
+  void Add(const std::wstring& path, int anime_id, int episode_number) {
+    const auto it = truth_.find(ToLower_Copy(path));
+    if (it == truth_.end())
+      return;
+    const auto& file = *it->second;
+    if (!anime::IsValidId(anime_id)) {
+      ++unidentified_;
+    } else if (anime_id != file.anime_id) {
+      if (misidentified_++ < kMaxLoggedErrors) {
+        LOGD(L"Misidentified as #{} instead of #{}: {}", anime_id,
+             file.anime_id, path);
+      }
+    } else if (episode_number != file.episode_number) {
+      ++wrong_episode_;
+    } else {
+      ++correct_;
+    }
+  }
+
+  std::wstring Format() const {
+    const auto total = correct_ + wrong_episode_ + misidentified_ +
+                       unidentified_;
+    return L"{:.2f}% correct, {} wrong episode, {} misidentified, "
+           L"{} unidentified"_format(
+               total ? 100.0 * correct_ / total : 0.0, wrong_episode_,
+               misidentified_, unidentified_);
+  }
+
+private:
+  static constexpr size_t kMaxLoggedErrors = 20;
+
+  std::unordered_map<std::wstring, const ScannerFile*> truth_;
+  size_t correct_ = 0;
+  size_t wrong_episode_ = 0;
+  size_t misidentified_ = 0;
+  size_t unidentified_ = 0;
+};
+
+static void LibraryScanner(std::vector<Result>& results) {
+  constexpr size_t kIterations = 3;
+
+  // Timing an empty library would tell us nothing
+  const auto files = GenerateScannerLibrary();
+  if (files.empty()) {
+    LOGE(L"Skipping scanner benchmark, as no files could be generated.");
+    return;
+  }
+
+  const auto root = GetPath(Path::Test) + L"scanner\\";
+
+  // Same as the scan pipeline
+  track::recognition::ParseOptions parse_options;
+  parse_options.parse_path = true;
+  parse_options.streaming_media = false;
+  track::recognition::MatchOptions match_options;
+  match_options.allow_sequels = true;
+  match_options.check_airing_date = true;
+  match_options.check_anime_type = true;
+  match_options.check_episode_number = true;
+  match_options.estimate_episode_range = false;
+  match_options.streaming_media = false;
+
+  Meow.InitializeTitles();
+
+  std::vector<Result> stages{
+      {L"Scanner (traversal)"},
+      {L"Scanner (parse)"},
+      {L"Scanner (identify)"},
+      {L"Scanner (availability)"},
+      {L"Scanner (total)"},
+  };
+
+  for (size_t i = 0; i < kIterations; ++i) {
+    std::vector<std::wstring> paths;
+    std::vector<anime::Episode> episodes;
+    size_t stage = 0;
+    double total = 0.0;
+
+    auto measure = [&](auto function) {
+      auto& result = stages.at(stage++);
+      AllocationCounter allocation_counter;
+      Stopwatch stopwatch;
+      function();
+      const auto elapsed = stopwatch.Elapsed();
+      result.allocations += allocation_counter.count();
+      result.peak_bytes =
+          std::max(result.peak_bytes, allocation_counter.peak_bytes());
+      result.items = paths.size();
+      result.samples.push_back(elapsed);
+      total += elapsed;
+    };
+
+    measure([&]() {
+      base::FileSearch search;
+      search.options.skip_directories = true;
+      search.Search(root, nullptr,
+          [&paths](const base::FileSearchResult& result) {
+            paths.push_back(AddTrailingSlash(result.root) + result.name);
+            return false;
+          });
+    });
+
+    measure([&]() {
+      episodes.resize(paths.size());
+      for (size_t j = 0; j < paths.size(); ++j) {
+        Meow.Parse(paths[j], parse_options, episodes[j]);
+      }
+    });
+
+    measure([&]() {
+      for (auto& episode : episodes) {
+        Meow.Identify(episode, false, match_options);
+      }
+    });
+
+    // Changes are collected but not committed, so that the user's library
+    // is not affected
+    measure([&]() {
+      anime::AvailabilityTransaction availability;
+      for (size_t j = 0; j < episodes.size(); ++j) {
+        const auto anime_item = anime::db.Find(episodes[j].anime_id, false);
+        if (!anime_item)
+          continue;
+        const int lower_bound = anime::GetEpisodeLow(episodes[j]);
+        const int upper_bound = anime::GetEpisodeHigh(episodes[j]);
+        for (int number = lower_bound; number <= upper_bound; ++number) {
+          availability.Set(*anime_item, number, true, paths[j]);
+        }
+      }
+    });
+
+    auto& result = stages.back();
+    result.items = paths.size();
+    result.samples.push_back(total);
+
+    if (i + 1 == kIterations) {
+      ScannerAccuracy accuracy{files};
+      for (size_t j = 0; j < episodes.size(); ++j) {
+        accuracy.Add(paths[j], episodes[j].anime_id,
+                     anime::GetEpisodeLow(episodes[j]));
+      }
+      stages.at(2).details = accuracy.Format();
+    }
+  }
+
+  for (size_t i = 0; i + 1 < stages.size(); ++i) {
+    stages.back().allocations += stages.at(i).allocations;
+    stages.back().peak_bytes =
+        std::max(stages.back().peak_bytes, stages.at(i).peak_bytes);
+  }
+
+  results.insert(results.end(), stages.begin(), stages.end());
+
+  // The scan index is not updated, so every file is recognized each time
+  base::FileSearchOptions options;
+  options.log_errors = false;
+
+  auto pipeline = Measure(L"Scanner (pipeline)", kIterations,
+      [&]() {
+        size_t items = 0;
+        track::ScanDirectoryTree(root, options, true,
+            [&items](track::ScanResult& result) {
+              items += result.directory.files.size();
+              return false;
+            });
+        return items;
+      });
+
+  // Checked separately, so as not to add to the time
+  ScannerAccuracy accuracy{files};
+  track::ScanDirectoryTree(root, options, true,
+      [&accuracy](track::ScanResult& result) {
+        const auto& path = result.path;
+        for (const auto& file : result.directory.files) {
+          accuracy.Add(AddTrailingSlash(path) + file.name, file.anime_id,
+                       file.episode_low);
+        }
+        return false;
+      });
+  pipeline.details = accuracy.Format();
+
+  results.push_back(std::move(pipeline));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Run() {
+  std::vector<Result> results;
+
+  FeedParser(results);
+  FeedPipeline(results);
+  StreamDetection(results);
+  SyncParser(results);
+  FileTree(results);
+  LibraryScanner(results);
+
+  std::wstring report;
+  for (const auto& result : results) {
+    const auto line = FormatResult(result);
+    LOGI(line);
+    report += line + L"\r\n";
+  }
+
+  SaveToFile(WstrToStr(report), GetPath(Path::Test) + L"benchmark.txt");
+}
+
+void Replay() {
+  const auto path = GetPath(Path::Test) + L"feed\\";
+  std::vector<std::wstring> files;
+  PopulateFiles(files, path, L"xml");
+
+  const bool profiling = track::feed_filter_manager.IsProfiling();
+  track::feed_filter_manager.SetProfiling(true);
+
+  for (const auto& file : files) {
+    std::string data;
+    if (!ReadFromFile(path + file, data))
+      continue;
+
+    track::Feed feed;
+    feed.Load(data);
+
+    track::feed_filter_manager.ResetProfile();
+    const Stopwatch stopwatch;
+    track::aggregator.ExamineData(feed);
+    const auto elapsed = stopwatch.Elapsed();
+
+    const auto selected = std::count_if(
+        feed.items.begin(), feed.items.end(), [](const auto& item) {
+          return item.state == track::FeedItemState::Selected;
+        });
+    LOGI(L"{}: {} items, {} selected, {:.3f} ms", file, feed.items.size(),
+         selected, elapsed);
+    track::feed_filter_manager.LogProfile();
+
+    SaveToFile(track::feed_filter_manager.ExportProfile(),
+               path + GetFileWithoutExtension(file) + L".profile.json");
+  }
+
+  track::feed_filter_manager.SetProfiling(profiling);
+}
+
+}  // namespace taiga::benchmark
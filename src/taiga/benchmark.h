@@ -0,0 +1,80 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace taiga::benchmark {
+
+class Stopwatch {
+public:
+  using clock_t = std::chrono::steady_clock;
+  using duration_t =
+      std::chrono::duration<double, std::chrono::milliseconds::period>;
+
+  double Elapsed() const;  // in milliseconds
+  void Reset();
+
+private:
+  clock_t::time_point t0_{clock_t::now()};
+};
+
+// Counts heap allocations made on any thread during its lifetime, and tracks
+// the peak number of bytes allocated on top of what was there at the start.
+// Only available in debug builds, where the CRT allows us to hook into
+// allocations.
+class AllocationCounter {
+public:
+  AllocationCounter();
+  ~AllocationCounter();
+
+  static bool IsAvailable();
+
+  size_t count() const;
+  size_t peak_bytes() const;
+
+private:
+  size_t initial_count_ = 0;
+  ptrdiff_t initial_bytes_ = 0;
+};
+
+struct Result {
+  std::wstring name;
+  size_t items = 0;             // per iteration
+  size_t allocations = 0;       // in total
+  size_t peak_bytes = 0;        // highest of all iterations
+  std::vector<double> samples;  // in milliseconds, one per iteration
+  std::wstring details;         // e.g. the accuracy of the results
+};
+
+double Percentile(std::vector<double> samples, double percentile);
+std::wstring FormatResult(const Result& result);
+
+// Runs all benchmarks over the data found in the test directory, and writes
+// the results to the log and to a report file in the same directory.
+void Run();
+
+// Runs the feeds found in the test directory through the aggregator as if they
+// were just downloaded, and writes the feed filter profile of each one next to
+// its file.
+void Replay();
+
+}  // namespace taiga::benchmark
@@ -16,10 +16,17 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <windows.h>
+#include <algorithm>
 #include <atomic>
-#include <list>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
+#include <vector>
 
 #include "taiga/http.h"
 
@@ -30,6 +37,10 @@
 #include "base/string.h"
 #include "taiga/app.h"
 #include "taiga/config.h"
+#include "taiga/http_cache.h"
+#include "taiga/http_limiter.h"
+#include "taiga/http_metrics.h"
+#include "taiga/path.h"
 #include "taiga/settings.h"
 #include "taiga/stats.h"
 #include "ui/ui.h"
@@ -106,15 +117,129 @@ static void Debug(const curl_infotype type, std::string_view data) {
   }
 }
 
-static void SendRequest(Request request,
-                        const TransferCallback& on_transfer,
-                        const ResponseCallback& on_response,
-                        hypr::Session& session) {
+////////////////////////////////////////////////////////////////////////////////
+
+constexpr UINT WM_HTTPCOMPLETION = WM_APP + 0x40;
+
+// Completions are posted to a message-only window that is created in the main
+// thread, so that they are handled by whichever message loop is running (e.g.
+// that of a modal dialog). Only one message is posted for any number of
+// completions that are waiting to be handled.
+class CompletionQueue final {
+public:
+  void Init() {
+    WNDCLASSEX wc = {0};
+    wc.cbSize = sizeof(wc);
+    wc.lpfnWndProc = WindowProc;
+    wc.hInstance = ::GetModuleHandle(nullptr);
+    wc.lpszClassName = kClassName;
+    ::RegisterClassEx(&wc);
+
+    window_ = ::CreateWindowEx(0, kClassName, L"", 0, 0, 0, 0, 0,
+                               HWND_MESSAGE, nullptr, wc.hInstance, nullptr);
+    if (!window_) {
+      LOGE(L"Could not create completion window.");
+    }
+  }
+
+  void Shutdown() {
+    {
+      std::lock_guard lock{mutex_};
+      shutdown_ = true;
+      completions_.clear();
+    }
+
+    if (window_) {
+      ::DestroyWindow(window_);
+      window_ = nullptr;
+    }
+  }
+
+  void Push(Completion&& completion) {
+    std::lock_guard lock{mutex_};
+
+    if (shutdown_ || !window_) {
+      return;
+    }
+
+    completions_.push_back(std::move(completion));
+
+    if (!posted_) {
+      posted_ = ::PostMessage(window_, WM_HTTPCOMPLETION, 0, 0) != FALSE;
+    }
+  }
+
+  void Process() {
+    std::vector<Completion> completions;
+    {
+      std::lock_guard lock{mutex_};
+      std::swap(completions, completions_);
+      posted_ = false;
+    }
+
+    if (completions.size() > 1 && app.options.verbose) {
+      LOGD(L"Handling {} completed requests", completions.size());
+    }
+
+    for (const auto& completion : completions) {
+      completion();
+    }
+  }
+
+private:
+  static constexpr auto kClassName = L"TaigaHttpCompletion";
+
+  static LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+                                     LPARAM lParam);
+
+  std::vector<Completion> completions_;
+  std::mutex mutex_;
+  HWND window_ = nullptr;
+  bool posted_ = false;
+  bool shutdown_ = false;
+};
+
+static CompletionQueue completion_queue;
+
+LRESULT CALLBACK CompletionQueue::WindowProc(HWND hwnd, UINT uMsg,
+                                             WPARAM wParam, LPARAM lParam) {
+  if (uMsg == WM_HTTPCOMPLETION) {
+    completion_queue.Process();
+    return 0;
+  }
+  return ::DefWindowProc(hwnd, uMsg, wParam, lParam);
+}
+
+static Cache cache;
+
+////////////////////////////////////////////////////////////////////////////////
+
+using steady_clock_t = std::chrono::steady_clock;
+
+static std::chrono::microseconds GetMicroseconds(
+    const steady_clock_t::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration);
+}
+
+static Response SendRequest(Request request,
+                            const TransferCallback& on_transfer,
+                            hypr::Session& session,
+                            Sample& sample) {
   session.options = GetOptions();
   session.proxy = GetProxy();
 
+  // The first progress report with received data marks the first byte.
+  // hypr does not expose curl's own timings, so this is as close as we get.
+  const auto time_started = steady_clock_t::now();
+  std::optional<steady_clock_t::time_point> time_first_byte;
+
   session.callbacks.debug = Debug;
-  session.callbacks.transfer = on_transfer;
+  session.callbacks.transfer = [&](const Transfer& transfer) {
+    if (!time_first_byte && transfer.current > 0) {
+      time_first_byte = steady_clock_t::now();
+    }
+    return on_transfer ? on_transfer(transfer) : true;
+  };
 
   // The default header (e.g. "User-Agent: Taiga/1.0") will be used, unless
   // another value is specified in the request header
@@ -125,8 +250,26 @@ static void SendRequest(Request request,
 
   LOGD(L"URL: {}"_format(StrToWstr(hypp::to_string(request.target()))));
 
+  Cache::Entry cached;
+  if (cache.Prepare(request, cached) && cache.IsFresh(request, cached)) {
+    LOGD(L"Fresh: {}", StrToWstr(cached.url));
+    Response response;
+    cache.Restore(cached, response);
+    sample.total_time = GetMicroseconds(steady_clock_t::now() - time_started);
+    sample.status_code = response.status_code();
+    return response;
+  }
+
   auto response = session.send(request);  // blocks
 
+  sample.total_time = GetMicroseconds(steady_clock_t::now() - time_started);
+  if (time_first_byte) {
+    sample.time_to_first_byte =
+        GetMicroseconds(*time_first_byte - time_started);
+  }
+  sample.bytes_in = response.body().size();
+  sample.bytes_out = request.body().size();
+
   // @TODO: Remove once hypr is able to do this automatically
   const auto content_encoding = response.header("content-encoding");
   if (content_encoding.find("gzip") != content_encoding.npos) {
@@ -138,213 +281,306 @@ static void SendRequest(Request request,
     }
   }
 
-  // @TODO: Do the rest in the main thread
+  // Replaces "304 Not Modified" responses with the cached ones
+  cache.Handle(request, cached, response);
 
   if (response.error()) {
     LOGE(util::to_string(response.error(), util::GetUrlHost(response.url())));
     taiga::stats.connections_failed++;
+    sample.transport_error = true;
   } else {
     taiga::stats.connections_succeeded++;
+    sample.status_code = response.status_code();
   }
 
-  if (on_response) {
-    on_response(response);
-  }
+  return response;
+}
 
-  ProcessQueue();
+struct QueuedRequest {
+  Request request;
+  TransferCallback on_transfer;
+  CompletionCallback on_complete;
+
+  std::string label;
+  Priority priority = Priority::Normal;
+  int attempt = 0;
+  steady_clock_t::time_point time_queued;
+  steady_clock_t::time_point not_before;  // when retried
+  bool waited_for_host_limit = false;
+  bool waited_for_pool_limit = false;
 };
 
-class Client final {
-public:
-  enum class State {
-    Ready,
-    Busy,
-    Cancelled,
-  };
-
-  Client() = default;
-
-  Client::~Client() {
-    Cancel();
-    if (thread_.joinable()) {
-      thread_.join();
-    }
-  }
-
-  void Cancel() {
-    if (state_ == State::Busy) {
-      state_ = State::Cancelled;
-    }
-  }
-
-  void Send(const Request& request,
-            const TransferCallback& on_transfer,
-            const ResponseCallback& on_response) {
-    state_ = State::Busy;
-
-    if (thread_.joinable()) {
-      thread_.join();
-    }
-
-    const auto transfer_callback = [=](const Transfer& transfer) {
-      if (state_ == State::Cancelled) {
-        return false;
-      }
-      return on_transfer ? on_transfer(transfer) : true;
-    };
-
-    thread_ = std::thread([=]() {
-      SendRequest(request, transfer_callback, on_response, session_);
-      state_ = State::Ready;
-    });
+static void Complete(const QueuedRequest& item, Response&& response) {
+  if (!item.on_complete) {
+    return;
   }
 
-  State state() const {
-    return state_;
+  if (auto completion = item.on_complete(std::move(response))) {
+    completion_queue.Push(
+        [label = item.label, priority = item.priority,
+         completion = std::move(completion)]() {
+          const MetricsScope metrics_scope{label};
+          const PriorityScope priority_scope{priority};
+          completion();
+        });
   }
+}
 
-private:
-  hypr::Session session_;
-  std::atomic<State> state_ = State::Ready;
-  std::thread thread_;
-};
-
-struct QueuedRequest {
-  Request request;
-  TransferCallback on_transfer;
-  ResponseCallback on_response;
-};
-
+// Requests are sent by a fixed number of long-lived worker threads, rather
+// than a new thread per request. Workers are started on demand, and idle
+// sessions are kept per host so that their connections can be reused.
 class Pool final {
 public:
   Pool() = default;
 
   ~Pool() {
     Shutdown();
+
+    for (auto& worker : workers_) {
+      if (worker.joinable()) {
+        worker.join();
+      }
+    }
   }
 
   void AddToQueue(QueuedRequest&& item) {
-    std::lock_guard lock{mutex_};
+    {
+      std::lock_guard lock{mutex_};
 
-    if (shutdown_) {
-      LOGD(L"Shutting down...");
-      return;
-    }
+      if (shutdown_) {
+        LOGD(L"Shutting down...");
+        return;
+      }
 
-    const auto& authority = item.request.target().uri.authority;
+      const auto& authority = item.request.target().uri.authority;
 
-    if (!authority) {
-      LOGE(L"Invalid request target: {}",
-           StrToWstr(hypp::to_string(item.request.target())));
-      return;
+      if (!authority) {
+        LOGE(L"Invalid request target: {}",
+             StrToWstr(hypp::to_string(item.request.target())));
+        return;
+      }
+
+      const auto& host = authority->host;
+      item.time_queued = steady_clock_t::now();
+      if (const auto it = active_connections_.find(host);
+          it != active_connections_.end()) {
+        item.waited_for_host_limit =
+            it->second >= kMaxSimultaneousConnectionsPerHost;
+      }
+      item.waited_for_pool_limit =
+          idle_workers_ <= queued_requests_ &&
+          workers_.size() >= kMaxSimultaneousConnections;
+
+      queue_[host].push_back(std::move(item));
+      ++queued_requests_;
+
+      if (idle_workers_ < queued_requests_ &&
+          workers_.size() < kMaxSimultaneousConnections) {
+        ++idle_workers_;
+        workers_.emplace_back([this]() { WorkerProc(); });
+        if (app.options.verbose) {
+          LOGD(L"Started worker thread ({})", workers_.size());
+        }
+      }
     }
 
-    queue_[authority->host].push_back(std::move(item));
+    condition_.notify_one();
   }
 
   void ProcessQueue() {
-    std::lock_guard lock{mutex_};
+    condition_.notify_all();
+  }
 
-    if (queue_.empty()) {
-      return;
-    }
-    if (ReachedMaxConnections()) {
-      if (app.options.verbose) {
-        LOGD(L"Reached max connections");
-      }
-      return;
+  void Shutdown() {
+    {
+      std::lock_guard lock{mutex_};
+
+      shutdown_ = true;
+      queue_.clear();
+      queued_requests_ = 0;
     }
 
-    for (auto& [host, items] : queue_) {
-      for (size_t i = 0; i < items.size(); ++i) {
-        const auto& item = items[i];
+    // Transfers in progress are cancelled via their transfer callbacks
+    condition_.notify_all();
+  }
 
-        if (ReachedMaxConnections(host)) {
-          if (app.options.verbose) {
-            LOGD(L"Reached max connections for host: {}", StrToWstr(host));
-          }
-          break;
+private:
+  static constexpr size_t kMaxSimultaneousConnections = 10;
+  static constexpr size_t kMaxSimultaneousConnectionsPerHost = 6;
+
+  void WorkerProc() {
+    std::unique_lock lock{mutex_};
+
+    while (true) {
+      std::string host;
+      size_t index = 0;
+      std::optional<steady_clock_t::time_point> next_time;
+
+      // Requests that are held back by a rate limit or a retry delay wake us
+      // up when they become ready
+      while (!shutdown_ && !FindRequest(host, index, next_time)) {
+        if (next_time) {
+          condition_.wait_until(lock, *next_time);
+        } else {
+          condition_.wait(lock);
         }
+      }
+      if (shutdown_) {
+        return;
+      }
 
-        auto& client = GetClient(host);
-        client.Send(item.request, item.on_transfer, item.on_response);
-
-        items.erase(items.begin() + i--);
+      auto& items = queue_[host];
+      auto item = std::move(items.at(index));
+      items.erase(items.begin() + index);
+      --queued_requests_;
+      --idle_workers_;
+      ++active_connections_[host];
+      limiter_.Acquire(host, steady_clock_t::now());
+
+      Sample sample;
+      sample.host = host;
+      sample.label = item.label;
+      sample.queue_wait =
+          GetMicroseconds(steady_clock_t::now() - item.time_queued);
+      sample.waited_for_host_limit = item.waited_for_host_limit;
+      sample.waited_for_pool_limit = item.waited_for_pool_limit;
+
+      auto session = AcquireSession(host, sample.reused_session);
+
+      lock.unlock();
+
+      const auto transfer_callback = [this, on_transfer = item.on_transfer](
+                                         const Transfer& transfer) {
+        if (shutdown_) {
+          return false;
+        }
+        return on_transfer ? on_transfer(transfer) : true;
+      };
+
+      auto response =
+          SendRequest(item.request, transfer_callback, *session, sample);
+      metrics.Add(sample);
+
+      lock.lock();
+
+      --active_connections_[host];
+      ++idle_workers_;
+      ReleaseSession(host, std::move(session));
+
+      if (!shutdown_) {
+        const auto now = steady_clock_t::now();
+        const auto retry_delay = limiter_.OnResponse(
+            host, item.request, response, item.attempt, now);
+        if (retry_delay) {
+          LOGD(L"Retrying request in {} ms (attempt {})",
+               std::chrono::duration_cast<std::chrono::milliseconds>(
+                   *retry_delay).count(),
+               item.attempt + 1);
+          metrics.AddRetry(item.request, item.label);
+          ++item.attempt;
+          item.time_queued = now;
+          item.not_before = now + *retry_delay;
+          queue_[host].push_back(std::move(item));
+          ++queued_requests_;
+          continue;
+        }
       }
+
+      lock.unlock();
+      Complete(item, std::move(response));
+      lock.lock();
     }
   }
 
-  void Shutdown() {
-    std::lock_guard lock{mutex_};
+  // Finds the request with the highest priority among the hosts that are
+  // below their connection limit and within their rate limit. Requests of the
+  // same priority are sent in the order they were queued. If no request is
+  // ready, `next_time` is set to when the first one will be.
+  bool FindRequest(std::string& host, size_t& index,
+                   std::optional<steady_clock_t::time_point>& next_time) const {
+    const auto now = steady_clock_t::now();
+    const QueuedRequest* found = nullptr;
+    next_time.reset();
+
+    for (const auto& [queued_host, items] : queue_) {
+      if (items.empty()) {
+        continue;
+      }
+      const auto it = active_connections_.find(queued_host);
+      if (it != active_connections_.end() &&
+          it->second >= kMaxSimultaneousConnectionsPerHost) {
+        continue;  // Reached max connections for host
+      }
 
-    shutdown_ = true;
-    queue_.clear();
+      const auto host_time = limiter_.GetReadyTime(queued_host, now);
 
-    for (auto& [host, clients] : connections_) {
-      for (auto& client : clients) {
-        client.Cancel();
+      for (size_t i = 0; i < items.size(); ++i) {
+        const auto& item = items[i];
+        const auto ready_time = std::max(host_time, item.not_before);
+        if (ready_time > now) {
+          if (!next_time || ready_time < *next_time) {
+            next_time = ready_time;
+          }
+          continue;
+        }
+        if (!found || item.priority > found->priority ||
+            (item.priority == found->priority &&
+             item.time_queued < found->time_queued)) {
+          found = &item;
+          host = queued_host;
+          index = i;
+        }
       }
     }
+
+    return found != nullptr;
   }
 
-private:
-  Client& GetClient(const std::string& host) {
-    auto& clients = connections_[host];
-
-    if (settings.GetAppConnectionReuseActive()) {
-      for (auto& client : clients) {
-        if (client.state() == Client::State::Ready) {
-          if (app.options.verbose) {
-            LOGD(L"Reusing client for {}", StrToWstr(host));
-          }
-          return client;
-        }
+  std::unique_ptr<hypr::Session> AcquireSession(const std::string& host,
+                                               bool& reused) {
+    auto& sessions = idle_sessions_[host];
+
+    reused = !sessions.empty();
+
+    if (reused) {
+      auto session = std::move(sessions.back());
+      sessions.pop_back();
+      if (app.options.verbose) {
+        LOGD(L"Reusing session for {}", StrToWstr(host));
       }
+      return session;
     }
 
-    auto& client = clients.emplace_back();
     if (app.options.verbose) {
-      LOGD(L"Created new client for {} ({})", StrToWstr(host), clients.size());
+      LOGD(L"Created new session for {}", StrToWstr(host));
     }
-    return client;
+    return std::make_unique<hypr::Session>();
   }
 
-  bool ReachedMaxConnections() const {
-    constexpr size_t kMaxSimultaneousConnections = 10;
-    size_t connections = 0;
-    for (const auto& [host, clients] : connections_) {
-      for (const auto& client : clients) {
-        if (client.state() != Client::State::Ready) {
-          if (++connections == kMaxSimultaneousConnections) {
-            return true;
-          }
-        }
-      }
+  void ReleaseSession(const std::string& host,
+                      std::unique_ptr<hypr::Session> session) {
+    if (!settings.GetAppConnectionReuseActive()) {
+      return;
     }
-    return false;
-  }
 
-  bool ReachedMaxConnections(const std::string& host) const {
-    constexpr size_t kMaxSimultaneousConnectionsPerHost = 6;
-    const auto it = connections_.find(host);
-    if (it != connections_.end()) {
-      size_t connections = 0;
-      for (const auto& client : it->second) {
-        if (client.state() != Client::State::Ready) {
-          if (++connections == kMaxSimultaneousConnectionsPerHost) {
-            return true;
-          }
-        }
-      }
+    auto& sessions = idle_sessions_[host];
+    if (sessions.size() < kMaxSimultaneousConnectionsPerHost) {
+      sessions.push_back(std::move(session));
     }
-    return false;
   }
 
-  std::map<std::string, std::list<Client>> connections_;
   std::map<std::string, std::vector<QueuedRequest>> queue_;
-
+  std::map<std::string, size_t> active_connections_;
+  RateLimiter limiter_;
+  std::map<std::string, std::vector<std::unique_ptr<hypr::Session>>>
+      idle_sessions_;
+  std::vector<std::thread> workers_;
+  size_t idle_workers_ = 0;
+  size_t queued_requests_ = 0;
+
+  std::condition_variable condition_;
   std::mutex mutex_;
-  bool shutdown_ = false;
+  std::atomic<bool> shutdown_ = false;
 };
 
 }  // namespace detail
@@ -397,8 +633,25 @@ std::wstring to_string(const Transfer& transfer) {
 
 static detail::Pool pool;
 
+static thread_local Priority current_priority = Priority::Normal;
+
+PriorityScope::PriorityScope(const Priority priority)
+    : previous_{current_priority} {
+  current_priority = priority;
+}
+
+PriorityScope::~PriorityScope() {
+  current_priority = previous_;
+}
+
+Priority PriorityScope::current() {
+  return current_priority;
+}
+
 void Init() {
   hypr::init();
+  detail::completion_queue.Init();
+  detail::cache.Prune();
 }
 
 void ProcessQueue() {
@@ -407,13 +660,41 @@ void ProcessQueue() {
 
 void Shutdown() {
   pool.Shutdown();
+  detail::completion_queue.Shutdown();
+
+  // Keep the metrics of the session while debugging
+  if (app.options.debug_mode) {
+    metrics.Log();
+    SaveToFile(metrics.Export(), GetPath(Path::Data) + L"http_metrics.json");
+  }
 }
 
 void Send(const Request& request,
           const TransferCallback& on_transfer,
           const ResponseCallback& on_response) {
-  pool.AddToQueue({request, on_transfer, on_response});
+  const auto on_complete = [on_response](Response&& response) {
+    if (!on_response) {
+      return detail::Completion{};
+    }
+    auto shared_response = std::make_shared<Response>(std::move(response));
+    return detail::Completion{[on_response, shared_response]() {
+      on_response(*shared_response);
+    }};
+  };
+
+  detail::Send(request, on_transfer, on_complete);
+}
+
+namespace detail {
+
+void Send(const Request& request,
+          const TransferCallback& on_transfer,
+          const CompletionCallback& on_complete) {
+  pool.AddToQueue({request, on_transfer, on_complete,
+                   MetricsScope::current(), PriorityScope::current()});
   pool.ProcessQueue();
 }
 
+}  // namespace detail
+
 }  // namespace taiga::http
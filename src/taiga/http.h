@@ -19,7 +19,9 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 #include <string_view>
+#include <type_traits>
 
 #include <hypp.hpp>
 #include <hypr.hpp>
@@ -35,14 +37,75 @@ using Uri = hypp::Uri;
 using ResponseCallback = std::function<void(const Response&)>;
 using TransferCallback = std::function<bool(const Transfer&)>;
 
+// Whenever several requests are waiting to be sent, the ones with a higher
+// priority go first (e.g. user-initiated list updates before image downloads).
+enum class Priority {
+  Low,
+  Normal,
+  High,
+};
+
+// Requests that are sent from the current thread while a scope is alive get its
+// priority. Completions are handled within the scope of their request, so that
+// follow-up requests keep the same priority.
+class PriorityScope {
+public:
+  explicit PriorityScope(const Priority priority);
+  ~PriorityScope();
+
+  PriorityScope(const PriorityScope&) = delete;
+  PriorityScope& operator=(const PriorityScope&) = delete;
+
+  static Priority current();
+
+private:
+  Priority previous_;
+};
+
+namespace detail {
+
+// Called in a worker thread with the response. Returns the function that is
+// to be called in the main thread, if any.
+using Completion = std::function<void()>;
+using CompletionCallback = std::function<Completion(Response&&)>;
+
+void Send(const Request& request,
+          const TransferCallback& on_transfer,
+          const CompletionCallback& on_complete);
+
+}  // namespace detail
+
 void Init();
 void ProcessQueue();
 void Shutdown();
 
+// Responses are handled in the main thread. Completed requests are queued and
+// handled together, whenever the main thread gets to process its messages.
 void Send(const Request& request,
           const TransferCallback& on_transfer,
           const ResponseCallback& on_response);
 
+// Calls on_parse in the worker thread, then passes its result to on_response
+// in the main thread. Expensive work that does not touch shared state (e.g.
+// parsing the response body) should be done in on_parse.
+template <typename ParseCallback, typename Callback>
+void Send(const Request& request,
+          const TransferCallback& on_transfer,
+          ParseCallback on_parse,
+          Callback on_response) {
+  using result_t = std::invoke_result_t<ParseCallback, const Response&>;
+
+  const auto on_complete = [on_parse, on_response](Response&& response) {
+    auto result = std::make_shared<result_t>(on_parse(response));
+    auto shared_response = std::make_shared<Response>(std::move(response));
+    return detail::Completion{[on_response, shared_response, result]() {
+      on_response(*shared_response, *result);
+    }};
+  };
+
+  detail::Send(request, on_transfer, on_complete);
+}
+
 namespace util {
 
 std::wstring GetUrlHost(const Uri& uri);
@@ -0,0 +1,249 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <filesystem>
+
+#include <nstd/string.hpp>
+
+#include "taiga/http_cache.h"
+
+#include "base/file.h"
+#include "base/format.h"
+#include "base/gzip.h"
+#include "base/json.h"
+#include "base/log.h"
+#include "base/string.h"
+#include "taiga/path.h"
+
+namespace taiga::http {
+
+constexpr unsigned long kMaxEntryAge = 60 * 60 * 24 * 30;  // 30 days
+
+// A "304 Not Modified" response does not repeat the headers that describe the
+// body, so they are stored along with it.
+constexpr const char* kEntryHeaders[] = {
+  "content-disposition",
+  "content-language",
+  "content-type",
+};
+
+static std::wstring GetCachePath() {
+  return GetPath(Path::Cache) + L"http\\";
+}
+
+static std::string GetHeader(const Response& response, const char* name) {
+  return nstd::tolower_string(std::string{response.header(name)});
+}
+
+// "no-cache" means that the response must be revalidated each time it is used,
+// which is what we do with responses that have no max-age anyway.
+static std::time_t ParseMaxAge(const std::string& cache_control) {
+  if (cache_control.find("no-cache") != cache_control.npos)
+    return 0;
+  const auto pos = cache_control.find("max-age=");
+  if (pos == cache_control.npos)
+    return 0;
+  return static_cast<std::time_t>(
+      std::strtoll(cache_control.c_str() + pos + 8, nullptr, 10));
+}
+
+bool Cache::Prepare(Request& request, Entry& entry) const {
+  if (request.method() != "GET")
+    return false;
+
+  if (!Read(GetEntryPath(request), entry))
+    return false;
+
+  if (!entry.etag.empty() && request.header("if-none-match").empty())
+    request.set_header("If-None-Match", entry.etag);
+  if (!entry.last_modified.empty() &&
+      request.header("if-modified-since").empty())
+    request.set_header("If-Modified-Since", entry.last_modified);
+
+  return true;
+}
+
+bool Cache::IsFresh(const Request& request, const Entry& entry) const {
+  const auto cache_control =
+      nstd::tolower_string(std::string{request.header("cache-control")});
+  if (cache_control.find("no-cache") != cache_control.npos)
+    return false;
+
+  const auto now = std::time(nullptr);
+  return entry.date && entry.max_age > 0 && entry.date <= now &&
+         now - entry.date < entry.max_age;
+}
+
+void Cache::Restore(const Entry& entry, Response& response) const {
+  response.set_status_code(200);
+  response.body() = entry.body;
+  for (const auto& [name, value] : entry.headers) {
+    if (response.header(name).empty())
+      response.set_header(name, value);
+  }
+}
+
+void Cache::Handle(const Request& request, const Entry& entry,
+                   Response& response) const {
+  if (response.error() || request.method() != "GET")
+    return;
+
+  const auto path = GetEntryPath(request);
+  const auto cache_control = GetHeader(response, "cache-control");
+
+  if (response.status_code() == 304) {
+    if (entry.date) {
+      LOGD(L"Not modified: {}", StrToWstr(entry.url));
+      Restore(entry, response);
+
+      Entry validated = entry;
+      validated.date = std::time(nullptr);
+      validated.max_age = ParseMaxAge(cache_control);
+      Write(path, validated);
+    }
+    return;
+  }
+
+  if (response.status_code() != 200)
+    return;
+
+  // Images are already stored in the database directory
+  if (nstd::starts_with(GetHeader(response, "content-type"), "image/"))
+    return;
+  if (cache_control.find("no-store") != cache_control.npos)
+    return;
+
+  Entry new_entry;
+  new_entry.etag = response.header("etag");
+  new_entry.last_modified = response.header("last-modified");
+  new_entry.max_age = ParseMaxAge(cache_control);
+  if (new_entry.etag.empty() && new_entry.last_modified.empty() &&
+      !new_entry.max_age)
+    return;
+
+  new_entry.url = hypp::to_string(request.target());
+  new_entry.date = std::time(nullptr);
+  for (const auto name : kEntryHeaders) {
+    if (const auto value = response.header(name); !value.empty())
+      new_entry.headers[name] = std::string{value};
+  }
+  new_entry.body = response.body();
+  Write(path, new_entry);
+}
+
+void Cache::Prune() const {
+  const auto path = GetCachePath();
+
+  std::vector<std::wstring> files;
+  PopulateFiles(files, path);
+
+  // Entries are rewritten each time they are validated
+  for (const auto& file : files) {
+    if (GetFileAge(path + file) > kMaxEntryAge) {
+      std::error_code error_code;
+      std::filesystem::remove(path + file, error_code);
+    }
+  }
+}
+
+// Entries are addressed by a 64-bit FNV-1a hash of the request method, target
+// and authorization, so that responses for different users are kept apart.
+std::wstring Cache::GetEntryPath(const Request& request) const {
+  const auto key = "{} {}\n{}"_format(request.method(),
+                                      hypp::to_string(request.target()),
+                                      request.header("authorization"));
+
+  uint64_t hash = 14695981039346656037ull;
+  for (const auto c : key) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ull;
+  }
+
+  return GetCachePath() + L"{:016x}"_format(hash);
+}
+
+// The first line of an entry is its metadata, followed by the body compressed
+// with zlib.
+
+bool Cache::Read(const std::wstring& path, Entry& entry) const {
+  std::string data;
+  if (!ReadFromFile(path, data))
+    return false;
+
+  const auto pos = data.find('\n');
+  if (pos == data.npos)
+    return false;
+
+  Json metadata;
+  if (!JsonParseString(data.substr(0, pos), metadata))
+    return false;
+
+  entry.url = JsonReadStr(metadata, "url");
+  entry.etag = JsonReadStr(metadata, "etag");
+  entry.last_modified = JsonReadStr(metadata, "last_modified");
+  entry.date = static_cast<std::time_t>(JsonReadDouble(metadata, "date"));
+  entry.max_age = static_cast<std::time_t>(JsonReadDouble(metadata, "max_age"));
+  entry.headers.clear();
+  if (const auto it = metadata.find("headers");
+      it != metadata.end() && it->is_object()) {
+    for (const auto& item : it->items()) {
+      if (item.value().is_string())
+        entry.headers[item.key()] = item.value().get<std::string>();
+    }
+  }
+
+  const auto size = static_cast<size_t>(JsonReadDouble(metadata, "size"));
+  return InflateString(data.substr(pos + 1), entry.body, size) &&
+         entry.body.size() == size;
+}
+
+bool Cache::Write(const std::wstring& path, const Entry& entry) const {
+  std::string body;
+  if (!DeflateString(entry.body, body))
+    return false;
+
+  const Json metadata{
+    {"url", entry.url},
+    {"etag", entry.etag},
+    {"last_modified", entry.last_modified},
+    {"date", entry.date},
+    {"max_age", entry.max_age},
+    {"headers", entry.headers},
+    {"size", entry.body.size()},
+  };
+
+  // Write to a temporary file first, as another thread might be reading the
+  // same entry. Each write gets its own file, as another thread might also be
+  // writing it.
+  static std::atomic<unsigned int> write_count{0};
+  const auto temp_path = L"{}.{}.tmp"_format(path, ++write_count);
+  if (!SaveToFile(metadata.dump() + '\n' + body, temp_path))
+    return false;
+
+  std::error_code error_code;
+  std::filesystem::rename(temp_path, path, error_code);
+  if (error_code) {
+    std::filesystem::remove(temp_path, error_code);
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace taiga::http
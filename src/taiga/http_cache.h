@@ -0,0 +1,74 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <ctime>
+#include <map>
+#include <string>
+
+#include "taiga/http.h"
+
+namespace taiga::http {
+
+// Keeps the responses of GET requests that can be revalidated (i.e. the ones
+// that come with an ETag or Last-Modified header) or that are fresh for a while
+// (Cache-Control: max-age) in the data directory. Fresh entries are served
+// without a request, and the others make later requests conditional. Entries
+// are addressed by a hash of the request, and their bodies are compressed.
+//
+// All functions can be called from worker threads.
+class Cache {
+public:
+  struct Entry {
+    std::string url;
+    std::string etag;
+    std::string last_modified;
+    std::time_t date = 0;     // when the response was last validated
+    std::time_t max_age = 0;  // in seconds, from the Cache-Control header
+    std::map<std::string, std::string> headers;  // e.g. Content-Type
+    std::string body;
+  };
+
+  // Reads the cached response for the request, and adds its validators to
+  // the request headers.
+  bool Prepare(Request& request, Entry& entry) const;
+
+  // Returns true if the entry can be served without asking the server, which
+  // the request can prevent with "Cache-Control: no-cache".
+  bool IsFresh(const Request& request, const Entry& entry) const;
+
+  // Fills the response with the cached status, headers and body.
+  void Restore(const Entry& entry, Response& response) const;
+
+  // Replaces a "304 Not Modified" response with the cached one, including the
+  // headers that describe its body, or stores a new response that can be
+  // revalidated.
+  void Handle(const Request& request, const Entry& entry,
+              Response& response) const;
+
+  // Removes the entries that have not been validated for a month.
+  void Prune() const;
+
+private:
+  std::wstring GetEntryPath(const Request& request) const;
+  bool Read(const std::wstring& path, Entry& entry) const;
+  bool Write(const std::wstring& path, const Entry& entry) const;
+};
+
+}  // namespace taiga::http
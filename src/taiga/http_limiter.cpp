@@ -0,0 +1,200 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+#include <ctime>
+
+#include "taiga/http_limiter.h"
+
+#include "base/log.h"
+#include "base/random.h"
+#include "base/string.h"
+#include "base/time.h"
+
+namespace taiga::http {
+
+// Servers usually count requests per minute, but do not say so
+constexpr auto kDefaultWindow = std::chrono::seconds{60};
+
+// Bursts are kept within the number of connections we open to a host anyway
+constexpr double kMaxBurst = 6.0;
+
+constexpr int kMaxRetries = 3;
+constexpr auto kBaseBackoff = std::chrono::seconds{1};
+constexpr auto kMaxBackoff = std::chrono::seconds{30};
+
+// Requests are not retried if the server wants us to wait longer than this,
+// but the host is still blocked for as long as it asked (up to the limit).
+constexpr auto kMaxRetryAfter = std::chrono::seconds{60};
+constexpr auto kMaxBlock = std::chrono::minutes{2};
+
+static std::optional<int> ReadHeaderInt(const Response& response,
+                                        const char* name) {
+  const auto value = std::string{response.header(name)};
+  if (value.empty() || !IsNumericString(StrToWstr(value)))
+    return std::nullopt;
+  return ToInt(value);
+}
+
+// The value of Retry-After is either a number of seconds or an HTTP date.
+// AniList also sends the time at which the limit is reset, as a timestamp.
+static std::optional<std::chrono::seconds> GetRetryAfter(
+    const Response& response) {
+  if (const auto seconds = ReadHeaderInt(response, "retry-after")) {
+    return std::chrono::seconds{std::max(*seconds, 0)};
+  }
+
+  if (const auto value = std::string{response.header("retry-after")};
+      !value.empty()) {
+    if (const auto date = ConvertRfc822(StrToWstr(value)); date != -1) {
+      return std::chrono::seconds{
+          std::max<time_t>(date - std::time(nullptr), 0)};
+    }
+  }
+
+  if (const auto reset = ReadHeaderInt(response, "x-ratelimit-reset")) {
+    return std::chrono::seconds{
+        std::max<time_t>(*reset - std::time(nullptr), 0)};
+  }
+
+  return std::nullopt;
+}
+
+static bool IsIdempotent(const Request& request) {
+  const auto method = std::string{request.method()};
+  return method == "GET" || method == "HEAD";
+}
+
+// Exponential backoff with equal jitter, so that requests that failed together
+// are not retried together.
+static RateLimiter::clock_t::duration GetBackoff(const int attempt) {
+  const auto backoff = std::min<RateLimiter::clock_t::duration>(
+      kBaseBackoff * (1 << attempt), kMaxBackoff);
+  const auto half = backoff / 2;
+  return half + std::chrono::duration_cast<RateLimiter::clock_t::duration>(
+                    half * Random::get(0.0, 1.0));
+}
+
+double RateLimiter::GetTokens(const Bucket& bucket,
+                              const clock_t::time_point now) {
+  const std::chrono::duration<double> elapsed = now - bucket.updated;
+  return std::min(bucket.capacity,
+                  bucket.tokens + bucket.rate * std::max(elapsed.count(), 0.0));
+}
+
+RateLimiter::clock_t::time_point RateLimiter::GetReadyTime(
+    const std::string& host, const clock_t::time_point now) const {
+  const auto it = buckets_.find(host);
+  if (it == buckets_.end())
+    return now;
+
+  const auto& bucket = it->second;
+  auto ready_time = std::max(now, bucket.blocked_until);
+
+  if (bucket.capacity > 0.0 && bucket.rate > 0.0) {
+    const auto tokens = GetTokens(bucket, ready_time);
+    if (tokens < 1.0) {
+      const std::chrono::duration<double> wait{(1.0 - tokens) / bucket.rate};
+      ready_time += std::chrono::duration_cast<clock_t::duration>(wait);
+    }
+  }
+
+  return ready_time;
+}
+
+void RateLimiter::Acquire(const std::string& host,
+                          const clock_t::time_point now) {
+  const auto it = buckets_.find(host);
+  if (it == buckets_.end())
+    return;
+
+  auto& bucket = it->second;
+  if (bucket.capacity > 0.0) {
+    bucket.tokens = std::max(GetTokens(bucket, now) - 1.0, 0.0);
+    bucket.updated = now;
+  }
+}
+
+std::optional<RateLimiter::clock_t::duration> RateLimiter::OnResponse(
+    const std::string& host, const Request& request, const Response& response,
+    const int attempt, const clock_t::time_point now) {
+  if (response.error())
+    return std::nullopt;  // includes cancelled transfers
+
+  auto& bucket = buckets_[host];
+
+  if (const auto limit = ReadHeaderInt(response, "x-ratelimit-limit");
+      limit && *limit > 0) {
+    if (bucket.capacity == 0.0) {
+      bucket.tokens = std::min<double>(*limit, kMaxBurst);
+      bucket.updated = now;
+    }
+    bucket.capacity = std::min<double>(*limit, kMaxBurst);
+    const std::chrono::duration<double> window = kDefaultWindow;
+    bucket.rate = *limit / window.count();
+  }
+
+  if (const auto remaining = ReadHeaderInt(response, "x-ratelimit-remaining")) {
+    bucket.tokens = std::min<double>(GetTokens(bucket, now), *remaining);
+    bucket.updated = now;
+  }
+
+  const auto status_code = response.status_code();
+  const auto retry_after = GetRetryAfter(response);
+
+  switch (status_code) {
+    case 429:  // Too Many Requests
+    case 503:  // Service Unavailable
+      if (retry_after || status_code == 429) {
+        const auto delay = retry_after.value_or(
+            std::chrono::duration_cast<std::chrono::seconds>(
+                GetBackoff(attempt)));
+        bucket.blocked_until =
+            std::max(bucket.blocked_until,
+                     now + std::min<clock_t::duration>(delay, kMaxBlock));
+        bucket.tokens = 0.0;
+        bucket.updated = now;
+        LOGW(L"{} asked us to wait {} seconds ({})", StrToWstr(host),
+             delay.count(), status_code);
+        // Jitter keeps the requests that were blocked together apart
+        if (attempt < kMaxRetries && delay <= kMaxRetryAfter)
+          return delay + GetBackoff(attempt);
+        return std::nullopt;
+      }
+      break;
+
+    case 500:  // Internal Server Error
+    case 502:  // Bad Gateway
+    case 504:  // Gateway Timeout
+      // The request might have been processed anyway
+      if (!IsIdempotent(request))
+        return std::nullopt;
+      break;
+
+    default:
+      return std::nullopt;
+  }
+
+  if (attempt < kMaxRetries)
+    return GetBackoff(attempt);
+
+  return std::nullopt;
+}
+
+}  // namespace taiga::http
@@ -0,0 +1,70 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+
+#include "taiga/http.h"
+
+namespace taiga::http {
+
+// Keeps a token bucket for each host, sized by the rate limit headers that the
+// host sends (e.g. AniList's X-RateLimit-Limit), and decides whether failed
+// requests are to be retried. Hosts that do not announce a limit are only
+// throttled after they ask us to back off.
+//
+// Not thread-safe; the pool calls it while holding its lock.
+class RateLimiter {
+public:
+  using clock_t = std::chrono::steady_clock;
+
+  // Returns the earliest time at which a request can be sent to the host.
+  clock_t::time_point GetReadyTime(const std::string& host,
+                                   const clock_t::time_point now) const;
+
+  // Takes a token from the host's bucket. Called when a request is sent.
+  void Acquire(const std::string& host, const clock_t::time_point now);
+
+  // Updates the host's bucket from the response headers. Returns the delay
+  // before the request is to be retried, if it should be retried at all.
+  std::optional<clock_t::duration> OnResponse(const std::string& host,
+                                              const Request& request,
+                                              const Response& response,
+                                              const int attempt,
+                                              const clock_t::time_point now);
+
+private:
+  struct Bucket {
+    double capacity = 0.0;  // 0 if the host has not announced a limit
+    double tokens = 0.0;
+    double rate = 0.0;      // tokens per second
+    clock_t::time_point updated;
+    clock_t::time_point blocked_until;
+  };
+
+  static double GetTokens(const Bucket& bucket, const clock_t::time_point now);
+
+  std::map<std::string, Bucket> buckets_;
+};
+
+}  // namespace taiga::http
@@ -0,0 +1,273 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+#include <cmath>
+
+#include "taiga/http_metrics.h"
+
+#include "base/format.h"
+#include "base/log.h"
+#include "base/string.h"
+
+namespace taiga::http {
+
+static void UpdateMax(std::atomic<uint64_t>& max, const uint64_t value) {
+  auto current = max.load();
+  while (value > current && !max.compare_exchange_weak(current, value)) {
+  }
+}
+
+static size_t GetBucketIndex(uint64_t value) {
+  size_t index = 0;
+  while (value) {
+    value >>= 1;
+    ++index;
+  }
+  return std::min(index, Histogram::kBucketCount - 1);
+}
+
+static uint64_t GetBucketUpperBound(const size_t index) {
+  return index ? (uint64_t{1} << index) - 1 : 0;
+}
+
+void Histogram::Add(const uint64_t value) {
+  ++buckets_[GetBucketIndex(value)];
+  ++count_;
+  sum_ += value;
+  UpdateMax(max_, value);
+}
+
+uint64_t Histogram::count() const {
+  return count_;
+}
+
+uint64_t Histogram::sum() const {
+  return sum_;
+}
+
+uint64_t Histogram::max() const {
+  return max_;
+}
+
+uint64_t Histogram::Percentile(const double percentile) const {
+  const auto count = count_.load();
+  if (!count)
+    return 0;
+
+  const auto target = static_cast<uint64_t>(
+      std::ceil(percentile / 100.0 * static_cast<double>(count)));
+
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    cumulative += buckets_[i];
+    if (cumulative >= target)
+      return std::min(GetBucketUpperBound(i), max());
+  }
+
+  return max();
+}
+
+Json Histogram::ToJson() const {
+  Json buckets = Json::array();
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    if (const uint64_t count = buckets_[i])
+      buckets.push_back({GetBucketUpperBound(i), count});
+  }
+
+  const auto count = this->count();
+
+  return {
+    {"count", count},
+    {"sum", sum()},
+    {"max", max()},
+    {"mean", count ? sum() / count : 0},
+    {"p50", Percentile(50.0)},
+    {"p90", Percentile(90.0)},
+    {"p99", Percentile(99.0)},
+    {"buckets", buckets},
+  };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Json Metrics::ToJson() const {
+  const uint64_t requests = this->requests;
+
+  return {
+    {"requests", requests},
+    {"transport_errors", transport_errors.load()},
+    {"client_errors", client_errors.load()},
+    {"server_errors", server_errors.load()},
+    {"retries", retries.load()},
+    {"reuse_ratio", requests ? static_cast<double>(reused_sessions) / requests
+                             : 0.0},
+    {"host_limit_waits", host_limit_waits.load()},
+    {"pool_limit_waits", pool_limit_waits.load()},
+    {"queue_wait_us", queue_wait.ToJson()},
+    {"time_to_first_byte_us", time_to_first_byte.ToJson()},
+    {"total_time_us", total_time.ToJson()},
+    {"bytes_in", bytes_in.ToJson()},
+    {"bytes_out", bytes_out.ToJson()},
+  };
+}
+
+static void AddSample(Metrics& metrics, const Sample& sample) {
+  metrics.queue_wait.Add(sample.queue_wait.count());
+  if (sample.time_to_first_byte.count() > 0)
+    metrics.time_to_first_byte.Add(sample.time_to_first_byte.count());
+  metrics.total_time.Add(sample.total_time.count());
+  metrics.bytes_in.Add(sample.bytes_in);
+  metrics.bytes_out.Add(sample.bytes_out);
+
+  ++metrics.requests;
+  if (sample.transport_error) {
+    ++metrics.transport_errors;
+  } else if (sample.status_code >= 500) {
+    ++metrics.server_errors;
+  } else if (sample.status_code >= 400) {
+    ++metrics.client_errors;
+  }
+  if (sample.reused_session)
+    ++metrics.reused_sessions;
+  if (sample.waited_for_host_limit)
+    ++metrics.host_limit_waits;
+  if (sample.waited_for_pool_limit)
+    ++metrics.pool_limit_waits;
+}
+
+void MetricsRegistry::Add(const Sample& sample) {
+  AddSample(total_, sample);
+  AddSample(Get(hosts_, sample.host), sample);
+  if (!sample.label.empty())
+    AddSample(Get(labels_, sample.label), sample);
+}
+
+void MetricsRegistry::AddRetry(const Request& request,
+                               const std::string& label) {
+  ++total_.retries;
+
+  if (const auto& authority = request.target().uri.authority)
+    ++Get(hosts_, authority->host).retries;
+
+  if (!label.empty())
+    ++Get(labels_, label).retries;
+}
+
+const Metrics& MetricsRegistry::total() const {
+  return total_;
+}
+
+const Metrics* MetricsRegistry::host(const std::string& host) const {
+  return Find(hosts_, host);
+}
+
+const Metrics* MetricsRegistry::label(const std::string& label) const {
+  return Find(labels_, label);
+}
+
+Json MetricsRegistry::ToJson() const {
+  Json hosts = Json::object();
+  Json labels = Json::object();
+  {
+    std::lock_guard lock{mutex_};
+    for (const auto& [host, metrics] : hosts_) {
+      hosts[host] = metrics->ToJson();
+    }
+    for (const auto& [label, metrics] : labels_) {
+      labels[label] = metrics->ToJson();
+    }
+  }
+
+  return {
+    {"total", total_.ToJson()},
+    {"hosts", hosts},
+    {"labels", labels},
+  };
+}
+
+std::string MetricsRegistry::Export() const {
+  return ToJson().dump(2);
+}
+
+void MetricsRegistry::Log() const {
+  const auto log = [](const std::string& name, const Metrics& metrics) {
+    const uint64_t requests = metrics.requests;
+    if (!requests)
+      return;
+    LOGD(L"{}: {} requests, {} errors, {:.0f}% reused | "
+         L"queue p50 {:.1f}ms, p90 {:.1f}ms | "
+         L"first byte p50 {:.1f}ms, p90 {:.1f}ms | "
+         L"total p50 {:.1f}ms, p90 {:.1f}ms | "
+         L"{} waited for host limit, {} for pool limit",
+         StrToWstr(name), requests,
+         metrics.transport_errors + metrics.client_errors +
+             metrics.server_errors,
+         100.0 * metrics.reused_sessions / requests,
+         metrics.queue_wait.Percentile(50.0) / 1000.0,
+         metrics.queue_wait.Percentile(90.0) / 1000.0,
+         metrics.time_to_first_byte.Percentile(50.0) / 1000.0,
+         metrics.time_to_first_byte.Percentile(90.0) / 1000.0,
+         metrics.total_time.Percentile(50.0) / 1000.0,
+         metrics.total_time.Percentile(90.0) / 1000.0,
+         metrics.host_limit_waits.load(), metrics.pool_limit_waits.load());
+  };
+
+  std::lock_guard lock{mutex_};
+  for (const auto& [host, metrics] : hosts_) {
+    log(host, *metrics);
+  }
+  for (const auto& [label, metrics] : labels_) {
+    log(label, *metrics);
+  }
+}
+
+Metrics& MetricsRegistry::Get(metrics_map_t& map, const std::string& key) {
+  std::lock_guard lock{mutex_};
+  auto& metrics = map[key];
+  if (!metrics)
+    metrics = std::make_unique<Metrics>();
+  return *metrics;
+}
+
+const Metrics* MetricsRegistry::Find(const metrics_map_t& map,
+                                     const std::string& key) const {
+  std::lock_guard lock{mutex_};
+  const auto it = map.find(key);
+  return it != map.end() ? it->second.get() : nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static thread_local std::string current_label;
+
+MetricsScope::MetricsScope(std::string label)
+    : previous_{std::move(current_label)} {
+  current_label = std::move(label);
+}
+
+MetricsScope::~MetricsScope() {
+  current_label = std::move(previous_);
+}
+
+const std::string& MetricsScope::current() {
+  return current_label;
+}
+
+}  // namespace taiga::http
@@ -0,0 +1,145 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "base/json.h"
+#include "taiga/http.h"
+
+namespace taiga::http {
+
+// A histogram of non-negative values with power-of-two buckets. Bucket 0 holds
+// zeros, and bucket `i` holds the values in [2^(i-1), 2^i). Values can be added
+// from any thread without locking.
+class Histogram {
+public:
+  static constexpr size_t kBucketCount = 40;
+
+  void Add(uint64_t value);
+
+  uint64_t count() const;
+  uint64_t sum() const;
+  uint64_t max() const;
+
+  // Returns the upper bound of the bucket that the percentile falls into.
+  uint64_t Percentile(double percentile) const;
+
+  Json ToJson() const;
+
+private:
+  std::array<std::atomic<uint64_t>, kBucketCount> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+// Durations are in microseconds, sizes are in bytes.
+struct Metrics {
+  Histogram queue_wait;
+  Histogram time_to_first_byte;
+  Histogram total_time;
+  Histogram bytes_in;
+  Histogram bytes_out;
+
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> transport_errors{0};
+  std::atomic<uint64_t> client_errors{0};  // 4xx
+  std::atomic<uint64_t> server_errors{0};  // 5xx
+  std::atomic<uint64_t> reused_sessions{0};
+  std::atomic<uint64_t> retries{0};
+  std::atomic<uint64_t> host_limit_waits{0};
+  std::atomic<uint64_t> pool_limit_waits{0};
+
+  Json ToJson() const;
+};
+
+// What the pool observed about a single request.
+struct Sample {
+  std::string host;
+  std::string label;
+  std::chrono::microseconds queue_wait{0};
+  std::chrono::microseconds time_to_first_byte{0};
+  std::chrono::microseconds total_time{0};
+  size_t bytes_in = 0;   // response body, before decompression
+  size_t bytes_out = 0;  // request body
+  bool transport_error = false;
+  int status_code = 0;
+  bool reused_session = false;
+  bool waited_for_host_limit = false;
+  bool waited_for_pool_limit = false;
+};
+
+// Requests that are sent from the current thread while a scope is alive are
+// also recorded under its label (e.g. the sync request type). Completions are
+// handled within the scope of their request, so that follow-up requests (e.g.
+// the next page of a list) inherit the label.
+class MetricsScope {
+public:
+  explicit MetricsScope(std::string label);
+  ~MetricsScope();
+
+  MetricsScope(const MetricsScope&) = delete;
+  MetricsScope& operator=(const MetricsScope&) = delete;
+
+  static const std::string& current();
+
+private:
+  std::string previous_;
+};
+
+// Keeps metrics in total, per host and per label. Entries are created on first
+// use and never removed, so the lock is only held while looking them up.
+class MetricsRegistry {
+public:
+  void Add(const Sample& sample);
+  void AddRetry(const Request& request,
+                const std::string& label = MetricsScope::current());
+
+  const Metrics& total() const;
+  const Metrics* host(const std::string& host) const;
+  const Metrics* label(const std::string& label) const;
+
+  Json ToJson() const;
+  std::string Export() const;
+  void Log() const;
+
+private:
+  using metrics_map_t = std::map<std::string, std::unique_ptr<Metrics>>;
+
+  Metrics& Get(metrics_map_t& map, const std::string& key);
+  const Metrics* Find(const metrics_map_t& map, const std::string& key) const;
+
+  Metrics total_;
+  metrics_map_t hosts_;
+  metrics_map_t labels_;
+  mutable std::mutex mutex_;
+};
+
+inline MetricsRegistry metrics;
+
+}  // namespace taiga::http
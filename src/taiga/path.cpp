@@ -60,6 +60,8 @@ std::wstring GetPath(Path path) {
     default:
     case Path::Data:
       return data_path;
+    case Path::Cache:
+      return data_path + L"cache\\";
     case Path::Database:
       return data_path + L"db\\";
     case Path::DatabaseAnime:
@@ -28,6 +28,7 @@ namespace taiga {
 
 enum class Path {
   Data,
+  Cache,
   Database,
   DatabaseAnime,
   DatabaseAnimeRelations,
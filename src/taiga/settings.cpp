@@ -17,6 +17,7 @@
 */
 
 #include <filesystem>
+#include <set>
 
 #include "taiga/settings.h"
 
@@ -24,6 +25,7 @@
 #include "base/string.h"
 #include "base/xml.h"
 #include "media/anime_db.h"
+#include "media/anime_folder_index.h"
 #include "media/anime_util.h"
 #include "media/library/history.h"
 #include "sync/service.h"
@@ -34,6 +36,8 @@
 #include "taiga/version.h"
 #include "track/feed_aggregator.h"
 #include "track/feed_filter_manager.h"
+#include "track/hash_index.h"
+#include "track/scan_index.h"
 #include "ui/menu.h"
 #include "ui/ui.h"
 
@@ -144,17 +148,19 @@ bool Settings::DeserializeFromXml(const std::wstring& path) {
   }
 
   // Anime items
+  anime::folder_index.Clear();
   const auto node_items = settings.child(L"anime").child(L"items");
   for (const auto item : node_items.children(L"item")) {
     const int anime_id = item.attribute(L"id").as_int();
     if (anime::IsValidId(anime_id)) {
+      anime::folder_index.Set(anime_id, item.attribute(L"folder").value());
       auto& anime_item = anime_settings_[anime_id];
-      anime_item.folder = item.attribute(L"folder").value();
       Split(item.attribute(L"titles").value(), L"; ", anime_item.synonyms);
       RemoveEmptyStrings(anime_item.synonyms);
       anime_item.use_alternative = item.attribute(L"use_alternative").as_bool();
     }
   }
+  anime::folder_index.SetLibraryFolders(library_folders_);
 
   // Media players
   const auto node_players = settings.child(L"recognition").child(L"mediaplayers");
@@ -227,17 +233,31 @@ bool Settings::SerializeToXml(const std::wstring& path) const {
   }
 
   // Anime items
-  auto items = settings.child(L"anime").append_child(L"items");
+  const auto anime_folders = anime::folder_index.GetAll();
+  std::set<int> anime_ids;
+  for (const auto& [anime_id, folder] : anime_folders) {
+    anime_ids.insert(anime_id);
+  }
   for (const auto& [anime_id, anime_item] : anime_settings_) {
-    if (anime_item.folder.empty() &&
+    anime_ids.insert(anime_id);
+  }
+
+  const AnimeSettings default_anime_settings;
+  auto items = settings.child(L"anime").append_child(L"items");
+  for (const auto anime_id : anime_ids) {
+    const auto folder_it = anime_folders.find(anime_id);
+    const auto settings_it = anime_settings_.find(anime_id);
+    const auto& anime_item = settings_it != anime_settings_.end() ?
+        settings_it->second : default_anime_settings;
+    if (folder_it == anime_folders.end() &&
         anime_item.synonyms.empty() &&
         !anime_item.use_alternative) {
       continue;
     }
     auto item = items.append_child(L"item");
     item.append_attribute(L"id") = anime_id;
-    if (!anime_item.folder.empty())
-      item.append_attribute(L"folder") = anime_item.folder.c_str();
+    if (folder_it != anime_folders.end())
+      item.append_attribute(L"folder") = folder_it->second.c_str();
     if (!anime_item.synonyms.empty())
       item.append_attribute(L"titles") = Join(anime_item.synonyms, L"; ").c_str();
     if (anime_item.use_alternative)
@@ -275,6 +295,8 @@ void Settings::ApplyChanges() {
   if (changed_account_or_service_) {
     anime::db.LoadList();
     library::history.Load();
+    track::scan_index.Load();
+    track::hash_index.Load();
     CurrentEpisode.Set(anime::ID_UNKNOWN);
     taiga::stats.CalculateAll();
     sync::InvalidateUserAuthentication();
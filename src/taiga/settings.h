@@ -56,8 +56,8 @@ public:
     int compare(const AnimeListColumn& rhs) const override;
   };
 
+  // Anime folders are kept in anime::folder_index
   struct AnimeSettings {
-    std::wstring folder;
     std::vector<std::wstring> synonyms;
     bool use_alternative = false;
   };
@@ -110,6 +110,10 @@ public:
   // Library
   int GetLibraryFileSizeThreshold() const;
   void SetLibraryFileSizeThreshold(const int bytes);
+  bool GetLibraryHashFiles() const;
+  void SetLibraryHashFiles(const bool enabled);
+  int GetLibraryHashRateLimit() const;
+  void SetLibraryHashRateLimit(const int bytes_per_second);
   std::wstring GetLibraryMediaPlayerPath() const;
   void SetLibraryMediaPlayerPath(const std::wstring& path);
   bool GetLibraryWatchFolders() const;
@@ -348,8 +352,6 @@ public:
   std::optional<AnimeListColumn> GetAnimeListColumn(const std::wstring& key) const;
   void SetAnimeListColumn(const std::wstring& key, const AnimeListColumn& column);
 
-  std::wstring GetAnimeFolder(const int id) const;
-  void SetAnimeFolder(const int id, const std::wstring& folder);
   bool GetAnimeUseAlternative(const int id) const;
   void SetAnimeUseAlternative(const int id, const bool enabled);
   std::vector<std::wstring> GetAnimeUserSynonyms(const int id) const;
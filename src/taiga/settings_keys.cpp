@@ -27,6 +27,7 @@
 #include "link/discord.h"
 #include "link/mirc.h"
 #include "media/anime_db.h"
+#include "media/anime_folder_index.h"
 #include "media/anime_season_db.h"
 #include "media/library/queue.h"
 #include "sync/service.h"
@@ -35,6 +36,7 @@
 #include "taiga/config.h"
 #include "taiga/settings.h"
 #include "track/feed_aggregator.h"
+#include "track/hasher.h"
 #include "track/monitor.h"
 #include "ui/dlg/dlg_anime_list.h"
 #include "ui/dlg/dlg_season.h"
@@ -87,6 +89,8 @@ constexpr auto kDefaultTorrentSource =
 
 // Here we assume that anything less than 10 MiB can't be a valid episode.
 constexpr int kDefaultFileSizeThreshold = 1024 * 1024 * 10;
+// Hashing files at 16 MiB/s is still well above the bitrate of any episode.
+constexpr int kDefaultHashRateLimit = 1024 * 1024 * 16;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -114,6 +118,8 @@ void Settings::InitKeyMap() const {
 
       // Library
       {AppSettingKey::LibraryFileSizeThreshold, {"anime/folders/scan/minfilesize", int{kDefaultFileSizeThreshold}}},
+      {AppSettingKey::LibraryHashFiles, {"anime/folders/scan/hash/enabled", false}},
+      {AppSettingKey::LibraryHashRateLimit, {"anime/folders/scan/hash/ratelimit", int{kDefaultHashRateLimit}}},
       {AppSettingKey::LibraryMediaPlayerPath, {"recognition/mediaplayers/launchpath", std::wstring{}}},
       {AppSettingKey::LibraryWatchFolders, {"anime/folders/watch/enabled", true}},
 
@@ -454,6 +460,24 @@ void Settings::SetLibraryFileSizeThreshold(const int bytes) {
   set_value(AppSettingKey::LibraryFileSizeThreshold, bytes);
 }
 
+bool Settings::GetLibraryHashFiles() const {
+  return value<bool>(AppSettingKey::LibraryHashFiles);
+}
+
+void Settings::SetLibraryHashFiles(const bool enabled) {
+  if (set_value(AppSettingKey::LibraryHashFiles, enabled))
+    track::hasher.Enable(enabled);
+}
+
+int Settings::GetLibraryHashRateLimit() const {
+  return value<int>(AppSettingKey::LibraryHashRateLimit);
+}
+
+void Settings::SetLibraryHashRateLimit(const int bytes_per_second) {
+  set_value(AppSettingKey::LibraryHashRateLimit, bytes_per_second);
+  track::hasher.set_rate_limit(bytes_per_second);
+}
+
 std::wstring Settings::GetLibraryMediaPlayerPath() const {
   return value<std::wstring>(AppSettingKey::LibraryMediaPlayerPath);
 }
@@ -1382,11 +1406,14 @@ std::vector<std::wstring> Settings::GetLibraryFolders() const {
 }
 
 void Settings::SetLibraryFolders(const std::vector<std::wstring>& folders) {
-  std::lock_guard lock{mutex_};
-  if (library_folders_ != folders) {
+  {
+    std::lock_guard lock{mutex_};
+    if (library_folders_ == folders)
+      return;
     library_folders_ = folders;
     modified_ = true;
   }
+  anime::folder_index.SetLibraryFolders(folders);
 }
 
 bool Settings::GetMediaPlayerEnabled(const std::wstring& player) const {
@@ -1425,21 +1452,6 @@ void Settings::SetAnimeListColumn(const std::wstring& key,
   }
 }
 
-std::wstring Settings::GetAnimeFolder(const int id) const {
-  std::lock_guard lock{mutex_};
-  const auto it = anime_settings_.find(id);
-  return it != anime_settings_.end() ? it->second.folder : std::wstring{};
-}
-
-void Settings::SetAnimeFolder(const int id, const std::wstring& folder) {
-  std::lock_guard lock{mutex_};
-  const auto it = anime_settings_.find(id);
-  if (it == anime_settings_.end() || it->second.folder != folder) {
-    anime_settings_[id].folder = folder;
-    modified_ = true;
-  }
-}
-
 bool Settings::GetAnimeUseAlternative(const int id) const {
   std::lock_guard lock{mutex_};
   const auto it = anime_settings_.find(id);
@@ -42,6 +42,8 @@ enum class AppSettingKey {
 
   // Library
   LibraryFileSizeThreshold,
+  LibraryHashFiles,
+  LibraryHashRateLimit,
   LibraryMediaPlayerPath,
   LibraryWatchFolders,
 
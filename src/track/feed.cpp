@@ -19,10 +19,10 @@
 #include "track/feed.h"
 
 #include "base/base64.h"
+#include "base/file.h"
 #include "base/html.h"
 #include "base/string.h"
 #include "base/url.h"
-#include "base/xml.h"
 #include "taiga/path.h"
 #include "track/episode_util.h"
 #include "track/feed_filter.h"
@@ -159,45 +159,43 @@ std::wstring Feed::GetDataPath() const {
 bool Feed::Load() {
   items.clear();
 
-  XmlDocument document;
+  std::string data;
   const auto path = GetDataPath() + L"feed.xml";
-  constexpr auto options = pugi::parse_default | pugi::parse_trim_pcdata;
-  const auto parse_result = XmlLoadFileToDocument(document, path, options);
-
-  if (!parse_result)
+  if (!ReadFromFile(path, data))
     return false;
 
-  Load(document);
-  return true;
+  return Load(data);
 }
 
-bool Feed::Load(const std::wstring& data) {
+bool Feed::Load(const std::string_view data) {
   items.clear();
 
-  XmlDocument document;
-  const auto parse_result = document.load_string(data.c_str());
+  rss::Reader reader{data};
+  rss::ItemView view;
 
-  if (!parse_result)
-    return false;
-
-  Load(document);
-  return true;
-}
+  while (reader.Next(view)) {
+    // All elements of an item are optional, however at least one of title or
+    // description must be present.
+    if (view.title.empty() && view.description.empty())
+      continue;
 
-void Feed::Load(const XmlDocument& document) {
-  auto rss_feed = rss::ParseDocument(document);
-  channel = rss_feed.channel;
+    items.push_back(FeedItem{rss::DecodeItem(view)});
+  }
 
-  for (auto& item : rss_feed.items) {
-    items.push_back(FeedItem{std::move(item)});
+  if (!reader.is_feed()) {
+    items.clear();
+    return false;
   }
 
+  channel = rss::DecodeChannel(reader.channel());
   source = GetFeedSource(channel.link);
 
   for (auto& item : items) {
     ParseFeedItemFromSource(source, item);
     TidyFeedItemDescription(item.description);
   }
+
+  return true;
 }
 
 }  // namespace track
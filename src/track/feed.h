@@ -21,16 +21,13 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "base/rss.h"
 #include "track/episode.h"
 #include "track/feed_source.h"
 
-namespace pugi {
-class xml_document;
-}
-
 namespace track {
 
 enum class FeedItemState {
@@ -75,14 +72,11 @@ public:
   std::wstring GetDataPath() const;
 
   bool Load();
-  bool Load(const std::wstring& data);
+  bool Load(const std::string_view data);
 
   FeedSource source = FeedSource::Unknown;
   rss::Channel channel;
   std::vector<FeedItem> items;
-
-private:
-  void Load(const pugi::xml_document& document);
 };
 
 TorrentCategory GetTorrentCategory(const FeedItem& item);
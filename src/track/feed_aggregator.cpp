@@ -17,16 +17,19 @@
 */
 
 #include <algorithm>
-#include <regex>
+#include <filesystem>
 #include <set>
 
+#include <nstd/algorithm.hpp>
 #include <nstd/string.hpp>
 
 #include "track/feed_aggregator.h"
 
+#include "base/bencode.h"
 #include "base/file.h"
 #include "base/format.h"
 #include "base/log.h"
+#include "base/regex.h"
 #include "base/string.h"
 #include "base/time.h"
 #include "base/xml.h"
@@ -92,6 +95,9 @@ bool Aggregator::CheckFeed(const std::wstring& source, bool automatic) {
   request.set_headers({
       {"Accept", "application/rss+xml, */*"},
       {"Accept-Encoding", "gzip"}});
+  // A manual check should not be answered from the cache
+  if (!automatic)
+    request.set_header("Cache-Control", "no-cache");
 
   const auto host = StrToWstr(request.target().uri.authority->host);
 
@@ -130,6 +136,12 @@ bool Aggregator::CheckFeed(const std::wstring& source, bool automatic) {
 }
 
 void Aggregator::ExamineData(Feed& feed) {
+  IdentifyItems(feed);
+  FilterItems(feed);
+  SortItems(feed);
+}
+
+void Aggregator::IdentifyItems(Feed& feed) {
   for (auto& feed_item : feed.items) {
     auto title = feed_item.title;
     switch (feed.source) {
@@ -140,10 +152,12 @@ void Aggregator::ExamineData(Feed& feed) {
         //    are only used to differentiate)
         // 2. Insert a pseudo-keyword (to make Anitomy stop there while parsing
         //    anime title)
-        std::wsmatch matches;
-        static const std::wregex pattern{L"(.+) - .+ \\[\\d{4}\\] :: (.+)"};
-        if (std::regex_match(title, matches, pattern))
-          title = matches[1].str() + L" [REMASTER] " + matches[2].str();
+        static const base::RegexSet pattern{"(.+) - .+ \\[\\d{4}\\] :: (.+)"};
+        const auto str = WstrToStr(title);
+        base::RegexSet::captures_t captures;
+        if (pattern.Match(0, str, captures))
+          title = StrToWstr(std::string{captures[1]}) + L" [REMASTER] " +
+                  StrToWstr(std::string{captures[2]});
         break;
       }
     }
@@ -177,7 +191,9 @@ void Aggregator::ExamineData(Feed& feed) {
     // Categorize
     feed_item.torrent_category = GetTorrentCategory(feed_item);
   }
+}
 
+void Aggregator::FilterItems(Feed& feed) {
   feed_filter_manager.MarkNewEpisodes(feed);
   // Preferences have lower priority, so we need to handle other filters
   // first in order to avoid discarding items that we actually want.
@@ -185,8 +201,9 @@ void Aggregator::ExamineData(Feed& feed) {
   feed_filter_manager.Filter(feed, true);
   // Archived items must be discarded after other filters are processed.
   feed_filter_manager.FilterArchived(feed);
+}
 
-  // Sort items
+void Aggregator::SortItems(Feed& feed) {
   std::stable_sort(feed.items.begin(), feed.items.end());
 }
 
@@ -194,9 +211,11 @@ bool Aggregator::Download(const FeedItem* feed_item) {
   Feed& feed = GetFeed();
 
   if (feed_item) {
-    download_queue_.push_back(feed_item->link);
-    feed_item = nullptr;
-  } else if (download_queue_.empty()) {
+    if (!nstd::contains(download_queue_, feed_item->link) &&
+        !active_downloads_.count(feed_item->link)) {
+      download_queue_.push_back(feed_item->link);
+    }
+  } else if (download_queue_.empty() && active_downloads_.empty()) {
     std::vector<const FeedItem*> selected_feed_items;
     for (const auto& item : feed.items) {
       if (item.state == FeedItemState::Selected)
@@ -233,54 +252,213 @@ bool Aggregator::Download(const FeedItem* feed_item) {
     }
   }
 
-  while (!feed_item && !download_queue_.empty()) {
-    feed_item = FindFeedItemByLink(feed, download_queue_.front());
-    if (!feed_item)
-      download_queue_.erase(download_queue_.begin());
+  return StartDownloads(feed);
+}
+
+bool Aggregator::StartDownloads(Feed& feed) {
+  constexpr size_t kMaxSimultaneousDownloads = 4;
+  constexpr size_t kMaxSimultaneousDownloadsPerHost = 2;
+
+  auto it = download_queue_.begin();
+  while (it != download_queue_.end() &&
+         active_downloads_.size() < kMaxSimultaneousDownloads) {
+    const auto feed_item = FindFeedItemByLink(feed, *it);
+
+    if (!feed_item) {
+      it = download_queue_.erase(it);
+      continue;
+    }
+
+    if (IsMagnetLink(*feed_item)) {
+      it = download_queue_.erase(it);
+      ui::ChangeStatusText(L"Opening magnet link for \"" + feed_item->title + L"\"...");
+      HandleFeedDownload(*feed_item, {});
+      continue;
+    }
+
+    const auto host = taiga::http::util::GetUrlHost(WstrToStr(*it));
+    const auto downloads_for_host = static_cast<size_t>(std::count_if(
+        active_downloads_.begin(), active_downloads_.end(),
+        [&host](const auto& pair) { return pair.second.host == host; }));
+    if (downloads_for_host >= kMaxSimultaneousDownloadsPerHost) {
+      ++it;  // Try the next item, which might be from another host
+      continue;
+    }
+
+    auto path = AddTrailingSlash(taiga::settings.GetTorrentDownloadFileLocation());
+    if (path.empty())
+      path = feed.GetDataPath();
+    auto file = feed_item->title;
+    ValidateFileName(file);
+    file = path + file + L".torrent";
+
+    // Items whose titles map to the same file would write over each other, so
+    // they are downloaded one after another
+    const bool is_file_in_use = std::any_of(
+        active_downloads_.begin(), active_downloads_.end(),
+        [&file](const auto& pair) { return IsEqual(pair.second.file, file); });
+    if (is_file_in_use) {
+      ++it;
+      continue;
+    }
+
+    active_downloads_[*it] = {host, file};
+    it = download_queue_.erase(it);
+    StartDownload(*feed_item, host, file);
   }
 
-  if (!feed_item)
-    return false;
+  // Save the archive once the queue has drained, rather than after each item
+  if (active_downloads_.empty() && archive_modified_) {
+    archive.Save();
+    archive_modified_ = false;
+  }
 
-  if (IsMagnetLink(*feed_item)) {
-    ui::ChangeStatusText(L"Opening magnet link for \"" + feed_item->title + L"\"...");
-    const std::string empty_data;
-    HandleFeedDownload(feed, empty_data);
+  return !active_downloads_.empty();
+}
 
-  } else {
-    const auto title = feed_item->title;
-    ui::ChangeStatusText(L"Downloading \"{}\"..."_format(title));
-    ui::EnableDialogInput(ui::Dialog::Torrents, false);
+// Torrent files are validated and written in the worker thread, so that the
+// main thread only has to open them.
 
-    taiga::http::Request request;
-    request.set_target(WstrToStr(feed_item->link));
-    request.set_header("Accept", "application/x-bittorrent, */*");
+static bool ValidateFeedDownload(const taiga::http::Response& response,
+                                 std::wstring& error) {
+  // Check response code
+  if (response.status_code() >= 400) {
+    if (response.status_code() == 404) {
+      error = L"File not found at " + StrToWstr(response.url());
+    } else {
+      error = L"Invalid HTTP response ({})"_format(response.status_code());
+    }
+    return false;
+  }
 
-    const auto host = taiga::http::util::GetUrlHost(request.target().uri);
+  // Check response body
+  if (StartsWith(StrToWstr(response.body()), L"<!DOCTYPE html>")) {
+    error = L"Invalid torrent file: " + StrToWstr(response.url());
+    return false;
+  }
 
-    const auto on_transfer = [title](const taiga::http::Transfer& transfer) {
-      ui::ChangeStatusText(L"Downloading \"{}\"... ({})"_format(
-          title, taiga::http::util::to_string(transfer)));
-      return true;
+  const auto verify_content_type = [&]() {
+    static const std::set<std::wstring> allowed_types{
+      L"application/x-bittorrent",
+      // The following MIME types are invalid for .torrent files, but we allow
+      // them to handle misconfigured servers.
+      L"application/force-download",
+      L"application/octet-stream",
+      L"application/torrent",
+      L"application/x-torrent",
     };
+    const auto content_type = response.header("content-type");
+    if (content_type.empty())
+      return true;  // We can't check the header if it doesn't exist
 
-    const auto on_response = [&feed, host, this](const taiga::http::Response& response) {
-      if (HandleFeedError(host, response)) {
-        return;
-      }
-      if (ValidateFeedDownload(response)) {
-        HandleFeedDownload(feed, response.body());
-      } else {
-        HandleFeedDownloadError(feed);
-      }
-    };
+    return allowed_types.count(ToLower_Copy(StrToWstr(content_type))) > 0;
+  };
 
-    taiga::http::Send(request, on_transfer, on_response);
+  auto has_content_disposition = [&]() {
+    return !response.header("content-disposition").empty();
+  };
+
+  if (!verify_content_type()) {
+    // Allow invalid MIME types when Content-Disposition field is present
+    if (!has_content_disposition()) {
+      error = L"Invalid content type: " +
+              StrToWstr(response.header("content-type"));
+      return false;
+    }
   }
 
   return true;
 }
 
+static bool SaveTorrentFile(const std::string& data, const std::wstring& file,
+                            std::wstring& error) {
+  constexpr size_t kChunkSize = 0x10000;
+
+  base::BencodeValidator validator;
+  for (size_t i = 0; i < data.size() && validator.IsValid(); i += kChunkSize) {
+    validator.Feed(std::string_view{data}.substr(i, kChunkSize));
+  }
+  if (!validator.IsTorrent()) {
+    error = L"Invalid torrent file";
+    return false;
+  }
+
+  // Write to a temporary file first, so that a partially written file is never
+  // opened by the BitTorrent client
+  const auto temp_file = file + L".part";
+  if (!SaveToFile(data, temp_file)) {
+    error = L"Could not save the torrent file";
+    return false;
+  }
+
+  std::error_code error_code;
+  std::filesystem::rename(temp_file, file, error_code);
+  if (error_code) {
+    std::filesystem::remove(temp_file, error_code);
+    error = L"Could not save the torrent file";
+    return false;
+  }
+
+  return true;
+}
+
+void Aggregator::StartDownload(FeedItem& feed_item, const std::wstring& host,
+                               const std::wstring& file) {
+  const auto title = feed_item.title;
+  const auto link = feed_item.link;
+
+  ui::ChangeStatusText(L"Downloading \"{}\"..."_format(title));
+  ui::EnableDialogInput(ui::Dialog::Torrents, false);
+
+  taiga::http::Request request;
+  request.set_target(WstrToStr(link));
+  request.set_header("Accept", "application/x-bittorrent, */*");
+
+  const auto on_transfer = [title](const taiga::http::Transfer& transfer) {
+    ui::ChangeStatusText(L"Downloading \"{}\"... ({})"_format(
+        title, taiga::http::util::to_string(transfer)));
+    return true;
+  };
+
+  const auto on_parse = [link, file](const taiga::http::Response& response) {
+    FeedDownload download{link};
+    if (!response.error() &&
+        ValidateFeedDownload(response, download.error) &&
+        SaveTorrentFile(response.body(), file, download.error)) {
+      download.file = file;
+    }
+    return download;
+  };
+
+  const auto on_response = [this, host](const taiga::http::Response& response,
+                                        const FeedDownload& download) {
+    if (HandleFeedError(host, response)) {
+      HandleFeedDownloadResult({download.link});
+    } else {
+      HandleFeedDownloadResult(download);
+    }
+  };
+
+  taiga::http::Send(request, on_transfer, on_parse, on_response);
+}
+
+void Aggregator::HandleFeedDownloadResult(const FeedDownload& download) {
+  Feed& feed = GetFeed();
+
+  active_downloads_.erase(download.link);
+
+  if (download.file.empty()) {
+    if (!download.error.empty())
+      ui::OnFeedDownloadError(download.error);
+  } else if (!FileExists(download.file)) {
+    ui::OnFeedDownloadError(L"Torrent file doesn't exist");
+  } else if (const auto feed_item = FindFeedItemByLink(feed, download.link)) {
+    HandleFeedDownload(*feed_item, download.file);
+  }
+
+  StartDownloads(feed);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 FeedItem* Aggregator::FindFeedItemByLink(Feed& feed, const std::wstring& link) {
@@ -294,11 +472,26 @@ FeedItem* Aggregator::FindFeedItemByLink(Feed& feed, const std::wstring& link) {
 
 void Aggregator::HandleFeedCheck(Feed& feed, const std::string& data,
                                  bool automatic) {
+  if (!feed.Load(data)) {
+    ui::ChangeStatusText(L"Could not read torrent feed: " + feed.channel.link);
+    ui::EnableDialogInput(ui::Dialog::Torrents, true);
+    return;
+  }
+
+  // Saved only once it is known to be a feed, so that it can be loaded later
   std::wstring file = feed.GetDataPath() + L"feed.xml";
   SaveToFile(data, file);
 
-  feed.Load(StrToWstr(data));
+  const bool profiling = feed_filter_manager.IsProfiling();
+  if (profiling)
+    feed_filter_manager.ResetProfile();
+
   ExamineData(feed);
+
+  if (profiling)
+    SaveToFile(feed_filter_manager.ExportProfile(),
+               feed.GetDataPath() + L"filter_profile.json");
+
   download_queue_.clear();
 
   bool success = false;
@@ -323,57 +516,21 @@ void Aggregator::HandleFeedCheck(Feed& feed, const std::string& data,
   }
 }
 
-void Aggregator::HandleFeedDownload(Feed& feed, const std::string& data) {
-  FeedItem* feed_item = nullptr;
-
-  if (!download_queue_.empty()) {
-    feed_item = FindFeedItemByLink(feed, download_queue_.front());
-    download_queue_.erase(download_queue_.begin());
-  }
-
-  if (!feed_item)
-    return;
-
-  std::wstring file;
-
-  if (!data.empty()) {
-    auto path = AddTrailingSlash(taiga::settings.GetTorrentDownloadFileLocation());
-    if (path.empty())
-      path = feed.GetDataPath();
-
-    file = feed_item->title;
-    ValidateFileName(file);
-    file = path + file + L".torrent";
-
-    SaveToFile(data, file);
+void Aggregator::HandleFeedDownload(FeedItem& feed_item,
+                                    const std::wstring& file) {
+  const bool is_magnet_link = IsMagnetLink(feed_item);
 
-    if (!FileExists(file)) {
-      ui::OnFeedDownloadError(L"Torrent file doesn't exist");
-      return;
-    }
-  }
-
-  const bool is_magnet_link = IsMagnetLink(*feed_item);
-
-  if (is_magnet_link) {
-    file = !feed_item->magnet_link.empty() ? feed_item->magnet_link :
-                                             feed_item->link;
-  }
-
-  feed_item->state = FeedItemState::DiscardedNormal;
-  archive.Add(feed_item->title);
-  archive.Save();
+  feed_item.state = FeedItemState::DiscardedNormal;
+  archive.Add(feed_item.title);
+  archive_modified_ = true;
   ui::OnFeedDownloadSuccess(is_magnet_link);
 
-  HandleFeedDownloadOpen(*feed_item, file);
-
-  if (!download_queue_.empty())
-    Download(nullptr);
-}
-
-void Aggregator::HandleFeedDownloadError(Feed& feed) {
-  if (!download_queue_.empty()) {
-    download_queue_.erase(download_queue_.begin());
+  if (is_magnet_link) {
+    HandleFeedDownloadOpen(feed_item, !feed_item.magnet_link.empty() ?
+                                          feed_item.magnet_link :
+                                          feed_item.link);
+  } else {
+    HandleFeedDownloadOpen(feed_item, file);
   }
 }
 
@@ -497,59 +654,6 @@ bool Aggregator::IsMagnetLink(const FeedItem& feed_item) const {
   return false;
 }
 
-bool Aggregator::ValidateFeedDownload(const taiga::http::Response& response) {
-  // Check response code
-  if (response.status_code() >= 400) {
-    if (response.status_code() == 404) {
-      ui::OnFeedDownloadError(
-          L"File not found at " + StrToWstr(response.url()));
-    } else {
-      ui::OnFeedDownloadError(
-          L"Invalid HTTP response ({})"_format(response.status_code()));
-    }
-    return false;
-  }
-
-  // Check response body
-  if (StartsWith(StrToWstr(response.body()), L"<!DOCTYPE html>")) {
-    ui::OnFeedDownloadError(L"Invalid torrent file: " +
-                            StrToWstr(response.url()));
-    return false;
-  }
-
-  const auto verify_content_type = [&]() {
-    static const std::set<std::wstring> allowed_types{
-      L"application/x-bittorrent",
-      // The following MIME types are invalid for .torrent files, but we allow
-      // them to handle misconfigured servers.
-      L"application/force-download",
-      L"application/octet-stream",
-      L"application/torrent",
-      L"application/x-torrent",
-    };
-    const auto content_type = response.header("content-type");
-    if (content_type.empty())
-      return true;  // We can't check the header if it doesn't exist
-
-    return allowed_types.count(ToLower_Copy(StrToWstr(content_type))) > 0;
-  };
-
-  auto has_content_disposition = [&]() {
-    return !response.header("content-disposition").empty();
-  };
-
-  if (!verify_content_type()) {
-    // Allow invalid MIME types when Content-Disposition field is present
-    if (!has_content_disposition()) {
-      ui::OnFeedDownloadError(L"Invalid content type: " +
-                              StrToWstr(response.header("content-type")));
-      return false;
-    }
-  }
-
-  return true;
-}
-
 ////////////////////////////////////////////////////////////////////////////////
 
 bool TorrentArchive::Load() {
@@ -18,16 +18,13 @@
 
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 
 #include "track/feed.h"
 #include "track/feed_filter.h"
 
-namespace hypr {
-class Response;
-}
-
 namespace track {
 
 enum TorrentAction {
@@ -55,6 +52,12 @@ private:
   std::vector<std::wstring> files_;
 };
 
+struct FeedDownload {
+  std::wstring link;
+  std::wstring file;   // empty if the download has failed
+  std::wstring error;  // empty if the error has already been reported
+};
+
 class Aggregator {
 public:
   Feed& GetFeed();
@@ -63,20 +66,32 @@ public:
   bool Download(const FeedItem* feed_item);
 
   void HandleFeedCheck(Feed& feed, const std::string& data, bool automatic);
-  void HandleFeedDownload(Feed& feed, const std::string& data);
-  void HandleFeedDownloadError(Feed& feed);
-  bool ValidateFeedDownload(const hypr::Response& http_response);
 
   void ExamineData(Feed& feed);
+  void IdentifyItems(Feed& feed);
+  void FilterItems(Feed& feed);
+  void SortItems(Feed& feed);
 
   TorrentArchive archive;
 
 private:
   FeedItem* FindFeedItemByLink(Feed& feed, const std::wstring& link);
+  bool StartDownloads(Feed& feed);
+  void StartDownload(FeedItem& feed_item, const std::wstring& host,
+                     const std::wstring& file);
+  void HandleFeedDownload(FeedItem& feed_item, const std::wstring& file);
+  void HandleFeedDownloadResult(const FeedDownload& download);
   void HandleFeedDownloadOpen(FeedItem& feed_item, const std::wstring& file);
   bool IsMagnetLink(const FeedItem& feed_item) const;
 
+  struct ActiveDownload {
+    std::wstring host;
+    std::wstring file;
+  };
+
   std::vector<std::wstring> download_queue_;
+  std::map<std::wstring, ActiveDownload> active_downloads_;  // link -> download
+  bool archive_modified_ = false;
   Feed feed_;
 };
 
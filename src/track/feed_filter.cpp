@@ -16,6 +16,7 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <chrono>
 #include <nstd/algorithm.hpp>
 
 #include "track/feed_filter.h"
@@ -175,6 +176,43 @@ static bool EvaluateCondition(const FeedFilterCondition& condition,
   return false;
 }
 
+static bool EvaluateCondition(const FeedFilter& filter, const size_t index,
+                              const FeedItem& item, FeedFilterStats* stats) {
+  const auto& condition = filter.conditions.at(index);
+
+  if (!stats)
+    return EvaluateCondition(condition, item);
+
+  const auto start = std::chrono::steady_clock::now();
+  const bool result = EvaluateCondition(condition, item);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  auto& condition_stats = stats->conditions.at(index);
+  condition_stats.evaluations += 1;
+  condition_stats.matches += result ? 1 : 0;
+  condition_stats.nanoseconds +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+  return result;
+}
+
+class FilterTimer {
+public:
+  explicit FilterTimer(FeedFilterStats* stats)
+      : stats_{stats}, start_{std::chrono::steady_clock::now()} {}
+  ~FilterTimer() {
+    if (stats_) {
+      const auto elapsed = std::chrono::steady_clock::now() - start_;
+      stats_->nanoseconds +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+  }
+
+private:
+  FeedFilterStats* stats_;
+  std::chrono::steady_clock::time_point start_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 
 bool ApplyFilter(const FeedFilter& filter, Feed& feed, FeedItem& item,
@@ -192,15 +230,20 @@ bool ApplyFilter(const FeedFilter& filter, Feed& feed, FeedItem& item,
     }
   }
 
+  auto stats = feed_filter_manager.GetStats(filter);
+  const FilterTimer timer{stats};
+
   bool matched = false;
+  bool decided = false;  // Whether a single condition determined the result
   size_t condition_index = 0;  // Used only for debugging purposes
 
   switch (filter.match) {
     case kFeedFilterMatchAll:
       matched = true;
       for (size_t i = 0; i < filter.conditions.size(); i++) {
-        if (!EvaluateCondition(filter.conditions.at(i), item)) {
+        if (!EvaluateCondition(filter, i, item, stats)) {
           matched = false;
+          decided = true;
           condition_index = i;
           break;
         }
@@ -209,8 +252,9 @@ bool ApplyFilter(const FeedFilter& filter, Feed& feed, FeedItem& item,
     case kFeedFilterMatchAny:
       matched = false;
       for (size_t i = 0; i < filter.conditions.size(); i++) {
-        if (EvaluateCondition(filter.conditions.at(i), item)) {
+        if (EvaluateCondition(filter, i, item, stats)) {
           matched = true;
+          decided = true;
           condition_index = i;
           break;
         }
@@ -218,6 +262,13 @@ bool ApplyFilter(const FeedFilter& filter, Feed& feed, FeedItem& item,
       break;
   }
 
+  if (stats) {
+    stats->evaluations += 1;
+    stats->matches += matched ? 1 : 0;
+    if (decided)
+      stats->conditions.at(condition_index).decisions += 1;
+  }
+
   switch (filter.action) {
     case kFeedFilterActionDiscard:
       if (matched) {
@@ -271,6 +322,9 @@ bool ApplyFilter(const FeedFilter& filter, Feed& feed, FeedItem& item,
     }
   }
 
+  if (stats)
+    stats->applications += 1;
+
   if (taiga::app.options.debug_mode) {
     item.description = L"[{}] {} -- {}"_format(
         item.IsDiscarded() ? L"\u274c" : L"\u2713",
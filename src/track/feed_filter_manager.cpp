@@ -21,6 +21,7 @@
 #include "track/feed_filter_manager.h"
 
 #include "base/format.h"
+#include "base/json.h"
 #include "base/log.h"
 #include "base/string.h"
 #include "base/xml.h"
@@ -64,6 +65,7 @@ const std::vector<FeedFilter>& FeedFilterManager::GetFilters() const {
 
 void FeedFilterManager::SetFilters(const std::vector<FeedFilter>& filters) {
   filters_ = filters;
+  ResetProfile();
 
   taiga::settings.SetModified();
 }
@@ -414,4 +416,91 @@ bool FeedFilterManager::AddDiscardFilter(int anime_id) {
   return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+bool FeedFilterManager::IsProfiling() const {
+  return profiling_;
+}
+
+void FeedFilterManager::SetProfiling(bool enabled) {
+  profiling_ = enabled;
+}
+
+void FeedFilterManager::ResetProfile() {
+  profile_.clear();
+}
+
+FeedFilterStats* FeedFilterManager::GetStats(const FeedFilter& filter) {
+  if (!profiling_ || filters_.empty())
+    return nullptr;
+
+  // Only the active filters are profiled, not the ones that are being edited
+  if (&filter < filters_.data() || &filter >= filters_.data() + filters_.size())
+    return nullptr;
+
+  if (profile_.size() != filters_.size())
+    profile_.resize(filters_.size());
+
+  auto& stats = profile_.at(&filter - filters_.data());
+  if (stats.conditions.size() != filter.conditions.size())
+    stats.conditions.resize(filter.conditions.size());
+
+  return &stats;
+}
+
+std::string FeedFilterManager::ExportProfile() const {
+  auto shortcode = [](util::Shortcode type, int index) {
+    return WstrToStr(util::GetShortcodeFromIndex(type, index));
+  };
+
+  Json filters = Json::array();
+
+  for (size_t i = 0; i < filters_.size(); ++i) {
+    const auto& filter = filters_.at(i);
+    const FeedFilterStats stats =
+        i < profile_.size() ? profile_.at(i) : FeedFilterStats{};
+
+    Json conditions = Json::array();
+    for (size_t j = 0; j < filter.conditions.size(); ++j) {
+      const auto& condition = filter.conditions.at(j);
+      const FeedFilterStats::Condition condition_stats =
+          j < stats.conditions.size() ? stats.conditions.at(j)
+                                      : FeedFilterStats::Condition{};
+      conditions.push_back({
+          {"element", shortcode(util::Shortcode::Element, condition.element)},
+          {"operator", shortcode(util::Shortcode::Operator, condition.op)},
+          {"value", WstrToStr(condition.value)},
+          {"evaluations", condition_stats.evaluations},
+          {"matches", condition_stats.matches},
+          {"decisions", condition_stats.decisions},
+          {"nanoseconds", condition_stats.nanoseconds},
+      });
+    }
+
+    filters.push_back({
+        {"name", WstrToStr(filter.name)},
+        {"enabled", filter.enabled},
+        {"action", shortcode(util::Shortcode::Action, filter.action)},
+        {"match", shortcode(util::Shortcode::Match, filter.match)},
+        {"evaluations", stats.evaluations},
+        {"matches", stats.matches},
+        {"applications", stats.applications},
+        {"nanoseconds", stats.nanoseconds},
+        {"conditions", conditions},
+    });
+  }
+
+  const Json json{{"filters", filters}};
+  return json.dump(2);
+}
+
+void FeedFilterManager::LogProfile() const {
+  for (size_t i = 0; i < filters_.size() && i < profile_.size(); ++i) {
+    const auto& stats = profile_.at(i);
+    LOGD(L"{}: {} evaluations, {} matches, {} applications, {:.3f} ms",
+         filters_.at(i).name, stats.evaluations, stats.matches,
+         stats.applications, stats.nanoseconds / 1000000.0);
+  }
+}
+
 }  // namespace track
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -29,6 +30,23 @@ class xml_node;
 
 namespace track {
 
+// Counters collected while filters are being applied. Times are inclusive of
+// any recursive preference filter evaluation.
+struct FeedFilterStats {
+  struct Condition {
+    size_t evaluations = 0;
+    size_t matches = 0;
+    size_t decisions = 0;  // number of times this condition decided the match
+    uint64_t nanoseconds = 0;
+  };
+
+  size_t evaluations = 0;
+  size_t matches = 0;
+  size_t applications = 0;  // number of times the filter affected an item
+  uint64_t nanoseconds = 0;
+  std::vector<Condition> conditions;
+};
+
 class FeedFilterManager {
 public:
   FeedFilterManager();
@@ -55,11 +73,21 @@ public:
   bool SetFansubFilter(int anime_id, const std::wstring& group_name, const std::wstring& video_resolution);
   bool AddDiscardFilter(int anime_id);
 
+  bool IsProfiling() const;
+  void SetProfiling(bool enabled);
+  void ResetProfile();
+  FeedFilterStats* GetStats(const FeedFilter& filter);
+  std::string ExportProfile() const;
+  void LogProfile() const;
+
 private:
   void InitializePresets();
 
   std::vector<FeedFilter> filters_;
   std::vector<FeedFilterPreset> presets_;
+
+  bool profiling_ = false;
+  std::vector<FeedFilterStats> profile_;
 };
 
 inline FeedFilterManager feed_filter_manager;
@@ -0,0 +1,285 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <vector>
+
+#include "track/hash_index.h"
+
+#include "base/file.h"
+#include "base/gzip.h"
+#include "base/json.h"
+#include "base/log.h"
+#include "base/string.h"
+#include "sync/service.h"
+#include "taiga/path.h"
+
+namespace track {
+
+constexpr int kHashIndexVersion = 1;
+
+static std::wstring GetHashIndexPath() {
+  return taiga::GetPath(taiga::Path::Database) + L"hash_index.dat";
+}
+
+std::wstring HashIndex::GetKey(const std::wstring& path) {
+  return ToLower_Copy(path);
+}
+
+std::string HashIndex::GetKey(const File& file) {
+  return file.ed2k + ':' + std::to_string(file.size);
+}
+
+std::optional<HashIndex::File> HashIndex::FindFile(
+    const std::wstring& path) const {
+  std::lock_guard lock{mutex_};
+  const auto it = files_.find(GetKey(path));
+  if (it == files_.end())
+    return std::nullopt;
+  return it->second;
+}
+
+void HashIndex::SetFile(const std::wstring& path, const File& file) {
+  std::lock_guard lock{mutex_};
+  modified_ = true;
+  files_[GetKey(path)] = file;
+}
+
+void HashIndex::RenameFile(const std::wstring& old_path,
+                           const std::wstring& new_path) {
+  std::lock_guard lock{mutex_};
+  const auto it = files_.find(GetKey(old_path));
+  if (it == files_.end())
+    return;
+  auto file = std::move(it->second);
+  files_.erase(it);
+  files_[GetKey(new_path)] = std::move(file);
+  modified_ = true;
+}
+
+void HashIndex::RemoveFile(const std::wstring& path) {
+  std::lock_guard lock{mutex_};
+  if (files_.erase(GetKey(path)))
+    modified_ = true;
+}
+
+void HashIndex::RenameFiles(const std::wstring& old_directory,
+                            const std::wstring& new_directory) {
+  std::lock_guard lock{mutex_};
+  const auto old_prefix = AddTrailingSlash(GetKey(old_directory));
+  const auto new_prefix = AddTrailingSlash(GetKey(new_directory));
+
+  std::vector<decltype(files_)::node_type> nodes;
+  for (auto it = files_.begin(); it != files_.end();) {
+    if (StartsWith(it->first, old_prefix)) {
+      nodes.push_back(files_.extract(it++));
+    } else {
+      ++it;
+    }
+  }
+
+  for (auto& node : nodes) {
+    node.key() = new_prefix + node.key().substr(old_prefix.size());
+    files_.insert(std::move(node));
+    modified_ = true;
+  }
+}
+
+void HashIndex::RemoveFiles(const std::wstring& directory) {
+  std::lock_guard lock{mutex_};
+  const auto prefix = AddTrailingSlash(GetKey(directory));
+
+  for (auto it = files_.begin(); it != files_.end();) {
+    if (StartsWith(it->first, prefix)) {
+      it = files_.erase(it);
+      modified_ = true;
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::optional<HashIndex::Identity> HashIndex::FindIdentity(
+    const File& file) const {
+  const auto it = identities_.find(GetKey(file));
+  if (it == identities_.end())
+    return std::nullopt;
+  return it->second;
+}
+
+std::optional<HashIndex::Identity> HashIndex::Find(const std::wstring& path,
+                                                   uint64_t size,
+                                                   uint64_t modified) const {
+  std::lock_guard lock{mutex_};
+  const auto it = files_.find(GetKey(path));
+  if (it == files_.end())
+    return std::nullopt;
+  const auto& file = it->second;
+  if (file.size != size || file.modified != modified)
+    return std::nullopt;
+  return FindIdentity(file);
+}
+
+std::optional<HashIndex::Identity> HashIndex::Find(
+    const std::wstring& path) const {
+  std::lock_guard lock{mutex_};
+  const auto it = files_.find(GetKey(path));
+  if (it == files_.end())
+    return std::nullopt;
+  return FindIdentity(it->second);
+}
+
+std::optional<HashIndex::Identity> HashIndex::Find(const File& file) const {
+  std::lock_guard lock{mutex_};
+  return FindIdentity(file);
+}
+
+void HashIndex::Set(const File& file, const Identity& identity) {
+  std::lock_guard lock{mutex_};
+  auto& current = identities_[GetKey(file)];
+  if (current.anime_id != identity.anime_id ||
+      current.episode_low != identity.episode_low ||
+      current.episode_high != identity.episode_high) {
+    current = identity;
+    modified_ = true;
+  }
+}
+
+void HashIndex::Clear() {
+  std::lock_guard lock{mutex_};
+  modified_ = modified_ || !files_.empty() || !identities_.empty();
+  files_.clear();
+  identities_.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Same format as the scan index: a line of metadata, followed by the index
+// compressed with zlib.
+
+bool HashIndex::Load() {
+  std::lock_guard lock{mutex_};
+
+  const auto service = sync::GetCurrentServiceSlug();
+
+  if (loaded_ && service_ == service)
+    return true;
+
+  files_.clear();
+  identities_.clear();
+  service_ = service;
+  loaded_ = true;
+  modified_ = false;
+
+  std::string data;
+  if (!ReadFromFile(GetHashIndexPath(), data))
+    return false;
+
+  const auto pos = data.find('\n');
+  if (pos == data.npos)
+    return false;
+
+  Json metadata;
+  if (!JsonParseString(data.substr(0, pos), metadata))
+    return false;
+  if (JsonReadInt(metadata, "version") != kHashIndexVersion ||
+      StrToWstr(JsonReadStr(metadata, "service")) != service) {
+    LOGD(L"Discarding hash index of another version or service.");
+    return false;
+  }
+
+  const auto size = static_cast<size_t>(JsonReadDouble(metadata, "size"));
+  std::string body;
+  if (!InflateString(data.substr(pos + 1), body, size) || body.size() != size)
+    return false;
+
+  Json root;
+  if (!JsonParseString(body, root) || !root.is_object())
+    return false;
+
+  try {
+    for (const auto& [key, value] :
+         root.value("files", Json::object()).items()) {
+      File file;
+      file.size = value.at(0).get<uint64_t>();
+      file.modified = value.at(1).get<uint64_t>();
+      file.crc32 = value.at(2).get<uint32_t>();
+      file.ed2k = value.at(3).get<std::string>();
+      files_[StrToWstr(key)] = std::move(file);
+    }
+
+    for (const auto& [key, value] :
+         root.value("identities", Json::object()).items()) {
+      Identity identity;
+      identity.anime_id = value.at(0).get<int>();
+      identity.episode_low = value.at(1).get<int>();
+      identity.episode_high = value.at(2).get<int>();
+      identities_[key] = identity;
+    }
+  } catch (const std::exception&) {
+    LOGW(L"Could not read hash index.");
+    files_.clear();
+    identities_.clear();
+    return false;
+  }
+
+  LOGD(L"Loaded hash index with {} files and {} identities.",
+       files_.size(), identities_.size());
+  return true;
+}
+
+bool HashIndex::Save() {
+  std::lock_guard lock{mutex_};
+
+  if (!modified_)
+    return true;
+
+  Json files = Json::object();
+  for (const auto& [key, file] : files_) {
+    files[WstrToStr(key)] = {file.size, file.modified, file.crc32, file.ed2k};
+  }
+
+  Json identities = Json::object();
+  for (const auto& [key, identity] : identities_) {
+    identities[key] = {identity.anime_id, identity.episode_low,
+                       identity.episode_high};
+  }
+
+  const Json root{
+    {"files", files},
+    {"identities", identities},
+  };
+
+  const auto body = root.dump();
+  std::string compressed;
+  if (!DeflateString(body, compressed))
+    return false;
+
+  const Json metadata{
+    {"version", kHashIndexVersion},
+    {"service", WstrToStr(service_)},
+    {"size", body.size()},
+  };
+
+  if (!SaveToFile(metadata.dump() + '\n' + compressed, GetHashIndexPath()))
+    return false;
+
+  modified_ = false;
+  return true;
+}
+
+}  // namespace track
@@ -0,0 +1,92 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "media/anime.h"
+
+namespace track {
+
+// Identifies files by their content, so that renamed files can still be
+// identified, and files that were hashed before don't need to be recognized
+// again. Hashes are computed in the background by track::hasher.
+//
+// Files are matched by path, size and modification time, the same way as in
+// the scan index. Identities are matched by ED2K hash and size.
+class HashIndex {
+public:
+  struct File {
+    uint64_t size = 0;
+    uint64_t modified = 0;
+    uint32_t crc32 = 0;
+    std::string ed2k;
+  };
+
+  struct Identity {
+    int anime_id = anime::ID_UNKNOWN;
+    int episode_low = 0;
+    int episode_high = 0;
+  };
+
+  std::optional<File> FindFile(const std::wstring& path) const;
+  void SetFile(const std::wstring& path, const File& file);
+  void RenameFile(const std::wstring& old_path, const std::wstring& new_path);
+  void RemoveFile(const std::wstring& path);
+  // Same as above, for all files inside a directory
+  void RenameFiles(const std::wstring& old_directory,
+                   const std::wstring& new_directory);
+  void RemoveFiles(const std::wstring& directory);
+
+  // Files that have changed since they were hashed are not identified. The
+  // overload without size and modification time is for files that are gone.
+  std::optional<Identity> Find(const std::wstring& path, uint64_t size,
+                               uint64_t modified) const;
+  std::optional<Identity> Find(const std::wstring& path) const;
+  std::optional<Identity> Find(const File& file) const;
+  void Set(const File& file, const Identity& identity);
+
+  void Clear();
+
+  // Anime IDs belong to the current service, so the index is discarded when
+  // the service changes.
+  bool Load();
+  bool Save();
+
+private:
+  static std::wstring GetKey(const std::wstring& path);
+  static std::string GetKey(const File& file);
+
+  std::optional<Identity> FindIdentity(const File& file) const;
+
+  std::unordered_map<std::wstring, File> files_;
+  std::unordered_map<std::string, Identity> identities_;
+  mutable std::mutex mutex_;
+  std::wstring service_;
+  bool loaded_ = false;
+  bool modified_ = false;
+};
+
+inline HashIndex hash_index;
+
+}  // namespace track
@@ -0,0 +1,288 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include <anisthesia/win_util.hpp>
+
+#include "track/hasher.h"
+
+#include "base/crypto.h"
+#include "base/file.h"
+#include "base/format.h"
+#include "base/log.h"
+#include "base/string.h"
+#include "media/anime_availability.h"
+#include "media/anime_db.h"
+#include "media/anime_item.h"
+#include "track/scan_index.h"
+
+using anisthesia::win::detail::Handle;
+
+namespace track {
+
+// Hashing is mostly waiting on the disk, and more workers would only make
+// them compete for it.
+constexpr size_t kWorkerCount = 2;
+constexpr size_t kBlockSize = 4 * 1024 * 1024;
+
+static bool GetFileInfo(const std::wstring& path, HashIndex::File& file) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!::GetFileAttributesEx(GetExtendedLengthPath(path).c_str(),
+                             GetFileExInfoStandard, &data)) {
+    return false;
+  }
+  if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    return false;
+
+  file.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) |
+              data.nFileSizeLow;
+  file.modified =
+      (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) |
+      data.ftLastWriteTime.dwLowDateTime;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Hasher::~Hasher() {
+  Stop();
+}
+
+void Hasher::Enable(bool enabled) {
+  Stop();
+
+  if (enabled) {
+    std::lock_guard lock{mutex_};
+    enabled_ = true;
+    stopping_ = false;
+    for (size_t i = 0; i < kWorkerCount; ++i) {
+      workers_.emplace_back(&Hasher::WorkerProc, this);
+    }
+  }
+}
+
+void Hasher::Stop() {
+  std::vector<std::thread> workers;
+
+  {
+    std::lock_guard lock{mutex_};
+    enabled_ = false;
+    stopping_ = true;
+    workers.swap(workers_);
+    requests_.clear();
+    queued_paths_.clear();
+  }
+
+  condition_.notify_all();
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void Hasher::Add(Request&& request) {
+  {
+    std::lock_guard lock{mutex_};
+    if (!enabled_)
+      return;
+    if (!queued_paths_.insert(ToLower_Copy(request.path)).second)
+      return;
+    requests_.push_back(std::move(request));
+  }
+
+  // Workers that are throttled wait on the same condition
+  condition_.notify_all();
+}
+
+void Hasher::Callback() {
+  std::vector<Result> results;
+  bool idle = false;
+
+  {
+    std::lock_guard lock{mutex_};
+    results.swap(results_);
+    idle = requests_.empty() && !busy_workers_;
+  }
+
+  anime::AvailabilityTransaction availability;
+
+  for (const auto& [path, identity] : results) {
+    const auto anime_item = anime::db.Find(identity.anime_id);
+    if (!anime_item)
+      continue;
+    for (int number = identity.episode_low;
+         number <= identity.episode_high; ++number) {
+      availability.Set(*anime_item, number, true, path);
+    }
+    LOGD(L"Identified by content: {}\nFile: {}", anime_item->GetTitle(), path);
+  }
+
+  availability.Commit();
+
+  if (idle) {
+    hash_index.Save();
+    scan_index.Save();  // episode availability
+  }
+}
+
+void Hasher::SetNotifyFunction(notify_function_t function) {
+  std::lock_guard lock{mutex_};
+  notify_function_ = std::move(function);
+}
+
+void Hasher::set_rate_limit(uint64_t bytes_per_second) {
+  std::lock_guard lock{mutex_};
+  rate_limit_ = bytes_per_second;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Hasher::WorkerProc() {
+  while (true) {
+    Request request;
+
+    {
+      std::unique_lock lock{mutex_};
+      condition_.wait(lock, [this] {
+        return stopping_ || !requests_.empty();
+      });
+      if (stopping_)
+        return;
+      request = std::move(requests_.front());
+      requests_.pop_front();
+      ++busy_workers_;
+    }
+
+    const bool identified = Hash(request);
+
+    notify_function_t notify_function;
+
+    {
+      std::lock_guard lock{mutex_};
+      queued_paths_.erase(ToLower_Copy(request.path));
+      --busy_workers_;
+      if (identified || (requests_.empty() && !busy_workers_))
+        notify_function = notify_function_;
+    }
+
+    if (notify_function)
+      notify_function();
+  }
+}
+
+bool Hasher::Hash(const Request& request) {
+  HashIndex::File file;
+  if (!GetFileInfo(request.path, file))
+    return false;
+
+  const auto previous = hash_index.FindFile(request.path);
+  if (previous && previous->size == file.size &&
+      previous->modified == file.modified) {
+    file = *previous;
+
+  } else {
+    if (!HashFile(request.path, file))
+      return false;
+    hash_index.SetFile(request.path, file);
+
+    if (!request.checksum.empty() &&
+        !IsEqual(request.checksum, L"{:08X}"_format(file.crc32))) {
+      LOGW(L"Checksum mismatch, file might be damaged: {}\n"
+           L"Expected: {}, computed: {:08X}",
+           request.path, request.checksum, file.crc32);
+    }
+  }
+
+  if (request.identity) {
+    hash_index.Set(file, *request.identity);
+    return false;
+  }
+
+  const auto identity = hash_index.Find(file);
+  if (!identity)
+    return false;
+
+  std::lock_guard lock{mutex_};
+  results_.push_back({request.path, *identity});
+  return true;
+}
+
+bool Hasher::HashFile(const std::wstring& path, HashIndex::File& file) {
+  // Files that are still being written can't be opened without sharing write
+  // access, which is what we want. They are hashed again once they change.
+  Handle handle{::CreateFile(GetExtendedLengthPath(path).c_str(),
+                             GENERIC_READ, FILE_SHARE_READ, nullptr,
+                             OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                             nullptr)};
+  if (handle.get() == INVALID_HANDLE_VALUE) {
+    LOGD(L"Could not open file for hashing: {}", path);
+    return false;
+  }
+
+  std::vector<char> buffer(kBlockSize);
+  uint32_t crc32 = 0;
+  Ed2kHash ed2k;
+  uint64_t size = 0;
+
+  while (true) {
+    DWORD bytes_read = 0;
+    if (!::ReadFile(handle.get(), buffer.data(),
+                    static_cast<DWORD>(buffer.size()), &bytes_read,
+                    nullptr)) {
+      LOGD(L"Could not read file for hashing: {}", path);
+      return false;
+    }
+    if (!bytes_read)
+      break;
+
+    crc32 = Crc32(crc32, buffer.data(), bytes_read);
+    ed2k.Update(buffer.data(), bytes_read);
+    size += bytes_read;
+
+    if (!Throttle(bytes_read))
+      return false;
+  }
+
+  // The file was changed while we were reading it
+  if (size != file.size)
+    return false;
+
+  file.crc32 = crc32;
+  file.ed2k = ed2k.Final();
+  return true;
+}
+
+// Each read reserves the time it takes at the current rate limit, so that the
+// limit is shared between workers.
+bool Hasher::Throttle(size_t bytes) {
+  std::unique_lock lock{mutex_};
+
+  if (rate_limit_) {
+    const auto now = clock_t::now();
+    const auto start = std::max(next_read_, now);
+    next_read_ = start + std::chrono::duration_cast<clock_t::duration>(
+        std::chrono::duration<double>(static_cast<double>(bytes) /
+                                      rate_limit_));
+    condition_.wait_until(lock, start, [this] { return stopping_; });
+  }
+
+  return !stopping_;
+}
+
+}  // namespace track
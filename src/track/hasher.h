@@ -0,0 +1,108 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <windows.h>
+
+#include "track/hash_index.h"
+
+constexpr unsigned int WM_HASHERCALLBACK = WM_APP + 0x33;
+
+namespace track {
+
+// Hashes library files in the background, so that they can be identified by
+// their content (see track::hash_index). Files are read sequentially in large
+// blocks, at a limited rate so that playback from the same disk is not
+// disturbed.
+//
+// Files that were identified by recognition add their identity to the index.
+// Files that were not are identified if the index already knows their
+// content, e.g. because they were renamed.
+class Hasher {
+public:
+  using notify_function_t = std::function<void()>;
+
+  struct Request {
+    std::wstring path;
+    std::optional<HashIndex::Identity> identity;  // as recognized
+    std::wstring checksum;  // CRC32 from the filename, if any
+  };
+
+  ~Hasher();
+
+  void Enable(bool enabled = true);
+
+  // Requests are ignored while the hasher is disabled
+  void Add(Request&& request);
+
+  // The notify function is called on a worker thread when files have been
+  // identified, or when there is nothing left to hash. It should arrange for
+  // Callback() to be called on the main thread, e.g. by posting
+  // WM_HASHERCALLBACK to a window.
+  void Callback();
+  void SetNotifyFunction(notify_function_t function);
+
+  void set_rate_limit(uint64_t bytes_per_second);
+
+private:
+  using clock_t = std::chrono::steady_clock;
+
+  struct Result {
+    std::wstring path;
+    HashIndex::Identity identity;
+  };
+
+  void Stop();
+  void WorkerProc();
+  bool Hash(const Request& request);
+  bool HashFile(const std::wstring& path, HashIndex::File& file);
+  bool Throttle(size_t bytes);
+
+  std::deque<Request> requests_;
+  std::unordered_set<std::wstring> queued_paths_;
+  std::vector<Result> results_;
+  size_t busy_workers_ = 0;
+
+  uint64_t rate_limit_ = 0;
+  clock_t::time_point next_read_;
+
+  notify_function_t notify_function_;
+
+  std::vector<std::thread> workers_;
+  std::condition_variable condition_;
+  std::mutex mutex_;
+  bool enabled_ = false;
+  bool stopping_ = false;
+};
+
+inline Hasher hasher;
+
+}  // namespace track
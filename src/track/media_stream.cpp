@@ -16,13 +16,13 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <regex>
 #include <set>
 
 #include "track/media_stream.h"
 
 #include "base/format.h"
 #include "base/process.h"
+#include "base/regex.h"
 #include "base/string.h"
 #include "base/url.h"
 #include "taiga/settings.h"
@@ -36,116 +36,112 @@ static const std::vector<StreamData> stream_data{
     Stream::Animelab,
     L"AnimeLab",
     L"https://www.animelab.com",
-    std::regex("animelab\\.com/player/"),
-    std::regex("AnimeLab - (.+)"),
+    "animelab\\.com/player/",
+    "AnimeLab - (.+)",
   },
   // Anime Digital Network
   {
     Stream::Adn,
     L"Anime Digital Network",
     L"https://animedigitalnetwork.fr/video/",
-    std::regex("animedigitalnetwork.fr/video/[^/]+/[0-9]+"),
-    std::regex("(.+) - streaming -.* ADN"),
+    "animedigitalnetwork.fr/video/[^/]+/[0-9]+",
+    "(.+) - streaming -.* ADN",
   },
   // Anime News Network
   {
     Stream::Ann,
     L"Anime News Network",
     L"https://www.animenewsnetwork.com/video/",
-    std::regex("animenewsnetwork\\.(?:com|cc)/video/[0-9]+"),
-    std::regex("(.+) - Anime News Network"),
+    "animenewsnetwork\\.(?:com|cc)/video/[0-9]+",
+    "(.+) - Anime News Network",
   },
   // Crunchyroll
   {
     Stream::Crunchyroll,
     L"Crunchyroll",
     L"http://www.crunchyroll.com",
-    std::regex(
-      "crunchyroll\\.[a-z.]+/[^/]+/(?:[^/]+/)?(?:"
-        "episode-[0-9]+.*|"
-        ".*-(?:movie|ona|ova)"
-      ")-[0-9]+"
-    ),
-    std::regex("(.+) - Watch on Crunchyroll"),
+    "crunchyroll\\.[a-z.]+/[^/]+/(?:[^/]+/)?(?:"
+      "episode-[0-9]+.*|"
+      ".*-(?:movie|ona|ova)"
+    ")-[0-9]+",
+    "(.+) - Watch on Crunchyroll",
   },
   // Funimation
   {
     Stream::Funimation,
     L"Funimation",
     L"https://www.funimation.com",
-    std::regex("funimation\\.com/shows/[^/]+/[^/]+/"),
-    std::regex("(?:Watch )?(.+) Anime.* (?:on|-) Funimation"),
+    "funimation\\.com/shows/[^/]+/[^/]+/",
+    "(?:Watch )?(.+) Anime.* (?:on|-) Funimation",
   },
   // HIDIVE
   {
     Stream::Hidive,
     L"HIDIVE",
     L"https://www.hidive.com",
-    std::regex("hidive\\.com/stream/"),
-    std::regex("Stream (.+) on HIDIVE"),
+    "hidive\\.com/stream/",
+    "Stream (.+) on HIDIVE",
   },
   // Plex Web App
   {
     Stream::Plex,
     L"Plex Web App",
     L"https://www.plex.tv",
-    std::regex(
-      "^app\\.plex\\.tv/desktop|"
-      "^[^/]*?plex\\.tv/web/|"
-      "^localhost:32400/web/|"
-      "^\\d{1,3}\\.\\d{1,3}\\.\\d{1,3}\\.\\d{1,3}:32400/web/|"
-      "^plex\\.[a-z0-9-]+\\.[a-z0-9-]+|"
-      "^[^/]*[a-z0-9-]+\\.[a-z0-9-]+/plex"
-    ),
-    std::regex(u8"Plex|(?:\u25B6 )?(.+)"),
+    "^app\\.plex\\.tv/desktop|"
+    "^[^/]*?plex\\.tv/web/|"
+    "^localhost:32400/web/|"
+    "^\\d{1,3}\\.\\d{1,3}\\.\\d{1,3}\\.\\d{1,3}:32400/web/|"
+    "^plex\\.[a-z0-9-]+\\.[a-z0-9-]+|"
+    "^[^/]*[a-z0-9-]+\\.[a-z0-9-]+/plex",
+    u8"Plex|(?:\u25B6 )?(.+)",
   },
   // Veoh
   {
     Stream::Veoh,
     L"Veoh",
     L"http://www.veoh.com",
-    std::regex("veoh\\.com/watch/"),
-    std::regex("Watch Videos Online \\| (.+) \\| Veoh\\.com"),
+    "veoh\\.com/watch/",
+    "Watch Videos Online \\| (.+) \\| Veoh\\.com",
   },
   // VIZ
   {
     Stream::Viz,
     L"VIZ",
     L"https://www.viz.com/watch",
-    std::regex("viz\\.com/watch/streaming/[^/]+-(?:episode-[0-9]+|movie)/"),
-    std::regex("(.+) // VIZ"),
+    "viz\\.com/watch/streaming/[^/]+-(?:episode-[0-9]+|movie)/",
+    "(.+) // VIZ",
   },
   // VRV
   {
     Stream::Vrv,
     L"VRV",
     L"https://vrv.co",
-    std::regex("vrv\\.co/watch/"),
-    std::regex("(.+) - Watch on VRV"),
+    "vrv\\.co/watch/",
+    "(.+) - Watch on VRV",
   },
   // Wakanim
   {
     Stream::Wakanim,
     L"Wakanim",
     L"https://www.wakanim.tv",
-    std::regex("wakanim\\.tv/[^/]+/v2/catalogue/episode/[^/]+/"),
-    std::regex("(.+) (?:auf|on|sur) Wakanim\\.TV.*"),
+    "wakanim\\.tv/[^/]+/v2/catalogue/episode/[^/]+/",
+    "(.+) (?:auf|on|sur) Wakanim\\.TV.*",
   },
   // Yahoo View
   {
     Stream::Yahoo,
     L"Yahoo View",
     L"https://view.yahoo.com",
-    std::regex("view.yahoo.com/show/[^/]+/episode/[^/]+/"),
-    std::regex("Watch .+ Free Online - (.+) \\| Yahoo View"),
+    "view.yahoo.com/show/[^/]+/episode/[^/]+/",
+    "Watch .+ Free Online - (.+) \\| Yahoo View",
   },
   // YouTube
   {
     Stream::Youtube,
     L"YouTube",
     L"https://www.youtube.com",
-    std::regex("youtube\\.com/watch"),
-    std::regex(u8"YouTube|(?:\u25B6 )?(.+) - YouTube"),
+    "youtube\\.com/watch",
+    u8"YouTube|(?:\u25B6 )?(.+) - YouTube",
   },
 };
 
@@ -229,6 +225,32 @@ void EnableStream(const Stream stream, const bool enabled) {
   }
 }
 
+// URL patterns are compiled into a single automaton, so that we can find the
+// stream in one pass while polling web browsers. Title patterns share the
+// same indices with stream data.
+
+static const base::RegexSet& GetUrlPatterns() {
+  static const base::RegexSet patterns = []() {
+    std::vector<std::string_view> patterns;
+    for (const auto& item : stream_data) {
+      patterns.push_back(item.url_pattern);
+    }
+    return base::RegexSet{patterns};
+  }();
+  return patterns;
+}
+
+static const base::RegexSet& GetTitlePatterns() {
+  static const base::RegexSet patterns = []() {
+    std::vector<std::string_view> patterns;
+    for (const auto& item : stream_data) {
+      patterns.push_back(item.title_pattern);
+    }
+    return base::RegexSet{patterns};
+  }();
+  return patterns;
+}
+
 const StreamData* FindStreamFromUrl(std::wstring url) {
   EraseLeft(url, L"http://");
   EraseLeft(url, L"https://");
@@ -238,34 +260,33 @@ const StreamData* FindStreamFromUrl(std::wstring url) {
 
   const std::string str = WstrToStr(url);
 
-  for (const auto& item : stream_data) {
-    if (std::regex_search(str, item.url_pattern)) {;
-      return IsStreamEnabled(item.id) ? &item : nullptr;
-    }
-  }
+  const auto index = GetUrlPatterns().Search(str);
+  if (index == base::RegexSet::npos)
+    return nullptr;
 
-  return nullptr;
+  const auto& item = stream_data.at(index);
+  return IsStreamEnabled(item.id) ? &item : nullptr;
 }
 
 bool ApplyStreamTitleFormat(const StreamData& stream_data, std::string& title) {
-  std::smatch match;
-  std::regex_match(title, match, stream_data.title_pattern);
+  const auto index = static_cast<size_t>(
+      &stream_data - track::recognition::stream_data.data());
+
+  base::RegexSet::captures_t captures;
+  if (!GetTitlePatterns().Match(index, title, captures))
+    return false;
 
   // Use the first non-empty match result
-  for (size_t i = 1; i < match.size(); ++i) {
-    if (!match.str(i).empty()) {
-      title = match.str(i);
+  for (size_t i = 1; i < captures.size(); ++i) {
+    if (!captures[i].empty()) {
+      title = std::string{captures[i]};
       return true;
     }
   }
 
   // Results are empty, but the match was successful
-  if (!match.empty()) {
-    title.clear();
-    return true;
-  }
-
-  return false;
+  title.clear();
+  return true;
 }
 
 void CleanStreamTitle(const StreamData& stream_data, std::string& title) {
@@ -280,15 +301,20 @@ void CleanStreamTitle(const StreamData& stream_data, std::string& title) {
       break;
     }
     case Stream::Ann: {
-      static const std::regex pattern{" \\((?:s|d)(?:, uncut)?\\)"};
-      title = std::regex_replace(title, pattern, "");
+      auto str = StrToWstr(title);
+      for (const auto suffix :
+           {L" (s)", L" (d)", L" (s, uncut)", L" (d, uncut)"}) {
+        ReplaceString(str, suffix, L"");
+      }
+      title = WstrToStr(str);
       break;
     }
     case Stream::Hidive: {
-      static const std::regex pattern{"(?:(Episode \\d+)|[^ ]+) of (.+)"};
-      std::smatch match;
-      if (std::regex_match(title, match, pattern))
-        title = match.str(2) + (match.length(1) ? " " + match.str(1) : "");
+      static const base::RegexSet pattern{"(?:(Episode \\d+)|[^ ]+) of (.+)"};
+      base::RegexSet::captures_t captures;
+      if (pattern.Match(0, title, captures))
+        title = std::string{captures[2]} +
+                (!captures[1].empty() ? " " + std::string{captures[1]} : "");
       break;
     }
     case Stream::Plex: {
@@ -304,12 +330,13 @@ void CleanStreamTitle(const StreamData& stream_data, std::string& title) {
       break;
     }
     case Stream::Wakanim: {
-      static const std::regex pattern{
+      static const base::RegexSet pattern{
           "(?:Episode (\\d+)|Film|Movie) - (?:ENGDUB - )?(.+)"};
-      std::smatch match;
-      if (std::regex_match(title, match, pattern))
-        title = match.str(2) +
-                (match.length(1) ? " - Episode " + match.str(1) : "");
+      base::RegexSet::captures_t captures;
+      if (pattern.Match(0, title, captures))
+        title = std::string{captures[2]} +
+                (!captures[1].empty()
+                     ? " - Episode " + std::string{captures[1]} : "");
       break;
     }
   }
@@ -18,8 +18,8 @@
 
 #pragma once
 
-#include <regex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace track::recognition {
@@ -44,8 +44,8 @@ struct StreamData {
   Stream id;
   std::wstring name;
   std::wstring url;
-  std::regex url_pattern;
-  std::regex title_pattern;
+  std::string_view url_pattern;    // see base::RegexSet for the syntax
+  std::string_view title_pattern;
 };
 
 const std::vector<StreamData>& GetStreamData();
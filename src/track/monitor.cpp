@@ -21,29 +21,29 @@
 #include "base/log.h"
 #include "base/string.h"
 #include "media/anime_db.h"
+#include "media/anime_folder_index.h"
 #include "taiga/settings.h"
 #include "track/episode.h"
 #include "track/episode_util.h"
+#include "track/hash_index.h"
+#include "track/hasher.h"
 #include "track/recognition.h"
 #include "track/scanner.h"
 
 namespace track {
 
 static void ChangeAnimeFolder(anime::Item& anime_item,
-                              const std::wstring& path) {
+                              const std::wstring& path,
+                              anime::AvailabilityTransaction& availability,
+                              std::set<int>& changed_folders) {
   anime_item.SetFolder(path);
-  taiga::settings.Save();
+  changed_folders.insert(anime_item.GetId());
 
   LOGD(L"Anime folder changed: {}\nPath: {}",
        anime_item.GetTitle(), anime_item.GetFolder());
 
-  if (path.empty()) {
-    for (int i = 1; i <= anime_item.GetAvailableEpisodeCount(); ++i) {
-      anime_item.SetEpisodeAvailability(i, false, path);
-    }
-  }
-
-  ScanAvailableEpisodesQuick(anime_item.GetId());
+  if (path.empty())
+    availability.Clear(anime_item);
 }
 
 static anime::Item* FindAnimeItem(
@@ -90,6 +90,30 @@ static anime::Item* FindAnimeItem(
   return anime::db.Find(anime_id);
 }
 
+// Renamed and removed files can be identified by their content, if they were
+// hashed before. Unlike recognition, this doesn't depend on their new names,
+// nor needs them to still exist.
+static std::optional<HashIndex::Identity> FindHashedFile(
+    const DirectoryChangeNotification& notification) {
+  using Action = DirectoryChangeNotification::Action;
+
+  const auto path = notification.path + notification.filename.first;
+
+  switch (notification.action) {
+    case Action::Renamed:
+      hash_index.RenameFile(notification.path + notification.filename.second,
+                            path);
+      return hash_index.Find(path);
+    case Action::Removed: {
+      const auto identity = hash_index.Find(path);
+      hash_index.RemoveFile(path);
+      return identity;
+    }
+    default:
+      return std::nullopt;
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void Monitor::Enable(bool enabled) {
@@ -104,78 +128,145 @@ void Monitor::Enable(bool enabled) {
   }
 }
 
-void Monitor::HandleChangeNotification(
-    const DirectoryChangeNotification& notification) const {
-  switch (notification.type) {
-    case DirectoryChangeNotification::Type::Directory:
-      OnDirectory(notification);
-      break;
-    case DirectoryChangeNotification::Type::File:
-      OnFile(notification);
-      break;
-    default:
-      LOGD(L"Unknown change type\nPath: {}\nFilename: {}",
-           notification.path, notification.filename.first);
-      break;
+void Monitor::HandleChangeNotifications(
+    const std::vector<DirectoryChangeNotification>& notifications) const {
+  Batch batch;
+
+  for (const auto& notification : notifications) {
+    switch (notification.type) {
+      case DirectoryChangeNotification::Type::Directory:
+        OnDirectory(notification, batch);
+        break;
+      case DirectoryChangeNotification::Type::File:
+        OnFile(notification, batch);
+        break;
+      default:
+        LOGD(L"Unknown change type\nPath: {}\nFilename: {}",
+             notification.path, notification.filename.first);
+        break;
+    }
+  }
+
+  batch.availability.Commit();
+
+  if (batch.changed_folders.empty())
+    return;
+
+  taiga::settings.Save();
+
+  for (const auto anime_id : batch.changed_folders) {
+    ScanAvailableEpisodesQuick(anime_id);
   }
 }
 
-void Monitor::OnDirectory(
-    const DirectoryChangeNotification& notification) const {
-  anime::Item* anime_item = nullptr;
+void Monitor::OnDirectory(const DirectoryChangeNotification& notification,
+                          Batch& batch) const {
+  using Action = DirectoryChangeNotification::Action;
 
-  const bool new_path_available = notification.action != FILE_ACTION_REMOVED;
-  const bool old_path_available = notification.action >= FILE_ACTION_REMOVED;
+  const bool new_path_available = notification.action != Action::Removed;
+  const bool old_path_available = notification.action != Action::Added;
 
   if (old_path_available) {
     std::wstring old_path = notification.path;
-    old_path += notification.action == FILE_ACTION_REMOVED ?
+    old_path += notification.action == Action::Removed ?
         notification.filename.first : notification.filename.second;
-    for (auto& item : anime::db.items) {
-      if (IsEqual(item.second.GetFolder(), old_path)) {
-        anime_item = &item.second;
-        break;
-      }
+
+    if (new_path_available) {
+      hash_index.RenameFiles(old_path,
+                             notification.path + notification.filename.first);
+    } else {
+      hash_index.RemoveFiles(old_path);
     }
-    if (anime_item) {
-      std::wstring new_path = notification.path + notification.filename.first;
-      ChangeAnimeFolder(*anime_item, new_path_available ? new_path : L"");
+
+    // The directory may be an anime folder, or contain several of them
+    const auto anime_ids = anime::folder_index.FindInside(old_path);
+    if (!anime_ids.empty()) {
+      const auto new_path = notification.path + notification.filename.first;
+      for (const auto anime_id : anime_ids) {
+        const auto anime_item = anime::db.Find(anime_id);
+        if (!anime_item)
+          continue;
+        const auto relative_path =
+            anime_item->GetFolder().substr(old_path.size());
+        ChangeAnimeFolder(*anime_item,
+                          new_path_available ? new_path + relative_path : L"",
+                          batch.availability, batch.changed_folders);
+      }
       return;
     }
   }
 
   if (new_path_available) {
     anime::Episode episode;
-    anime_item = FindAnimeItem(notification, episode);
+    const auto anime_item = FindAnimeItem(notification, episode);
     if (anime_item && Meow.IsValidAnimeType(episode)) {
       std::wstring new_path = notification.path + notification.filename.first;
-      ChangeAnimeFolder(*anime_item, new_path);
+      ChangeAnimeFolder(*anime_item, new_path, batch.availability,
+                        batch.changed_folders);
     }
   }
 }
 
-void Monitor::OnFile(const DirectoryChangeNotification& notification) const {
+void Monitor::OnFile(const DirectoryChangeNotification& notification,
+                     Batch& batch) const {
+  const std::wstring path = notification.path + notification.filename.first;
+  const bool path_available =
+      notification.action != DirectoryChangeNotification::Action::Removed;
+
+  // The hash index follows renamed and removed files either way
+  const auto hashed_identity = FindHashedFile(notification);
+
   anime::Episode episode;
-  const auto anime_item = FindAnimeItem(notification, episode);
+  auto anime_item = FindAnimeItem(notification, episode);
+  if (anime_item && !Meow.IsValidAnimeType(episode))
+    anime_item = nullptr;
 
-  if (!anime_item)
-    return;
-  if (!Meow.IsValidAnimeType(episode) || !Meow.IsValidFileExtension(episode))
-    return;
+  std::wstring folder;
+  int lower_bound = 0;
+  int upper_bound = 0;
+
+  if (anime_item) {
+    if (!Meow.IsValidFileExtension(episode))
+      return;
 
-  const bool path_available = notification.action != FILE_ACTION_REMOVED;
+    folder = episode.folder;
+    lower_bound = anime::GetEpisodeLow(episode);
+    upper_bound = anime::GetEpisodeHigh(episode);
+
+    // Recognition has the final say, so that a file that was misidentified
+    // once doesn't stay that way
+    if (path_available) {
+      hasher.Add({path,
+                  HashIndex::Identity{anime_item->GetId(), lower_bound,
+                                      upper_bound},
+                  episode.file_checksum()});
+    }
+
+  // Files that recognition fails for may have been identified before
+  } else if (hashed_identity) {
+    anime_item = anime::db.Find(hashed_identity->anime_id);
+    if (!anime_item)
+      return;
+
+    folder = GetPathOnly(path);
+    lower_bound = hashed_identity->episode_low;
+    upper_bound = hashed_identity->episode_high;
+
+  } else {
+    if (path_available && Meow.IsValidFileExtension(episode))
+      hasher.Add({path, std::nullopt, episode.file_checksum()});
+    return;
+  }
 
   // Set anime folder
   if (path_available && anime_item->GetFolder().empty()) {
-    ChangeAnimeFolder(*anime_item, episode.folder);
+    ChangeAnimeFolder(*anime_item, folder, batch.availability,
+                      batch.changed_folders);
   }
 
   // Set episode availability
-  const int lower_bound = anime::GetEpisodeLow(episode);
-  const int upper_bound = anime::GetEpisodeHigh(episode);
-  const std::wstring path = notification.path + notification.filename.first;
   for (int number = lower_bound; number <= upper_bound; ++number) {
-    if (anime_item->SetEpisodeAvailability(number, path_available, path)) {
+    if (batch.availability.Set(*anime_item, number, path_available, path)) {
       LOGD(L"{} #{} is {}.", anime_item->GetTitle(), number,
            path_available ? L"available" : L"unavailable");
     }
@@ -18,19 +18,33 @@
 
 #pragma once
 
+#include <set>
+#include <vector>
+
 #include "base/file_monitor.h"
+#include "media/anime_availability.h"
 
 namespace track {
 
 class Monitor : public DirectoryMonitor {
 public:
   void Enable(bool enabled = true);
-  void HandleChangeNotification(
-      const DirectoryChangeNotification& notification) const override;
+  void HandleChangeNotifications(
+      const std::vector<DirectoryChangeNotification>& notifications)
+      const override;
 
 private:
-  void OnDirectory(const DirectoryChangeNotification& notification) const;
-  void OnFile(const DirectoryChangeNotification& notification) const;
+  // Changes are collected and applied once per batch, so that each anime is
+  // rescanned and refreshed only once.
+  struct Batch {
+    anime::AvailabilityTransaction availability;
+    std::set<int> changed_folders;
+  };
+
+  void OnDirectory(const DirectoryChangeNotification& notification,
+                   Batch& batch) const;
+  void OnFile(const DirectoryChangeNotification& notification,
+              Batch& batch) const;
 };
 
 inline Monitor monitor;
@@ -25,6 +25,7 @@
 #include "base/string.h"
 #include "media/anime.h"
 #include "media/anime_db.h"
+#include "media/anime_folder_index.h"
 #include "media/anime_util.h"
 #include "taiga/settings.h"
 #include "track/episode.h"
@@ -165,7 +166,8 @@ int Engine::Identify(anime::Episode& episode, bool give_score,
     if (episode.elements().empty(anitomy::kElementEpisodeNumber)) {
       if (!episode.file_extension().empty()) {
         episode.set_episode_number(1);
-      } else if (episode.elements().empty(anitomy::kElementVolumeNumber)) {
+      } else if (episode.elements().empty(anitomy::kElementVolumeNumber) &&
+                 match_options.estimate_episode_range) {
         auto anime_item = anime::db.Find(episode.anime_id);
         if (anime_item) {
           const int last_episode = [&anime_item]() {
@@ -199,7 +201,7 @@ bool Engine::Search(const std::wstring& title, std::vector<int>& anime_ids) {
 
   ScoreTitle(episode, empty_set, default_options);
 
-  for (const auto& score : scores_) {
+  for (const auto& score : GetScores()) {
     anime_ids.push_back(score.first);
   }
 
@@ -370,18 +372,9 @@ bool Engine::GetTitleFromPath(anime::Episode& episode) {
   if (episode.folder.empty())
     return false;
 
-  std::wstring path = episode.folder;
-
-  for (const auto& library_folder : taiga::settings.GetLibraryFolders()) {
-    if (StartsWith(path, library_folder)) {
-      path.erase(0, library_folder.size());
-      break;
-    }
-  }
-
-  Trim(path, L"\\/");
-  std::vector<std::wstring> directories;
-  Tokenize(path, L"\\/", directories);
+  // Directories below the library folder
+  const auto directories =
+      anime::folder_index.Resolve(episode.folder).components;
 
   auto is_invalid_string = [](std::wstring str) {
     if (str.find(L':') != str.npos)  // drive letter
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
@@ -45,6 +46,7 @@ struct MatchOptions {
   bool check_airing_date = false;
   bool check_anime_type = false;
   bool check_episode_number = false;
+  bool estimate_episode_range = true;
   bool streaming_media = false;
 };
 
@@ -112,6 +114,7 @@ private:
   };
   std::map<int, ScoreStore> db_;
   sorted_scores_t scores_;
+  mutable std::mutex scores_mutex_;
 };
 
 }  // namespace track::recognition
@@ -17,6 +17,7 @@
 */
 
 #include <algorithm>
+#include <mutex>
 
 #include "track/recognition.h"
 
@@ -29,6 +30,7 @@
 namespace track::recognition {
 
 sorted_scores_t Engine::GetScores() const {
+  std::lock_guard lock{scores_mutex_};
   return scores_;
 }
 
@@ -42,8 +44,13 @@ int Engine::ScoreTitle(anime::Episode& episode, const std::set<int>& anime_ids,
   trigram_container_t t1;
   GetTrigrams(normal_title, t1);
 
+  // Recognition may run on several threads at once, so the score store must
+  // not be modified here; anime without an entry have nothing to score.
   auto calculate_trigram_results = [&](int anime_id) {
-    for (const auto& t2 : db_[anime_id].trigrams) {
+    const auto it = db_.find(anime_id);
+    if (it == db_.end())
+      return;
+    for (const auto& t2 : it->second.trigrams) {
       double result = CompareTrigrams(t1, t2);
       if (result > 0.1) {
         auto& target = trigram_results[anime_id];
@@ -117,13 +124,18 @@ int Engine::ScoreTitle(const std::wstring& str, const anime::Episode& episode,
                        const scores_t& trigram_results) {
   scores_t jaro_winkler, levenshtein, custom, bonus;
 
-  scores_.clear();
+  sorted_scores_t scores;
 
   for (const auto& trigram_result : trigram_results) {
     int id = trigram_result.first;
 
+    // Trigram results only have IDs that are in the store
+    const auto it = db_.find(id);
+    if (it == db_.end())
+      continue;
+
     // Calculate individual scores for all titles
-    for (auto& title : db_[id].normal_titles) {
+    for (const auto& title : it->second.normal_titles) {
       jaro_winkler[id] = std::max(jaro_winkler[id], JaroWinklerDistance(title, str));
       levenshtein[id] = std::max(levenshtein[id], LevenshteinDistance(title, str));
       custom[id] = std::max(custom[id], CustomScore(title, str));
@@ -137,23 +149,29 @@ int Engine::ScoreTitle(const std::wstring& str, const anime::Episode& episode,
           (0.3 * std::pow(levenshtein[id], 0.8)) +
           (0.2 * std::pow(trigram_result.second, 0.8))) / 2.0) + bonus[id];
     if (score >= 0.3)
-      scores_.push_back(std::make_pair(id, score));
+      scores.push_back(std::make_pair(id, score));
   }
 
   // Sort scores in descending order, then limit the results
-  std::stable_sort(scores_.begin(), scores_.end(),
+  std::stable_sort(scores.begin(), scores.end(),
       [&](const std::pair<int, double>& a,
           const std::pair<int, double>& b) {
         return a.second > b.second;
       });
-  if (scores_.size() > 20)
-    scores_.resize(20);
+  if (scores.size() > 20)
+    scores.resize(20);
+
+  // Identification can run on several threads while scanning
+  {
+    std::lock_guard lock{scores_mutex_};
+    scores_ = scores;
+  }
 
-  double score_1st = scores_.size() > 0 ? scores_.at(0).second : 0.0;
-  double score_2nd = scores_.size() > 1 ? scores_.at(1).second : 0.0;
+  double score_1st = scores.size() > 0 ? scores.at(0).second : 0.0;
+  double score_2nd = scores.size() > 1 ? scores.at(1).second : 0.0;
 
   if (score_1st >= 1.0 && score_1st != score_2nd)
-    return scores_.front().first;
+    return scores.front().first;
 
   return anime::ID_UNKNOWN;
 }
@@ -0,0 +1,278 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <map>
+
+#include "track/scan_index.h"
+
+#include "base/file.h"
+#include "base/gzip.h"
+#include "base/json.h"
+#include "base/log.h"
+#include "base/string.h"
+#include "media/anime_availability.h"
+#include "sync/service.h"
+#include "taiga/path.h"
+
+namespace track {
+
+constexpr int kScanIndexVersion = 3;
+
+static std::wstring GetScanIndexPath() {
+  return taiga::GetPath(taiga::Path::Database) + L"scan_index.dat";
+}
+
+std::wstring ScanIndex::GetKey(const std::wstring& path) {
+  auto key = ToLower_Copy(path);
+  while (!key.empty() && key.back() == L'\\')
+    key.pop_back();
+  return key;
+}
+
+std::optional<ScanIndex::Directory> ScanIndex::Find(
+    const std::wstring& path) const {
+  std::lock_guard lock{mutex_};
+  const auto it = directories_.find(GetKey(path));
+  if (it == directories_.end())
+    return std::nullopt;
+  return it->second;
+}
+
+void ScanIndex::Set(const std::wstring& path, Directory&& directory) {
+  std::lock_guard lock{mutex_};
+  modified_ = true;
+  directories_[GetKey(path)] = std::move(directory);
+}
+
+void ScanIndex::Remove(const std::wstring& path) {
+  std::lock_guard lock{mutex_};
+  const auto key = GetKey(path);
+  const auto prefix = key + L'\\';
+
+  for (auto it = directories_.begin(); it != directories_.end();) {
+    if (it->first == key || StartsWith(it->first, prefix)) {
+      it = directories_.erase(it);
+      modified_ = true;
+    } else {
+      ++it;
+    }
+  }
+}
+
+void ScanIndex::Clear() {
+  std::lock_guard lock{mutex_};
+  modified_ = modified_ || !directories_.empty();
+  directories_.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The first line of the file is its metadata, followed by the index compressed
+// with zlib, as with the HTTP cache.
+
+bool ScanIndex::Load() {
+  std::lock_guard lock{mutex_};
+
+  const auto service = sync::GetCurrentServiceSlug();
+
+  if (loaded_ && service_ == service)
+    return true;
+
+  directories_.clear();
+  anime::availability_db.Clear();
+  anime::availability_db.set_modified(false);
+  service_ = service;
+  loaded_ = true;
+  modified_ = false;
+
+  std::string data;
+  if (!ReadFromFile(GetScanIndexPath(), data))
+    return false;
+
+  const auto pos = data.find('\n');
+  if (pos == data.npos)
+    return false;
+
+  Json metadata;
+  if (!JsonParseString(data.substr(0, pos), metadata))
+    return false;
+  if (JsonReadInt(metadata, "version") != kScanIndexVersion ||
+      StrToWstr(JsonReadStr(metadata, "service")) != service) {
+    LOGD(L"Discarding scan index of another version or service.");
+    return false;
+  }
+
+  const auto size = static_cast<size_t>(JsonReadDouble(metadata, "size"));
+  std::string body;
+  if (!InflateString(data.substr(pos + 1), body, size) || body.size() != size)
+    return false;
+
+  Json root;
+  if (!JsonParseString(body, root) || !root.is_object())
+    return false;
+
+  // Entries are written by us, but the file might still be damaged
+  try {
+    for (const auto& [key, value] :
+         root.value("directories", Json::object()).items()) {
+      Directory directory;
+      directory.modified = value.value("modified", uint64_t{0});
+      directory.min_file_size = value.value("min_file_size", uint64_t{0});
+
+      for (const auto& item : value.value("subdirectories", Json::array())) {
+        Subdirectory subdirectory;
+        subdirectory.name = StrToWstr(item.at(0).get<std::string>());
+        if (item.at(1).is_number())
+          subdirectory.anime_id = item.at(1).get<int>();
+        directory.subdirectories.push_back(std::move(subdirectory));
+      }
+
+      for (const auto& item : value.value("files", Json::array())) {
+        File file;
+        file.name = StrToWstr(item.at(0).get<std::string>());
+        file.size = item.at(1).get<uint64_t>();
+        file.modified = item.at(2).get<uint64_t>();
+        file.anime_id = item.at(3).get<int>();
+        file.episode_low = item.at(4).get<int>();
+        file.episode_high = item.at(5).get<int>();
+        directory.files.push_back(std::move(file));
+      }
+
+      directories_[StrToWstr(key)] = std::move(directory);
+    }
+
+    const auto availability = root.value("availability", Json::object());
+    std::vector<std::wstring> paths;
+    for (const auto& path : availability.value("paths", Json::array())) {
+      paths.push_back(StrToWstr(path.get<std::string>()));
+    }
+    for (const auto& item : availability.value("anime", Json::array())) {
+      const auto id = item.at(0).get<int>();
+
+      anime::EpisodeSet episodes;
+      std::vector<anime::EpisodeSet::block_t> blocks;
+      for (const auto& block : item.at(1)) {
+        blocks.emplace_back(block.at(0).get<uint32_t>(),
+                            block.at(1).get<uint64_t>());
+      }
+      episodes.set_blocks(std::move(blocks));
+
+      std::map<int, std::wstring> episode_paths;
+      for (const auto& episode : item.at(2)) {
+        episode_paths[episode.at(0).get<int>()] =
+            paths.at(episode.at(1).get<size_t>());
+      }
+
+      episodes.ForEach([&](int number) {
+        anime::availability_db.Set(id, number, true, episode_paths[number]);
+      });
+    }
+  } catch (const std::exception&) {
+    LOGW(L"Could not read scan index.");
+    directories_.clear();
+    anime::availability_db.Clear();
+    anime::availability_db.set_modified(false);
+    return false;
+  }
+
+  anime::availability_db.set_modified(false);
+
+  LOGD(L"Loaded scan index with {} directories and {} anime.",
+       directories_.size(), anime::availability_db.entries().size());
+  return true;
+}
+
+bool ScanIndex::Save() {
+  std::lock_guard lock{mutex_};
+
+  if (!modified_ && !anime::availability_db.modified())
+    return true;
+
+  Json directories = Json::object();
+
+  for (const auto& [key, directory] : directories_) {
+    Json subdirectories = Json::array();
+    for (const auto& subdirectory : directory.subdirectories) {
+      subdirectories.push_back({
+          WstrToStr(subdirectory.name),
+          subdirectory.anime_id ? Json(*subdirectory.anime_id) : Json()});
+    }
+
+    Json files = Json::array();
+    for (const auto& file : directory.files) {
+      files.push_back({WstrToStr(file.name), file.size, file.modified,
+                       file.anime_id, file.episode_low, file.episode_high});
+    }
+
+    directories[WstrToStr(key)] = {
+      {"modified", directory.modified},
+      {"min_file_size", directory.min_file_size},
+      {"subdirectories", subdirectories},
+      {"files", files},
+    };
+  }
+
+  // Only the paths that are still in use are written, and renumbered
+  Json paths = Json::array();
+  Json items = Json::array();
+  std::map<uint32_t, size_t> path_indexes;
+
+  for (const auto& [id, entry] : anime::availability_db.entries()) {
+    Json blocks = Json::array();
+    for (const auto& [index, bits] : entry.episodes.blocks()) {
+      blocks.push_back({index, bits});
+    }
+
+    Json episode_paths = Json::array();
+    for (const auto& [number, index] : entry.paths) {
+      const auto [it, inserted] = path_indexes.emplace(index, paths.size());
+      if (inserted) {
+        paths.push_back(
+            WstrToStr(anime::availability_db.GetPathByIndex(index)));
+      }
+      episode_paths.push_back({number, it->second});
+    }
+
+    items.push_back({id, blocks, episode_paths});
+  }
+
+  const Json root{
+    {"directories", directories},
+    {"availability", {{"paths", paths}, {"anime", items}}},
+  };
+
+  const auto body = root.dump();
+  std::string compressed;
+  if (!DeflateString(body, compressed))
+    return false;
+
+  const Json metadata{
+    {"version", kScanIndexVersion},
+    {"service", WstrToStr(service_)},
+    {"size", body.size()},
+  };
+
+  if (!SaveToFile(metadata.dump() + '\n' + compressed, GetScanIndexPath()))
+    return false;
+
+  modified_ = false;
+  anime::availability_db.set_modified(false);
+  return true;
+}
+
+}  // namespace track
@@ -0,0 +1,88 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "media/anime.h"
+
+namespace track {
+
+// Remembers what the scanner found in each directory, so that later scans can
+// skip the directories that have not changed, and the files that have not
+// changed can skip recognition.
+//
+// A directory's modification time changes whenever an entry is added, removed
+// or renamed, which is how episodes come and go. Files are matched by name,
+// size and modification time.
+class ScanIndex {
+public:
+  struct File {
+    std::wstring name;
+    uint64_t size = 0;
+    uint64_t modified = 0;
+    int anime_id = anime::ID_UNKNOWN;
+    int episode_low = 0;
+    int episode_high = 0;
+  };
+
+  struct Subdirectory {
+    std::wstring name;
+    std::optional<int> anime_id;  // not set if it was never identified
+  };
+
+  struct Directory {
+    uint64_t modified = 0;
+    uint64_t min_file_size = 0;  // smaller files were not recognized
+    std::vector<Subdirectory> subdirectories;
+    std::vector<File> files;
+  };
+
+  // The index can be read and written from several threads during a scan, so
+  // entries are returned by value.
+  std::optional<Directory> Find(const std::wstring& path) const;
+  void Set(const std::wstring& path, Directory&& directory);
+  void Remove(const std::wstring& path);  // including subdirectories
+  void Clear();
+
+  // The index is loaded on startup, and saved after scans if it was changed.
+  // Episode availability (anime::availability_db) is saved along with it.
+  // Anime IDs belong to the current service, so both are discarded when the
+  // service changes.
+  bool Load();
+  bool Save();
+
+private:
+  static std::wstring GetKey(const std::wstring& path);
+
+  std::unordered_map<std::wstring, Directory> directories_;
+  mutable std::mutex mutex_;
+  std::wstring service_;
+  bool loaded_ = false;
+  bool modified_ = false;
+};
+
+inline ScanIndex scan_index;
+
+}  // namespace track
@@ -0,0 +1,658 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include <windows.h>
+
+#include "track/scan_pipeline.h"
+
+#include "base/file.h"
+#include "base/log.h"
+#include "base/string.h"
+#include "media/anime.h"
+#include "media/anime_folder_index.h"
+#include "media/anime_util.h"
+#include "track/episode.h"
+#include "track/episode_util.h"
+#include "track/hash_index.h"
+#include "track/hasher.h"
+#include "track/recognition.h"
+
+namespace track {
+
+// Reading a directory is mostly waiting on the disk or the network, so there
+// are more I/O workers than a processor count would suggest.
+constexpr size_t kIoWorkerCount = 8;
+constexpr size_t kRecognitionQueueSize = 256;
+
+static uint64_t GetFileTime(const FILETIME& file_time) {
+  return (static_cast<uint64_t>(file_time.dwHighDateTime) << 32) |
+         file_time.dwLowDateTime;
+}
+
+static uint64_t GetDirectoryModifiedTime(const std::wstring& path) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!::GetFileAttributesEx(GetExtendedLengthPath(path).c_str(),
+                             GetFileExInfoStandard, &data)) {
+    return 0;
+  }
+  if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    return 0;
+  return GetFileTime(data.ftLastWriteTime);
+}
+
+static bool GetFileSizeAndTime(const std::wstring& path, uint64_t& size,
+                               uint64_t& modified) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!::GetFileAttributesEx(GetExtendedLengthPath(path).c_str(),
+                             GetFileExInfoStandard, &data)) {
+    return false;
+  }
+  if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    return false;
+  size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) |
+         data.nFileSizeLow;
+  modified = GetFileTime(data.ftLastWriteTime);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int IdentifyDirectory(const std::wstring& path,
+                             const std::wstring& name,
+                             anime::Episode& episode) {
+  // Known anime folders don't need to be recognized again
+  const auto anime_id = anime::folder_index.Find(AddTrailingSlash(path) + name);
+  if (anime::IsValidId(anime_id))
+    return anime_id;
+
+  static const auto parse_options = [] {
+    track::recognition::ParseOptions options;
+    options.parse_path = false;
+    options.streaming_media = false;
+    return options;
+  }();
+
+  if (!Meow.Parse(name, parse_options, episode)) {
+    LOGD(L"Could not parse directory: {}", name);
+    return anime::ID_UNKNOWN;
+  }
+
+  static const auto match_options = [] {
+    track::recognition::MatchOptions options;
+    options.allow_sequels = false;
+    options.check_airing_date = false;
+    options.check_anime_type = false;
+    options.check_episode_number = false;
+    // Reads the availability that is being updated while we're scanning
+    options.estimate_episode_range = false;
+    options.streaming_media = false;
+    return options;
+  }();
+
+  Meow.Identify(episode, false, match_options);
+
+  if (!Meow.IsValidAnimeType(episode))
+    return anime::ID_UNKNOWN;
+
+  return episode.anime_id;
+}
+
+// Files that were hashed before are identified by their content, when
+// recognition fails for them (e.g. because they have been renamed since).
+static bool IdentifyHashedFile(const std::wstring& path,
+                               ScanIndex::File& file) {
+  const auto identity = hash_index.Find(path, file.size, file.modified);
+  if (!identity)
+    return false;
+
+  file.anime_id = identity->anime_id;
+  file.episode_low = identity->episode_low;
+  file.episode_high = identity->episode_high;
+  return true;
+}
+
+static void IdentifyFile(const std::wstring& path, anime::Episode& episode,
+                         ScanIndex::File& file) {
+  file.anime_id = anime::ID_UNKNOWN;
+  file.episode_low = 0;
+  file.episode_high = 0;
+
+  static const auto parse_options = [] {
+    track::recognition::ParseOptions options;
+    options.parse_path = true;
+    options.streaming_media = false;
+    return options;
+  }();
+
+  if (!Meow.Parse(path, parse_options, episode)) {
+    LOGD(L"Could not parse filename: {}", file.name);
+    IdentifyHashedFile(path, file);
+    return;
+  }
+
+  static const auto match_options = [] {
+    track::recognition::MatchOptions options;
+    options.allow_sequels = true;
+    options.check_airing_date = true;
+    options.check_anime_type = true;
+    options.check_episode_number = true;
+    options.estimate_episode_range = false;
+    options.streaming_media = false;
+    return options;
+  }();
+
+  Meow.Identify(episode, false, match_options);
+
+  if (!Meow.IsValidFileExtension(episode))
+    return;
+
+  std::optional<HashIndex::Identity> identity;
+
+  if (Meow.IsValidAnimeType(episode)) {
+    file.anime_id = episode.anime_id;
+    file.episode_low = anime::GetEpisodeLow(episode);
+    file.episode_high = anime::GetEpisodeHigh(episode);
+    if (anime::IsValidId(file.anime_id))
+      identity = HashIndex::Identity{file.anime_id, file.episode_low,
+                                     file.episode_high};
+  }
+
+  // Recognition has the final say, so that a file that was misidentified once
+  // doesn't stay that way. Its identity replaces the one in the hash index.
+  if (!identity && IdentifyHashedFile(path, file))
+    return;
+
+  hasher.Add({path, identity, episode.file_checksum()});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A directory that has been read, and is waiting for its entries to be
+// recognized. Each entry is written by a single task, and the last task to
+// finish passes the directory on.
+struct PendingDirectory {
+  ScanResult result;
+  std::atomic<size_t> remaining = 0;
+};
+
+struct RecognitionTask {
+  std::shared_ptr<PendingDirectory> directory;
+  size_t index = 0;
+  bool is_file = false;
+};
+
+// Blocks producers while it is full, and consumers while it is empty, until
+// it is closed.
+template <typename T>
+class BoundedQueue final {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_{capacity} {}
+
+  bool Push(T&& item) {
+    std::unique_lock lock{mutex_};
+    not_full_.wait(lock, [this] {
+      return closed_ || items_.size() < capacity_;
+    });
+    if (closed_)
+      return false;
+    items_.push_back(std::move(item));
+    lock.unlock();
+    not_empty_.notify_one();
+    return true;
+  }
+
+  std::optional<T> Pop() {
+    std::unique_lock lock{mutex_};
+    not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+    if (closed_)
+      return std::nullopt;
+    auto item = std::move(items_.front());
+    items_.pop_front();
+    lock.unlock();
+    not_full_.notify_one();
+    return item;
+  }
+
+  void Close() {
+    {
+      std::lock_guard lock{mutex_};
+      closed_ = true;
+    }
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+private:
+  const size_t capacity_;
+  std::deque<T> items_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::mutex mutex_;
+  bool closed_ = false;
+};
+
+// Each I/O worker has its own queue of directories. Workers take the newest
+// directory from their own queue, which keeps the traversal close to
+// depth-first, and steal the oldest directory from another queue when theirs
+// is empty.
+class DirectoryQueues final {
+public:
+  explicit DirectoryQueues(size_t count) : queues_(count) {}
+
+  void Push(size_t worker, std::wstring path) {
+    {
+      auto& queue = queues_.at(worker);
+      std::lock_guard lock{queue.mutex};
+      queue.paths.push_back(std::move(path));
+    }
+    {
+      std::lock_guard lock{mutex_};
+      ++size_;
+    }
+    condition_.notify_one();
+  }
+
+  std::optional<std::wstring> Pop(size_t worker) {
+    while (true) {
+      if (auto path = Take(worker)) {
+        std::lock_guard lock{mutex_};
+        --size_;
+        return path;
+      }
+      std::unique_lock lock{mutex_};
+      condition_.wait(lock, [this] { return closed_ || size_ > 0; });
+      if (closed_)
+        return std::nullopt;
+    }
+  }
+
+  void Close() {
+    {
+      std::lock_guard lock{mutex_};
+      closed_ = true;
+    }
+    condition_.notify_all();
+  }
+
+private:
+  std::optional<std::wstring> Take(size_t worker) {
+    for (size_t i = 0; i < queues_.size(); ++i) {
+      auto& queue = queues_.at((worker + i) % queues_.size());
+      std::lock_guard lock{queue.mutex};
+      if (queue.paths.empty())
+        continue;
+      std::wstring path;
+      if (i == 0) {
+        path = std::move(queue.paths.back());
+        queue.paths.pop_back();
+      } else {
+        path = std::move(queue.paths.front());
+        queue.paths.pop_front();
+      }
+      return path;
+    }
+    return std::nullopt;
+  }
+
+  struct Queue {
+    std::deque<std::wstring> paths;
+    std::mutex mutex;
+  };
+
+  std::vector<Queue> queues_;
+  std::condition_variable condition_;
+  std::mutex mutex_;
+  size_t size_ = 0;
+  bool closed_ = false;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class TreeScan final {
+public:
+  TreeScan(const base::FileSearchOptions& options, bool revalidate)
+      : options_{options},
+        revalidate_{revalidate},
+        directories_{kIoWorkerCount},
+        tasks_{kRecognitionQueueSize} {}
+
+  bool Run(const std::wstring& root, const apply_function_t& apply) {
+    pending_ = 1;
+    directories_.Push(0, root);
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < kIoWorkerCount; ++i) {
+      workers.emplace_back([this, i]() { ReadDirectories(i); });
+    }
+    const auto cpu_worker_count =
+        std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < cpu_worker_count; ++i) {
+      workers.emplace_back([this]() { RecognizeEntries(); });
+    }
+
+    bool found = false;
+    size_t directory_count = 0;
+    std::vector<std::shared_ptr<PendingDirectory>> batch;
+
+    while (!found) {
+      {
+        std::unique_lock lock{mutex_};
+        condition_.wait(lock, [this] {
+          return !results_.empty() || !pending_;
+        });
+        if (results_.empty())
+          break;  // Nothing left to read
+        batch.swap(results_);
+      }
+
+      for (const auto& directory : batch) {
+        ++directory_count;
+        if (apply(directory->result)) {
+          found = true;
+          break;
+        }
+      }
+
+      {
+        std::lock_guard lock{mutex_};
+        pending_ -= batch.size();
+      }
+      batch.clear();
+    }
+
+    directories_.Close();
+    tasks_.Close();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+
+    LOGD(L"Scanned {} directories in {}", directory_count, root);
+
+    return found;
+  }
+
+private:
+  void ReadDirectories(size_t worker) {
+    while (const auto path = directories_.Pop(worker)) {
+      if (!ReadDirectory(worker, *path))
+        break;
+    }
+  }
+
+  void RecognizeEntries() {
+    anime::Episode episode;
+
+    while (auto task = tasks_.Pop()) {
+      auto& result = task->directory->result;
+      const auto& path = result.path;
+
+      if (task->is_file) {
+        auto& file = result.directory.files.at(task->index);
+        IdentifyFile(AddTrailingSlash(path) + file.name, episode, file);
+      } else {
+        auto& subdirectory = result.directory.subdirectories.at(task->index);
+        subdirectory.anime_id =
+            IdentifyDirectory(path, subdirectory.name, episode);
+      }
+
+      if (task->directory->remaining.fetch_sub(1) == 1)
+        Post(std::move(task->directory));
+    }
+  }
+
+  bool ReadDirectory(size_t worker, const std::wstring& path) {
+    auto pending = std::make_shared<PendingDirectory>();
+    auto& result = pending->result;
+    auto& directory = result.directory;
+    result.path = path;
+
+    std::vector<size_t> files;  // to be recognized
+
+    const auto modified = GetDirectoryModifiedTime(path);
+    auto previous = scan_index.Find(path);
+
+    // Nothing was added, removed or renamed since the last time we were here
+    if (previous && !revalidate_ && modified &&
+        previous->modified == modified &&
+        previous->min_file_size == options_.min_file_size) {
+      directory = std::move(*previous);
+      // Subdirectories that were skipped before are identified now
+      result.changed = !options_.skip_directories &&
+          std::any_of(directory.subdirectories.begin(),
+                      directory.subdirectories.end(),
+                      [](const ScanIndex::Subdirectory& subdirectory) {
+                        return !subdirectory.anime_id;
+                      });
+      // Files that were too small to be recognized may have grown in place
+      // (e.g. while being downloaded), which doesn't change the modification
+      // time of the directory
+      for (size_t i = 0; i < directory.files.size(); ++i) {
+        auto& file = directory.files[i];
+        if (file.size >= options_.min_file_size)
+          continue;
+        uint64_t size = 0;
+        uint64_t file_modified = 0;
+        if (!GetFileSizeAndTime(AddTrailingSlash(path) + file.name, size,
+                                file_modified) ||
+            (size == file.size && file_modified == file.modified)) {
+          continue;
+        }
+        file.size = size;
+        file.modified = file_modified;
+        if (file.size >= options_.min_file_size)
+          files.push_back(i);
+        result.changed = true;
+      }
+      // Files may have been identified by their content in the meantime
+      for (auto& file : directory.files) {
+        if (!anime::IsValidId(file.anime_id) &&
+            IdentifyHashedFile(AddTrailingSlash(path) + file.name, file)) {
+          result.changed = true;
+        }
+      }
+
+    } else {
+      ListDirectory(path, previous, directory, files);
+      directory.modified = modified;
+      directory.min_file_size = options_.min_file_size;
+      result.changed = modified && !options_.skip_files;
+
+      // Forget about the subdirectories that are gone
+      if (previous) {
+        for (const auto& subdirectory : previous->subdirectories) {
+          const auto it = std::lower_bound(
+              directory.subdirectories.begin(), directory.subdirectories.end(),
+              subdirectory.name,
+              [](const ScanIndex::Subdirectory& a, const std::wstring& b) {
+                return a.name < b;
+              });
+          if (it == directory.subdirectories.end() ||
+              it->name != subdirectory.name) {
+            result.removed_subdirectories.push_back(subdirectory.name);
+          }
+        }
+      }
+    }
+
+    if (!options_.skip_subdirectories &&
+        !directory.subdirectories.empty()) {
+      {
+        std::lock_guard lock{mutex_};
+        pending_ += directory.subdirectories.size();
+      }
+      for (const auto& subdirectory : directory.subdirectories) {
+        directories_.Push(worker, AddTrailingSlash(path) + subdirectory.name);
+      }
+    }
+
+    return Submit(std::move(pending), files);
+  }
+
+  void ListDirectory(const std::wstring& path,
+                     const std::optional<ScanIndex::Directory>& previous,
+                     ScanIndex::Directory& directory,
+                     std::vector<size_t>& files) const {
+    std::unordered_map<std::wstring_view, const ScanIndex::Subdirectory*>
+        previous_subdirectories;
+    std::unordered_map<std::wstring_view, const ScanIndex::File*>
+        previous_files;
+    if (previous) {
+      for (const auto& subdirectory : previous->subdirectories) {
+        previous_subdirectories[subdirectory.name] = &subdirectory;
+      }
+      for (const auto& file : previous->files) {
+        previous_files[file.name] = &file;
+      }
+    }
+
+    // Identifications are kept unless we're revalidating the index, in which
+    // case the ones that failed are given another chance.
+    const auto reuse = [this](const std::optional<int>& anime_id) {
+      return anime_id && (!revalidate_ || anime::IsValidId(*anime_id));
+    };
+
+    // Subdirectories are listed even if they are skipped, so that the index
+    // stays complete.
+    // Files below the size threshold are listed as well, so that they are
+    // noticed if they grow in place.
+    base::FileSearch search;
+    search.options = options_;
+    search.options.skip_directories = false;
+    search.options.skip_subdirectories = true;
+    search.options.min_file_size = 0;
+
+    const auto on_directory = [&](const base::FileSearchResult& result) {
+      auto& subdirectory = directory.subdirectories.emplace_back();
+      subdirectory.name = result.name;
+      const auto it = previous_subdirectories.find(result.name);
+      if (it != previous_subdirectories.end() && reuse(it->second->anime_id))
+        subdirectory.anime_id = it->second->anime_id;
+      return false;
+    };
+
+    const auto on_file = [&](const base::FileSearchResult& result) {
+      auto& file = directory.files.emplace_back();
+      file.name = result.name;
+      file.size = result.size;
+      file.modified = result.modified;
+
+      // Too small to be recognized for now
+      if (file.size < options_.min_file_size)
+        return false;
+
+      const auto it = previous_files.find(file.name);
+      if (it != previous_files.end() && it->second->size == file.size &&
+          it->second->modified == file.modified &&
+          reuse(it->second->anime_id)) {
+        file.anime_id = it->second->anime_id;
+        file.episode_low = it->second->episode_low;
+        file.episode_high = it->second->episode_high;
+        if (!anime::IsValidId(file.anime_id))
+          IdentifyHashedFile(AddTrailingSlash(path) + file.name, file);
+      } else {
+        files.push_back(directory.files.size() - 1);
+      }
+      return false;
+    };
+
+    search.Search(path, on_directory, on_file);
+
+    std::sort(directory.subdirectories.begin(), directory.subdirectories.end(),
+              [](const ScanIndex::Subdirectory& a,
+                 const ScanIndex::Subdirectory& b) {
+                return a.name < b.name;
+              });
+  }
+
+  bool Submit(std::shared_ptr<PendingDirectory> pending,
+              const std::vector<size_t>& files) {
+    std::vector<RecognitionTask> tasks;
+
+    if (!options_.skip_directories) {
+      const auto& subdirectories = pending->result.directory.subdirectories;
+      for (size_t i = 0; i < subdirectories.size(); ++i) {
+        if (!subdirectories[i].anime_id)
+          tasks.push_back({pending, i, false});
+      }
+    }
+    for (const auto index : files) {
+      tasks.push_back({pending, index, true});
+    }
+
+    if (tasks.empty()) {
+      Post(std::move(pending));
+      return true;
+    }
+
+    // Must be set before any of the tasks can finish
+    pending->remaining = tasks.size();
+
+    for (auto& task : tasks) {
+      if (!tasks_.Push(std::move(task)))
+        return false;  // The scan has ended
+    }
+
+    return true;
+  }
+
+  void Post(std::shared_ptr<PendingDirectory> directory) {
+    {
+      std::lock_guard lock{mutex_};
+      results_.push_back(std::move(directory));
+    }
+    condition_.notify_one();
+  }
+
+  const base::FileSearchOptions options_;
+  const bool revalidate_;
+
+  DirectoryQueues directories_;
+  BoundedQueue<RecognitionTask> tasks_;
+
+  // Directories that have been queued, but not applied yet
+  size_t pending_ = 0;
+  std::vector<std::shared_ptr<PendingDirectory>> results_;
+  std::condition_variable condition_;
+  std::mutex mutex_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ScanDirectoryTree(const std::wstring& root,
+                       const base::FileSearchOptions& options,
+                       bool revalidate,
+                       const apply_function_t& apply) {
+  // This is not safe to do on the workers
+  Meow.InitializeTitles();
+
+  TreeScan scan{options, revalidate};
+  return scan.Run(root, apply);
+}
+
+}  // namespace track
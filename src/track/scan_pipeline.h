@@ -0,0 +1,54 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "base/file_search.h"
+#include "track/scan_index.h"
+
+namespace track {
+
+// What was found in a directory, and how the index should be updated
+struct ScanResult {
+  std::wstring path;
+  ScanIndex::Directory directory;
+  std::vector<std::wstring> removed_subdirectories;
+  bool changed = false;  // the index entry should be replaced
+};
+
+// Returns true to end the scan early.
+using apply_function_t = std::function<bool(ScanResult& result)>;
+
+// Scans a directory tree with two thread pools. Directories are read by I/O
+// workers, which steal from each other when they run out of work, and the
+// names they find are recognized by CPU workers. A bounded queue keeps the
+// readers from getting too far ahead of recognition.
+//
+// Results are passed in batches to the calling thread, which is the only one
+// that applies them. Workers read the anime database while the scan is
+// running, so the caller must not modify it until this function returns.
+bool ScanDirectoryTree(const std::wstring& root,
+                       const base::FileSearchOptions& options,
+                       bool revalidate,
+                       const apply_function_t& apply);
+
+}  // namespace track
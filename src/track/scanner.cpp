@@ -25,38 +25,20 @@
 #include "media/anime_util.h"
 #include "taiga/settings.h"
 #include "track/episode_util.h"
-#include "track/recognition.h"
 #include "ui/ui.h"
 
 namespace track {
 
-bool Scanner::OnDirectory(const base::FileSearchResult& result) {
-  static track::recognition::ParseOptions parse_options;
-  parse_options.parse_path = false;
-  parse_options.streaming_media = false;
+bool Scanner::OnDirectory(const std::wstring& root, const std::wstring& name,
+                          const int anime_id) {
+  const auto anime_item = anime::db.Find(anime_id);
 
-  if (!Meow.Parse(result.name, parse_options, episode_)) {
-    LOGD(L"Could not parse directory: {}", result.name);
-    return false;
-  }
-
-  static track::recognition::MatchOptions match_options;
-  match_options.allow_sequels = false;
-  match_options.check_airing_date = false;
-  match_options.check_anime_type = false;
-  match_options.check_episode_number = false;
-  match_options.streaming_media = false;
-
-  Meow.Identify(episode_, false, match_options);
-
-  const auto anime_item = anime::db.Find(episode_.anime_id);
-
-  if (anime_item && Meow.IsValidAnimeType(episode_)) {
+  if (anime_item) {
     if (anime_item->GetFolder().empty())
-      anime_item->SetFolder(AddTrailingSlash(result.root) + result.name);
+      anime_item->SetFolder(AddTrailingSlash(root) + name);
 
     if (anime_id_ && anime_id_.value() == anime_item->GetId()) {
-      path_found_ = AddTrailingSlash(result.root) + result.name;
+      path_found_ = AddTrailingSlash(root) + name;
       if (options.skip_files)
         return true;
     }
@@ -65,45 +47,25 @@ bool Scanner::OnDirectory(const base::FileSearchResult& result) {
   return false;
 }
 
-bool Scanner::OnFile(const base::FileSearchResult& result) {
-  const auto path = AddTrailingSlash(result.root) + result.name;
-
-  static track::recognition::ParseOptions parse_options;
-  parse_options.parse_path = true;
-  parse_options.streaming_media = false;
-
-  if (!Meow.Parse(path, parse_options, episode_)) {
-    LOGD(L"Could not parse filename: {}", result.name);
-    return false;
-  }
-
-  static track::recognition::MatchOptions match_options;
-  match_options.allow_sequels = true;
-  match_options.check_airing_date = true;
-  match_options.check_anime_type = true;
-  match_options.check_episode_number = true;
-  match_options.streaming_media = false;
+bool Scanner::OnFile(const std::wstring& path, const ScanIndex::File& file) {
+  const auto anime_item = anime::db.Find(file.anime_id);
 
-  Meow.Identify(episode_, false, match_options);
-
-  const auto anime_item = anime::db.Find(episode_.anime_id);
-
-  if (anime_item && Meow.IsValidAnimeType(episode_) &&
-      Meow.IsValidFileExtension(episode_)) {
-    const int upper_bound = anime::GetEpisodeHigh(episode_);
-    const int lower_bound = anime::GetEpisodeLow(episode_);
+  if (anime_item) {
+    const int upper_bound = file.episode_high;
+    const int lower_bound = file.episode_low;
 
     if (!anime::IsValidEpisodeNumber(upper_bound,
                                      anime_item->GetEpisodeCount()) ||
         !anime::IsValidEpisodeNumber(lower_bound,
                                      anime_item->GetEpisodeCount())) {
-      const auto episode_number = anime::GetEpisodeRange(episode_);
+      const auto episode_number =
+          anime::GetEpisodeRange({lower_bound, upper_bound});
       LOGD(L"Invalid episode number: {}\nFile: {}", episode_number, path);
       return false;
     }
 
     for (int i = lower_bound; i <= upper_bound; ++i) {
-      anime_item->SetEpisodeAvailability(i, true, path);
+      availability_.Set(*anime_item, i, true, path);
     }
 
     if (anime_id_ && anime_id_.value() == anime_item->GetId()) {
@@ -114,7 +76,8 @@ bool Scanner::OnFile(const base::FileSearchResult& result) {
         return true;
       }
       // Check if all episodes are available
-      if (episode_number_ == 0 && IsAllEpisodesAvailable(*anime_item)) {
+      if (episode_number_ == 0 &&
+          availability_.IsAllEpisodesAvailable(*anime_item)) {
         return true;
       }
     }
@@ -123,15 +86,56 @@ bool Scanner::OnFile(const base::FileSearchResult& result) {
   return false;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
 bool Scanner::Search(const std::wstring& root) {
-  return base::FileSearch::Search(root,
-      [this](const base::FileSearchResult& result) {
-        return OnDirectory(result);
-      },
-      [this](const base::FileSearchResult& result) {
-        return OnFile(result);
+  scan_index.Load();
+
+  const bool found = ScanDirectoryTree(root, options, revalidate_,
+      [this](ScanResult& result) {
+        return Apply(result);
+      });
+
+  // Having seen every file, we also know which episodes are gone
+  if (!found && !options.skip_files && !options.skip_subdirectories)
+    availability_.Reset(root);
+
+  return found;
+}
+
+bool Scanner::Apply(ScanResult& result) {
+  const auto& path = result.path;
+  const auto& directory = result.directory;
+
+  if (!options.skip_directories) {
+    for (const auto& subdirectory : directory.subdirectories) {
+      if (OnDirectory(path, subdirectory.name,
+                      subdirectory.anime_id.value_or(anime::ID_UNKNOWN))) {
+        return true;
       }
-  );
+    }
+  }
+
+  if (!options.skip_files) {
+    for (const auto& file : directory.files) {
+      if (file.size < options.min_file_size)
+        continue;
+      if (OnFile(AddTrailingSlash(path) + file.name, file))
+        return true;
+    }
+  }
+
+  for (const auto& name : result.removed_subdirectories) {
+    scan_index.Remove(AddTrailingSlash(path) + name);
+  }
+  if (result.changed)
+    scan_index.Set(path, std::move(result.directory));
+
+  return false;
+}
+
+void Scanner::CommitAvailability() {
+  availability_.Commit();
 }
 
 const std::wstring& Scanner::path_found() const {
@@ -154,6 +158,10 @@ void Scanner::set_path_found(const std::wstring& path_found) {
   path_found_ = path_found;
 }
 
+void Scanner::set_revalidate(bool revalidate) {
+  revalidate_ = revalidate;
+}
+
 }  // namespace track
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -163,7 +171,10 @@ void ScanAvailableEpisodes(bool silent) {
     anime::ValidateFolder(item);
   }
 
+  // Manual scans re-read every directory, in case something was missed
+  track::scanner.set_revalidate(!silent);
   ScanAvailableEpisodes(silent, anime::ID_UNKNOWN, 0);
+  track::scanner.set_revalidate(false);
 }
 
 void ScanAvailableEpisodes(bool silent, int anime_id, int episode_number) {
@@ -243,6 +254,10 @@ void ScanAvailableEpisodes(bool silent, int anime_id, int episode_number) {
     ui::ClearStatusText();
   }
 
+  scanner.CommitAvailability();
+  track::scan_index.Save();
+  taiga::settings.Save();  // anime folders that were found or lost
+
   ui::OnScanAvailableEpisodesFinished();
 }
 
@@ -276,5 +291,9 @@ void ScanAvailableEpisodesQuick(int anime_id) {
     scanner.Search(folder);
   }
 
+  scanner.CommitAvailability();
+  track::scan_index.Save();
+  taiga::settings.Save();  // anime folders that were found or lost
+
   ui::OnScanAvailableEpisodesFinished();
 }
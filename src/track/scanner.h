@@ -22,7 +22,10 @@
 #include <string>
 
 #include "base/file_search.h"
+#include "media/anime_availability.h"
 #include "track/episode.h"
+#include "track/scan_index.h"
+#include "track/scan_pipeline.h"
 
 namespace track {
 
@@ -30,20 +33,28 @@ class Scanner : public base::FileSearch {
 public:
   bool Search(const std::wstring& root);
 
+  // Availability changes found by searches are applied together, once the
+  // whole scan is complete.
+  void CommitAvailability();
+
   const std::wstring& path_found() const;
 
   void set_anime_id(int anime_id);
   void set_episode_number(int episode_number);
   void set_path_found(const std::wstring& path_found);
+  void set_revalidate(bool revalidate);
 
 private:
-  bool OnDirectory(const base::FileSearchResult& result);
-  bool OnFile(const base::FileSearchResult& result);
+  bool Apply(ScanResult& result);
+  bool OnDirectory(const std::wstring& root, const std::wstring& name,
+                   int anime_id);
+  bool OnFile(const std::wstring& path, const ScanIndex::File& file);
 
+  anime::AvailabilityTransaction availability_;
   std::optional<int> anime_id_;
-  anime::Episode episode_;
   int episode_number_ = 0;
   std::wstring path_found_;
+  bool revalidate_ = false;
 };
 
 inline Scanner scanner;
@@ -482,7 +482,7 @@ std::wstring GetAvailableEpisodesTooltip(const anime::Item& anime_item) {
   std::wstring text;
 
   const int eps_aired_estimated = anime::GetLastEpisodeNumber(anime_item);
-  const int eps_available = anime_item.GetAvailableEpisodeCount();
+  const int eps_available = anime_item.GetLastAvailableEpisode();
   const int available_episodes = std::max(eps_aired_estimated, eps_available);
 
   // Find missing episodes
@@ -40,6 +40,7 @@
 #include "taiga/timer.h"
 #include "track/episode_util.h"
 #include "track/media.h"
+#include "track/hasher.h"
 #include "track/monitor.h"
 #include "track/feed_aggregator.h"
 #include "track/play.h"
@@ -123,10 +124,17 @@ BOOL MainDialog::OnInitDialog() {
     if (dlg.GetSelectedButtonID() == IDYES)
       ShowDlgSettings(kSettingsSectionServices, kSettingsPageServicesMain);
   }
-  if (taiga::settings.GetLibraryWatchFolders()) {
-    track::monitor.SetWindowHandle(GetWindowHandle());
+  track::monitor.SetNotifyFunction([hwnd = GetWindowHandle()]() {
+    ::PostMessage(hwnd, WM_MONITORCALLBACK, 0, 0);
+  });
+  if (taiga::settings.GetLibraryWatchFolders())
     track::monitor.Enable();
-  }
+  track::hasher.SetNotifyFunction([hwnd = GetWindowHandle()]() {
+    ::PostMessage(hwnd, WM_HASHERCALLBACK, 0, 0);
+  });
+  track::hasher.set_rate_limit(taiga::settings.GetLibraryHashRateLimit());
+  if (taiga::settings.GetLibraryHashFiles())
+    track::hasher.Enable();
 
   return TRUE;
 }
@@ -301,7 +309,13 @@ INT_PTR MainDialog::DialogProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lPara
 
     // Monitor anime folders
     case WM_MONITORCALLBACK: {
-      track::monitor.Callback(*reinterpret_cast<DirectoryChangeEntry*>(lParam));
+      track::monitor.Callback();
+      return TRUE;
+    }
+
+    // Identify files by their content
+    case WM_HASHERCALLBACK: {
+      track::hasher.Callback();
       return TRUE;
     }
 
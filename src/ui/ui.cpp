@@ -126,6 +126,26 @@ void OnLibraryChange() {
   DlgMain.EnableInput(true);
 }
 
+void OnLibraryEntriesChange(const std::vector<int>& ids) {
+  ClearStatusText();
+
+  for (const auto id : ids) {
+    if (DlgAnime.GetCurrentId() == id)
+      DlgAnime.Refresh(false, true, false, false);
+
+    if (DlgAnimeList.IsWindow())
+      DlgAnimeList.RefreshListItem(id);
+
+    if (DlgNowPlaying.GetCurrentId() == id)
+      DlgNowPlaying.Refresh(false, true, false, false);
+  }
+
+  if (!ids.empty() && DlgSeason.IsWindow())
+    DlgSeason.RefreshList(true);
+
+  DlgMain.EnableInput(true);
+}
+
 void OnLibraryEntryAdd(int id) {
   if (DlgAnime.GetCurrentId() == id)
     DlgAnime.Refresh(false, false, true, false);
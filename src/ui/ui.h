@@ -69,6 +69,7 @@ void DisplayErrorMessage(const std::wstring& text, const std::wstring& caption);
 bool EnterAuthorizationPin(const std::wstring& service, std::wstring& auth_pin);
 
 void OnLibraryChange();
+void OnLibraryEntriesChange(const std::vector<int>& ids);
 void OnLibraryEntryAdd(int id);
 void OnLibraryEntryChange(int id);
 void OnLibraryEntryDelete(int id);
@@ -0,0 +1,249 @@
+/*
+** Taiga
+** Copyright (C) 2010-2021, Eren Okka
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Conformance checks for base::FileSearch, run against the native backend of
+// the platform it is built on (getdents64 and openat on Linux). The results
+// are compared with std::filesystem over a small generated library, which
+// mirrors the one in the benchmark.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+
+#include "base/file_search.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t kTreeDirectories = 20;
+constexpr size_t kTreeFilesPerDirectory = 50;
+constexpr uint64_t kMinFileSize = 8;
+
+int failures = 0;
+
+#define CHECK(condition)                                             \
+  do {                                                               \
+    if (!(condition)) {                                              \
+      std::fprintf(stderr, "%s:%d: Check failed: %s\n", __FILE__,    \
+                   __LINE__, #condition);                            \
+      ++failures;                                                    \
+    }                                                                \
+  } while (false)
+
+void WriteFile(const fs::path& path, size_t size) {
+  std::ofstream{path, std::ios::binary} << std::string(size, 'x');
+}
+
+// Series folders with an "Extras" subfolder, files of varying sizes, and the
+// kinds of entries that must be skipped: dot files and folders, links to
+// folders, and special files. Links to files are followed.
+fs::path GenerateFileTree() {
+  const auto root = fs::temp_directory_path() /
+                    ("taiga_file_search_" + std::to_string(::getpid()));
+  fs::remove_all(root);
+
+  for (size_t i = 0; i < kTreeDirectories; ++i) {
+    const auto directory = root / ("Series " + std::to_string(i));
+    fs::create_directories(directory / "Extras");
+
+    for (size_t j = 0; j < kTreeFilesPerDirectory; ++j) {
+      const auto number = std::to_string(j);
+      WriteFile(j % 10 ? directory / ("[Group] Series - " + number + ".mkv")
+                       : directory / "Extras" / ("NCOP " + number + ".mkv"),
+                j % 16);
+    }
+
+    WriteFile(directory / ".hidden", 0);
+    fs::create_directories(directory / ".hidden_folder");
+    WriteFile(directory / ".hidden_folder" / "Episode 01.mkv", 16);
+  }
+
+  const auto first = root / "Series 0";
+  fs::create_symlink(first / "[Group] Series - 9.mkv", first / "Link.mkv");
+  fs::create_directory_symlink(root / "Series 1", first / "Link");
+  fs::create_symlink(first / "Missing.mkv", first / "Dangling.mkv");
+  ::mkfifo((first / "Pipe").c_str(), 0600);
+
+  return root;
+}
+
+std::wstring FormatDirectory(const std::wstring& root,
+                             const std::wstring& name) {
+  return (fs::path{root} / name).wstring() + L"/";
+}
+
+std::wstring FormatFile(const std::wstring& root, const std::wstring& name,
+                        uint64_t size) {
+  return (fs::path{root} / name).wstring() + L" (" + std::to_wstring(size) +
+         L")";
+}
+
+std::set<std::wstring> ListFileTree(const fs::path& root,
+                                    const base::FileSearchOptions& options) {
+  std::set<std::wstring> entries;
+
+  base::FileSearch search;
+  search.options = options;
+  search.options.log_errors = false;
+  search.Search(root.wstring(),
+      [&entries](const base::FileSearchResult& result) {
+        entries.insert(FormatDirectory(result.root, result.name));
+        return false;
+      },
+      [&entries](const base::FileSearchResult& result) {
+        entries.insert(FormatFile(result.root, result.name, result.size));
+        return false;
+      });
+
+  return entries;
+}
+
+std::set<std::wstring> ListFileTreeReference(
+    const fs::path& root, const base::FileSearchOptions& options) {
+  std::set<std::wstring> entries;
+
+  for (auto it = fs::recursive_directory_iterator{root};
+       it != fs::recursive_directory_iterator{}; ++it) {
+    if (options.skip_subdirectories)
+      it.disable_recursion_pending();
+
+    const auto name = it->path().filename().wstring();
+    const auto parent = it->path().parent_path().wstring();
+    std::error_code error_code;
+
+    if (name.front() == L'.' ||
+        (it->is_symlink() && it->is_directory(error_code))) {
+      it.disable_recursion_pending();
+    } else if (it->is_directory()) {
+      if (!options.skip_directories)
+        entries.insert(FormatDirectory(parent, name));
+    } else if (it->is_regular_file(error_code)) {
+      const auto size = it->file_size();
+      if (!options.skip_files && size >= options.min_file_size)
+        entries.insert(FormatFile(parent, name, size));
+    }
+  }
+
+  return entries;
+}
+
+void CheckOptions(const fs::path& root) {
+  base::FileSearchOptions options;
+  options.min_file_size = kMinFileSize;
+
+  const auto entries = ListFileTree(root, options);
+  CHECK(entries == ListFileTreeReference(root, options));
+  CHECK(entries.count(FormatFile((root / "Series 0").wstring(), L"Link.mkv",
+                                  9)));
+  CHECK(!entries.count(FormatDirectory((root / "Series 0").wstring(),
+                                       L"Link")));
+
+  options.skip_directories = true;
+  CHECK(ListFileTree(root, options) == ListFileTreeReference(root, options));
+
+  options.skip_directories = false;
+  options.skip_files = true;
+  CHECK(ListFileTree(root, options) == ListFileTreeReference(root, options));
+  CHECK(ListFileTree(root, options).size() == kTreeDirectories * 2);
+
+  options.skip_files = false;
+  options.skip_subdirectories = true;
+  CHECK(ListFileTree(root, options) == ListFileTreeReference(root, options));
+  CHECK(ListFileTree(root, options).size() == kTreeDirectories);
+}
+
+void CheckResults(const fs::path& root) {
+  base::FileSearch search;
+  search.options.log_errors = false;
+
+  size_t files = 0;
+  search.Search(root.wstring(), nullptr,
+      [&files](const base::FileSearchResult& result) {
+        const auto path = fs::path{result.root} / result.name;
+        struct stat st;
+        CHECK(::stat(path.c_str(), &st) == 0);
+        CHECK(result.size == static_cast<uint64_t>(st.st_size));
+        // 100-nanosecond intervals since 1601-01-01
+        CHECK(result.modified / 10000000 - 11644473600ull ==
+              static_cast<uint64_t>(st.st_mtim.tv_sec));
+        CHECK(result.attributes == 0);
+        ++files;
+        return false;
+      });
+  CHECK(files == kTreeDirectories * kTreeFilesPerDirectory + 1);
+
+  // A trailing separator does not change the results
+  base::FileSearchOptions options;
+  CHECK(ListFileTree(root.wstring() + L"/", options) ==
+        ListFileTree(root, options));
+}
+
+void CheckSearch(const fs::path& root) {
+  base::FileSearch search;
+  search.options.log_errors = false;
+
+  // Returning true from a callback ends the search
+  size_t files = 0;
+  CHECK(search.Search(root.wstring(), nullptr,
+      [&files](const base::FileSearchResult&) {
+        ++files;
+        return true;
+      }));
+  CHECK(files == 1);
+
+  size_t directories = 0;
+  CHECK(search.Search(root.wstring(),
+      [&directories](const base::FileSearchResult&) {
+        ++directories;
+        return true;
+      }, nullptr));
+  CHECK(directories == 1);
+
+  CHECK(!search.Search(L"", nullptr, nullptr));
+  CHECK(!search.Search((root / "Missing").wstring(), nullptr, nullptr));
+
+  search.options.skip_directories = true;
+  search.options.skip_files = true;
+  CHECK(!search.Search(root.wstring(), nullptr, nullptr));
+}
+
+}  // namespace
+
+int main() {
+  const auto root = GenerateFileTree();
+
+  CheckOptions(root);
+  CheckResults(root);
+  CheckSearch(root);
+
+  fs::remove_all(root);
+
+  if (failures) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+
+  return 0;
+}